@@ -1,5 +1,15 @@
 #include <kernel/cpu.h>
 
+#include <kernel/errno.h>
+
+/* MPIDR_EL1 affinity fields Aff0 to Aff2, and Aff3.  */
+#define MPIDR_AFF0_AFF2_MASK	0x00ffffffUL
+#define MPIDR_AFF3_MASK		0xff00000000UL
+
+/* Interrupt controller IDs of the CPUs, indexed by CPU index.  */
+static uint32_t cpu_ids[MAX_CPUS];
+static unsigned int nr_cpus;
+
 void arch_halt_cpu(void)
 {
 	asm volatile (
@@ -8,3 +18,54 @@ void arch_halt_cpu(void)
 		:
 		: "memory");
 }
+
+uint64_t arch_cycle_counter(void)
+{
+	uint64_t ret;
+	asm volatile(
+		"mrs %0, cntvct_el0"
+		: "=r"(ret));
+	return ret;
+}
+
+void arch_register_cpu(uint32_t cpu_id)
+{
+	if (nr_cpus < MAX_CPUS) {
+		cpu_ids[nr_cpus++] = cpu_id;
+	}
+}
+
+unsigned int arch_nr_cpus(void)
+{
+	/* Without a platform configuration, only the boot CPU is known.  */
+	return nr_cpus ? nr_cpus : 1;
+}
+
+uint32_t arch_cpu_id(void)
+{
+	uint64_t mpidr;
+	asm volatile(
+		"mrs %0, mpidr_el1"
+		: "=r"(mpidr));
+	return (mpidr & MPIDR_AFF0_AFF2_MASK) | ((mpidr & MPIDR_AFF3_MASK) >> 8);
+}
+
+bool arch_cpu_online(uint32_t cpu_id)
+{
+	/* Application processors are not started, so the boot CPU, which runs
+	   this code, is the only online CPU.  */
+	return cpu_id == arch_cpu_id();
+}
+
+int arch_cpu_index(uint32_t cpu_id)
+{
+	if (!nr_cpus) {
+		return cpu_id == arch_cpu_id() ? 0 : -EINVAL;
+	}
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		if (cpu_ids[i] == cpu_id) {
+			return i;
+		}
+	}
+	return -EINVAL;
+}
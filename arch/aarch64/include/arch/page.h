@@ -0,0 +1,13 @@
+#ifndef __MANTICORE_AARCH64_PAGE_H
+#define __MANTICORE_AARCH64_PAGE_H
+
+#include <stddef.h>
+#include <string.h>
+
+/// Zero \size bytes at \addr, bypassing the cache where possible.
+static inline void arch_clear_page_nocache(void *addr, size_t size)
+{
+	memset(addr, 0, size);
+}
+
+#endif
@@ -4,4 +4,8 @@
 /// Kernel virtual memory base address that maps to physical address zero.
 #define KERNEL_VMA 0xffff000000000000ULL
 
+/// Kernel virtual memory area for virtually contiguous allocations (vmalloc).
+#define KERNEL_VMALLOC_START 0xffff800000000000ULL
+#define KERNEL_VMALLOC_SIZE (256ULL << 20)
+
 #endif
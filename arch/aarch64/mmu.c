@@ -2,6 +2,8 @@
 
 #include <kernel/errno.h>
 
+#include <stdbool.h>
+
 phys_t virt_to_phys(virt_t addr)
 {
 	return addr;
@@ -24,8 +26,44 @@ int mmu_map_small_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 	return -EINVAL;
 }
 
+int mmu_unmap_small_page(mmu_map_t map, virt_t vaddr, phys_t *paddr)
+{
+	/* FIXME: not implemented.  */
+	return -EINVAL;
+}
+
+int mmu_unmap_large_page(mmu_map_t map, virt_t vaddr, phys_t *paddr)
+{
+	/* FIXME: not implemented.  */
+	return -EINVAL;
+}
+
 int mmu_map_large_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags)
 {
 	/* FIXME: not implemented.  */
 	return -EINVAL;
 }
+
+int mmu_unmap_huge_page(mmu_map_t map, virt_t vaddr, phys_t *paddr)
+{
+	/* FIXME: not implemented.  */
+	return -EINVAL;
+}
+
+int mmu_map_huge_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags)
+{
+	/* FIXME: not implemented.  */
+	return -EINVAL;
+}
+
+size_t mmu_unmapped_size(mmu_map_t map, virt_t vaddr)
+{
+	/* FIXME: not implemented.  */
+	return 0;
+}
+
+bool mmu_has_huge_pages(void)
+{
+	/* FIXME: not implemented.  */
+	return false;
+}
@@ -1,5 +1,8 @@
 #include <arch/vmem.h>
 
+#include <kernel/cpu.h>
+#include <kernel/numa.h>
+#include <kernel/pci.h>
 #include <kernel/printf.h>
 
 #include <assert.h>
@@ -46,6 +49,95 @@ struct acpi_madt_header {
 	uint32_t flags;
 };
 
+/* MADT Processor Local APIC structure.  */
+struct acpi_madt_local_apic {
+	uint8_t type;
+	uint8_t length;
+	uint8_t acpi_processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__((packed));
+
+enum {
+	ACPI_MADT_LOCAL_APIC_ENABLED = 1 << 0,
+};
+
+/* PCI Express memory mapped configuration space base address description
+   table (MCFG).  */
+struct acpi_mcfg_header {
+	struct acpi_sdt_header sdt;
+	uint64_t reserved;
+} __attribute__((packed));
+
+/* MCFG configuration space base address allocation structure.  */
+struct acpi_mcfg_alloc {
+	uint64_t base_addr;
+	uint16_t segment;
+	uint8_t start_bus;
+	uint8_t end_bus;
+	uint32_t reserved;
+} __attribute__((packed));
+
+/* System Resource Affinity Table (SRAT).  */
+struct acpi_srat_header {
+	struct acpi_sdt_header sdt;
+	uint32_t table_revision;
+	uint64_t reserved;
+} __attribute__((packed));
+
+/* SRAT Processor Local APIC Affinity structure.  */
+struct acpi_srat_cpu_affinity {
+	uint8_t type;
+	uint8_t length;
+	uint8_t proximity_domain_lo;
+	uint8_t apic_id;
+	uint32_t flags;
+	uint8_t local_sapic_eid;
+	uint8_t proximity_domain_hi[3];
+	uint32_t clock_domain;
+} __attribute__((packed));
+
+/* SRAT Memory Affinity structure.  */
+struct acpi_srat_mem_affinity {
+	uint8_t type;
+	uint8_t length;
+	uint32_t proximity_domain;
+	uint16_t reserved1;
+	uint64_t base_addr;
+	uint64_t length_bytes;
+	uint32_t reserved2;
+	uint32_t flags;
+	uint64_t reserved3;
+} __attribute__((packed));
+
+/* SRAT Processor Local x2APIC Affinity structure.  */
+struct acpi_srat_x2apic_affinity {
+	uint8_t type;
+	uint8_t length;
+	uint16_t reserved1;
+	uint32_t proximity_domain;
+	uint32_t x2apic_id;
+	uint32_t flags;
+	uint32_t clock_domain;
+	uint32_t reserved2;
+} __attribute__((packed));
+
+enum {
+	ACPI_SRAT_CPU_AFFINITY = 0x00,
+	ACPI_SRAT_MEM_AFFINITY = 0x01,
+	ACPI_SRAT_X2APIC_AFFINITY = 0x02,
+};
+
+enum {
+	ACPI_SRAT_AFFINITY_ENABLED = 1 << 0,
+};
+
+/* System Locality Information Table (SLIT).  */
+struct acpi_slit_header {
+	struct acpi_sdt_header sdt;
+	uint64_t nr_localities;
+} __attribute__((packed));
+
 enum {
 	ACPI_PROCESSOR_LOCAL_APIC = 0x00,
 	ACPI_IO_APIC = 0x01,
@@ -82,9 +174,14 @@ static void acpi_parse_madt(void *raw_madt)
 		uint8_t len = acpi_read_u8(raw_madt + off + 1);
 
 		switch (type) {
-		case ACPI_PROCESSOR_LOCAL_APIC:
-			nr_cpus++;
+		case ACPI_PROCESSOR_LOCAL_APIC: {
+			struct acpi_madt_local_apic *lapic = raw_madt + off;
+			if (lapic->flags & ACPI_MADT_LOCAL_APIC_ENABLED) {
+				arch_register_cpu(lapic->apic_id);
+				nr_cpus++;
+			}
 			break;
+		}
 		case ACPI_IO_APIC:
 			break;
 		case ACPI_INT_SOURCE_OVERRIDE:
@@ -100,6 +197,78 @@ static void acpi_parse_madt(void *raw_madt)
 	printf("Found %lu CPUs via ACPI MADT\n", nr_cpus);
 }
 
+static void acpi_parse_mcfg(void *raw_mcfg)
+{
+	struct acpi_mcfg_header *mcfg_header = raw_mcfg;
+
+	for (size_t off = sizeof(*mcfg_header); off + sizeof(struct acpi_mcfg_alloc) <= mcfg_header->sdt.length;
+	     off += sizeof(struct acpi_mcfg_alloc)) {
+		struct acpi_mcfg_alloc *alloc = raw_mcfg + off;
+		pci_ecam_register(alloc->base_addr, alloc->segment, alloc->start_bus, alloc->end_bus);
+	}
+}
+
+static void acpi_parse_srat(void *raw_srat)
+{
+	struct acpi_srat_header *srat_header = raw_srat;
+
+	size_t off = sizeof(*srat_header);
+	while (off + 2 <= srat_header->sdt.length) {
+		uint8_t type = acpi_read_u8(raw_srat + off);
+		uint8_t len = acpi_read_u8(raw_srat + off + 1);
+		if (!len) {
+			break;
+		}
+		switch (type) {
+		case ACPI_SRAT_CPU_AFFINITY: {
+			struct acpi_srat_cpu_affinity *cpu = raw_srat + off;
+			if (cpu->flags & ACPI_SRAT_AFFINITY_ENABLED) {
+				uint32_t domain = cpu->proximity_domain_lo | (cpu->proximity_domain_hi[0] << 8) |
+						  (cpu->proximity_domain_hi[1] << 16) | (cpu->proximity_domain_hi[2] << 24);
+				numa_add_cpu(numa_domain_to_node(domain), cpu->apic_id);
+			}
+			break;
+		}
+		case ACPI_SRAT_MEM_AFFINITY: {
+			struct acpi_srat_mem_affinity *mem = raw_srat + off;
+			if (mem->flags & ACPI_SRAT_AFFINITY_ENABLED) {
+				numa_add_memory(numa_domain_to_node(mem->proximity_domain), mem->base_addr, mem->length_bytes);
+			}
+			break;
+		}
+		case ACPI_SRAT_X2APIC_AFFINITY: {
+			struct acpi_srat_x2apic_affinity *cpu = raw_srat + off;
+			if (cpu->flags & ACPI_SRAT_AFFINITY_ENABLED) {
+				numa_add_cpu(numa_domain_to_node(cpu->proximity_domain), cpu->x2apic_id);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		off += len;
+	}
+}
+
+static void acpi_parse_slit(void *raw_slit)
+{
+	struct acpi_slit_header *slit_header = raw_slit;
+	uint64_t n = slit_header->nr_localities;
+
+	if (sizeof(*slit_header) + n * n > slit_header->sdt.length) {
+		printf("ACPI SLIT is truncated\n");
+		return;
+	}
+	uint8_t *distances = raw_slit + sizeof(*slit_header);
+	/* Localities are proximity domains. The SRAT is parsed first, so the
+	   domains already have nodes.  */
+	for (uint64_t from = 0; from < n; from++) {
+		for (uint64_t to = 0; to < n; to++) {
+			numa_set_distance(numa_domain_to_node(from), numa_domain_to_node(to), distances[from * n + to]);
+		}
+	}
+}
+
 /* Parse platform configuration from the given ACPI Root System Description
    Pointer (RSDP).  */
 void acpi_parse_config(void *raw_rsdp)
@@ -120,6 +289,8 @@ void acpi_parse_config(void *raw_rsdp)
 		return;
 	}
 
+	void *srat = NULL;
+	void *slit = NULL;
 	for (size_t off = sizeof(struct acpi_sdt_header); off < rsdt_header->length; off += 4) {
 		uint32_t sdt_addr = acpi_read_u32(rsdt_addr + off);
 
@@ -127,6 +298,18 @@ void acpi_parse_config(void *raw_rsdp)
 
 		if (!memcmp(sdt_header->signature, "APIC", 4)) {
 			acpi_parse_madt(sdt_header);
+		} else if (!memcmp(sdt_header->signature, "MCFG", 4)) {
+			acpi_parse_mcfg(sdt_header);
+		} else if (!memcmp(sdt_header->signature, "SRAT", 4)) {
+			srat = sdt_header;
+		} else if (!memcmp(sdt_header->signature, "SLIT", 4)) {
+			slit = sdt_header;
+		}
+	}
+	if (srat) {
+		acpi_parse_srat(srat);
+		if (slit) {
+			acpi_parse_slit(slit);
 		}
 	}
 }
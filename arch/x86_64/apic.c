@@ -19,6 +19,7 @@
 /* Local APIC registers in MSR offsets. Specified in Table 10-6 ("Local APIC
    Register Address Map Supported by x2APIC") of Intel SDM.  */
 enum {
+	APIC_ID = 0x802,
 	APIC_EOI = 0x80b,
 	APIC_SPIV = 0x80f,
 	APIC_LVT_TIMER  = 0x832,
@@ -97,6 +98,15 @@ bool apic_is_bsp(void)
 	return (rdmsr(X86_IA32_APIC_BASE) & X86_IA32_APIC_BASE_BSP) == X86_IA32_APIC_BASE_BSP;
 }
 
+uint32_t apic_id(void)
+{
+	/* The ID register is only accessible in x2APIC mode.  */
+	if (!_apic_base) {
+		return 0;
+	}
+	return rdmsr(APIC_ID);
+}
+
 void init_apic(void)
 {
 	if (!probe_x2apic()) {
@@ -1,5 +1,13 @@
 #include <kernel/cpu.h>
 
+#include <arch/apic.h>
+
+#include <kernel/errno.h>
+
+/* Interrupt controller IDs of the CPUs, indexed by CPU index.  */
+static uint32_t cpu_ids[MAX_CPUS];
+static unsigned int nr_cpus;
+
 void arch_halt_cpu(void)
 {
 	asm volatile (
@@ -8,3 +16,50 @@ void arch_halt_cpu(void)
 		:
 		: "memory");
 }
+
+uint64_t arch_cycle_counter(void)
+{
+	uint32_t high, low;
+	asm volatile(
+		"rdtsc"
+		: "=a"(low), "=d"(high));
+	return ((uint64_t) high << 32) | low;
+}
+
+void arch_register_cpu(uint32_t cpu_id)
+{
+	if (nr_cpus < MAX_CPUS) {
+		cpu_ids[nr_cpus++] = cpu_id;
+	}
+}
+
+unsigned int arch_nr_cpus(void)
+{
+	/* Without a platform configuration, only the boot CPU is known.  */
+	return nr_cpus ? nr_cpus : 1;
+}
+
+uint32_t arch_cpu_id(void)
+{
+	return apic_id();
+}
+
+bool arch_cpu_online(uint32_t cpu_id)
+{
+	/* Application processors are not started, so the boot CPU, which runs
+	   this code, is the only online CPU.  */
+	return cpu_id == arch_cpu_id();
+}
+
+int arch_cpu_index(uint32_t cpu_id)
+{
+	if (!nr_cpus) {
+		return cpu_id == arch_cpu_id() ? 0 : -EINVAL;
+	}
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		if (cpu_ids[i] == cpu_id) {
+			return i;
+		}
+	}
+	return -EINVAL;
+}
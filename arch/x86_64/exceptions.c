@@ -8,6 +8,7 @@
 #include <arch/cpu.h>
 #include <arch/interrupt-defs.h>
 #include <arch/segment.h>
+#include <arch/vmem.h>
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -239,14 +240,39 @@ void do_x86_general_protection_exception(struct exception_frame *ef)
 	panic("Halted");
 }
 
+// Page-fault error code bits:
+#define X86_PF_P	(1U << 0)	/* Page was present */
+#define X86_PF_W	(1U << 1)	/* Access was a write */
+#define X86_PF_ID	(1U << 4)	/* Access was an instruction fetch */
+
+static uint32_t x86_page_fault_flags(uint64_t error_code)
+{
+	uint32_t flags = 0;
+	if (error_code & X86_PF_P) {
+		flags |= PAGE_FAULT_PROT;
+	}
+	if (error_code & X86_PF_W) {
+		flags |= PAGE_FAULT_WRITE;
+	}
+	if (error_code & X86_PF_ID) {
+		flags |= PAGE_FAULT_EXEC;
+	}
+	return flags;
+}
+
 void do_x86_page_fault_exception(struct exception_frame *ef)
 {
+	uint64_t addr = x86_read_cr2();
+	/* User memory is populated on demand, also when the kernel accesses
+	   it on behalf of a process.  */
+	if (addr < KERNEL_VMA && !page_fault_handle(addr, x86_page_fault_flags(ef->error_code))) {
+		return;
+	}
 	void *fixup = page_fault_get_fixup();
 	if (fixup) {
 		ef->rip = (uint64_t) fixup;
 		return;
 	}
-	uint64_t addr = x86_read_cr2();
 	printf("Page fault at address %016lx\n", addr);
 	dump_exception_frame(ef);
 	panic("Halted");
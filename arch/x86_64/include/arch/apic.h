@@ -13,6 +13,8 @@ void apic_compose_msi_msg(struct msi_message *msg, uint8_t vector, uint8_t dest_
 
 bool apic_is_bsp(void);
 
+uint32_t apic_id(void);
+
 void init_apic(void);
 
 #endif
@@ -64,4 +64,7 @@
 #define X86_CPUID_FEATURE_EDX_TM		_UL_BIT(29)
 #define X86_CPUID_FEATURE_EDX_PBE		_UL_BIT(31)
 
+#define X86_CPUID_EXT_FEATURE			0x80000001
+#define X86_CPUID_EXT_FEATURE_EDX_PDPE1GB	_UL_BIT(26)
+
 #endif
@@ -8,4 +8,10 @@ typedef struct {
 	uint64_t cr3;
 } mmu_map_t;
 
+/// Program the page attribute table (PAT) of the current CPU.
+void mmu_init_pat(void);
+
+/// Detect whether the current CPU supports 1 GiB pages.
+void mmu_init_huge_pages(void);
+
 #endif
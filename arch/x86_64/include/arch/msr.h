@@ -8,6 +8,8 @@
 #define X86_IA32_APIC_BASE_EXTD	_UL_BIT(10)
 #define X86_IA32_APIC_BASE_EN	_UL_BIT(11)
 
+#define X86_IA32_PAT		0x00000277
+
 #define X86_IA32_EFER		0xc0000080
 #define X86_IA32_EFER_SCE	_UL_BIT(0)
 #define X86_IA32_EFER_LME	_UL_BIT(8)
@@ -0,0 +1,34 @@
+#ifndef X86_PAGE_H
+#define X86_PAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Zero \size bytes at \addr with non-temporal stores, which bypass the cache
+/// so that zeroing pages ahead of time does not evict the working set. \addr
+/// must be 8-byte aligned and \size a multiple of 64 bytes.
+static inline void arch_clear_page_nocache(void *addr, size_t size)
+{
+	uint64_t *p = addr;
+	uint64_t *end = addr + size;
+
+	for (; p < end; p += 8) {
+		asm volatile(
+			"movnti %1, 0(%0)\n"
+			"movnti %1, 8(%0)\n"
+			"movnti %1, 16(%0)\n"
+			"movnti %1, 24(%0)\n"
+			"movnti %1, 32(%0)\n"
+			"movnti %1, 40(%0)\n"
+			"movnti %1, 48(%0)\n"
+			"movnti %1, 56(%0)\n"
+			:
+			: "r"(p), "r"(0UL)
+			: "memory");
+	}
+	/* Non-temporal stores are weakly ordered, so order them before the
+	   page is handed out.  */
+	asm volatile("sfence" ::: "memory");
+}
+
+#endif
@@ -4,4 +4,8 @@
 /// Kernel virtual memory base address that maps to physical address zero.
 #define KERNEL_VMA 0xffffffff80000000
 
+/// Kernel virtual memory area for virtually contiguous allocations (vmalloc).
+#define KERNEL_VMALLOC_START 0xffffc90000000000
+#define KERNEL_VMALLOC_SIZE (256ULL << 20)
+
 #endif
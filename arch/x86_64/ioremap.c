@@ -1,5 +1,7 @@
 #include <kernel/mmu.h>
 
+#include <kernel/memory.h>
+
 #include <kernel/page-alloc.h>
 #include <kernel/align.h>
 
@@ -24,12 +26,14 @@ virt_t kernel_vm_end;
 ///
 void *ioremap(phys_t io_mem_start, size_t io_mem_size)
 {
+	phys_t start = align_down(io_mem_start, PAGE_SIZE_SMALL);
+	size_t size = align_up(io_mem_start + io_mem_size - start, PAGE_SIZE_SMALL);
 	virt_t ret = kernel_vm_end;
-	kernel_vm_end += align_up(io_mem_size, PAGE_SIZE_SMALL);
+	kernel_vm_end += size;
 	mmu_map_t map = mmu_current_map();
-	int err = mmu_map_range(map, ret, io_mem_start, io_mem_size, MMU_PROT_READ | MMU_PROT_WRITE, MMU_NOCACHE);
+	int err = mmu_map_range(map, ret, start, size, MMU_PROT_READ | MMU_PROT_WRITE, MMU_NOCACHE);
 	if (err) {
 		return NULL;
 	}
-	return (void *)ret;
+	return (void *)(ret + (io_mem_start - start));
 }
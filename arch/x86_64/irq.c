@@ -2,44 +2,103 @@
 
 #include <arch/interrupt-defs.h>
 
+#include <kernel/cpu.h>
 #include <kernel/errno.h>
 #include <kernel/printf.h>
+#include <kernel/softirq.h>
 
 #include <stddef.h>
+#include <string.h>
 
 struct irq_service {
-	irq_handler_t	handler;
-	void		*arg;
+	irq_handler_t		handler;
+	void			*arg;
+	struct irq_vector_stats	stats;
 };
 
-static unsigned int next_vector = NR_EXCEPTIONS;
-static struct irq_service irq_services[NR_INTERRUPTS];
+/* Interrupt vectors are a per-CPU resource, so every CPU has its own table
+   of interrupt services.  */
+static struct irq_service irq_services[MAX_CPUS][NR_INTERRUPTS];
 
 irq_vector_t request_irq(irq_handler_t handler, void *arg)
 {
-	irq_vector_t vector = next_vector++;
-	if (vector < NR_EXCEPTIONS || vector > NR_INTERRUPT_VECTORS) {
+	return request_irq_on(arch_cpu_id(), handler, arg);
+}
+
+irq_vector_t request_irq_on(uint32_t cpu_id, irq_handler_t handler, void *arg)
+{
+	if (!arch_cpu_online(cpu_id)) {
 		return -EINVAL;
 	}
-	size_t idx = vector - NR_EXCEPTIONS;
-	struct irq_service *service = &irq_services[idx];
-	if (service->handler) {
+	int cpu = arch_cpu_index(cpu_id);
+	if (cpu < 0) {
+		return cpu;
+	}
+	for (size_t idx = 0; idx < NR_INTERRUPTS; idx++) {
+		struct irq_service *service = &irq_services[cpu][idx];
+		if (!service->handler) {
+			service->handler = handler;
+			service->arg = arg;
+			memset(&service->stats, 0, sizeof(service->stats));
+			return idx + NR_EXCEPTIONS;
+		}
+	}
+	return -EINVAL;
+}
+
+void free_irq(uint32_t cpu_id, irq_vector_t vector)
+{
+	int cpu = arch_cpu_index(cpu_id);
+	if (cpu < 0 || vector < NR_EXCEPTIONS || vector >= NR_INTERRUPT_VECTORS) {
+		return;
+	}
+	struct irq_service *service = &irq_services[cpu][vector - NR_EXCEPTIONS];
+	service->handler = NULL;
+	service->arg = NULL;
+}
+
+int irq_get_stats(uint32_t cpu_id, irq_vector_t vector, struct irq_vector_stats *stats)
+{
+	int cpu = arch_cpu_index(cpu_id);
+	if (cpu < 0) {
+		return cpu;
+	}
+	if (vector < NR_EXCEPTIONS || vector >= NR_INTERRUPT_VECTORS) {
 		return -EINVAL;
 	}
-	service->handler = handler;
-	service->arg = arg;
-	return vector;
+	*stats = irq_services[cpu][vector - NR_EXCEPTIONS].stats;
+	return 0;
+}
+
+static unsigned int irq_hist_bucket(uint64_t cycles)
+{
+	if (!cycles) {
+		return 0;
+	}
+	unsigned int bucket = 63 - __builtin_clzll(cycles);
+	if (bucket >= IRQ_HIST_BUCKETS) {
+		bucket = IRQ_HIST_BUCKETS - 1;
+	}
+	return bucket;
 }
 
 static void interrupt_service(irq_vector_t vector)
 {
-	if (vector < NR_EXCEPTIONS || vector > NR_INTERRUPT_VECTORS) {
+	if (vector < NR_EXCEPTIONS || vector >= NR_INTERRUPT_VECTORS) {
+		return;
+	}
+	int cpu = arch_cpu_index(arch_cpu_id());
+	if (cpu < 0) {
 		return;
 	}
 	size_t idx = vector - NR_EXCEPTIONS;
-	struct irq_service *service = &irq_services[idx];
+	struct irq_service *service = &irq_services[cpu][idx];
 	if (service->handler) {
+		uint64_t start = arch_cycle_counter();
 		service->handler(service->arg);
+		uint64_t cycles = arch_cycle_counter() - start;
+		service->stats.count++;
+		service->stats.cycles_hist[irq_hist_bucket(cycles)]++;
 	} else {
 		printf("warning: unhandled interrupt %d\n", vector);
 	}
@@ -49,4 +108,7 @@ void handle_interrupt(irq_vector_t vector)
 {
 	end_of_interrupt();
 	interrupt_service(vector);
+	/* Interrupt handlers only acknowledge the device and schedule
+	   tasklets, which do the batch work here in bounded rounds.  */
+	softirq_run();
 }
@@ -5,10 +5,64 @@
 #include <kernel/page-alloc.h>
 #include <kernel/printf.h>
 
+#include <arch/cpu.h>
+#include <arch/cpuid.h>
+#include <arch/msr.h>
 #include <arch/processor.h>
 #include <arch/vmem.h>
 
-#include <string.h>
+#include <stdbool.h>
+
+/* PAT memory types. Specified in Table 11-10 ("Memory Types That Can Be
+   Encoded With PAT") of Intel SDM.  */
+enum {
+	X86_PAT_UC = 0x00,
+	X86_PAT_WC = 0x01,
+	X86_PAT_WT = 0x04,
+	X86_PAT_WB = 0x06,
+	X86_PAT_UC_MINUS = 0x07,
+};
+
+#define X86_PAT_ENTRY(idx, type) ((uint64_t)(type) << ((idx) * 8))
+
+/* The PAT has the power-on default layout, except that entry 1, which is
+   selected by PWT, is write-combining instead of write-through. PCD alone
+   still selects UC-, so existing uncached mappings are unchanged.  */
+#define X86_PAT_VALUE                                                                                                  \
+	(X86_PAT_ENTRY(0, X86_PAT_WB) | X86_PAT_ENTRY(1, X86_PAT_WC) | X86_PAT_ENTRY(2, X86_PAT_UC_MINUS) |            \
+	 X86_PAT_ENTRY(3, X86_PAT_UC) | X86_PAT_ENTRY(4, X86_PAT_WB) | X86_PAT_ENTRY(5, X86_PAT_WC) |                  \
+	 X86_PAT_ENTRY(6, X86_PAT_UC_MINUS) | X86_PAT_ENTRY(7, X86_PAT_UC))
+
+/* Page table entry bits that select the write-combining PAT entry.  */
+#define X86_PE_CACHE_WC X86_PE_PWT
+
+static bool mmu_pat_enabled;
+
+static bool mmu_huge_pages_enabled;
+
+void mmu_init_pat(void)
+{
+	uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+	cpuid(X86_CPUID_FEATURE, &eax, &ebx, &ecx, &edx);
+	if (!(edx & X86_CPUID_FEATURE_EDX_PAT)) {
+		printf("warning: no PAT support, write-combining mappings are uncached\n");
+		return;
+	}
+	wrmsr(X86_IA32_PAT, X86_PAT_VALUE);
+	mmu_pat_enabled = true;
+}
+
+void mmu_init_huge_pages(void)
+{
+	uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+	cpuid(X86_CPUID_EXT_FEATURE, &eax, &ebx, &ecx, &edx);
+	mmu_huge_pages_enabled = edx & X86_CPUID_EXT_FEATURE_EDX_PDPE1GB;
+}
+
+bool mmu_has_huge_pages(void)
+{
+	return mmu_huge_pages_enabled;
+}
 
 phys_t virt_to_phys(virt_t addr)
 {
@@ -109,6 +163,11 @@ static bool pte_is_none(pte_t pte)
 	return !pte.pte;
 }
 
+static bool pdpte_is_huge(pdpte_t pdpte)
+{
+	return pdpte.pdpte & X86_PE_PS;
+}
+
 static bool pde_is_large(pde_t pde)
 {
 	return pde.pde & X86_PE_PS;
@@ -176,6 +235,11 @@ void mmu_invalidate_tlb(void)
 	x86_write_cr3(x86_read_cr3());
 }
 
+static void x86_invlpg(virt_t vaddr)
+{
+	asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
+
 mmu_map_t mmu_current_map(void)
 {
 	return (mmu_map_t){cr3: x86_read_cr3()};
@@ -212,10 +276,21 @@ static uint64_t mmu_flags_to_hw(mmu_flags_t flags)
 	if (flags & MMU_USER_PAGE) {
 		hw_flags |= X86_PE_US;
 	}
+	return hw_flags;
+}
+
+/* Returns the memory type bits of a page. The bits only apply to the entry
+   that maps the page, because in the upper levels they control the caching
+   of the next-level page table.  */
+static uint64_t mmu_cache_flags_to_hw(mmu_flags_t flags)
+{
+	if (flags & MMU_WRITE_COMBINE) {
+		return mmu_pat_enabled ? X86_PE_CACHE_WC : X86_PE_PCD;
+	}
 	if (flags & MMU_NOCACHE) {
-		hw_flags |= X86_PE_PCD;
+		return X86_PE_PCD;
 	}
-	return hw_flags;
+	return 0;
 }
 
 int mmu_map_small_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags)
@@ -225,11 +300,10 @@ int mmu_map_small_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 	uint64_t pml4_idx = (vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK;
 	pml4e_t pml4e = pml4_table[pml4_idx];
 	if (pml4e_is_none(pml4e)) {
-		void *pdp_page = page_alloc_small();
+		void *pdp_page = page_alloc_small_zeroed();
 		if (!pdp_page) {
 			return -ENOMEM;
 		}
-		memset(pdp_page, 0, PAGE_SIZE_SMALL);
 		pml4e = make_pml4e(ptr_to_paddr(pdp_page), X86_PE_P | X86_PE_RW | hw_flags);
 		pml4_table[pml4_idx] = pml4e;
 	}
@@ -237,23 +311,25 @@ int mmu_map_small_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 	uint64_t pdpt_idx = (vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK;
 	pdpte_t pdpte = pdp_table[pdpt_idx];
 	if (pdpte_is_none(pdpte)) {
-		void *pd_page = page_alloc_small();
+		void *pd_page = page_alloc_small_zeroed();
 		if (!pd_page) {
 			return -ENOMEM;
 		}
-		memset(pd_page, 0, PAGE_SIZE_SMALL);
 		pdpte = make_pdpte(ptr_to_paddr(pd_page), X86_PE_P | X86_PE_RW | hw_flags);
 		pdp_table[pdpt_idx] = pdpte;
 	}
+	if (pdpte_is_huge(pdpte)) {
+		/* PDPTE is already mapped as a huge page. */
+		return -EINVAL;
+	}
 	pde_t *pd = paddr_to_ptr(pdpte_paddr(pdpte));
 	uint64_t pd_idx = (vaddr >> PD_INDEX_SHIFT) & PD_INDEX_MASK;
 	pde_t pde = pd[pd_idx];
 	if (pde_is_none(pde)) {
-		void *pt_page = page_alloc_small();
+		void *pt_page = page_alloc_small_zeroed();
 		if (!pt_page) {
 			return -ENOMEM;
 		}
-		memset(pt_page, 0, PAGE_SIZE_SMALL);
 		pde = make_pde(ptr_to_paddr(pt_page), X86_PE_P | X86_PE_RW | hw_flags);
 		pd[pd_idx] = pde;
 	}
@@ -264,7 +340,97 @@ int mmu_map_small_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 	uint64_t hw_prot = mmu_prot_to_hw(prot);
 	pte_t *pt = paddr_to_ptr(pde_paddr(pde));
 	uint64_t pt_idx = (vaddr >> PT_INDEX_SHIFT) & PT_INDEX_MASK;
-	pt[pt_idx] = make_pte(paddr, hw_prot | hw_flags);
+	pt[pt_idx] = make_pte(paddr, hw_prot | hw_flags | mmu_cache_flags_to_hw(flags));
+	return 0;
+}
+
+/* Returns true if no entry of the paging structure \table is present.  */
+static bool pg_table_is_empty(const void *table)
+{
+	const uint64_t *entries = table;
+	for (unsigned idx = 0; idx < NR_PG_ENTRIES; idx++) {
+		if (entries[idx]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Frees the page directory \pd if it has become empty. The paging-structure
+   caches are invalidated before the page is freed, because they may still
+   hold translations through it.  */
+static void mmu_release_pd(pdpte_t *pdp_table, uint64_t pdpt_idx, pde_t *pd, virt_t vaddr)
+{
+	if (!pg_table_is_empty(pd)) {
+		return;
+	}
+	pdp_table[pdpt_idx] = (pdpte_t){pdpte: 0};
+	x86_invlpg(vaddr);
+	page_free_small(pd);
+}
+
+int mmu_unmap_small_page(mmu_map_t map, virt_t vaddr, phys_t *paddr)
+{
+	pml4e_t *pml4_table = paddr_to_ptr(map.cr3);
+	pml4e_t pml4e = pml4_table[(vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK];
+	if (pml4e_is_none(pml4e)) {
+		return -EINVAL;
+	}
+	pdpte_t *pdp_table = paddr_to_ptr(pml4e_paddr(pml4e));
+	uint64_t pdpt_idx = (vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK;
+	pdpte_t pdpte = pdp_table[pdpt_idx];
+	if (pdpte_is_none(pdpte) || pdpte_is_huge(pdpte)) {
+		return -EINVAL;
+	}
+	pde_t *pd = paddr_to_ptr(pdpte_paddr(pdpte));
+	uint64_t pd_idx = (vaddr >> PD_INDEX_SHIFT) & PD_INDEX_MASK;
+	pde_t pde = pd[pd_idx];
+	if (pde_is_none(pde) || pde_is_large(pde)) {
+		return -EINVAL;
+	}
+	pte_t *pt = paddr_to_ptr(pde_paddr(pde));
+	uint64_t pt_idx = (vaddr >> PT_INDEX_SHIFT) & PT_INDEX_MASK;
+	pte_t pte = pt[pt_idx];
+	if (pte_is_none(pte)) {
+		return -EINVAL;
+	}
+	pt[pt_idx] = (pte_t){pte: 0};
+	x86_invlpg(vaddr);
+	*paddr = pte_paddr(pte);
+	/* Empty page tables are freed, so that the range can be mapped with
+	   larger pages again.  */
+	if (pg_table_is_empty(pt)) {
+		pd[pd_idx] = (pde_t){pde: 0};
+		x86_invlpg(vaddr);
+		page_free_small(pt);
+		mmu_release_pd(pdp_table, pdpt_idx, pd, vaddr);
+	}
+	return 0;
+}
+
+int mmu_unmap_large_page(mmu_map_t map, virt_t vaddr, phys_t *paddr)
+{
+	pml4e_t *pml4_table = paddr_to_ptr(map.cr3);
+	pml4e_t pml4e = pml4_table[(vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK];
+	if (pml4e_is_none(pml4e)) {
+		return -EINVAL;
+	}
+	pdpte_t *pdp_table = paddr_to_ptr(pml4e_paddr(pml4e));
+	uint64_t pdpt_idx = (vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK;
+	pdpte_t pdpte = pdp_table[pdpt_idx];
+	if (pdpte_is_none(pdpte) || pdpte_is_huge(pdpte)) {
+		return -EINVAL;
+	}
+	pde_t *pd = paddr_to_ptr(pdpte_paddr(pdpte));
+	uint64_t pd_idx = (vaddr >> PD_INDEX_SHIFT) & PD_INDEX_MASK;
+	pde_t pde = pd[pd_idx];
+	if (!pde_is_large(pde)) {
+		return -EINVAL;
+	}
+	pd[pd_idx] = (pde_t){pde: 0};
+	x86_invlpg(vaddr);
+	*paddr = pde_paddr(pde);
+	mmu_release_pd(pdp_table, pdpt_idx, pd, vaddr);
 	return 0;
 }
 
@@ -275,11 +441,10 @@ int mmu_map_large_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 	uint64_t pml4_idx = (vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK;
 	pml4e_t pml4e = pml4_table[pml4_idx];
 	if (pml4e_is_none(pml4e)) {
-		void *pdp_page = page_alloc_small();
+		void *pdp_page = page_alloc_small_zeroed();
 		if (!pdp_page) {
 			return -ENOMEM;
 		}
-		memset(pdp_page, 0, PAGE_SIZE_SMALL);
 		pml4e = make_pml4e(ptr_to_paddr(pdp_page), X86_PE_P | X86_PE_RW | hw_flags);
 		pml4_table[pml4_idx] = pml4e;
 	}
@@ -287,14 +452,17 @@ int mmu_map_large_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 	uint64_t pdpt_idx = (vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK;
 	pdpte_t pdpte = pdp_table[pdpt_idx];
 	if (pdpte_is_none(pdpte)) {
-		void *pd_page = page_alloc_small();
+		void *pd_page = page_alloc_small_zeroed();
 		if (!pd_page) {
 			return -ENOMEM;
 		}
-		memset(pd_page, 0, PAGE_SIZE_SMALL);
 		pdpte = make_pdpte(ptr_to_paddr(pd_page), X86_PE_P | X86_PE_RW | hw_flags);
 		pdp_table[pdpt_idx] = pdpte;
 	}
+	if (pdpte_is_huge(pdpte)) {
+		/* PDPTE is already mapped as a huge page. */
+		return -EINVAL;
+	}
 	pde_t *pd = paddr_to_ptr(pdpte_paddr(pdpte));
 	uint64_t pd_idx = (vaddr >> PD_INDEX_SHIFT) & PD_INDEX_MASK;
 	pde_t pde = pd[pd_idx];
@@ -303,7 +471,78 @@ int mmu_map_large_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t pro
 		return -EINVAL;
 	}
 	uint64_t hw_prot = mmu_prot_to_hw(prot);
-	pd[pd_idx] = make_pde(paddr, hw_prot | hw_flags | X86_PE_PS);
+	pd[pd_idx] = make_pde(paddr, hw_prot | hw_flags | mmu_cache_flags_to_hw(flags) | X86_PE_PS);
+	return 0;
+}
+
+int mmu_unmap_huge_page(mmu_map_t map, virt_t vaddr, phys_t *paddr)
+{
+	pml4e_t *pml4_table = paddr_to_ptr(map.cr3);
+	pml4e_t pml4e = pml4_table[(vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK];
+	if (pml4e_is_none(pml4e)) {
+		return -EINVAL;
+	}
+	pdpte_t *pdp_table = paddr_to_ptr(pml4e_paddr(pml4e));
+	uint64_t pdpt_idx = (vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK;
+	pdpte_t pdpte = pdp_table[pdpt_idx];
+	if (!pdpte_is_huge(pdpte)) {
+		return -EINVAL;
+	}
+	pdp_table[pdpt_idx] = (pdpte_t){pdpte: 0};
+	x86_invlpg(vaddr);
+	*paddr = pdpte_paddr(pdpte);
+	return 0;
+}
+
+int mmu_map_huge_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags)
+{
+	if (!mmu_huge_pages_enabled) {
+		return -EINVAL;
+	}
+	uint64_t hw_flags = mmu_flags_to_hw(flags);
+	pml4e_t *pml4_table = paddr_to_ptr(map.cr3);
+	uint64_t pml4_idx = (vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK;
+	pml4e_t pml4e = pml4_table[pml4_idx];
+	if (pml4e_is_none(pml4e)) {
+		void *pdp_page = page_alloc_small_zeroed();
+		if (!pdp_page) {
+			return -ENOMEM;
+		}
+		pml4e = make_pml4e(ptr_to_paddr(pdp_page), X86_PE_P | X86_PE_RW | hw_flags);
+		pml4_table[pml4_idx] = pml4e;
+	}
+	pdpte_t *pdp_table = paddr_to_ptr(pml4e_paddr(pml4e));
+	uint64_t pdpt_idx = (vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK;
+	pdpte_t pdpte = pdp_table[pdpt_idx];
+	if (!pdpte_is_none(pdpte) && !pdpte_is_huge(pdpte)) {
+		/* PDPTE is already mapped as a page directory. */
+		return -EINVAL;
+	}
+	uint64_t hw_prot = mmu_prot_to_hw(prot);
+	pdp_table[pdpt_idx] = make_pdpte(paddr, hw_prot | hw_flags | mmu_cache_flags_to_hw(flags) | X86_PE_PS);
+	return 0;
+}
+
+size_t mmu_unmapped_size(mmu_map_t map, virt_t vaddr)
+{
+	pml4e_t *pml4_table = paddr_to_ptr(map.cr3);
+	pml4e_t pml4e = pml4_table[(vaddr >> PML4_INDEX_SHIFT) & PML4_INDEX_MASK];
+	if (pml4e_is_none(pml4e)) {
+		return 1ULL << PML4_INDEX_SHIFT;
+	}
+	pdpte_t *pdp_table = paddr_to_ptr(pml4e_paddr(pml4e));
+	pdpte_t pdpte = pdp_table[(vaddr >> PDPT_INDEX_SHIFT) & PDPT_INDEX_MASK];
+	if (pdpte_is_none(pdpte)) {
+		return 1ULL << PDPT_INDEX_SHIFT;
+	}
+	if (pdpte_is_huge(pdpte)) {
+		return 0;
+	}
+	pde_t *pd = paddr_to_ptr(pdpte_paddr(pdpte));
+	pde_t pde = pd[(vaddr >> PD_INDEX_SHIFT) & PD_INDEX_MASK];
+	if (pde_is_none(pde)) {
+		return 1ULL << PD_INDEX_SHIFT;
+	}
 	return 0;
 }
 
@@ -331,6 +570,12 @@ static void mmu_dump_pde(unsigned pml4_idx, unsigned pdpt_idx, unsigned pd_idx,
 
 static void mmu_dump_pdpte(unsigned pml4_idx, unsigned pdpt_idx, pdpte_t pdpte)
 {
+	if (pdpte_is_huge(pdpte)) {
+		printf("    PDPTE: %4d %016lx -> %016lx [%lx]\n", pdpt_idx,
+		       pg_index_to_vaddr(pml4_idx, pdpt_idx, 0, 0), pdpte_paddr(pdpte),
+		       pdpte_flags(pdpte));
+		return;
+	}
 	printf("    PDPTE: %d @ %016lx [%lx]\n", pdpt_idx, pdpte_paddr(pdpte), pdpte_flags(pdpte));
 
 	pde_t *pd = paddr_to_ptr(pdpte_paddr(pdpte));
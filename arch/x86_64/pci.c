@@ -1,4 +1,20 @@
+/*
+ * PCI configuration space access for x86
+ *
+ * Configuration space is accessed through the memory-mapped enhanced
+ * configuration access mechanism (ECAM) when the ACPI MCFG table describes
+ * it, and through the legacy configuration address and data I/O ports
+ * otherwise. ECAM needs no port I/O, which is expensive under virtualization,
+ * and also covers the PCI Express extended configuration space.
+ */
+#include <kernel/pci.h>
+
 #include <arch/ioport.h>
+
+#include <kernel/memory.h>
+#include <kernel/printf.h>
+
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -6,7 +22,72 @@
 #define PCI_CONFIG_DATA 0xcfc
 #define PCI_CONFIG_ADDRESS_ENABLE 0x80000000UL
 
-static uintptr_t pci_config_addr(uint16_t bus, uint16_t slot, uint16_t func, uint8_t offset)
+/* Size of the legacy configuration space of a function.  */
+#define PCI_CONFIG_SPACE_SIZE 0x100
+
+/* Size of the extended configuration space of a function in ECAM.  */
+#define PCI_ECAM_CONFIG_SPACE_SIZE 0x1000
+
+/* Size of the ECAM region of a bus, which has 32 slots of 8 functions of 4 KiB.  */
+#define PCI_ECAM_BUS_SIZE (1UL << 20)
+
+struct pci_ecam {
+	/* Physical base address of the ECAM region of bus 0.  */
+	uint64_t	base;
+	/* Virtual address of the mapped ECAM region of bus 0.  */
+	void		*virt;
+	uint8_t		start_bus;
+	uint8_t		end_bus;
+	bool		present;
+};
+
+static struct pci_ecam pci_ecam;
+
+void pci_ecam_register(uint64_t base, uint16_t segment, uint8_t start_bus, uint8_t end_bus)
+{
+	/* Only PCI segment group 0 is supported.  */
+	if (segment != 0 || pci_ecam.present) {
+		return;
+	}
+	pci_ecam.base = base;
+	pci_ecam.start_bus = start_bus;
+	pci_ecam.end_bus = end_bus;
+	pci_ecam.present = true;
+}
+
+void pci_ecam_init(void)
+{
+	if (!pci_ecam.present) {
+		return;
+	}
+	phys_t start = pci_ecam.base + pci_ecam.start_bus * PCI_ECAM_BUS_SIZE;
+	size_t size = (pci_ecam.end_bus - pci_ecam.start_bus + 1) * PCI_ECAM_BUS_SIZE;
+	void *virt = ioremap(start, size);
+	if (!virt) {
+		printf("warning: unable to map PCI ECAM, using legacy configuration access\n");
+		return;
+	}
+	pci_ecam.virt = virt - pci_ecam.start_bus * PCI_ECAM_BUS_SIZE;
+	printf("PCI ECAM at %lx for buses %02x-%02x\n", start, pci_ecam.start_bus, pci_ecam.end_bus);
+}
+
+/* Returns the ECAM address of \offset in the configuration space of a
+   function, or NULL if the function is not covered by ECAM. An offset past
+   the configuration space of the function is not covered either, because
+   it would reach into the configuration space of the next function. The
+   legacy path then rejects it.  */
+static inline void *pci_ecam_addr(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
+{
+	if (!pci_ecam.virt || bus < pci_ecam.start_bus || bus > pci_ecam.end_bus) {
+		return NULL;
+	}
+	if (offset >= PCI_ECAM_CONFIG_SPACE_SIZE) {
+		return NULL;
+	}
+	return pci_ecam.virt + (bus << 20 | slot << 15 | func << 12 | offset);
+}
+
+static uintptr_t pci_config_addr(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
 {
 	uintptr_t addr;
 	addr = PCI_CONFIG_ADDRESS_ENABLE;
@@ -17,36 +98,88 @@ static uintptr_t pci_config_addr(uint16_t bus, uint16_t slot, uint16_t func, uin
 	return addr;
 }
 
-uint8_t pci_config_read_u8(uint16_t bus, uint16_t slot, uint16_t func, uint8_t offset)
+uint8_t pci_config_read_u8(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
 {
+	void *ecam_addr = pci_ecam_addr(bus, slot, func, offset);
+	if (ecam_addr) {
+		return *(volatile uint8_t *) ecam_addr;
+	}
+	if (offset >= PCI_CONFIG_SPACE_SIZE) {
+		return 0xff;
+	}
 	size_t addr = pci_config_addr(bus, slot, func, offset);
 	pio_write32(addr, PCI_CONFIG_ADDRESS);
 	return pio_read8(PCI_CONFIG_DATA + (offset & 3));
 }
 
-uint16_t pci_config_read_u16(uint16_t bus, uint16_t slot, uint16_t func, uint8_t offset)
+uint16_t pci_config_read_u16(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
 {
+	void *ecam_addr = pci_ecam_addr(bus, slot, func, offset);
+	if (ecam_addr) {
+		return *(volatile uint16_t *) ecam_addr;
+	}
+	if (offset >= PCI_CONFIG_SPACE_SIZE) {
+		return 0xffff;
+	}
 	size_t addr = pci_config_addr(bus, slot, func, offset);
 	pio_write32(addr, PCI_CONFIG_ADDRESS);
 	return pio_read16(PCI_CONFIG_DATA + (offset & 2));
 }
 
-uint32_t pci_config_read_u32(uint16_t bus, uint16_t slot, uint16_t func, uint8_t offset)
+uint32_t pci_config_read_u32(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset)
 {
+	void *ecam_addr = pci_ecam_addr(bus, slot, func, offset);
+	if (ecam_addr) {
+		return *(volatile uint32_t *) ecam_addr;
+	}
+	if (offset >= PCI_CONFIG_SPACE_SIZE) {
+		return 0xffffffff;
+	}
 	size_t addr = pci_config_addr(bus, slot, func, offset);
 	pio_write32(addr, PCI_CONFIG_ADDRESS);
 	return pio_read32(PCI_CONFIG_DATA);
 }
 
-void pci_config_write_u16(uint16_t bus, uint16_t slot, uint16_t func, uint8_t offset, uint16_t value)
+void pci_config_write_u8(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset, uint8_t value)
+{
+	void *ecam_addr = pci_ecam_addr(bus, slot, func, offset);
+	if (ecam_addr) {
+		*(volatile uint8_t *) ecam_addr = value;
+		return;
+	}
+	if (offset >= PCI_CONFIG_SPACE_SIZE) {
+		return;
+	}
+	size_t addr = pci_config_addr(bus, slot, func, offset);
+	pio_write32(addr, PCI_CONFIG_ADDRESS);
+	pio_write8(value, PCI_CONFIG_DATA + (offset & 3));
+}
+
+void pci_config_write_u16(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset, uint16_t value)
 {
+	void *ecam_addr = pci_ecam_addr(bus, slot, func, offset);
+	if (ecam_addr) {
+		*(volatile uint16_t *) ecam_addr = value;
+		return;
+	}
+	if (offset >= PCI_CONFIG_SPACE_SIZE) {
+		return;
+	}
 	size_t addr = pci_config_addr(bus, slot, func, offset);
 	pio_write32(addr, PCI_CONFIG_ADDRESS);
 	pio_write16(value, PCI_CONFIG_DATA + (offset & 2));
 }
 
-void pci_config_write_u32(uint16_t bus, uint16_t slot, uint16_t func, uint8_t offset, uint32_t value)
+void pci_config_write_u32(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset, uint32_t value)
 {
+	void *ecam_addr = pci_ecam_addr(bus, slot, func, offset);
+	if (ecam_addr) {
+		*(volatile uint32_t *) ecam_addr = value;
+		return;
+	}
+	if (offset >= PCI_CONFIG_SPACE_SIZE) {
+		return;
+	}
 	size_t addr = pci_config_addr(bus, slot, func, offset);
 	pio_write32(addr, PCI_CONFIG_ADDRESS);
 	pio_write32(value, PCI_CONFIG_DATA);
@@ -70,6 +70,15 @@ static const char *memory_types[] = {
 struct memory_region mem_regions[MAX_MEM_REGIONS];
 size_t nr_mem_regions;
 
+/* Spans of available memory, which are added to the page allocator only after
+   all tags are parsed because the NUMA node of a span is known only after the
+   ACPI tables are parsed.  */
+static struct memory_span {
+	virt_t base;
+	size_t len;
+} mem_spans[MAX_MEM_REGIONS];
+static size_t nr_mem_spans;
+
 static void parse_boot_loader_name(struct tag *tag, void *data)
 {
 	const char *boot_loader_name = data + sizeof(*tag);
@@ -141,7 +150,9 @@ static void parse_memory_map(struct tag *tag, void *data)
 		}
 		base_addr = align_up(base_addr, PAGE_SIZE_SMALL);
 		length = align_down(length, PAGE_SIZE_SMALL);
-		memory_add_span(base_addr, length);
+		mem_spans[nr_mem_spans].base = base_addr;
+		mem_spans[nr_mem_spans].len = length;
+		nr_mem_spans++;
 	}
 }
 
@@ -189,4 +200,7 @@ void parse_platform_config(void)
 		offset += tag->size;
 		offset = align_up(offset, 8);
 	}
+	for (size_t i = 0; i < nr_mem_spans; i++) {
+		memory_add_span(mem_spans[i].base, mem_spans[i].len);
+	}
 }
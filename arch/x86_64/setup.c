@@ -3,6 +3,7 @@
 #include <kernel/page-alloc.h>
 #include <kernel/platform.h>
 #include <kernel/memory.h>
+#include <kernel/numa.h>
 #include <kernel/virtio.h>
 #include <kernel/panic.h>
 #include <kernel/mmu.h>
@@ -18,7 +19,6 @@
 #include <arch/gdt.h>
 #include <arch/msr.h>
 
-#include <string.h>
 #include <stdint.h>
 
 uint64_t gdt[] __attribute__ ((aligned (8))) = {
@@ -54,11 +54,10 @@ static void init_gdt(void)
 
 void init_mmu_map(void)
 {
-	void *page = page_alloc_small();
+	void *page = page_alloc_small_zeroed();
 	if (!page) {
 		panic("Unable to allocate kernel MMU map");
 	}
-	memset(page, 0, PAGE_SIZE_SMALL);
 	mmu_map_t mmu_map = (mmu_map_t){ cr3: ptr_to_paddr(page) };
 	for (unsigned i = 0; i < nr_mem_regions; i++) {
 		struct memory_region *mem_region = &mem_regions[i];
@@ -85,13 +84,17 @@ void arch_early_setup(void)
 	init_task();
 	init_syscall();
 	parse_platform_config();
+	mmu_init_pat();
+	mmu_init_huge_pages();
 	init_mmu_map();
 	init_apic();
+	numa_init();
 	setup_nxe();
 }
 
 void arch_late_setup(void)
 {
 	virtio_register_drivers();
+	pci_ecam_init();
 	pci_probe();
 }
@@ -10,7 +10,9 @@ void task_state_init(struct task_state *task_state, void *rip, void *rsp)
 
 struct task_state *task_state_new(void *rip, void *rsp)
 {
-	struct task_state *ret = kmem_alloc(sizeof(struct task_state));
+	/* Task states are aligned to cache lines, so that CPUs that switch
+	   between different tasks do not share cache lines.  */
+	struct task_state *ret = kmem_alloc_align(sizeof(struct task_state), KMEM_CACHE_LINE_SIZE);
 	if (ret) {
 		ret->flags = TIF_NEW;
 		ret->rip = rip;
@@ -21,7 +23,7 @@ struct task_state *task_state_new(void *rip, void *rsp)
 
 void task_state_delete(struct task_state *task_state)
 {
-	kmem_free(task_state, sizeof(struct task_state));
+	kmem_free_align(task_state, sizeof(struct task_state), KMEM_CACHE_LINE_SIZE);
 }
 
 void *task_state_stack_top(struct task_state *task_state)
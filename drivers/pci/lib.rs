@@ -11,10 +11,15 @@ extern crate kernel;
 extern crate intrusive_collections;
 
 use alloc::rc::Rc;
+use alloc::vec::Vec;
+use core::cell::RefCell;
 use core::intrinsics::transmute;
 use intrusive_collections::{LinkedList, LinkedListLink, UnsafeRef};
 use kernel::device::{register_device, Device};
+use kernel::errno::EINVAL;
 use kernel::ioport::IOPort;
+use kernel::memory;
+use kernel::mmu;
 use kernel::print;
 
 const MSIX_ENTRY_SIZE: usize = 16;
@@ -29,13 +34,13 @@ pub struct MSIMessage {
 }
 
 impl MSIMessage {
-    fn compose(vector: u8) -> MSIMessage {
+    fn compose(vector: u8, dest_id: u8) -> MSIMessage {
         let mut msi_msg = MSIMessage {
             msg_addr: 0,
             msg_data: 0,
         };
         unsafe {
-            apic_compose_msi_msg(&mut msi_msg, vector, 0);
+            apic_compose_msi_msg(&mut msi_msg, vector, dest_id);
         }
         msi_msg
     }
@@ -53,7 +58,6 @@ const PCI_CFG_VENDOR_ID: u8 = 0x00;
 const PCI_CFG_DEVICE_ID: u8 = 0x02;
 const PCI_CFG_COMMAND: u8 = 0x04;
 const PCI_CFG_STATUS: u8 = 0x06;
-const PCI_CFG_CLASS_REVISION: u8 = 0x08;
 const PCI_CFG_REVISION_ID: u8 = 0x08;
 const PCI_CFG_CLASS_CODE: u8 = 0x08;
 const PCI_CFG_SUBCLASS: u8 = 0x08;
@@ -67,6 +71,7 @@ const PCI_HEADER_TYPE_MASK: u8 = 0x03;
 const PCI_HEADER_TYPE_DEVICE: u8 = 0x00;
 const PCI_HEADER_TYPE_BRIDGE: u8 = 0x01;
 const PCI_HEADER_TYPE_PCCARD: u8 = 0x02;
+const PCI_HEADER_TYPE_MULTI_FUNCTION: u8 = 0x80;
 
 const PCI_CMD_BUS_MASTER: u16 = 1 << 2;
 const PCI_CMD_INTX_DISABLE: u16 = 1 << 10;
@@ -78,6 +83,11 @@ const PCI_STATUS_CAPABILITIES_LIST: u8 = 1 << 4;
 const PCI_CAP_ID_OFFSET: u8 = 0x00;
 const PCI_CAP_NEXT_OFFSET: u8 = 0x01;
 
+/* 7.6.3 PCI Express Extended Capability Header */
+const PCI_CFG_EXT_CAPABILITIES: u16 = 0x100;
+const PCI_CFG_SPACE_EXP_SIZE: u16 = 0x1000;
+const PCI_EXT_CAP_HEADER_SIZE: u16 = 4;
+
 pub const PCI_CAPABILITY_VENDOR: u8 = 0x09;
 const PCI_CAPABILITY_MSIX: u8 = 0x11;
 
@@ -264,28 +274,61 @@ impl PCIFunction {
     }
 
     pub fn read_config_u8(&self, offset: u8) -> u8 {
-        unsafe { pci_config_read_u8(self.bus_id, self.slot_id, self.func_id, offset) }
+        unsafe { pci_config_read_u8(self.bus_id, self.slot_id, self.func_id, offset as u16) }
     }
 
     pub fn write_config_u8(&self, offset: u8, value: u8) {
-        unsafe { pci_config_write_u8(self.bus_id, self.slot_id, self.func_id, offset, value) }
+        unsafe { pci_config_write_u8(self.bus_id, self.slot_id, self.func_id, offset as u16, value) }
     }
 
     pub fn read_config_u16(&self, offset: u8) -> u16 {
-        unsafe { pci_config_read_u16(self.bus_id, self.slot_id, self.func_id, offset) }
+        unsafe { pci_config_read_u16(self.bus_id, self.slot_id, self.func_id, offset as u16) }
     }
 
     pub fn write_config_u16(&self, offset: u8, value: u16) {
-        unsafe { pci_config_write_u16(self.bus_id, self.slot_id, self.func_id, offset, value) }
+        unsafe { pci_config_write_u16(self.bus_id, self.slot_id, self.func_id, offset as u16, value) }
     }
 
     pub fn read_config_u32(&self, offset: u8) -> u32 {
-        unsafe { pci_config_read_u32(self.bus_id, self.slot_id, self.func_id, offset) }
+        unsafe { pci_config_read_u32(self.bus_id, self.slot_id, self.func_id, offset as u16) }
     }
 
     pub fn write_config_u32(&self, offset: u8, value: u32) {
+        unsafe { pci_config_write_u32(self.bus_id, self.slot_id, self.func_id, offset as u16, value) }
+    }
+
+    /// Reads the PCI Express extended configuration space, which is beyond
+    /// the first 256 bytes. Reads return all ones without ECAM.
+    pub fn read_config_ext_u32(&self, offset: u16) -> u32 {
+        unsafe { pci_config_read_u32(self.bus_id, self.slot_id, self.func_id, offset) }
+    }
+
+    /// Writes the PCI Express extended configuration space. Writes are
+    /// ignored without ECAM.
+    pub fn write_config_ext_u32(&self, offset: u16, value: u32) {
         unsafe { pci_config_write_u32(self.bus_id, self.slot_id, self.func_id, offset, value) }
     }
+
+    /// Returns the offset of PCI Express extended capability `cap_id`.
+    pub fn find_ext_capability(&self, cap_id: u16) -> Option<u16> {
+        let mut offset = PCI_CFG_EXT_CAPABILITIES;
+        // Every capability occupies at least its header, which bounds the
+        // walk of a malformed capability list.
+        for _ in 0..(PCI_CFG_SPACE_EXP_SIZE - PCI_CFG_EXT_CAPABILITIES) / PCI_EXT_CAP_HEADER_SIZE {
+            let header = self.read_config_ext_u32(offset);
+            if header == 0 || header == !0 {
+                return None;
+            }
+            if header & 0xffff == cap_id as u32 {
+                return Some(offset);
+            }
+            offset = ((header >> 20) & 0xffc) as u16;
+            if offset < PCI_CFG_EXT_CAPABILITIES {
+                return None;
+            }
+        }
+        None
+    }
 }
 
 #[derive(Debug)]
@@ -295,12 +338,43 @@ pub struct MSIX {
     pub table_offset: u64,
 }
 
+/// An interrupt that is registered to an MSI-X table entry.
+#[derive(Debug, Clone, Copy)]
+struct MSIXIrq {
+    entry: u16,
+    cpu_id: u32,
+    vector: i32,
+    handler: extern "C" fn(arg: usize),
+    arg: usize,
+}
+
+/// Number of buckets in the cycle histogram of an interrupt vector.
+pub const IRQ_HIST_BUCKETS: usize = 32;
+
+/// Statistics of an interrupt vector, which has the layout of
+/// `struct irq_vector_stats`.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct IrqVectorStats {
+    pub count: u64,
+    pub cycles_hist: [u64; IRQ_HIST_BUCKETS],
+}
+
+/// Interrupt statistics of an MSI-X table entry.
+pub struct MSIXIrqStats {
+    pub entry: u16,
+    pub cpu_id: u32,
+    pub vector: i32,
+    pub stats: IrqVectorStats,
+}
+
 #[derive(Debug)]
 pub struct PCIDevice {
     pub func: PCIFunction,
     pub dev_id: DeviceID,
     pub bars: [Option<IOPort>; 6],
     pub msix: Option<MSIX>,
+    irqs: RefCell<Vec<MSIXIrq>>,
 }
 
 impl PCIDevice {
@@ -352,6 +426,7 @@ impl PCIDevice {
             },
             bars,
             msix,
+            irqs: RefCell::new(Vec::new()),
         });
         for driver in unsafe { PCI_DRIVER_LIST.iter() } {
             if driver.dev_id.vendor_id != pci_dev.dev_id.vendor_id {
@@ -367,6 +442,69 @@ impl PCIDevice {
         return pci_dev;
     }
 
+    /// Returns the physical base address of memory BAR `bar_idx`, or `None`
+    /// if the BAR is not a memory BAR.
+    pub fn bar_phys_addr(&self, bar_idx: usize) -> Option<u64> {
+        let offset = PCI_CFG_BARS + (bar_idx << 2) as u8;
+        let raw_bar = self.func.read_config_u32(offset);
+        if raw_bar == 0 || raw_bar & 0x01 != 0 {
+            return None;
+        }
+        match (raw_bar & 0b110) >> 1 {
+            0b00 => Some((raw_bar & !0xf) as u64),
+            0b10 => {
+                let next_bar = self.func.read_config_u32(offset + 4);
+                Some(((raw_bar & !0xf) as u64) | ((next_bar as u64) << 32))
+            }
+            _ => None,
+        }
+    }
+
+    /// Returns `true` if BAR `bar_idx` is a prefetchable memory BAR.
+    pub fn bar_prefetchable(&self, bar_idx: usize) -> bool {
+        let raw_bar = self.func.read_config_u32(PCI_CFG_BARS + (bar_idx << 2) as u8);
+        raw_bar & 0x01 == 0 && raw_bar & 0b1000 != 0
+    }
+
+    /// Switches `size` bytes at `offset` of memory BAR `bar_idx` to
+    /// write-combining in place, so that the physical pages are never mapped
+    /// with two memory types. The rest of the BAR stays uncached. Returns
+    /// `None` if the BAR is not prefetchable, which means that the device does
+    /// not permit writes to be merged, if the range does not cover whole
+    /// pages, or if the BAR holds the MSI-X table.
+    pub fn remap_bar_wc(&self, bar_idx: usize, offset: usize, size: u32) -> Option<IOPort> {
+        if !self.bar_prefetchable(bar_idx) {
+            return None;
+        }
+        if let Some(ref msix) = self.msix {
+            if msix.table_bar as usize == bar_idx {
+                return None;
+            }
+        }
+        let (virt_base, bar_size) = match self.bars[bar_idx] {
+            Some(IOPort::Memory { base_addr, size }) => (base_addr, size as usize),
+            _ => return None,
+        };
+        let page_size = memory::PAGE_SIZE_SMALL as usize;
+        let phys = self.bar_phys_addr(bar_idx)? as usize + offset;
+        let len = size as usize;
+        if phys % page_size != 0 || len % page_size != 0 || len == 0 || offset > bar_size || len > bar_size - offset {
+            return None;
+        }
+        let virt = virt_base + offset;
+        let prot = mmu::MMU_PROT_READ | mmu::MMU_PROT_WRITE;
+        unsafe {
+            let map = mmu::mmu_current_map();
+            mmu::mmu_unmap_range(map, virt, len);
+            if mmu::mmu_map_range(map, virt, phys, len, prot, mmu::MMU_WRITE_COMBINE) != 0 {
+                mmu::mmu_unmap_range(map, virt, len);
+                mmu::mmu_map_range(map, virt, phys, len, prot, mmu::MMU_NOCACHE);
+                return None;
+            }
+        }
+        Some(IOPort::Memory { base_addr: virt, size })
+    }
+
     pub fn set_bus_master(&self, master: bool) {
         let mut cmd = self.func.read_config_u16(PCI_CFG_COMMAND);
         if master {
@@ -406,16 +544,74 @@ impl PCIDevice {
         self.func.write_config_u16(PCI_CFG_COMMAND, cmd);
     }
 
-    pub fn register_irq(&self, entry: u16, handler: extern "C" fn(arg: usize), arg: usize) -> i32 {
-        let vector = unsafe { request_irq(handler, transmute(arg)) };
+    /// Registers `handler` for the interrupt of MSI-X table entry `entry` and
+    /// targets the interrupt to the CPU with interrupt controller ID `cpu_id`.
+    /// Returns the interrupt vector or a negative error code.
+    pub fn register_irq(&self, entry: u16, handler: extern "C" fn(arg: usize), arg: usize, cpu_id: u32) -> i32 {
+        // The MSI destination ID is 8 bits without interrupt remapping.
+        if cpu_id > u8::max_value() as u32 {
+            return -EINVAL;
+        }
+        let vector = unsafe { request_irq_on(cpu_id, handler, transmute(arg)) };
         if vector < 0 {
             return vector
         }
-        let msi_msg = MSIMessage::compose(vector as u8);
+        let msi_msg = MSIMessage::compose(vector as u8, cpu_id as u8);
+        self.write_msix_entry(entry, msi_msg.msg_addr, msi_msg.msg_data);
+        self.irqs.borrow_mut().push(MSIXIrq { entry, cpu_id, vector, handler, arg });
+        vector
+    }
+
+    /// Re-targets the interrupt of MSI-X table entry `entry` to the CPU with
+    /// interrupt controller ID `cpu_id`. Interrupt vectors are per-CPU, so
+    /// the interrupt is moved to a vector that is allocated on the new CPU.
+    /// Returns the new interrupt vector or a negative error code. CPUs that
+    /// are not online are rejected with -EINVAL.
+    pub fn set_irq_affinity(&self, entry: u16, cpu_id: u32) -> i32 {
+        if cpu_id > u8::max_value() as u32 || !cpu_online(cpu_id) {
+            return -EINVAL;
+        }
+        let mut irqs = self.irqs.borrow_mut();
+        let irq = match irqs.iter_mut().find(|irq| irq.entry == entry) {
+            Some(irq) => irq,
+            None => return -EINVAL,
+        };
+        if irq.cpu_id == cpu_id {
+            return irq.vector;
+        }
+        let vector = unsafe { request_irq_on(cpu_id, irq.handler, transmute(irq.arg)) };
+        if vector < 0 {
+            return vector;
+        }
+        // Mask the entry while the message is updated so that the device
+        // never signals a message with a torn address and data.
+        let masked = self.read_msix_entry_ctrl(entry) & PCI_MSIX_ENTRY_VECTOR_CTRL_MASK_BIT != 0;
+        self.mask_msix_entry(entry);
+        let msi_msg = MSIMessage::compose(vector as u8, cpu_id as u8);
         self.write_msix_entry(entry, msi_msg.msg_addr, msi_msg.msg_data);
+        if !masked {
+            self.unmask_msix_entry(entry);
+        }
+        unsafe { free_irq(irq.cpu_id, irq.vector) };
+        irq.cpu_id = cpu_id;
+        irq.vector = vector;
         vector
     }
 
+    /// Returns the statistics of the interrupts that are registered to the
+    /// MSI-X table entries.
+    pub fn irq_stats(&self) -> Vec<MSIXIrqStats> {
+        let mut ret = Vec::new();
+        for irq in self.irqs.borrow().iter() {
+            let mut stats = IrqVectorStats::default();
+            if unsafe { irq_get_stats(irq.cpu_id, irq.vector, &mut stats) } < 0 {
+                continue;
+            }
+            ret.push(MSIXIrqStats { entry: irq.entry, cpu_id: irq.cpu_id, vector: irq.vector, stats });
+        }
+        ret
+    }
+
     pub fn enable_irq(&self, entry: u16) {
         self.unmask_msix_entry(entry);
     }
@@ -471,46 +667,72 @@ impl PCIDevice {
 
 extern "C" {
     pub fn request_irq(handler: extern "C" fn(arg: usize), arg: usize) -> i32;
+    pub fn request_irq_on(cpu_id: u32, handler: extern "C" fn(arg: usize), arg: usize) -> i32;
+    pub fn free_irq(cpu_id: u32, vector: i32);
+    fn irq_get_stats(cpu_id: u32, vector: i32, stats: *mut IrqVectorStats) -> i32;
+    fn arch_cpu_id() -> u32;
+    fn arch_cpu_online(cpu_id: u32) -> bool;
+}
+
+/// Returns the interrupt controller ID of the current CPU.
+pub fn cpu_id() -> u32 {
+    unsafe { arch_cpu_id() }
+}
+
+/// Returns `true` if the CPU with interrupt controller ID `cpu_id` can take
+/// interrupts.
+pub fn cpu_online(cpu_id: u32) -> bool {
+    unsafe { arch_cpu_online(cpu_id) }
 }
 
 #[no_mangle]
 pub extern "C" fn pci_probe() {
     println!("Probing PCI devices ...");
 
-    for bus in 0..256 {
-        if !pci_probe_bus(bus) {
-            break;
+    // Only buses that are reachable from the host bridges are probed. The
+    // host bridge at 00:00.0 decodes bus 0, and if it is a multi-function
+    // device, function N is the host bridge of bus N.
+    let host_bridge = PCIFunction::new(0, 0, 0);
+    if host_bridge.read_config_u8(PCI_CFG_HEADER_TYPE) & PCI_HEADER_TYPE_MULTI_FUNCTION == 0 {
+        pci_probe_bus(0);
+        return;
+    }
+    for func_id in 0..8 {
+        let func = PCIFunction::new(0, 0, func_id);
+        if func.read_config_u16(PCI_CFG_VENDOR_ID) == 0xffff {
+            continue;
         }
+        pci_probe_bus(func_id);
     }
 }
 
-fn pci_probe_bus(bus: u16) -> bool {
-    let mut result = false;
+fn pci_probe_bus(bus: u16) {
     for slot in 0..32 {
-        let vendor_id = unsafe { pci_config_read_u16(bus, slot, 0, PCI_CFG_VENDOR_ID) };
+        let vendor_id = unsafe { pci_config_read_u16(bus, slot, 0, PCI_CFG_VENDOR_ID as u16) };
         if vendor_id == 0xffff {
             continue;
         }
-        result |= pci_probe_slot(bus, slot);
+        pci_probe_slot(bus, slot);
     }
-    return result;
 }
 
-fn pci_probe_slot(bus_id: u16, slot_id: u16) -> bool {
-    let mut result = false;
-    for func_id in 0..8 {
+fn pci_probe_slot(bus_id: u16, slot_id: u16) {
+    let header_type = unsafe { pci_config_read_u8(bus_id, slot_id, 0, PCI_CFG_HEADER_TYPE as u16) };
+    let nr_funcs = if header_type & PCI_HEADER_TYPE_MULTI_FUNCTION != 0 { 8 } else { 1 };
+    for func_id in 0..nr_funcs {
         let func = PCIFunction::new(bus_id, slot_id, func_id);
-        let class_revision = func.read_config_u32(PCI_CFG_CLASS_REVISION);
-        if class_revision == 0xffffffff {
+        if func.read_config_u16(PCI_CFG_VENDOR_ID) == 0xffff {
             continue;
         }
         let header_type = func.read_config_u8(PCI_CFG_HEADER_TYPE);
         if header_type & PCI_HEADER_TYPE_MASK == PCI_HEADER_TYPE_BRIDGE {
-            let secondary_bus = func.read_config_u8(PCI_CFG_SECONDARY_BUS);
-            pci_probe_bus(secondary_bus as u16);
+            // A bridge that is not configured has no secondary bus.
+            let secondary_bus = func.read_config_u8(PCI_CFG_SECONDARY_BUS) as u16;
+            if secondary_bus > bus_id {
+                pci_probe_bus(secondary_bus);
+            }
             continue;
         }
-        result = true;
         let dev = PCIDevice::probe(func, header_type);
         println!(
             "  {:02x}:{:02x}.{:x} {:02x}{:02x}: {:04x}:{:04x} (rev {:x}) {}",
@@ -525,7 +747,6 @@ fn pci_probe_slot(bus_id: u16, slot_id: u16) -> bool {
             if dev.msix.is_some() { "[msix]" } else { "" },
         );
     }
-    return result;
 }
 
 type PCIProbe = fn(Rc<PCIDevice>) -> Option<Rc<Device>>;
@@ -557,11 +778,11 @@ pub fn pci_register_driver(driver: &PCIDriver) {
 }
 
 extern "C" {
-    pub fn pci_config_read_u8(bus: u16, slot: u16, func: u16, offset: u8) -> u8;
-    pub fn pci_config_write_u8(bus: u16, slot: u16, func: u16, offset: u8, value: u8);
-    pub fn pci_config_read_u16(bus: u16, slot: u16, func: u16, offset: u8) -> u16;
-    pub fn pci_config_write_u16(bus: u16, slot: u16, func: u16, offset: u8, value: u16);
-    pub fn pci_config_read_u32(bus: u16, slot: u16, func: u16, offset: u8) -> u32;
-    pub fn pci_config_write_u32(bus: u16, slot: u16, func: u16, offset: u8, value: u32);
+    pub fn pci_config_read_u8(bus: u16, slot: u16, func: u16, offset: u16) -> u8;
+    pub fn pci_config_write_u8(bus: u16, slot: u16, func: u16, offset: u16, value: u8);
+    pub fn pci_config_read_u16(bus: u16, slot: u16, func: u16, offset: u16) -> u16;
+    pub fn pci_config_write_u16(bus: u16, slot: u16, func: u16, offset: u16, value: u16);
+    pub fn pci_config_read_u32(bus: u16, slot: u16, func: u16, offset: u16) -> u32;
+    pub fn pci_config_write_u32(bus: u16, slot: u16, func: u16, offset: u16, value: u32);
     pub fn ioremap(paddr: usize, size: usize) -> u64;
 }
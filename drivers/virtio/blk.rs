@@ -0,0 +1,555 @@
+//! Virtio block device driver.
+//!
+//! Block I/O is asynchronous: a process submits `struct blk_request` requests
+//! to the I/O queue of the device and receives a completion event for every
+//! request. The data buffers of the requests are in a data area that is
+//! mapped to the process, which lets the device transfer data without copying.
+
+use alloc::collections::VecDeque;
+use alloc::rc::Rc;
+use alloc::vec::Vec;
+use core::cell::{Cell, RefCell};
+use core::mem;
+use core::ptr;
+use kernel::device::{ConfigOption, Device, DeviceOps, CONFIG_BLOCK_CAPACITY, CONFIG_BLOCK_DATA_AREA, CONFIG_BLOCK_DATA_AREA_SIZE, CONFIG_IO_QUEUE};
+use kernel::device::{CONFIG_IRQ_AFFINITY, CONFIG_IRQ_STATS, CONFIG_STATS};
+use kernel::errno::{Error, Result, EINVAL};
+use kernel::event::{Event, EventListener, EventNotifier};
+use kernel::ioport::IOPort;
+use kernel::ioqueue::{IOCmd, IOQueue, Opcode};
+use kernel::memory::{self, DmaRegion, DMA_ALLOC_LARGE_PAGE};
+use kernel::net::Counter;
+use kernel::print;
+use kernel::softirq::Tasklet;
+use kernel::vm::{VMAddressSpace, VMProt};
+use pci::{cpu_id, DeviceID, PCIDevice, PCIDriver, PCI_VENDOR_ID_REDHAT};
+use transport::{find_capability, irq_stats, set_irq_affinity, DEVICE_FEATURE, DEVICE_FEATURE_SELECT, DEVICE_STATUS, DRIVER_FEATURE, DRIVER_FEATURE_SELECT};
+use transport::{NUM_QUEUES, QUEUE_AVAIL, QUEUE_DESC, QUEUE_ENABLE, QUEUE_MSIX_VECTOR, QUEUE_NOTIFY_OFF, QUEUE_SELECT, QUEUE_SIZE, QUEUE_USED};
+use transport::{VIRTIO_ACKNOWLEDGE, VIRTIO_DRIVER, VIRTIO_DRIVER_OK, VIRTIO_FEATURES_OK};
+use transport::{VIRTIO_NOTIFY_OFF_MULTIPLIER, VIRTIO_PCI_CAP_COMMON_CFG, VIRTIO_PCI_CAP_DEVICE_CFG, VIRTIO_PCI_CAP_NOTIFY_CFG};
+use virtqueue::{Virtqueue, VIRTQ_DESC_F_WRITE};
+
+const PCI_DEVICE_ID_VIRTIO_BLK: u16 = 0x1042;
+
+bitflags! {
+    pub struct Features: u32 {
+        const VIRTIO_BLK_F_SIZE_MAX = 1<<1;
+        const VIRTIO_BLK_F_SEG_MAX = 1<<2;
+        const VIRTIO_BLK_F_GEOMETRY = 1<<4;
+        const VIRTIO_BLK_F_RO = 1<<5;
+        const VIRTIO_BLK_F_BLK_SIZE = 1<<6;
+        const VIRTIO_BLK_F_FLUSH = 1<<9;
+        const VIRTIO_BLK_F_TOPOLOGY = 1<<10;
+        const VIRTIO_BLK_F_CONFIG_WCE = 1<<11;
+        const VIRTIO_F_INDIRECT_DESC = 1<<28;
+    }
+}
+
+/* 5.2.4 Device configuration layout */
+const VIRTIO_BLK_CFG_CAPACITY: usize = 0x00;
+
+/* 5.2.6 Device Operation */
+const VIRTIO_BLK_T_IN: u32 = 0;
+const VIRTIO_BLK_T_OUT: u32 = 1;
+const VIRTIO_BLK_T_FLUSH: u32 = 4;
+/// A request type that the device does not support, which is used to
+/// complete requests that are not valid through the device.
+const VIRTIO_BLK_T_INVALID: u32 = !0;
+
+const VIRTIO_BLK_S_IOERR: u8 = 1;
+
+const VIRTIO_BLK_SECTOR_SIZE: usize = 512;
+
+const VIRTIO_BLK_REQ_QUEUE_IDX: u16 = 0;
+
+/// Size of a request header slot, which holds a virtio-blk request header
+/// followed by the status byte that the device writes.
+const REQ_HDR_SLOT_SIZE: usize = 32;
+
+const REQ_STATUS_OFF: usize = mem::size_of::<VirtioBlkReqHdr>();
+
+/// Virtio-blk request header.
+#[repr(C)]
+#[derive(Debug, Default)]
+struct VirtioBlkReqHdr {
+    type_: u32,
+    reserved: u32,
+    sector: u64,
+}
+
+/// A block I/O request as submitted by user space.
+///
+/// NOTE! When modifying this data structure, please make sure it matches the C
+/// definition in `include/uapi/manticore/blk_abi.h`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+struct BlkRequest {
+    type_: u32,
+    reserved: u32,
+    sector: u64,
+    buf: usize,
+    len: u64,
+}
+
+/// Block device statistics.
+///
+/// NOTE! When modifying this data structure, please make sure it matches the C
+/// definition in `include/uapi/manticore/blk_abi.h`.
+#[repr(C)]
+#[derive(Debug, Default)]
+struct BlkDeviceStats {
+    completions: Counter,
+    event_overflows: Counter,
+}
+
+/// A request that is waiting for free descriptors.
+struct PendingRequest {
+    /// User space address of the request, which identifies its completion.
+    addr: usize,
+    req: BlkRequest,
+}
+
+/// State of a descriptor chain that the device owns.
+///
+/// The interrupt handler completes requests while the process may be
+/// submitting requests, so the state is only updated through `Cell`s.
+struct BlkInflight {
+    /// User space address of the request.
+    req: Cell<usize>,
+    /// Request header slot of the request.
+    hdr_slot: Cell<usize>,
+    /// The device has completed the request, but the completion event did
+    /// not fit in the event queue of the process yet.
+    undelivered: Cell<bool>,
+    /// The request has completed and the descriptor chain can be freed.
+    done: Cell<bool>,
+}
+
+struct VirtioBlkDevice {
+    pci_dev: Rc<PCIDevice>,
+    notify_cfg_ioport: IOPort,
+    notify_off_multiplier: u32,
+    vqs: RefCell<Vec<Virtqueue>>,
+    notifier: Rc<EventNotifier>,
+    features: Cell<Features>,
+    capacity: Cell<u64>,
+    data_area: DmaRegion,
+    hdr_area: Cell<DmaRegion>,
+    hdr_slots: RefCell<Vec<usize>>,
+    inflight: RefCell<Vec<BlkInflight>>,
+    pending: RefCell<VecDeque<PendingRequest>>,
+    data_addr: RefCell<Option<usize>>,
+    io_queue: RefCell<Option<IOQueue>>,
+    stats_page: usize,
+    stats_addr: RefCell<Option<usize>>,
+    /// Delivers the completions that did not fit in the event queue.
+    redeliver_tasklet: Tasklet,
+}
+
+/// The name of this virtio device that is exported to user space.
+const VIRTIO_DEV_NAME: &str = "/dev/blk";
+
+impl VirtioBlkDevice {
+    fn probe(pci_dev: Rc<PCIDevice>) -> Option<Rc<Device>> {
+        pci_dev.set_bus_master(true);
+
+        pci_dev.enable_msix();
+
+        let notify_cfg_cap = find_capability(&pci_dev, VIRTIO_PCI_CAP_NOTIFY_CFG)?;
+
+        let notify_off_multiplier = pci_dev.func.read_config_u32(notify_cfg_cap.offset + VIRTIO_NOTIFY_OFF_MULTIPLIER);
+
+        let notify_cfg_ioport = notify_cfg_cap.map(&pci_dev)?;
+
+        /* FIXME: Free allocated pages when driver is unloaded.  */
+        let large_page_size = memory::PAGE_SIZE_LARGE as usize;
+        let data_area = DmaRegion::alloc(large_page_size, large_page_size, DMA_ALLOC_LARGE_PAGE).ok()?;
+
+        let stats_page = unsafe { memory::page_alloc_small_zeroed() } as usize;
+        if stats_page == 0 {
+            unsafe { data_area.free() };
+            return None;
+        }
+
+        let dev = Rc::new(VirtioBlkDevice::new(pci_dev, notify_cfg_ioport, notify_off_multiplier, data_area, stats_page));
+
+        dev.redeliver_tasklet.init(VirtioBlkDevice::redeliver, Rc::as_ptr(&dev) as usize);
+
+        let common_cfg_cap = find_capability(&dev.pci_dev, VIRTIO_PCI_CAP_COMMON_CFG)?;
+
+        let ioport = common_cfg_cap.map(&dev.pci_dev)?;
+
+        println!("virtio-blk: using PCI BAR{} for device configuration", common_cfg_cap.bar_idx);
+
+        //
+        // 1. Reset device
+        //
+        let mut status: u8 = 0;
+        ioport.write8(status, DEVICE_STATUS);
+
+        //
+        // 2. Set ACKNOWLEDGE status bit
+        //
+        status |= VIRTIO_ACKNOWLEDGE;
+        ioport.write8(status, DEVICE_STATUS);
+
+        //
+        // 3. Set DRIVER status bit
+        //
+        status |= VIRTIO_DRIVER;
+        ioport.write8(status, DEVICE_STATUS);
+
+        //
+        // 4. Negotiate features
+        //
+        ioport.write32(0, DEVICE_FEATURE_SELECT);
+        let dev_features = Features::from_bits_truncate(ioport.read32(DEVICE_FEATURE));
+        let features = dev_features & (Features::VIRTIO_BLK_F_RO | Features::VIRTIO_BLK_F_FLUSH | Features::VIRTIO_F_INDIRECT_DESC);
+        ioport.write32(0, DRIVER_FEATURE_SELECT);
+        ioport.write32(features.bits(), DRIVER_FEATURE);
+        dev.features.set(features);
+
+        //
+        // 5. Set the FEATURES_OK status bit
+        //
+        status |= VIRTIO_FEATURES_OK;
+        ioport.write8(status, DEVICE_STATUS);
+
+        //
+        // 6. Re-read device status to ensure the FEATURES_OK bit is still set
+        //
+        if ioport.read8(DEVICE_STATUS) & VIRTIO_FEATURES_OK != VIRTIO_FEATURES_OK {
+            panic!("Device does not support our subset of features");
+        }
+
+        //
+        // 7. Perform device-specific setup
+        //
+        let num_queues = ioport.read16(NUM_QUEUES);
+
+        println!("virtio-blk: {} virtqueues found.", num_queues);
+
+        let mut vqs = Vec::new();
+
+        // Only the first request queue is used.
+        let queue = VIRTIO_BLK_REQ_QUEUE_IDX;
+
+        ioport.write16(queue, QUEUE_SELECT);
+
+        let size = ioport.read16(QUEUE_SIZE);
+
+        let notify_off = ioport.read16(QUEUE_NOTIFY_OFF);
+
+        let mut vq = Virtqueue::new(queue, size as usize, notify_off)?;
+
+        ioport.write64(vq.descriptor_table_phys() as u64, QUEUE_DESC);
+        ioport.write64(vq.available_ring_phys() as u64, QUEUE_AVAIL);
+        ioport.write64(vq.used_ring_phys() as u64, QUEUE_USED);
+
+        // Indirect descriptors let a request, which consists of a header, a
+        // data buffer, and a status byte, occupy one ring entry.
+        if features.contains(Features::VIRTIO_F_INDIRECT_DESC) && !vq.enable_indirect() {
+            println!("virtio-blk: unable to allocate indirect descriptor tables");
+        }
+        let hdr_area = DmaRegion::alloc(size as usize * REQ_HDR_SLOT_SIZE, REQ_HDR_SLOT_SIZE, 0).ok()?;
+        for i in 0..size as usize {
+            dev.hdr_slots.borrow_mut().push(hdr_area.virt + i * REQ_HDR_SLOT_SIZE);
+            dev.inflight.borrow_mut().push(BlkInflight {
+                req: Cell::new(0),
+                hdr_slot: Cell::new(0),
+                undelivered: Cell::new(false),
+                done: Cell::new(false),
+            });
+        }
+        dev.hdr_area.set(hdr_area);
+
+        let vector = unsafe { dev.pci_dev.register_irq(queue, VirtioBlkDevice::interrupt, mem::transmute(Rc::as_ptr(&dev)), cpu_id()) };
+        if vector < 0 {
+            panic!("Unable to allocate IRQ");
+        }
+        dev.pci_dev.enable_irq(queue);
+        ioport.write16(queue, QUEUE_MSIX_VECTOR);
+        println!("virtio-blk: virtqueue {} is using IRQ vector {}", queue, vector);
+
+        ioport.write16(1 as u16, QUEUE_ENABLE);
+
+        vqs.push(vq);
+
+        dev.vqs.replace(vqs);
+
+        //
+        // 8. Set DRIVER_OK status bit
+        //
+        status |= VIRTIO_DRIVER_OK;
+        ioport.write8(status, DEVICE_STATUS);
+
+        if let Some(dev_cfg_cap) = find_capability(&dev.pci_dev, VIRTIO_PCI_CAP_DEVICE_CFG) {
+            let dev_cfg_ioport = dev_cfg_cap.map(&dev.pci_dev).unwrap();
+            dev.capacity.set(dev_cfg_ioport.read64(VIRTIO_BLK_CFG_CAPACITY));
+        }
+        println!(
+            "virtio-blk: capacity is {} sectors{}",
+            dev.capacity.get(),
+            if features.contains(Features::VIRTIO_BLK_F_RO) { " (read-only)" } else { "" }
+        );
+
+        Some(Rc::new(Device::new(VIRTIO_DEV_NAME, RefCell::new(dev))))
+    }
+
+    extern "C" fn interrupt(arg: usize) {
+        let dev: *mut VirtioBlkDevice = unsafe { mem::transmute(arg) };
+        unsafe { (*dev).complete() };
+    }
+
+    /// Tasklet that delivers the completions that did not fit in the event
+    /// queue. It runs with interrupts disabled, so the interrupt handler does
+    /// not deliver events at the same time.
+    extern "C" fn redeliver(arg: usize) -> bool {
+        let dev = unsafe { &*(arg as *const VirtioBlkDevice) };
+        for entry in dev.inflight.borrow().iter() {
+            if entry.undelivered.get() {
+                if !dev.deliver(entry) {
+                    break;
+                }
+                entry.undelivered.set(false);
+            }
+        }
+        false
+    }
+
+    fn new(pci_dev: Rc<PCIDevice>, notify_cfg_ioport: IOPort, notify_off_multiplier: u32, data_area: DmaRegion, stats_page: usize) -> Self {
+        VirtioBlkDevice {
+            pci_dev,
+            notify_cfg_ioport,
+            notify_off_multiplier,
+            vqs: RefCell::new(Vec::new()),
+            notifier: Rc::new(EventNotifier::new(VIRTIO_DEV_NAME)),
+            features: Cell::new(Features::empty()),
+            capacity: Cell::new(0),
+            data_area,
+            hdr_area: Cell::new(DmaRegion::default()),
+            hdr_slots: RefCell::new(Vec::new()),
+            inflight: RefCell::new(Vec::new()),
+            pending: RefCell::new(VecDeque::new()),
+            data_addr: RefCell::new(None),
+            io_queue: RefCell::new(None),
+            stats_page,
+            stats_addr: RefCell::new(None),
+            redeliver_tasklet: Tasklet::new(),
+        }
+    }
+
+    fn stats(&self) -> &BlkDeviceStats {
+        unsafe { &*(self.stats_page as *const BlkDeviceStats) }
+    }
+
+    /// Delivers a completion event for every request that the device has
+    /// completed. A completion that does not fit in the event queue is
+    /// delivered again by the redeliver tasklet. The descriptor chains are
+    /// freed in process context by `reclaim()`, because a process may be
+    /// submitting requests.
+    fn complete(&self) {
+        let vq = &self.vqs.borrow()[VIRTIO_BLK_REQ_QUEUE_IDX as usize];
+        let inflight = self.inflight.borrow();
+        while let Some((idx, _)) = vq.pop_used() {
+            let entry = &inflight[idx as usize];
+            self.stats().completions.inc();
+            if !self.deliver(entry) {
+                entry.undelivered.set(true);
+            }
+        }
+    }
+
+    /// Delivers the completion event of request `entry` and marks its
+    /// descriptor chain for reclaim. Returns `false` if the event queue of
+    /// the process is full.
+    fn deliver(&self, entry: &BlkInflight) -> bool {
+        let status = unsafe { ptr::read_volatile((entry.hdr_slot.get() + REQ_STATUS_OFF) as *const u8) };
+        if !self.notifier.on_event(Event::BlockIO { req: entry.req.get(), status: status as usize }) {
+            self.stats().event_overflows.inc();
+            return false;
+        }
+        entry.done.set(true);
+        true
+    }
+
+    /// Frees the descriptor chains and header slots of completed requests.
+    /// Completions that are not delivered yet are redelivered.
+    fn reclaim(&self) {
+        let vq = &self.vqs.borrow()[VIRTIO_BLK_REQ_QUEUE_IDX as usize];
+        let mut hdr_slots = self.hdr_slots.borrow_mut();
+        let mut undelivered = false;
+        for (idx, entry) in self.inflight.borrow().iter().enumerate() {
+            if entry.done.get() {
+                entry.done.set(false);
+                vq.free_desc(idx as u16);
+                hdr_slots.push(entry.hdr_slot.get());
+            }
+            undelivered |= entry.undelivered.get();
+        }
+        if undelivered {
+            self.redeliver_tasklet.schedule();
+        }
+    }
+
+    fn process_io_one(&self, cmd: IOCmd) {
+        match cmd.opcode {
+            Opcode::Submit => {
+                if cmd.len < mem::size_of::<BlkRequest>() {
+                    return;
+                }
+                let req = unsafe { ptr::read_unaligned(cmd.addr as *const BlkRequest) };
+                self.pending.borrow_mut().push_back(PendingRequest { addr: cmd.addr as usize, req });
+            }
+            Opcode::SubmitOffload | Opcode::Complete => {}
+        }
+    }
+
+    /// Submits pending requests to the device until it runs out of
+    /// descriptors. Returns `true` if a request was submitted.
+    fn submit_pending(&self) -> bool {
+        let mut submitted = false;
+        let mut pending = self.pending.borrow_mut();
+        while let Some(pending_req) = pending.pop_front() {
+            if !self.submit(&pending_req) {
+                pending.push_front(pending_req);
+                break;
+            }
+            submitted = true;
+        }
+        submitted
+    }
+
+    /// Submits request `pending_req` to the device. Returns `false` if the
+    /// device is out of descriptors.
+    fn submit(&self, pending_req: &PendingRequest) -> bool {
+        let hdr_slot = match self.hdr_slots.borrow_mut().pop() {
+            Some(hdr_slot) => hdr_slot,
+            None => return false,
+        };
+        let req = &pending_req.req;
+        let data = self.data_phys(req.buf, req.len as usize);
+        let type_ = match (req.type_, data) {
+            (VIRTIO_BLK_T_IN, Some(_)) | (VIRTIO_BLK_T_OUT, Some(_)) => req.type_,
+            (VIRTIO_BLK_T_FLUSH, _) => VIRTIO_BLK_T_FLUSH,
+            _ => VIRTIO_BLK_T_INVALID,
+        };
+        let hdr = VirtioBlkReqHdr { type_, reserved: 0, sector: req.sector };
+        unsafe {
+            ptr::write(hdr_slot as *mut VirtioBlkReqHdr, hdr);
+            ptr::write_volatile((hdr_slot + REQ_STATUS_OFF) as *mut u8, VIRTIO_BLK_S_IOERR);
+        }
+        let hdr_area = self.hdr_area.get();
+        let hdr_phys = hdr_area.phys_addr(hdr_slot);
+        let status_sg = (hdr_phys + REQ_STATUS_OFF, 1, VIRTQ_DESC_F_WRITE);
+        let hdr_sg = (hdr_phys, mem::size_of::<VirtioBlkReqHdr>(), 0);
+        let vq = &self.vqs.borrow()[VIRTIO_BLK_REQ_QUEUE_IDX as usize];
+        let idx = match (type_, data) {
+            (VIRTIO_BLK_T_IN, Some(data_phys)) => vq.alloc_sg(&[hdr_sg, (data_phys, req.len as usize, VIRTQ_DESC_F_WRITE), status_sg]),
+            (VIRTIO_BLK_T_OUT, Some(data_phys)) => vq.alloc_sg(&[hdr_sg, (data_phys, req.len as usize, 0), status_sg]),
+            _ => vq.alloc_sg(&[hdr_sg, status_sg]),
+        };
+        match idx {
+            Some(idx) => {
+                // The completion interrupt can run as soon as the chain is
+                // available to the device, so the inflight entry is filled
+                // in before that.
+                let entry = &self.inflight.borrow()[idx as usize];
+                entry.req.set(pending_req.addr);
+                entry.hdr_slot.set(hdr_slot);
+                vq.add_buf_idx(idx);
+                true
+            }
+            None => {
+                self.hdr_slots.borrow_mut().push(hdr_slot);
+                false
+            }
+        }
+    }
+
+    /// Returns the physical address of a data buffer at user space address
+    /// `buf` of `len` bytes, or `None` if the buffer is not in the data area
+    /// or its length is not a multiple of the sector size.
+    fn data_phys(&self, buf: usize, len: usize) -> Option<usize> {
+        let data_addr = (*self.data_addr.borrow())?;
+        let off = buf.checked_sub(data_addr)?;
+        if len == 0 || len % VIRTIO_BLK_SECTOR_SIZE != 0 || off.checked_add(len)? > self.data_area.size {
+            return None;
+        }
+        Some(self.data_area.phys_addr(self.data_area.virt + off))
+    }
+
+    fn notify(&self, queue: &Virtqueue) {
+        let notify_off = (self.notify_off_multiplier * queue.notify_off as u32) as usize;
+        self.notify_cfg_ioport.write16(queue.queue_idx, notify_off);
+    }
+}
+
+impl DeviceOps for VirtioBlkDevice {
+    fn acquire(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>) -> Result<()> {
+        self.notifier.add_listener(listener);
+
+        let data_area_size = self.data_area.size;
+        let (data_start, data_end) = vmspace.allocate(data_area_size, data_area_size, VMProt::VM_PROT_RW)?;
+        vmspace.map(data_start, data_end, self.data_area.virt)?;
+        self.data_addr.replace(Some(data_start));
+
+        let stats_size = memory::PAGE_SIZE_SMALL as usize;
+        let (stats_start, stats_end) = vmspace.allocate(stats_size, stats_size, VMProt::VM_PROT_READ)?;
+        vmspace.map(stats_start, stats_end, self.stats_page)?;
+        self.stats_addr.replace(Some(stats_start));
+
+        let io_buf_size = 4096;
+        let (io_buf_start, io_buf_end) = vmspace.allocate(io_buf_size, memory::PAGE_SIZE_SMALL as usize, VMProt::VM_PROT_RW)?;
+        vmspace.populate(io_buf_start, io_buf_end)?;
+        let io_queue = IOQueue::new(io_buf_start, io_buf_size);
+        self.io_queue.replace(Some(io_queue));
+
+        Ok(())
+    }
+
+    fn subscribe(&self, _events: &'static str) {}
+
+    fn get_config(&self, opt: ConfigOption) -> Option<Vec<u8>> {
+        match opt {
+            CONFIG_IO_QUEUE => {
+                self.io_queue.borrow().as_ref().map(|io_queue| io_queue.ring_buffer.raw_ptr().to_ne_bytes().to_vec())
+            }
+            CONFIG_STATS => self.stats_addr.borrow().map(|addr| addr.to_ne_bytes().to_vec()),
+            CONFIG_BLOCK_CAPACITY => Some(self.capacity.get().to_ne_bytes().to_vec()),
+            CONFIG_BLOCK_DATA_AREA => self.data_addr.borrow().map(|addr| addr.to_ne_bytes().to_vec()),
+            CONFIG_BLOCK_DATA_AREA_SIZE => Some((self.data_area.size as u64).to_ne_bytes().to_vec()),
+            CONFIG_IRQ_STATS => Some(irq_stats(&self.pci_dev)),
+            _ => None,
+        }
+    }
+
+    fn set_config(&self, opt: ConfigOption, value: &[u8]) -> Result<()> {
+        match opt {
+            CONFIG_IRQ_AFFINITY => set_irq_affinity(&self.pci_dev, value),
+            _ => Err(Error::new(EINVAL)),
+        }
+    }
+
+    fn process_io(&self) {
+        self.reclaim();
+        if let Some(io_queue) = self.io_queue.borrow_mut().as_mut() {
+            while let Some(cmd) = io_queue.pop() {
+                self.process_io_one(cmd);
+            }
+        }
+        if self.submit_pending() {
+            self.notify(&self.vqs.borrow()[VIRTIO_BLK_REQ_QUEUE_IDX as usize]);
+        }
+    }
+
+    fn io_pending(&self) -> bool {
+        self.io_queue.borrow().as_ref().map_or(false, |io_queue| !io_queue.is_empty())
+    }
+}
+
+pub static mut VIRTIO_BLK_DRIVER: PCIDriver =
+    PCIDriver::new(
+        DeviceID::new(PCI_VENDOR_ID_REDHAT, PCI_DEVICE_ID_VIRTIO_BLK),
+        VirtioBlkDevice::probe,
+    );
@@ -12,12 +12,15 @@ extern crate intrusive_collections;
 extern crate kernel;
 extern crate rlibc;
 
+pub mod transport;
 pub mod virtqueue;
+pub mod blk;
 pub mod net;
 
 #[no_mangle]
 pub extern "C" fn virtio_register_drivers() {
     unsafe {
         pci::pci_register_driver(&net::VIRTIO_NET_DRIVER);
+        pci::pci_register_driver(&blk::VIRTIO_BLK_DRIVER);
     }
 }
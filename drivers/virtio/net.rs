@@ -2,52 +2,33 @@
 
 use alloc::rc::Rc;
 use alloc::vec::Vec;
-use core::cell::RefCell;
+use core::arch::x86_64::_mm_sfence;
+use core::cell::{Cell, RefCell};
+use core::cmp;
 use core::mem;
-use kernel::errno::Result;
-use kernel::device::{ConfigOption, Device, DeviceOps, CONFIG_ETHERNET_MAC_ADDRESS, CONFIG_IO_QUEUE};
+use core::ptr;
+use core::slice;
+use kernel::errno::{Error, Result, EBUSY, EINVAL};
+use kernel::device::{ConfigOption, Device, DeviceOps, CONFIG_ETHERNET_MAC_ADDRESS, CONFIG_IO_QUEUE, CONFIG_STATS};
+use kernel::device::{CONFIG_IRQ_AFFINITY, CONFIG_IRQ_STATS, CONFIG_VIRTIO_BYPASS_INFO};
 use kernel::event::{Event, EventListener, EventNotifier};
 use kernel::ioport::IOPort;
 use kernel::ioqueue::{IOCmd, Opcode, IOQueue};
-use kernel::memory;
-use kernel::mmu;
+use kernel::memory::{self, DmaRegion, DMA_ALLOC_LARGE_PAGE};
+use kernel::net::{self, GroContext, GsoSegmenter, NetDeviceStats, NetOffloadHdr, NetQueueStats};
+use kernel::net::{NET_GSO_NONE, NET_GSO_TCPV4, NET_GSO_UDP, NET_OFFLOAD_F_DATA_VALID, NET_OFFLOAD_F_NEEDS_CSUM};
 use kernel::print;
+use kernel::softirq::Tasklet;
 use kernel::vm::{VMAddressSpace, VMProt};
-use pci::{DeviceID, PCIDevice, PCIDriver, PCI_CAPABILITY_VENDOR, PCI_VENDOR_ID_REDHAT};
-use virtqueue::{Virtqueue};
+use pci::{cpu_id, DeviceID, PCIDevice, PCIDriver, PCI_VENDOR_ID_REDHAT};
+use transport::{find_capability, irq_stats, set_irq_affinity, DEVICE_FEATURE, DEVICE_FEATURE_SELECT, DEVICE_STATUS, DRIVER_FEATURE, DRIVER_FEATURE_SELECT};
+use transport::{NUM_QUEUES, QUEUE_AVAIL, QUEUE_DESC, QUEUE_ENABLE, QUEUE_MSIX_VECTOR, QUEUE_NOTIFY_OFF, QUEUE_SELECT, QUEUE_SIZE, QUEUE_USED};
+use transport::{VIRTIO_ACKNOWLEDGE, VIRTIO_DRIVER, VIRTIO_DRIVER_OK, VIRTIO_FEATURES_OK};
+use transport::{VIRTIO_NOTIFY_OFF_MULTIPLIER, VIRTIO_PCI_CAP_COMMON_CFG, VIRTIO_PCI_CAP_DEVICE_CFG, VIRTIO_PCI_CAP_NOTIFY_CFG};
+use virtqueue::{Virtqueue, VIRTQ_DESC_F_WRITE};
 
 const PCI_DEVICE_ID_VIRTIO_NET: u16 = 0x1041;
 
-#[allow(dead_code)]
-const DEVICE_FEATURE_SELECT: usize = 0x00;
-const DEVICE_FEATURE: usize = 0x04;
-#[allow(dead_code)]
-const DRIVER_FEATURE_SELECT: usize = 0x08;
-const DRIVER_FEATURE: usize = 0x0c;
-#[allow(dead_code)]
-const MSIX_CONFIG: usize = 0x10;
-const NUM_QUEUES: usize = 0x12;
-const DEVICE_STATUS: usize = 0x14;
-#[allow(dead_code)]
-const CONFIG_GENERATION: usize = 0x15;
-const QUEUE_SELECT: usize = 0x16;
-const QUEUE_SIZE: usize = 0x18;
-const QUEUE_MSIX_VECTOR: usize = 0x1a;
-const QUEUE_ENABLE: usize = 0x1c;
-const QUEUE_NOTIFY_OFF: usize = 0x1e;
-const QUEUE_DESC: usize = 0x20;
-const QUEUE_AVAIL: usize = 0x28;
-const QUEUE_USED: usize = 0x30;
-
-const VIRTIO_ACKNOWLEDGE: u8 = 1;
-const VIRTIO_DRIVER: u8 = 2;
-#[allow(dead_code)]
-const VIRTIO_FAILED: u8 = 128;
-const VIRTIO_FEATURES_OK: u8 = 8;
-const VIRTIO_DRIVER_OK: u8 = 4;
-#[allow(dead_code)]
-const DEVICE_NEEDS_RESET: u8 = 64;
-
 bitflags! {
     pub struct Features: u32 {
         const VIRTIO_NET_F_CSUM = 1<<0;
@@ -70,33 +51,31 @@ bitflags! {
         const VIRTIO_NET_F_GUEST_ANNOUNCE = 1<<21;
         const VIRTIO_NET_F_MQ = 1<<22;
         const VIRTIO_NET_F_CTRL_MAC_ADDR = 1<<23;
+        const VIRTIO_F_INDIRECT_DESC = 1<<28;
     }
 }
 
-const VIRTIO_PCI_CAP_COMMON_CFG: u8 = 1;
-const VIRTIO_PCI_CAP_NOTIFY_CFG: u8 = 2;
-#[allow(dead_code)]
-const VIRTIO_PCI_CAP_ISR_CFG: u8 = 3;
-const VIRTIO_PCI_CAP_DEVICE_CFG: u8 = 4;
-#[allow(dead_code)]
-const VIRTIO_PCI_CAP_PCI_CFG: u8 = 5;
+const VIRTIO_RX_QUEUE_IDX: u16 = 0;
+const VIRTIO_TX_QUEUE_IDX: u16 = 1;
 
-/* 4.1.4 Virtio Structure PCI Capabilities */
-const VIRTIO_PCI_CAP_CFG_TYPE: u8 = 3;
-const VIRTIO_PCI_CAP_BAR: u8 = 4;
-const VIRTIO_PCI_CAP_OFFSET: u8 = 8;
-const VIRTIO_PCI_CAP_LENGTH: u8 = 12;
+/// Size of a buffer that holds a virtio-net header and the largest frame that
+/// segmentation offload produces (64 KiB IP datagram).
+const NET_BUF_SIZE_MAX: usize = 68 * 1024;
 
-/* 4.1.4.4 Notification structure layout */
-const VIRTIO_NOTIFY_OFF_MULTIPLIER: u8 = 16;
+/// Size of a transmit header slot, which holds a virtio-net header and the
+/// L2-L4 headers of a segment produced by software segmentation.
+const TX_HDR_SLOT_SIZE: usize = 256;
 
-const VIRTIO_RX_QUEUE_IDX: u16 = 0;
-const VIRTIO_TX_QUEUE_IDX: u16 = 1;
+/// Maximum number of packets that the receive tasklet removes from the RX
+/// queue in one run.
+const RX_POLL_BUDGET: usize = 64;
 
 type MacAddr = [u8; 6];
 
+/// Virtio-net header. The `num_buffers` field is present only if
+/// VIRTIO_NET_F_MRG_RXBUF is negotiated.
 #[repr(C)]
-#[derive(Debug)]
+#[derive(Debug, Default)]
 struct VirtioNetHdr {
     flags: u8,
     gso_type: u8,
@@ -104,42 +83,143 @@ struct VirtioNetHdr {
     gso_size: u16,
     csum_start: u16,
     csum_offset: u16,
+    num_buffers: u16,
+}
+
+const VIRTIO_NET_HDR_F_NEEDS_CSUM: u8 = 1;
+const VIRTIO_NET_HDR_F_DATA_VALID: u8 = 2;
+
+impl VirtioNetHdr {
+    fn from_offload_hdr(hdr: &NetOffloadHdr) -> Self {
+        VirtioNetHdr {
+            flags: hdr.flags,
+            gso_type: hdr.gso_type,
+            hdr_len: hdr.hdr_len,
+            gso_size: hdr.gso_size,
+            csum_start: hdr.csum_start,
+            csum_offset: hdr.csum_offset,
+            num_buffers: 0,
+        }
+    }
+
+    fn to_offload_hdr(&self) -> NetOffloadHdr {
+        NetOffloadHdr {
+            flags: self.flags,
+            gso_type: self.gso_type,
+            hdr_len: self.hdr_len,
+            gso_size: self.gso_size,
+            csum_start: self.csum_start,
+            csum_offset: self.csum_offset,
+        }
+    }
+}
+
+/// Receive buffer state.
+struct RxBuf {
+    /// Number of buffers that the packet starting in this buffer occupies.
+    nr_bufs: Cell<usize>,
+    /// The buffer is no longer in use and can be made available to the device.
+    done: Cell<bool>,
+}
+
+/// Transmit state of a descriptor chain that the device owns.
+#[derive(Clone, Copy, Default)]
+struct TxInflight {
+    /// Transmit buffer that the descriptor chain refers to.
+    buf: usize,
+    /// Header slot that the descriptor chain refers to, or zero.
+    hdr_slot: usize,
+}
+
+/// Virtqueue state in kernel-bypass mode (needs to match the definition in
+/// include/uapi/manticore/virtio_bypass_abi.h).
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct VirtioBypassQueue {
+    desc: u64,
+    avail: u64,
+    used: u64,
+    notify: u64,
+    size: u16,
+    queue_idx: u16,
+    last_used_idx: u16,
+    reserved: u16,
+}
+
+/// A memory area that is mapped to a process in kernel-bypass mode.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct VirtioBypassArea {
+    addr: u64,
+    dma_addr: u64,
+    size: u64,
+}
+
+/// Maximum number of virtqueues that are mapped in kernel-bypass mode.
+const VIRTIO_BYPASS_MAX_QUEUES: usize = 2;
+
+/// Device state in kernel-bypass mode.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct VirtioBypassInfo {
+    features: u64,
+    vhdr_size: u64,
+    rx_buf_size: u64,
+    nr_rx_bufs: u64,
+    rx_area: VirtioBypassArea,
+    tx_area: VirtioBypassArea,
+    nr_queues: u64,
+    queues: [VirtioBypassQueue; VIRTIO_BYPASS_MAX_QUEUES],
+}
+
+/// A received packet.
+struct RxPacket {
+    /// Index of the first receive buffer of the packet.
+    head: usize,
+    /// Number of receive buffers that the packet occupies.
+    nr_bufs: usize,
+    /// Kernel address of the Ethernet frame.
+    frame: usize,
+    /// Length of the Ethernet frame.
+    len: usize,
+    /// Offload header of the packet.
+    hdr: NetOffloadHdr,
+    /// GRO context if the packet is a GRO candidate.
+    gro: Option<GroContext>,
 }
 
 struct VirtioNetDevice {
     pci_dev: Rc<PCIDevice>,
     notify_cfg_ioport: IOPort,
+    /// The notification structure is mapped with write-combining.
+    notify_wc: bool,
+    /// Physical address and length of the notification structure.
+    notify_cfg_phys: Option<(usize, usize)>,
     notify_off_multiplier: u32,
     vqs: RefCell<Vec<Virtqueue>>,
     notifier: Rc<EventNotifier>,
-    rx_page: usize,
-    rx_page_size: usize,
-    tx_page: usize,
-    tx_page_size: usize,
+    features: Cell<Features>,
+    vhdr_size: Cell<usize>,
+    rx_area: DmaRegion,
+    rx_buf_size: Cell<usize>,
+    rx_bufs: RefCell<Vec<RxBuf>>,
+    rx_post: Cell<usize>,
+    tx_area: DmaRegion,
+    tx_hdr_area: Cell<DmaRegion>,
+    tx_free_bufs: RefCell<Vec<usize>>,
+    tx_buf_refs: RefCell<Vec<usize>>,
+    tx_hdr_slots: RefCell<Vec<usize>>,
+    tx_inflight: RefCell<Vec<TxInflight>>,
+    stats_page: usize,
+    stats_addr: RefCell<Option<usize>>,
     mac_addr: RefCell<Option<MacAddr>>,
     rx_buffer_addr: RefCell<Option<usize>>,
     io_queue: RefCell<Option<IOQueue>>,
-}
-
-/// Virtio PCI capability structure.
-struct VirtioPCICap {
-    pub offset: u8,
-    pub bar_idx: u8,
-}
-
-impl VirtioPCICap {
-    fn new(offset: u8, bar_idx: u8) -> Self {
-      Self {
-          offset,
-          bar_idx,
-      }
-    }
-
-    fn map(&self, pci_dev: &PCIDevice) -> Option<IOPort> {
-        let offset = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_OFFSET);
-        let length = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_LENGTH);
-        pci_dev.bars[self.bar_idx as usize].map(|bar| { bar.remap(offset as usize, length) }).flatten()
-    }
+    /// Receives packets after an RX queue interrupt.
+    rx_tasklet: Tasklet,
+    /// The device is acquired in kernel-bypass mode.
+    bypass: Cell<bool>,
+    bypass_info: Cell<VirtioBypassInfo>,
 }
 
 /// The name of this virtio device that is exported to user space.
@@ -151,15 +231,44 @@ impl VirtioNetDevice {
 
         pci_dev.enable_msix();
 
-        let notify_cfg_cap = VirtioNetDevice::find_capability(&pci_dev, VIRTIO_PCI_CAP_NOTIFY_CFG)?;
+        let notify_cfg_cap = find_capability(&pci_dev, VIRTIO_PCI_CAP_NOTIFY_CFG)?;
 
         let notify_off_multiplier = pci_dev.func.read_config_u32(notify_cfg_cap.offset + VIRTIO_NOTIFY_OFF_MULTIPLIER);
 
-        let notify_cfg_ioport = notify_cfg_cap.map(&pci_dev)?;
+        // A notification is a plain register write, so it goes through a
+        // write-combining mapping where the device permits.
+        let (notify_cfg_ioport, notify_wc) = match notify_cfg_cap.map_wc(&pci_dev) {
+            Some(ioport) => (ioport, true),
+            None => (notify_cfg_cap.map(&pci_dev)?, false),
+        };
+
+        let notify_cfg_phys = notify_cfg_cap.phys_range(&pci_dev);
+
+        /* FIXME: Free allocated pages when driver is unloaded.  */
+        let large_page_size = memory::PAGE_SIZE_LARGE as usize;
+        let rx_area = DmaRegion::alloc(large_page_size, large_page_size, DMA_ALLOC_LARGE_PAGE).ok()?;
+        let tx_area = match DmaRegion::alloc(large_page_size, large_page_size, DMA_ALLOC_LARGE_PAGE) {
+            Ok(tx_area) => tx_area,
+            Err(_) => {
+                unsafe { rx_area.free() };
+                return None;
+            }
+        };
+
+        let stats_page = unsafe { memory::page_alloc_small_zeroed() } as usize;
+        if stats_page == 0 {
+            unsafe {
+                rx_area.free();
+                tx_area.free();
+            }
+            return None;
+        }
+
+        let dev = Rc::new(VirtioNetDevice::new(pci_dev, notify_cfg_ioport, notify_wc, notify_cfg_phys, notify_off_multiplier, rx_area, tx_area, stats_page));
 
-        let dev = Rc::new(VirtioNetDevice::new(pci_dev, notify_cfg_ioport, notify_off_multiplier));
+        dev.rx_tasklet.init(VirtioNetDevice::rx_poll, Rc::as_ptr(&dev) as usize);
 
-        let common_cfg_cap = VirtioNetDevice::find_capability(&dev.pci_dev, VIRTIO_PCI_CAP_COMMON_CFG)?;
+        let common_cfg_cap = find_capability(&dev.pci_dev, VIRTIO_PCI_CAP_COMMON_CFG)?;
 
         let ioport = common_cfg_cap.map(&dev.pci_dev)?;
 
@@ -186,8 +295,35 @@ impl VirtioNetDevice {
         //
         // 4. Negotiate features
         //
-        let features = Features::VIRTIO_NET_F_MAC;
+        ioport.write32(0, DEVICE_FEATURE_SELECT);
+        let dev_features = Features::from_bits_truncate(ioport.read32(DEVICE_FEATURE));
+        let mut features = dev_features
+            & (Features::VIRTIO_NET_F_MAC
+                | Features::VIRTIO_NET_F_CSUM
+                | Features::VIRTIO_NET_F_HOST_TSO4
+                | Features::VIRTIO_NET_F_HOST_UFO
+                | Features::VIRTIO_NET_F_GUEST_CSUM
+                | Features::VIRTIO_NET_F_GUEST_TSO4
+                | Features::VIRTIO_NET_F_GUEST_UFO
+                | Features::VIRTIO_NET_F_MRG_RXBUF
+                | Features::VIRTIO_F_INDIRECT_DESC);
+        // Segmentation offload requires checksum offload.
+        if !features.contains(Features::VIRTIO_NET_F_CSUM) {
+            features.remove(Features::VIRTIO_NET_F_HOST_TSO4 | Features::VIRTIO_NET_F_HOST_UFO);
+        }
+        if !features.contains(Features::VIRTIO_NET_F_GUEST_CSUM) {
+            features.remove(Features::VIRTIO_NET_F_GUEST_TSO4 | Features::VIRTIO_NET_F_GUEST_UFO);
+        }
+        ioport.write32(0, DRIVER_FEATURE_SELECT);
         ioport.write32(features.bits(), DRIVER_FEATURE);
+        dev.features.set(features);
+
+        if features.contains(Features::VIRTIO_NET_F_MRG_RXBUF) {
+            dev.vhdr_size.set(mem::size_of::<VirtioNetHdr>());
+        } else if features.intersects(Features::VIRTIO_NET_F_GUEST_TSO4 | Features::VIRTIO_NET_F_GUEST_UFO) {
+            // Without mergeable buffers, every buffer must hold a maximum-sized packet.
+            dev.rx_buf_size.set(NET_BUF_SIZE_MAX);
+        }
 
         //
         // 5. Set the FEATURES_OK status bit
@@ -218,16 +354,59 @@ impl VirtioNetDevice {
 
             let notify_off = ioport.read16(QUEUE_NOTIFY_OFF);
 
-            let vq = Virtqueue::new(queue, size as usize, notify_off);
+            let mut vq = Virtqueue::new(queue, size as usize, notify_off)?;
 
-            ioport.write64(unsafe { mmu::virt_to_phys(vq.raw_descriptor_table_ptr) as u64 }, QUEUE_DESC);
-            ioport.write64(unsafe { mmu::virt_to_phys(vq.raw_available_ring_ptr) as u64 }, QUEUE_AVAIL);
-            ioport.write64(unsafe { mmu::virt_to_phys(vq.raw_used_ring_ptr) as u64 }, QUEUE_USED);
+            ioport.write64(vq.descriptor_table_phys() as u64, QUEUE_DESC);
+            ioport.write64(vq.available_ring_phys() as u64, QUEUE_AVAIL);
+            ioport.write64(vq.used_ring_phys() as u64, QUEUE_USED);
 
             // RX queue:
             if queue == VIRTIO_RX_QUEUE_IDX {
-                vq.add_inbuf(unsafe { mmu::virt_to_phys(dev.rx_page as usize) as usize }, dev.rx_page_size);
-                let vector = unsafe { dev.pci_dev.register_irq(queue, VirtioNetDevice::interrupt, mem::transmute(Rc::as_ptr(&dev))) };
+                // The receive area holds the receive buffers followed by an
+                // overflow area, where packets that wrap around the end of the
+                // receive buffers are made contiguous.
+                let rx_buf_size = dev.rx_buf_size.get();
+                let nr_bufs = cmp::min((memory::PAGE_SIZE_LARGE as usize - NET_BUF_SIZE_MAX) / rx_buf_size, size as usize);
+                let mut rx_bufs = dev.rx_bufs.borrow_mut();
+                for i in 0..nr_bufs {
+                    let addr = dev.rx_area.phys + i * rx_buf_size;
+                    vq.set_desc(i as u16, addr, rx_buf_size, VIRTQ_DESC_F_WRITE);
+                    vq.add_buf_idx(i as u16);
+                    rx_bufs.push(RxBuf { nr_bufs: Cell::new(1), done: Cell::new(false) });
+                }
+                let vector = unsafe { dev.pci_dev.register_irq(queue, VirtioNetDevice::interrupt, mem::transmute(Rc::as_ptr(&dev)), cpu_id()) };
+                if vector < 0 {
+                    panic!("Unable to allocate IRQ");
+                }
+                dev.pci_dev.enable_irq(queue);
+                ioport.write16(queue, QUEUE_MSIX_VECTOR);
+                println!("virtio-net: virtqueue {} is using IRQ vector {}", queue, vector);
+            }
+            // TX queue:
+            if queue == VIRTIO_TX_QUEUE_IDX {
+                // Indirect descriptors let a segment that is split between a
+                // header slot and a transmit buffer occupy one ring entry.
+                if features.contains(Features::VIRTIO_F_INDIRECT_DESC) && !vq.enable_indirect() {
+                    println!("virtio-net: unable to allocate indirect descriptor tables");
+                }
+                let nr_bufs = cmp::min(memory::PAGE_SIZE_LARGE as usize / NET_BUF_SIZE_MAX, size as usize);
+                let mut tx_free_bufs = dev.tx_free_bufs.borrow_mut();
+                for i in 0..nr_bufs {
+                    tx_free_bufs.push(dev.tx_area.virt + i * NET_BUF_SIZE_MAX);
+                }
+                dev.tx_buf_refs.borrow_mut().resize(nr_bufs, 0);
+                let tx_hdr_area = DmaRegion::alloc(size as usize * TX_HDR_SLOT_SIZE, TX_HDR_SLOT_SIZE, 0).ok()?;
+                let mut tx_hdr_slots = dev.tx_hdr_slots.borrow_mut();
+                for i in 0..size as usize {
+                    tx_hdr_slots.push(tx_hdr_area.virt + i * TX_HDR_SLOT_SIZE);
+                }
+                dev.tx_hdr_area.set(tx_hdr_area);
+                dev.tx_inflight.borrow_mut().resize(size as usize, TxInflight::default());
+                // Transmit buffers are reclaimed when the process does I/O,
+                // so the TX queue only interrupts a process that acquires
+                // the device in kernel-bypass mode.
+                vq.disable_interrupts();
+                let vector = unsafe { dev.pci_dev.register_irq(queue, VirtioNetDevice::tx_interrupt, mem::transmute(Rc::as_ptr(&dev)), cpu_id()) };
                 if vector < 0 {
                     panic!("Unable to allocate IRQ");
                 }
@@ -248,10 +427,8 @@ impl VirtioNetDevice {
         status |= VIRTIO_DRIVER_OK;
         ioport.write8(status, DEVICE_STATUS);
 
-        let dev_features = Features::from_bits_truncate(ioport.read32(DEVICE_FEATURE));
-
         if dev_features.contains(Features::VIRTIO_NET_F_MAC) {
-            if let Some(dev_cfg_cap) = VirtioNetDevice::find_capability(&dev.pci_dev, VIRTIO_PCI_CAP_DEVICE_CFG) {
+            if let Some(dev_cfg_cap) = find_capability(&dev.pci_dev, VIRTIO_PCI_CAP_DEVICE_CFG) {
                 let dev_cfg_ioport = dev_cfg_cap.map(&dev.pci_dev).unwrap();
                 let mut mac: [u8; 6] = [0; 6];
                 for i in 0..mac.len() {
@@ -268,103 +445,576 @@ impl VirtioNetDevice {
         Some(Rc::new(Device::new(VIRTIO_DEV_NAME, RefCell::new(dev))))
     }
 
-    fn find_capability(pci_dev: &PCIDevice, cfg_type: u8) -> Option<VirtioPCICap> {
-        let mut capability = pci_dev.func.find_capability(PCI_CAPABILITY_VENDOR);
-        while let Some(offset) = capability {
-            let ty = pci_dev.func.read_config_u8(offset + VIRTIO_PCI_CAP_CFG_TYPE);
-            let bar_idx = pci_dev.func.read_config_u8(offset + VIRTIO_PCI_CAP_BAR);
-            if ty == cfg_type && bar_idx < 0x05 {
-                return Some(VirtioPCICap::new(offset, bar_idx))
+    /// Receives at most `budget` packets from the RX queue. Returns `true` if
+    /// the budget ran out before the queue was empty.
+    fn recv(&self, budget: usize) -> bool {
+        let vq = &self.vqs.borrow()[VIRTIO_RX_QUEUE_IDX as usize];
+        let mut pending: Option<RxPacket> = None;
+        let mut nr_pkts = 0;
+        while nr_pkts < budget {
+            let pkt = match self.rx_pop(vq) {
+                Some(pkt) => pkt,
+                None => break,
+            };
+            nr_pkts += 1;
+            if let Some(ref mut cur) = pending {
+                if self.rx_merge(cur, &pkt) {
+                    continue;
+                }
+            }
+            if let Some(cur) = pending.take() {
+                self.rx_deliver(cur);
             }
-            capability = pci_dev.func.find_next_capability(PCI_CAPABILITY_VENDOR, offset);
+            pending = Some(pkt);
+        }
+        if let Some(cur) = pending {
+            self.rx_deliver(cur);
+        }
+        // The device drops packets while it has no receive buffers.
+        if vq.avail_idx() == vq.last_used_idx() {
+            self.stats().rx.ring_full.inc();
         }
-        None
+        nr_pkts == budget
     }
 
-    fn recv(&self) {
-        let vq = &self.vqs.borrow()[VIRTIO_RX_QUEUE_IDX as usize];
-        let last_seen_idx = vq.last_seen_used();
-        let last_used_idx = vq.last_used_idx();
-        let mut idx = last_seen_idx;
+    /// Removes the next received packet from the RX queue.
+    fn rx_pop(&self, vq: &Virtqueue) -> Option<RxPacket> {
+        let nr_bufs = self.rx_bufs.borrow().len();
+        let buf_size = self.rx_buf_size.get();
+        let vhdr_size = self.vhdr_size.get();
+        let mrg_rxbuf = self.features.get().contains(Features::VIRTIO_NET_F_MRG_RXBUF);
         loop {
-            if idx == last_used_idx {
-                break
+            let (id, len) = vq.pop_used()?;
+            let head = id as usize;
+            let buf = self.rx_area.virt + head * buf_size;
+            let mut vhdr = VirtioNetHdr::default();
+            unsafe { ptr::copy_nonoverlapping(buf as *const u8, &mut vhdr as *mut VirtioNetHdr as *mut u8, vhdr_size) };
+            let nr_pkt_bufs = if mrg_rxbuf { cmp::max(vhdr.num_buffers as usize, 1) } else { 1 };
+            let mut valid = len >= vhdr_size;
+            let mut frame_len = len.saturating_sub(vhdr_size);
+            // With mergeable buffers, the rest of the packet is in the
+            // following buffers. Buffers are made available in order, so they
+            // are contiguous unless the packet wraps around the receive area.
+            for i in 1..nr_pkt_bufs {
+                let (id, len) = match vq.pop_used() {
+                    Some(used) => used,
+                    None => {
+                        valid = false;
+                        break;
+                    }
+                };
+                let idx = id as usize;
+                if idx != (head + i) % nr_bufs {
+                    valid = false;
+                    self.rx_release(idx, 1);
+                    continue;
+                }
+                if head + i >= nr_bufs {
+                    let src = self.rx_area.virt + idx * buf_size;
+                    let dst = self.rx_area.virt + (head + i) * buf_size;
+                    unsafe { ptr::copy_nonoverlapping(src as *const u8, dst as *mut u8, len) };
+                }
+                frame_len += len;
+            }
+            if !valid {
+                self.stats().rx.drops.inc();
+                self.rx_release(head, nr_pkt_bufs);
+                continue;
+            }
+            let frame = buf + vhdr_size;
+            if vhdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM != 0 {
+                let frame_buf = unsafe { slice::from_raw_parts_mut(frame as *mut u8, frame_len) };
+                if net::checksum_complete(frame_buf, vhdr.csum_start as usize, vhdr.csum_offset as usize).is_err() {
+                    self.stats().rx.drops.inc();
+                    self.rx_release(head, nr_pkt_bufs);
+                    continue;
+                }
+                vhdr.flags = VIRTIO_NET_HDR_F_DATA_VALID;
             }
-            let (buf_addr, buf_len) = vq.get_used_buf(idx % vq.queue_size as u16);
+            let csum_valid = vhdr.flags & VIRTIO_NET_HDR_F_DATA_VALID != 0;
+            let gro = if vhdr.gso_type == NET_GSO_NONE {
+                GroContext::new(unsafe { slice::from_raw_parts(frame as *const u8, frame_len) }, csum_valid)
+            } else {
+                None
+            };
+            return Some(RxPacket { head, nr_bufs: nr_pkt_bufs, frame, len: frame_len, hdr: vhdr.to_offload_hdr(), gro });
+        }
+    }
 
-            let buf_vaddr = unsafe { mmu::phys_to_virt(buf_addr) };
-            let _hdr: *const VirtioNetHdr = unsafe { mem::transmute(buf_vaddr) };
+    /// Merges packet `pkt` into packet `cur` if they are consecutive segments
+    /// of the same flow. Returns `true` if the packet was merged.
+    fn rx_merge(&self, cur: &mut RxPacket, pkt: &RxPacket) -> bool {
+        let nr_bufs = self.rx_bufs.borrow().len();
+        if pkt.head != (cur.head + cur.nr_bufs) % nr_bufs || pkt.hdr.gso_type != NET_GSO_NONE {
+            return false;
+        }
+        let csum_valid = pkt.hdr.flags & VIRTIO_NET_HDR_F_DATA_VALID != 0;
+        let gro = match cur.gro {
+            Some(ref mut gro) => gro,
+            None => return false,
+        };
+        let end = gro.len();
+        let head = unsafe { slice::from_raw_parts(cur.frame as *const u8, end) };
+        let frame = unsafe { slice::from_raw_parts(pkt.frame as *const u8, pkt.len) };
+        match gro.merge(head, frame, csum_valid) {
+            Some((off, len)) => {
+                // The payload moves towards the start of the receive area, or
+                // to the overflow area if the packet wrapped around.
+                unsafe { ptr::copy((pkt.frame + off) as *const u8, (cur.frame + end) as *mut u8, len) };
+                cur.nr_bufs += pkt.nr_bufs;
+                true
+            }
+            None => false,
+        }
+    }
 
-            if let Some(rx_buffer_addr) = *self.rx_buffer_addr.borrow() {
-                let packet_len = buf_len - mem::size_of::<VirtioNetHdr>();
-                self.notifier.on_event(Event::PacketIO {
-                    addr: rx_buffer_addr + mem::size_of::<VirtioNetHdr>(),
-                    len: packet_len,
-                });
+    /// Delivers packet `pkt` to user space.
+    fn rx_deliver(&self, mut pkt: RxPacket) {
+        self.rx_bufs.borrow()[pkt.head].nr_bufs.set(pkt.nr_bufs);
+        let stats = &self.stats().rx;
+        let rx_buffer_addr = match *self.rx_buffer_addr.borrow() {
+            Some(addr) => addr,
+            None => {
+                stats.drops.inc();
+                self.rx_release(pkt.head, pkt.nr_bufs);
+                return;
+            }
+        };
+        let mut nr_packets = 1;
+        if let Some(ref gro) = pkt.gro {
+            nr_packets = gro.segs();
+            if gro.segs() > 1 {
+                let frame = unsafe { slice::from_raw_parts_mut(pkt.frame as *mut u8, gro.len()) };
+                pkt.hdr = gro.finish(frame);
+                pkt.len = gro.len();
+            }
+        }
+        let delivered = if pkt.hdr.gso_type == NET_GSO_NONE {
+            self.notifier.on_event(Event::PacketIO {
+                addr: rx_buffer_addr + (pkt.frame - self.rx_area.virt),
+                len: pkt.len,
+            })
+        } else {
+            // The offload header is placed immediately before the frame,
+            // overwriting the tail of the virtio-net header.
+            let hdr_size = mem::size_of::<NetOffloadHdr>();
+            let hdr_addr = pkt.frame - hdr_size;
+            if pkt.hdr.flags & VIRTIO_NET_HDR_F_DATA_VALID != 0 {
+                pkt.hdr.flags = NET_OFFLOAD_F_DATA_VALID;
             }
+            unsafe { ptr::write_unaligned(hdr_addr as *mut NetOffloadHdr, pkt.hdr) };
+            self.notifier.on_event(Event::PacketIOOffload {
+                addr: rx_buffer_addr + (hdr_addr - self.rx_area.virt),
+                len: hdr_size + pkt.len,
+            })
+        };
+        if !delivered {
+            // Nobody will complete the packet, so release its buffers now.
+            stats.event_overflows.inc();
+            stats.drops.add(nr_packets as u64);
+            self.rx_release(pkt.head, pkt.nr_bufs);
+            return;
+        }
+        stats.packets.add(nr_packets as u64);
+        stats.bytes.add(pkt.len as u64);
+    }
 
-            vq.advance_last_seen_used();
+    /// Marks `count` receive buffers starting at index `head` as no longer in use.
+    fn rx_release(&self, head: usize, count: usize) {
+        let rx_bufs = self.rx_bufs.borrow();
+        for i in 0..count {
+            rx_bufs[(head + i) % rx_bufs.len()].done.set(true);
+        }
+    }
 
-            idx += 1;
+    /// Makes released receive buffers available to the device again. Buffers
+    /// are made available in order so that packets spanning multiple buffers
+    /// are contiguous in memory.
+    fn rx_refill(&self) {
+        let vq = &self.vqs.borrow()[VIRTIO_RX_QUEUE_IDX as usize];
+        let rx_bufs = self.rx_bufs.borrow();
+        let mut idx = self.rx_post.get();
+        let mut refilled = false;
+        while idx < rx_bufs.len() && rx_bufs[idx].done.get() {
+            rx_bufs[idx].done.set(false);
+            vq.add_buf_idx(idx as u16);
+            idx = (idx + 1) % rx_bufs.len();
+            refilled = true;
+        }
+        self.rx_post.set(idx);
+        if refilled {
+            self.notify(vq);
         }
     }
 
     extern "C" fn interrupt(arg: usize) {
         let dev: *mut VirtioNetDevice = unsafe { mem::transmute(arg) };
-        unsafe { (*dev).recv() };
+        unsafe {
+            if (*dev).bypass.get() {
+                (*dev).forward_interrupt(VIRTIO_RX_QUEUE_IDX);
+            } else {
+                (*dev).stats().rx.interrupts.inc();
+                // Interrupts stay off until the receive tasklet has emptied
+                // the RX queue, which keeps a packet flood from raising an
+                // interrupt per packet.
+                (*dev).vqs.borrow()[VIRTIO_RX_QUEUE_IDX as usize].disable_interrupts();
+                (*dev).rx_tasklet.schedule();
+            }
+        }
+    }
+
+    extern "C" fn tx_interrupt(arg: usize) {
+        let dev: &VirtioNetDevice = unsafe { &*(arg as *const VirtioNetDevice) };
+        if dev.bypass.get() {
+            dev.forward_interrupt(VIRTIO_TX_QUEUE_IDX);
+        } else {
+            dev.stats().tx.interrupts.inc();
+        }
+    }
+
+    /// Receive tasklet. Returns `true` if the RX queue has more packets.
+    extern "C" fn rx_poll(arg: usize) -> bool {
+        let dev: &VirtioNetDevice = unsafe { &*(arg as *const VirtioNetDevice) };
+        // The process owns the queues once it acquires the device in
+        // kernel-bypass mode.
+        if dev.bypass.get() {
+            return false;
+        }
+        if dev.recv(RX_POLL_BUDGET) {
+            return true;
+        }
+        let vqs = dev.vqs.borrow();
+        let vq = &vqs[VIRTIO_RX_QUEUE_IDX as usize];
+        vq.enable_interrupts();
+        // A packet that arrived before interrupts were enabled did not raise
+        // an interrupt, so poll for it again.
+        if vq.has_used() {
+            vq.disable_interrupts();
+            return true;
+        }
+        false
     }
 
-    fn new(pci_dev: Rc<PCIDevice>, notify_cfg_ioport: IOPort, notify_off_multiplier: u32) -> Self {
+    /// Forwards an interrupt of queue `queue_idx` to the process that drives
+    /// the device in kernel-bypass mode.
+    fn forward_interrupt(&self, queue_idx: u16) {
+        let stats = self.queue_stats(queue_idx);
+        stats.interrupts.inc();
+        if !self.notifier.on_event(Event::Interrupt { queue: queue_idx as usize }) {
+            stats.event_overflows.inc();
+        }
+    }
+
+    /// Maps the notification structure, the receive and transmit areas, and
+    /// the rings of the queues to `vmspace` for kernel-bypass mode. Returns
+    /// the address of the notification structure and of every ring. The
+    /// regions are appended to `regions` as they are allocated, so that the
+    /// caller can deallocate them if a later step fails.
+    fn bypass_map(&self, vmspace: &mut VMAddressSpace, regions: &mut Vec<(usize, usize)>, info: &mut VirtioBypassInfo) -> Result<(usize, [usize; VIRTIO_BYPASS_MAX_QUEUES])> {
+        let (notify_phys, notify_len) = self.notify_cfg_phys.ok_or(Error::new(EINVAL))?;
+        let page_size = memory::PAGE_SIZE_SMALL as usize;
+        let notify_base = memory::align_down(notify_phys as u64, page_size as u64) as usize;
+        let notify_size = memory::align_up((notify_phys + notify_len - notify_base) as u64, page_size as u64) as usize;
+        let (notify_start, notify_end) = vmspace.allocate(notify_size, page_size, VMProt::VM_PROT_RW)?;
+        regions.push((notify_start, notify_end));
+        vmspace.map_io(notify_start, notify_end, notify_base)?;
+        let notify_addr = notify_start + (notify_phys - notify_base);
+
+        info.rx_area = self.bypass_map_area(vmspace, regions, &self.rx_area)?;
+        info.tx_area = self.bypass_map_area(vmspace, regions, &self.tx_area)?;
+        let mut ring_addrs = [0usize; VIRTIO_BYPASS_MAX_QUEUES];
+        for (i, vq) in self.vqs.borrow().iter().take(VIRTIO_BYPASS_MAX_QUEUES).enumerate() {
+            ring_addrs[i] = self.bypass_map_area(vmspace, regions, vq.ring_region())?.addr as usize;
+        }
+        Ok((notify_addr, ring_addrs))
+    }
+
+    /// Maps DMA memory area `area` read-write to `vmspace`. The region is
+    /// appended to `regions` as soon as it is allocated.
+    fn bypass_map_area(&self, vmspace: &mut VMAddressSpace, regions: &mut Vec<(usize, usize)>, area: &DmaRegion) -> Result<VirtioBypassArea> {
+        let size = memory::align_up(area.size as u64, memory::PAGE_SIZE_SMALL) as usize;
+        let (start, end) = vmspace.allocate(size, memory::PAGE_SIZE_SMALL as usize, VMProt::VM_PROT_RW)?;
+        regions.push((start, end));
+        vmspace.map(start, end, area.virt)?;
+        Ok(VirtioBypassArea {
+            addr: start as u64,
+            dma_addr: area.phys as u64,
+            size: area.size as u64,
+        })
+    }
+
+    fn new(
+        pci_dev: Rc<PCIDevice>,
+        notify_cfg_ioport: IOPort,
+        notify_wc: bool,
+        notify_cfg_phys: Option<(usize, usize)>,
+        notify_off_multiplier: u32,
+        rx_area: DmaRegion,
+        tx_area: DmaRegion,
+        stats_page: usize,
+    ) -> Self {
         VirtioNetDevice {
             pci_dev,
             notify_cfg_ioport,
+            notify_wc,
+            notify_cfg_phys,
             notify_off_multiplier,
             vqs: RefCell::new(Vec::new()),
             notifier: Rc::new(EventNotifier::new(VIRTIO_DEV_NAME)),
-            /* FIXME: Free allocated pages when driver is unloaded.  */
-            /* FIXME: Check if page allocator returned NULL.  */
-            rx_page: memory::page_alloc_small() as usize,
-            rx_page_size: memory::PAGE_SIZE_SMALL as usize,
-            tx_page: memory::page_alloc_small() as usize,
-            tx_page_size: memory::PAGE_SIZE_SMALL as usize,
+            features: Cell::new(Features::empty()),
+            vhdr_size: Cell::new(mem::size_of::<VirtioNetHdr>() - mem::size_of::<u16>()),
+            rx_area,
+            rx_buf_size: Cell::new(memory::PAGE_SIZE_SMALL as usize),
+            rx_bufs: RefCell::new(Vec::new()),
+            rx_post: Cell::new(0),
+            tx_area,
+            tx_hdr_area: Cell::new(DmaRegion::default()),
+            tx_free_bufs: RefCell::new(Vec::new()),
+            tx_buf_refs: RefCell::new(Vec::new()),
+            tx_hdr_slots: RefCell::new(Vec::new()),
+            tx_inflight: RefCell::new(Vec::new()),
+            stats_page,
+            stats_addr: RefCell::new(None),
             mac_addr: RefCell::new(None),
             rx_buffer_addr: RefCell::new(None),
             io_queue: RefCell::new(None),
+            rx_tasklet: Tasklet::new(),
+            bypass: Cell::new(false),
+            bypass_info: Cell::new(VirtioBypassInfo::default()),
         }
     }
 
     fn process_io_one(&self, cmd: IOCmd) {
         match cmd.opcode {
             Opcode::Submit => {
-                unsafe { rlibc::memset(mem::transmute(self.tx_page), 0, mem::size_of::<VirtioNetHdr>()); }
-                unsafe { rlibc::memcpy(mem::transmute(self.tx_page + mem::size_of::<VirtioNetHdr>()), cmd.addr, cmd.len); }
-                let vq = &self.vqs.borrow()[VIRTIO_TX_QUEUE_IDX as usize];
-                assert!(cmd.len <= self.tx_page_size);
-                unsafe { vq.add_outbuf(mmu::virt_to_phys(self.tx_page as usize) as usize, mem::size_of::<VirtioNetHdr>() + cmd.len); }
-                self.notify(vq);
+                let frame = unsafe { slice::from_raw_parts(cmd.addr, cmd.len) };
+                self.xmit(&NetOffloadHdr::default(), frame);
+            },
+            Opcode::SubmitOffload => {
+                let hdr_size = mem::size_of::<NetOffloadHdr>();
+                if cmd.len < hdr_size {
+                    return;
+                }
+                let hdr = unsafe { ptr::read_unaligned(cmd.addr as *const NetOffloadHdr) };
+                let frame = unsafe { slice::from_raw_parts(cmd.addr.add(hdr_size), cmd.len - hdr_size) };
+                self.xmit(&hdr, frame);
             },
             Opcode::Complete => {
-                let vq = &self.vqs.borrow()[VIRTIO_RX_QUEUE_IDX as usize];
-                vq.add_inbuf(unsafe { mmu::virt_to_phys(self.rx_page as usize) as usize }, self.rx_page_size);
-                self.notify(vq);
+                if let Some(rx_buffer_addr) = *self.rx_buffer_addr.borrow() {
+                    let head = (cmd.addr as usize).wrapping_sub(rx_buffer_addr) / self.rx_buf_size.get();
+                    let nr_bufs = self.rx_bufs.borrow().get(head).map(|buf| buf.nr_bufs.get());
+                    if let Some(nr_bufs) = nr_bufs {
+                        self.rx_release(head, nr_bufs);
+                    }
+                }
+                self.rx_refill();
             }
         }
     }
 
+    /// Transmits `frame` with the offloads requested in `hdr`.
+    ///
+    /// Segmentation that the device does not support is performed in software.
+    fn xmit(&self, hdr: &NetOffloadHdr, frame: &[u8]) {
+        let features = self.features.get();
+        let device_gso = match hdr.gso_type {
+            NET_GSO_NONE => true,
+            NET_GSO_TCPV4 => features.contains(Features::VIRTIO_NET_F_HOST_TSO4),
+            NET_GSO_UDP => features.contains(Features::VIRTIO_NET_F_HOST_UFO),
+            _ => false,
+        };
+        if !device_gso {
+            self.xmit_gso(hdr, frame);
+            return;
+        }
+        let stats = &self.stats().tx;
+        let vhdr_size = self.vhdr_size.get();
+        if vhdr_size + frame.len() > NET_BUF_SIZE_MAX {
+            stats.drops.inc();
+            return;
+        }
+        let buf = self.tx_buf_alloc();
+        let tx_buf = unsafe { slice::from_raw_parts_mut(buf as *mut u8, vhdr_size + frame.len()) };
+        tx_buf[vhdr_size..].copy_from_slice(frame);
+        let mut vhdr = VirtioNetHdr::from_offload_hdr(hdr);
+        if vhdr.flags & NET_OFFLOAD_F_NEEDS_CSUM != 0 && !features.contains(Features::VIRTIO_NET_F_CSUM) {
+            if net::checksum_complete(&mut tx_buf[vhdr_size..], hdr.csum_start as usize, hdr.csum_offset as usize).is_err() {
+                stats.drops.inc();
+                self.tx_buf_put(buf);
+                return;
+            }
+            vhdr.flags &= !NET_OFFLOAD_F_NEEDS_CSUM;
+        }
+        self.write_vhdr(buf, &vhdr);
+        let addr = self.tx_area.phys_addr(buf);
+        self.tx_submit(&[(addr, vhdr_size + frame.len(), 0)], buf, 0);
+        self.tx_buf_put(buf);
+        stats.packets.inc();
+        stats.bytes.add(frame.len() as u64);
+        self.notify(&self.vqs.borrow()[VIRTIO_TX_QUEUE_IDX as usize]);
+    }
+
+    /// Segments `frame` in software and transmits the segments.
+    ///
+    /// The frame is copied to a transmit buffer once. Every segment consists
+    /// of its own headers in a header slot and its payload in the transmit
+    /// buffer.
+    fn xmit_gso(&self, hdr: &NetOffloadHdr, frame: &[u8]) {
+        let stats = &self.stats().tx;
+        if frame.len() > NET_BUF_SIZE_MAX {
+            stats.drops.inc();
+            return;
+        }
+        let buf = self.tx_buf_alloc();
+        let data = unsafe { slice::from_raw_parts_mut(buf as *mut u8, frame.len()) };
+        data.copy_from_slice(frame);
+        let vhdr_size = self.vhdr_size.get();
+        let buf_addr = self.tx_area.phys_addr(buf);
+        match GsoSegmenter::new(hdr, data) {
+            Ok(ref mut segmenter) if vhdr_size + segmenter.hdr_len() <= TX_HDR_SLOT_SIZE => {
+                let hdr_len = segmenter.hdr_len();
+                loop {
+                    let slot = self.tx_hdr_slot_alloc();
+                    let seg_hdr = unsafe { slice::from_raw_parts_mut((slot + vhdr_size) as *mut u8, hdr_len) };
+                    let (off, len) = match segmenter.next_segment(seg_hdr) {
+                        Some(seg) => seg,
+                        None => {
+                            self.tx_hdr_slots.borrow_mut().push(slot);
+                            break;
+                        }
+                    };
+                    self.write_vhdr(slot, &VirtioNetHdr::default());
+                    let slot_addr = self.tx_hdr_area.get().phys_addr(slot);
+                    let sg = [(slot_addr, vhdr_size + hdr_len, 0), (buf_addr + off, len, 0)];
+                    let nr_sg = if len > 0 { 2 } else { 1 };
+                    self.tx_submit(&sg[..nr_sg], buf, slot);
+                    stats.packets.inc();
+                    stats.bytes.add((hdr_len + len) as u64);
+                }
+            }
+            _ => stats.drops.inc(),
+        }
+        self.tx_buf_put(buf);
+        self.notify(&self.vqs.borrow()[VIRTIO_TX_QUEUE_IDX as usize]);
+    }
+
+    /// Writes the virtio-net header `vhdr` to the start of buffer `buf`.
+    fn write_vhdr(&self, buf: usize, vhdr: &VirtioNetHdr) {
+        unsafe { ptr::copy_nonoverlapping(vhdr as *const VirtioNetHdr as *const u8, buf as *mut u8, self.vhdr_size.get()) };
+    }
+
+    /// Allocates a transmit buffer with a reference count of one. If all
+    /// buffers are in flight, waits for the device to complete one.
+    fn tx_buf_alloc(&self) -> usize {
+        let buf = self.tx_retry(|| self.tx_free_bufs.borrow_mut().pop());
+        self.tx_buf_refs.borrow_mut()[(buf - self.tx_area.virt) / NET_BUF_SIZE_MAX] = 1;
+        buf
+    }
+
+    /// Drops a reference to transmit buffer `buf`, and returns the buffer to
+    /// the free list when the last reference is dropped.
+    fn tx_buf_put(&self, buf: usize) {
+        let mut refs = self.tx_buf_refs.borrow_mut();
+        let idx = (buf - self.tx_area.virt) / NET_BUF_SIZE_MAX;
+        refs[idx] -= 1;
+        if refs[idx] == 0 {
+            self.tx_free_bufs.borrow_mut().push(buf);
+        }
+    }
+
+    /// Allocates a header slot. If all slots are in flight, waits for the
+    /// device to complete one.
+    fn tx_hdr_slot_alloc(&self) -> usize {
+        self.tx_retry(|| self.tx_hdr_slots.borrow_mut().pop())
+    }
+
+    /// Makes the scatter-gather list `sg` available to the device. The
+    /// descriptor chain takes a reference to transmit buffer `buf` and owns
+    /// header slot `hdr_slot`, if non-zero, until the device completes it.
+    fn tx_submit(&self, sg: &[(usize, usize, u16)], buf: usize, hdr_slot: usize) {
+        let idx = self.tx_retry(|| self.vqs.borrow()[VIRTIO_TX_QUEUE_IDX as usize].add_sg(sg)) as usize;
+        self.tx_buf_refs.borrow_mut()[(buf - self.tx_area.virt) / NET_BUF_SIZE_MAX] += 1;
+        self.tx_inflight.borrow_mut()[idx] = TxInflight { buf, hdr_slot };
+    }
+
+    /// Retries `alloc` until it succeeds. While transmit resources are
+    /// exhausted, waits for the device to complete transmit descriptors.
+    fn tx_retry<T, F: FnMut() -> Option<T>>(&self, mut alloc: F) -> T {
+        if let Some(val) = alloc() {
+            return val;
+        }
+        self.stats().tx.ring_full.inc();
+        // Descriptors that are not yet notified to the device would never complete.
+        self.notify(&self.vqs.borrow()[VIRTIO_TX_QUEUE_IDX as usize]);
+        loop {
+            if !self.tx_reclaim() {
+                core::hint::spin_loop();
+            }
+            if let Some(val) = alloc() {
+                return val;
+            }
+        }
+    }
+
+    /// Releases the transmit buffers and header slots of descriptor chains
+    /// that the device has completed. Returns `true` if any descriptor chains
+    /// were completed.
+    fn tx_reclaim(&self) -> bool {
+        let vq = &self.vqs.borrow()[VIRTIO_TX_QUEUE_IDX as usize];
+        let mut reclaimed = false;
+        while let Some((desc_idx, _)) = vq.pop_used() {
+            vq.free_desc(desc_idx);
+            let inflight = self.tx_inflight.borrow()[desc_idx as usize];
+            if inflight.hdr_slot != 0 {
+                self.tx_hdr_slots.borrow_mut().push(inflight.hdr_slot);
+            }
+            self.tx_buf_put(inflight.buf);
+            reclaimed = true;
+        }
+        reclaimed
+    }
+
+    fn stats(&self) -> &NetDeviceStats {
+        unsafe { &*(self.stats_page as *const NetDeviceStats) }
+    }
+
+    fn queue_stats(&self, queue_idx: u16) -> &NetQueueStats {
+        if queue_idx == VIRTIO_RX_QUEUE_IDX {
+            &self.stats().rx
+        } else {
+            &self.stats().tx
+        }
+    }
+
     fn notify(&self, queue: &Virtqueue) {
+        self.queue_stats(queue.queue_idx).doorbells.inc();
         let notify_off = (self.notify_off_multiplier * queue.notify_off as u32) as usize;
         self.notify_cfg_ioport.write16(queue.queue_idx, notify_off);
+        if self.notify_wc {
+            // Drain the write-combining buffer so that the device sees the
+            // notification without delay.
+            unsafe { _mm_sfence() };
+        }
     }
 }
 
 impl DeviceOps for VirtioNetDevice {
     fn acquire(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>) -> Result<()> {
+        if self.bypass.get() {
+            return Err(Error::new(EBUSY));
+        }
         self.notifier.add_listener(listener);
 
-        let (rx_buf_start, rx_buf_end) = vmspace.allocate(self.rx_page_size, memory::PAGE_SIZE_SMALL as usize, VMProt::VM_PROT_READ)?;
-        vmspace.map(rx_buf_start, rx_buf_end, self.rx_page)?;
+        let rx_area_size = memory::PAGE_SIZE_LARGE as usize;
+        let (rx_buf_start, rx_buf_end) = vmspace.allocate(rx_area_size, rx_area_size, VMProt::VM_PROT_READ)?;
+        vmspace.map(rx_buf_start, rx_buf_end, self.rx_area.virt)?;
         self.rx_buffer_addr.replace(Some(rx_buf_start));
 
+        let stats_size = memory::PAGE_SIZE_SMALL as usize;
+        let (stats_start, stats_end) = vmspace.allocate(stats_size, stats_size, VMProt::VM_PROT_READ)?;
+        vmspace.map(stats_start, stats_end, self.stats_page)?;
+        self.stats_addr.replace(Some(stats_start));
+
         let io_buf_size = 4096;
         let (io_buf_start, io_buf_end) = vmspace.allocate(io_buf_size, memory::PAGE_SIZE_SMALL as usize, VMProt::VM_PROT_RW)?;
         vmspace.populate(io_buf_start, io_buf_end)?;
@@ -374,6 +1024,61 @@ impl DeviceOps for VirtioNetDevice {
         Ok(())
     }
 
+    fn acquire_bypass(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>) -> Result<()> {
+        // The queues have a single owner, so the device cannot be shared with
+        // processes that use the I/O queue.
+        if self.bypass.get() || self.io_queue.borrow().is_some() {
+            return Err(Error::new(EBUSY));
+        }
+        let mut info = VirtioBypassInfo::default();
+        let mut regions = Vec::new();
+        let (notify_addr, ring_addrs) = match self.bypass_map(vmspace, &mut regions, &mut info) {
+            Ok(addrs) => addrs,
+            Err(e) => {
+                // Unmap what was mapped before the failure.
+                for (start, end) in regions {
+                    let _ = vmspace.deallocate(start, end);
+                }
+                return Err(e);
+            }
+        };
+        let vqs = self.vqs.borrow();
+
+        // Make released receive buffers available to the device before the
+        // queues are handed over. Once the bypass flag is set, the interrupt
+        // handler no longer touches the queues.
+        self.rx_refill();
+        self.bypass.set(true);
+        // The receive tasklet may have left RX queue interrupts off, and TX
+        // queue interrupts are off outside of kernel-bypass mode, but the
+        // process relies on them.
+        for vq in vqs.iter() {
+            vq.enable_interrupts();
+        }
+
+        info.features = self.features.get().bits() as u64;
+        info.vhdr_size = self.vhdr_size.get() as u64;
+        info.rx_buf_size = self.rx_buf_size.get() as u64;
+        info.nr_rx_bufs = self.rx_bufs.borrow().len() as u64;
+        info.nr_queues = cmp::min(vqs.len(), VIRTIO_BYPASS_MAX_QUEUES) as u64;
+        for (i, vq) in vqs.iter().take(VIRTIO_BYPASS_MAX_QUEUES).enumerate() {
+            let ring_virt = vq.ring_region().virt;
+            info.queues[i] = VirtioBypassQueue {
+                desc: (ring_addrs[i] + (vq.raw_descriptor_table_ptr - ring_virt)) as u64,
+                avail: (ring_addrs[i] + (vq.raw_available_ring_ptr - ring_virt)) as u64,
+                used: (ring_addrs[i] + (vq.raw_used_ring_ptr - ring_virt)) as u64,
+                notify: (notify_addr + (self.notify_off_multiplier * vq.notify_off as u32) as usize) as u64,
+                size: vq.queue_size as u16,
+                queue_idx: vq.queue_idx,
+                last_used_idx: vq.last_seen_used(),
+                reserved: 0,
+            };
+        }
+        self.bypass_info.set(info);
+        self.notifier.add_listener(listener);
+        Ok(())
+    }
+
     fn subscribe(&self, _events: &'static str) {
         // TODO: A process receives packets from all flows. Implement flow filtering.
     }
@@ -387,17 +1092,43 @@ impl DeviceOps for VirtioNetDevice {
                 }
                 None
             },
+            CONFIG_STATS => { self.stats_addr.borrow().map(|addr| addr.to_ne_bytes().to_vec()) },
+            CONFIG_VIRTIO_BYPASS_INFO => {
+                if !self.bypass.get() {
+                    return None;
+                }
+                let info = self.bypass_info.get();
+                let raw = unsafe { slice::from_raw_parts(&info as *const VirtioBypassInfo as *const u8, mem::size_of::<VirtioBypassInfo>()) };
+                Some(raw.to_vec())
+            },
+            CONFIG_IRQ_STATS => Some(irq_stats(&self.pci_dev)),
             _ => { None }
         }
     }
 
+    fn set_config(&self, opt: ConfigOption, value: &[u8]) -> Result<()> {
+        match opt {
+            CONFIG_IRQ_AFFINITY => set_irq_affinity(&self.pci_dev, value),
+            _ => Err(Error::new(EINVAL)),
+        }
+    }
+
     fn process_io(&self) {
+        // In kernel-bypass mode, the process owns the queues.
+        if self.bypass.get() {
+            return;
+        }
+        self.rx_refill();
         if let Some(io_queue) = self.io_queue.borrow_mut().as_mut() {
             while let Some(cmd) = io_queue.pop() {
                 self.process_io_one(cmd);
             }
         }
     }
+
+    fn io_pending(&self) -> bool {
+        self.io_queue.borrow().as_ref().map_or(false, |io_queue| !io_queue.is_empty())
+    }
 }
 
 pub static mut VIRTIO_NET_DRIVER: PCIDriver =
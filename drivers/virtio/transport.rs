@@ -0,0 +1,139 @@
+//! Virtio over PCI bus transport.
+
+use alloc::vec::Vec;
+use core::mem;
+use kernel::errno::{Error, Result, EINVAL};
+use kernel::ioport::IOPort;
+use pci::{PCIDevice, PCI_CAPABILITY_VENDOR};
+
+/* 4.1.4.3 Common configuration structure layout */
+pub const DEVICE_FEATURE_SELECT: usize = 0x00;
+pub const DEVICE_FEATURE: usize = 0x04;
+pub const DRIVER_FEATURE_SELECT: usize = 0x08;
+pub const DRIVER_FEATURE: usize = 0x0c;
+pub const MSIX_CONFIG: usize = 0x10;
+pub const NUM_QUEUES: usize = 0x12;
+pub const DEVICE_STATUS: usize = 0x14;
+pub const CONFIG_GENERATION: usize = 0x15;
+pub const QUEUE_SELECT: usize = 0x16;
+pub const QUEUE_SIZE: usize = 0x18;
+pub const QUEUE_MSIX_VECTOR: usize = 0x1a;
+pub const QUEUE_ENABLE: usize = 0x1c;
+pub const QUEUE_NOTIFY_OFF: usize = 0x1e;
+pub const QUEUE_DESC: usize = 0x20;
+pub const QUEUE_AVAIL: usize = 0x28;
+pub const QUEUE_USED: usize = 0x30;
+
+/* 2.1 Device Status Field */
+pub const VIRTIO_ACKNOWLEDGE: u8 = 1;
+pub const VIRTIO_DRIVER: u8 = 2;
+pub const VIRTIO_FAILED: u8 = 128;
+pub const VIRTIO_FEATURES_OK: u8 = 8;
+pub const VIRTIO_DRIVER_OK: u8 = 4;
+pub const DEVICE_NEEDS_RESET: u8 = 64;
+
+/* 4.1.4 Virtio Structure PCI Capabilities */
+pub const VIRTIO_PCI_CAP_COMMON_CFG: u8 = 1;
+pub const VIRTIO_PCI_CAP_NOTIFY_CFG: u8 = 2;
+pub const VIRTIO_PCI_CAP_ISR_CFG: u8 = 3;
+pub const VIRTIO_PCI_CAP_DEVICE_CFG: u8 = 4;
+pub const VIRTIO_PCI_CAP_PCI_CFG: u8 = 5;
+
+pub const VIRTIO_PCI_CAP_CFG_TYPE: u8 = 3;
+pub const VIRTIO_PCI_CAP_BAR: u8 = 4;
+pub const VIRTIO_PCI_CAP_OFFSET: u8 = 8;
+pub const VIRTIO_PCI_CAP_LENGTH: u8 = 12;
+
+/* 4.1.4.4 Notification structure layout */
+pub const VIRTIO_NOTIFY_OFF_MULTIPLIER: u8 = 16;
+
+/// Virtio PCI capability structure.
+pub struct VirtioPCICap {
+    pub offset: u8,
+    pub bar_idx: u8,
+}
+
+impl VirtioPCICap {
+    pub fn new(offset: u8, bar_idx: u8) -> Self {
+      Self {
+          offset,
+          bar_idx,
+      }
+    }
+
+    pub fn map(&self, pci_dev: &PCIDevice) -> Option<IOPort> {
+        let offset = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_OFFSET);
+        let length = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_LENGTH);
+        pci_dev.bars[self.bar_idx as usize].map(|bar| { bar.remap(offset as usize, length) }).flatten()
+    }
+
+    /// Switches the mapping of the structure that this capability refers to
+    /// to write-combining. Returns `None` if the BAR does not permit it.
+    pub fn map_wc(&self, pci_dev: &PCIDevice) -> Option<IOPort> {
+        let offset = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_OFFSET);
+        let length = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_LENGTH);
+        pci_dev.remap_bar_wc(self.bar_idx as usize, offset as usize, length)
+    }
+
+    /// Returns the physical address and the length of the structure that
+    /// this capability refers to. The BAR must be a memory BAR.
+    pub fn phys_range(&self, pci_dev: &PCIDevice) -> Option<(usize, usize)> {
+        let offset = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_OFFSET);
+        let length = pci_dev.func.read_config_u32(self.offset + VIRTIO_PCI_CAP_LENGTH);
+        let base = pci_dev.bar_phys_addr(self.bar_idx as usize)?;
+        Some((base as usize + offset as usize, length as usize))
+    }
+}
+
+/// Sets the interrupt affinity of a virtqueue from the `struct irq_affinity`
+/// value of the CONFIG_IRQ_AFFINITY option. The MSI-X table entry of a
+/// virtqueue is the virtqueue index.
+pub fn set_irq_affinity(pci_dev: &PCIDevice, value: &[u8]) -> Result<()> {
+    if value.len() != 2 * mem::size_of::<u32>() {
+        return Err(Error::new(EINVAL));
+    }
+    let mut raw = [0u8; 4];
+    raw.copy_from_slice(&value[0..4]);
+    let queue = u32::from_ne_bytes(raw);
+    raw.copy_from_slice(&value[4..8]);
+    let cpu_id = u32::from_ne_bytes(raw);
+    if queue > u16::max_value() as u32 {
+        return Err(Error::new(EINVAL));
+    }
+    let vector = pci_dev.set_irq_affinity(queue as u16, cpu_id);
+    if vector < 0 {
+        return Err(Error::new(-vector));
+    }
+    Ok(())
+}
+
+/// Returns the value of the CONFIG_IRQ_STATS option, which is a `struct
+/// irq_queue_stats` for every virtqueue that has an interrupt.
+pub fn irq_stats(pci_dev: &PCIDevice) -> Vec<u8> {
+    let mut value = Vec::new();
+    for irq in pci_dev.irq_stats() {
+        value.extend_from_slice(&(irq.entry as u32).to_ne_bytes());
+        value.extend_from_slice(&irq.cpu_id.to_ne_bytes());
+        value.extend_from_slice(&(irq.vector as u32).to_ne_bytes());
+        value.extend_from_slice(&0u32.to_ne_bytes());
+        value.extend_from_slice(&irq.stats.count.to_ne_bytes());
+        for count in irq.stats.cycles_hist.iter() {
+            value.extend_from_slice(&count.to_ne_bytes());
+        }
+    }
+    value
+}
+
+/// Returns the virtio PCI capability of type `cfg_type`.
+pub fn find_capability(pci_dev: &PCIDevice, cfg_type: u8) -> Option<VirtioPCICap> {
+    let mut capability = pci_dev.func.find_capability(PCI_CAPABILITY_VENDOR);
+    while let Some(offset) = capability {
+        let ty = pci_dev.func.read_config_u8(offset + VIRTIO_PCI_CAP_CFG_TYPE);
+        let bar_idx = pci_dev.func.read_config_u8(offset + VIRTIO_PCI_CAP_BAR);
+        if ty == cfg_type && bar_idx < 0x05 {
+            return Some(VirtioPCICap::new(offset, bar_idx))
+        }
+        capability = pci_dev.func.find_next_capability(PCI_CAPABILITY_VENDOR, offset);
+    }
+    None
+}
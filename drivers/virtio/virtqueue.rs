@@ -3,8 +3,10 @@
 use alloc::boxed::Box;
 use core::cell::Cell;
 use core::mem;
+use core::ptr;
+use core::sync::atomic::{self, Ordering};
 use intrusive_collections::LinkedListLink;
-use kernel::memory;
+use kernel::memory::{self, DmaRegion};
 
 // =============================================================================
 // Virtqueue memory layout
@@ -29,6 +31,11 @@ pub const VIRTQ_DESC_F_NEXT: u16 = 1;
 pub const VIRTQ_DESC_F_WRITE: u16 = 2;
 pub const VIRTQ_DESC_F_INDIRECT: u16 = 4;
 
+/// Maximum number of descriptors in an indirect descriptor table.
+pub const VIRTQ_INDIRECT_MAX: usize = 16;
+
+const VIRTQ_INDIRECT_TABLE_SIZE: usize = VIRTQ_INDIRECT_MAX * mem::size_of::<VirtqDesc>();
+
 /// Virtqueue available ring.
 #[repr(C)]
 #[derive(Debug)]
@@ -63,7 +70,11 @@ pub const VIRTQ_USED_F_NO_NOTIFY: u16 = 0x01;
 // =============================================================================
 
 /// Virtqueue.
+///
+/// The metadata is aligned to a cache line, so that the RX and TX queues of a
+/// device, which are used from different contexts, do not share cache lines.
 #[derive(Debug)]
+#[repr(align(64))]
 pub struct Virtqueue {
     /// Queue index.
     pub queue_idx: u16,
@@ -73,12 +84,22 @@ pub struct Virtqueue {
     pub notify_off: u16,
     /// Last seen index in the used ring.
     pub last_seen_used: Cell<u16>,
+    /// Head of the free descriptor list.
+    pub free_head: Cell<u16>,
+    /// Number of descriptors in the free descriptor list.
+    pub num_free: Cell<u16>,
     /// Raw pointer to the descriptor table.
     pub raw_descriptor_table_ptr: usize,
     /// Raw pointer to the available ring.
     pub raw_available_ring_ptr: usize,
     /// Raw pointer to the used ring.
     pub raw_used_ring_ptr: usize,
+    /// DMA memory of the descriptor table and the rings.
+    ring_region: DmaRegion,
+    /// DMA memory of the indirect descriptor tables, one table for every
+    /// descriptor in the descriptor table. Empty if indirect descriptors are
+    /// not enabled.
+    indirect_region: DmaRegion,
     /// A linked list link.
     pub link: LinkedListLink,
 }
@@ -92,84 +113,280 @@ impl Drop for Virtqueue {
 }
 
 impl Virtqueue {
-    pub fn new(queue_idx: u16, queue_size: usize, notify_off: u16) -> Self {
-        // FIXME: Ensure that virtqueue components are aligned.
-        unsafe {
-            let raw_descriptor_table_ptr = memory::kmem_zalloc(queue_size * 16);
-            if raw_descriptor_table_ptr == 0 {
-                panic!("out of memory");
-            }
-            let raw_available_ring_ptr = memory::kmem_zalloc(queue_size * 2 + 6);
-            if raw_available_ring_ptr == 0 {
-                panic!("out of memory");
-            }
-            let raw_used_ring_ptr = memory::kmem_zalloc(queue_size * 4 + 6);
-            if raw_used_ring_ptr == 0 {
-                panic!("out of memory");
-            }
-            Virtqueue {
-                queue_idx,
-                queue_size,
-                notify_off,
-                last_seen_used: Cell::new(0),
-                raw_descriptor_table_ptr,
-                raw_available_ring_ptr,
-                raw_used_ring_ptr,
-                link: LinkedListLink::new(),
-            }
+    /// Constructs a virtqueue of `queue_size` elements. Returns `None` if out
+    /// of memory.
+    pub fn new(queue_idx: u16, queue_size: usize, notify_off: u16) -> Option<Self> {
+        // The descriptor table, the available ring and the used ring are in
+        // one DMA region. The used ring, which the device writes to, starts
+        // on its own cache line.
+        let avail_off = queue_size * mem::size_of::<VirtqDesc>();
+        let used_off = memory::align_up((avail_off + queue_size * 2 + 6) as u64, memory::DMA_ALIGN_MIN as u64) as usize;
+        // The region is a whole number of pages so that it can be mapped to a
+        // process without exposing other DMA memory.
+        let ring_size = used_off + queue_size * mem::size_of::<VirtqUsedElem>() + 6;
+        let ring_size = memory::align_up(ring_size as u64, memory::PAGE_SIZE_SMALL) as usize;
+        let ring_region = DmaRegion::alloc(ring_size, memory::PAGE_SIZE_SMALL as usize, 0).ok()?;
+        let vq = Virtqueue {
+            queue_idx,
+            queue_size,
+            notify_off,
+            last_seen_used: Cell::new(0),
+            free_head: Cell::new(0),
+            num_free: Cell::new(queue_size as u16),
+            raw_descriptor_table_ptr: ring_region.virt,
+            raw_available_ring_ptr: ring_region.virt + avail_off,
+            raw_used_ring_ptr: ring_region.virt + used_off,
+            ring_region,
+            indirect_region: DmaRegion::default(),
+            link: LinkedListLink::new(),
+        };
+        let descs = vq.descriptor_table();
+        for idx in 0..queue_size {
+            unsafe { (*descs)[idx].next = (idx + 1) as u16 };
         }
+        Some(vq)
     }
 
     pub fn free(&mut self) {
         unsafe {
-            // FIXME: Fix duplication of component size calculation with new()
-            memory::kmem_free(self.raw_descriptor_table_ptr, self.queue_size * 16);
-            memory::kmem_free(self.raw_available_ring_ptr, self.queue_size * 2 + 6);
-            memory::kmem_free(self.raw_used_ring_ptr, self.queue_size * 4 + 6);
+            self.ring_region.free();
+            self.indirect_region.free();
+        }
+        self.ring_region = DmaRegion::default();
+        self.indirect_region = DmaRegion::default();
+    }
+
+    /// Returns the DMA memory of the descriptor table and the rings.
+    pub fn ring_region(&self) -> &DmaRegion {
+        &self.ring_region
+    }
+
+    /// Returns the physical address of the descriptor table.
+    pub fn descriptor_table_phys(&self) -> usize {
+        self.ring_region.phys_addr(self.raw_descriptor_table_ptr)
+    }
+
+    /// Returns the physical address of the available ring.
+    pub fn available_ring_phys(&self) -> usize {
+        self.ring_region.phys_addr(self.raw_available_ring_ptr)
+    }
+
+    /// Returns the physical address of the used ring.
+    pub fn used_ring_phys(&self) -> usize {
+        self.ring_region.phys_addr(self.raw_used_ring_ptr)
+    }
+
+    /// Enables indirect descriptors by allocating an indirect descriptor
+    /// table for every descriptor. The VIRTIO_F_INDIRECT_DESC feature must be
+    /// negotiated with the device. Returns `false` if out of memory.
+    pub fn enable_indirect(&mut self) -> bool {
+        match DmaRegion::alloc(self.queue_size * VIRTQ_INDIRECT_TABLE_SIZE, VIRTQ_INDIRECT_TABLE_SIZE, 0) {
+            Ok(region) => {
+                self.indirect_region = region;
+                true
+            }
+            Err(_) => false,
         }
     }
 
+    fn indirect_enabled(&self) -> bool {
+        self.indirect_region.virt != 0
+    }
+
+    /// Returns the indirect descriptor table of descriptor `idx`.
+    fn indirect_table(&self, idx: u16) -> *mut [VirtqDesc] {
+        let addr = self.indirect_region.virt + idx as usize * VIRTQ_INDIRECT_TABLE_SIZE;
+        unsafe { mem::transmute((addr, VIRTQ_INDIRECT_MAX)) }
+    }
+
     pub fn last_seen_used(&self) -> u16 {
         self.last_seen_used.get()
     }
 
     pub fn advance_last_seen_used(&self) {
-        self.last_seen_used.replace(self.last_seen_used.get() + 1);
+        self.last_seen_used.replace(self.last_seen_used.get().wrapping_add(1));
+    }
+
+    /// Returns the index of the next available ring entry.
+    pub fn avail_idx(&self) -> u16 {
+        unsafe { ptr::read_volatile(&(*self.available_ring()).idx) }
     }
 
     pub fn last_used_idx(&self) -> u16 {
         /* FIXME: The used ring is in little endian byte order.  */
-        unsafe { (*self.used_ring()).idx }
+        unsafe { ptr::read_volatile(&(*self.used_ring()).idx) }
+    }
+
+    /// Returns `true` if the device has used buffers that are not popped yet.
+    pub fn has_used(&self) -> bool {
+        self.last_seen_used() != self.last_used_idx()
+    }
+
+    /// Asks the device not to interrupt when it uses buffers. The device may
+    /// still interrupt, because the flag is only a hint.
+    pub fn disable_interrupts(&self) {
+        unsafe { ptr::write_volatile(&mut (*self.available_ring()).flags, VIRTQ_AVAIL_F_NO_INTERRUPT) };
+    }
+
+    /// Asks the device to interrupt when it uses buffers. Buffers that are used
+    /// before the device sees the flag do not raise an interrupt, so callers
+    /// check `has_used()` afterwards.
+    pub fn enable_interrupts(&self) {
+        unsafe { ptr::write_volatile(&mut (*self.available_ring()).flags, 0) };
+        atomic::fence(Ordering::SeqCst);
     }
 
     /// Add a device-writable buffer to virtqueue that is consumed by us.
-    pub fn add_inbuf(&self, addr: usize, len: usize) {
+    pub fn add_inbuf(&self, addr: usize, len: usize) -> Option<u16> {
         self.add_buf(addr, len, VIRTQ_DESC_F_WRITE)
     }
 
     /// Add a device-readable buffer to virtqueue that is produced by us.
-    pub fn add_outbuf(&self, addr: usize, len: usize) {
+    pub fn add_outbuf(&self, addr: usize, len: usize) -> Option<u16> {
         self.add_buf(addr, len, 0)
     }
 
-    pub fn add_buf(&self, addr: usize, len: usize, flags: u16) {
+    /// Add a buffer to the virtqueue. Returns the index of the descriptor
+    /// that describes the buffer, or `None` if the descriptor table is full.
+    pub fn add_buf(&self, addr: usize, len: usize, flags: u16) -> Option<u16> {
+        let idx = self.alloc_desc()?;
+        unsafe {
+            (*self.descriptor_table())[idx as usize] = VirtqDesc {
+                addr: addr as u64,
+                len: len as u32,
+                flags,
+                next: 0,
+            };
+        }
+        self.add_buf_idx(idx);
+        Some(idx)
+    }
+
+    /// Add a scatter-gather list of `(addr, len, flags)` buffers to the
+    /// virtqueue. If indirect descriptors are enabled, the list occupies a
+    /// single descriptor. Returns the index of the descriptor chain head, or
+    /// `None` if there are not enough free descriptors.
+    pub fn add_sg(&self, bufs: &[(usize, usize, u16)]) -> Option<u16> {
+        let idx = self.alloc_sg(bufs)?;
+        self.add_buf_idx(idx);
+        Some(idx)
+    }
+
+    /// Sets up the descriptors of a scatter-gather list like `add_sg`, but
+    /// does not make them available to the device. The caller does that with
+    /// `add_buf_idx` once it is ready for the device to complete the chain.
+    pub fn alloc_sg(&self, bufs: &[(usize, usize, u16)]) -> Option<u16> {
+        let n = bufs.len();
+        if n == 0 {
+            return None;
+        }
+        if n == 1 {
+            let idx = self.alloc_desc()?;
+            self.set_desc(idx, bufs[0].0, bufs[0].1, bufs[0].2);
+            return Some(idx);
+        }
+        if self.indirect_enabled() && n <= VIRTQ_INDIRECT_MAX {
+            let idx = self.alloc_desc()?;
+            let table = self.indirect_table(idx);
+            for (i, &(addr, len, flags)) in bufs.iter().enumerate() {
+                let next = if i + 1 < n { VIRTQ_DESC_F_NEXT } else { 0 };
+                unsafe {
+                    (*table)[i] = VirtqDesc {
+                        addr: addr as u64,
+                        len: len as u32,
+                        flags: flags | next,
+                        next: (i + 1) as u16,
+                    };
+                }
+            }
+            let table_addr = self.indirect_region.phys_addr(table as *mut VirtqDesc as usize);
+            self.set_desc(idx, table_addr, n * mem::size_of::<VirtqDesc>(), VIRTQ_DESC_F_INDIRECT);
+            return Some(idx);
+        }
+        if (self.num_free.get() as usize) < n {
+            return None;
+        }
+        // The free descriptor list is already chained through the `next`
+        // fields, so the descriptors at its head form the chain.
+        let descs = self.descriptor_table();
+        let head = self.free_head.get();
+        let mut idx = head;
+        for (i, &(addr, len, flags)) in bufs.iter().enumerate() {
+            let next = if i + 1 < n { VIRTQ_DESC_F_NEXT } else { 0 };
+            unsafe {
+                let desc = &mut (*descs)[idx as usize];
+                desc.addr = addr as u64;
+                desc.len = len as u32;
+                desc.flags = flags | next;
+                idx = desc.next;
+            }
+        }
+        self.free_head.set(idx);
+        self.num_free.set(self.num_free.get() - n as u16);
+        Some(head)
+    }
+
+    /// Sets up descriptor `idx` for a driver that manages descriptors itself.
+    /// The descriptor must not be allocated from the free descriptor list.
+    pub fn set_desc(&self, idx: u16, addr: usize, len: usize, flags: u16) {
         unsafe {
-            /* FIXME: We only support one virtqueue descriptor.  */
-            let idx = 0 as u16;
             (*self.descriptor_table())[idx as usize] = VirtqDesc {
                 addr: addr as u64,
                 len: len as u32,
                 flags,
                 next: 0,
             };
-            self.add_buf_idx(idx);
         }
     }
 
     pub fn add_buf_idx(&self, idx: u16) {
         let avail = self.available_ring();
         unsafe { (*avail).ring[((*avail).idx % self.queue_size as u16) as usize] = idx; }
-        unsafe { (*avail).idx += 1; }
+        // Make the ring entry visible to the device before the index update.
+        atomic::fence(Ordering::Release);
+        unsafe { ptr::write_volatile(&mut (*avail).idx, (*avail).idx.wrapping_add(1)); }
+    }
+
+    /// Allocates a descriptor from the free descriptor list.
+    fn alloc_desc(&self) -> Option<u16> {
+        if self.num_free.get() == 0 {
+            return None;
+        }
+        let idx = self.free_head.get();
+        self.free_head.set(unsafe { (*self.descriptor_table())[idx as usize].next });
+        self.num_free.set(self.num_free.get() - 1);
+        Some(idx)
+    }
+
+    /// Returns the descriptor chain that starts at `idx` to the free descriptor list.
+    pub fn free_desc(&self, idx: u16) {
+        let descs = self.descriptor_table();
+        let mut last = idx;
+        let mut count = 1;
+        unsafe {
+            while (*descs)[last as usize].flags & VIRTQ_DESC_F_NEXT != 0 {
+                last = (*descs)[last as usize].next;
+                count += 1;
+            }
+            (*descs)[last as usize].next = self.free_head.get();
+        }
+        self.free_head.set(idx);
+        self.num_free.set(self.num_free.get() + count);
+    }
+
+    /// Removes the next buffer that the device has used from the used ring.
+    /// Returns the index of the descriptor chain head and the number of bytes
+    /// written to the buffer, or `None` if there are no used buffers.
+    pub fn pop_used(&self) -> Option<(u16, usize)> {
+        let idx = self.last_seen_used();
+        if idx == self.last_used_idx() {
+            return None;
+        }
+        atomic::fence(Ordering::Acquire);
+        let used = unsafe { &(*self.used_ring()).ring[(idx % self.queue_size as u16) as usize] };
+        let ret = (used.id as u16, used.len as usize);
+        self.advance_last_seen_used();
+        Some(ret)
     }
 
     pub fn get_used_buf(&self, idx: u16) -> (usize, usize) {
@@ -1,7 +1,31 @@
 #ifndef KERNEL_CPU_H
 #define KERNEL_CPU_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Maximum number of CPUs.
+#define MAX_CPUS 64
+
 /// Halt the current CPU, and wait for an interrupt to wake it up.
 void arch_halt_cpu(void);
 
+/// Return the value of the monotonic CPU cycle counter.
+uint64_t arch_cycle_counter(void);
+
+/// Register a CPU with interrupt controller ID \cpu_id that was found in the platform configuration.
+void arch_register_cpu(uint32_t cpu_id);
+
+/// Return the number of CPUs.
+unsigned int arch_nr_cpus(void);
+
+/// Return the interrupt controller ID of the current CPU.
+uint32_t arch_cpu_id(void);
+
+/// Return true if the CPU with interrupt controller ID \cpu_id is running and can take interrupts.
+bool arch_cpu_online(uint32_t cpu_id);
+
+/// Return the index of the CPU with interrupt controller ID \cpu_id, or a negative error code if there is no such CPU.
+int arch_cpu_index(uint32_t cpu_id);
+
 #endif
@@ -0,0 +1,28 @@
+#ifndef KERNEL_DMA_H
+#define KERNEL_DMA_H
+
+#include <arch/vmem.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Minimum alignment and size granularity of DMA memory.
+#define DMA_ALIGN_MIN 64
+
+/// Back the DMA memory region with dedicated large pages.
+#define DMA_ALLOC_LARGE_PAGE (1U << 0)
+
+/// A physically contiguous memory region that is shared with devices.
+struct dma_region {
+	virt_t virt;
+	phys_t phys;
+	size_t size;
+	uint32_t flags;
+	uint32_t node;
+};
+
+int dma_alloc(struct dma_region *region, size_t size, size_t align, uint32_t flags);
+int dma_alloc_node(struct dma_region *region, size_t size, size_t align, uint32_t flags, int node);
+void dma_free(const struct dma_region *region);
+
+#endif
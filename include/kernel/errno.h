@@ -3,6 +3,7 @@
 
 #define ENOMEM 12
 #define EFAULT 14
+#define EBUSY 16
 #define EINVAL 22
 #define ENOSYS 38
 
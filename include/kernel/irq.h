@@ -1,11 +1,26 @@
 #ifndef KERNEL_IRQ_H
 #define KERNEL_IRQ_H
 
+#include <uapi/manticore/irq_abi.h>
+
+#include <stdint.h>
+
 typedef int irq_vector_t;
 typedef void (*irq_handler_t)(void *);
 
+/// Allocate an interrupt vector on the current CPU for \handler.
 irq_vector_t request_irq(irq_handler_t, void *arg);
 
+/// Allocate an interrupt vector on the CPU with interrupt controller ID \cpu_id for \handler. Fails with -EINVAL if the
+/// CPU is not online.
+irq_vector_t request_irq_on(uint32_t cpu_id, irq_handler_t, void *arg);
+
+/// Free interrupt vector \vector on the CPU with interrupt controller ID \cpu_id.
+void free_irq(uint32_t cpu_id, irq_vector_t vector);
+
+/// Copy the statistics of interrupt vector \vector on the CPU with interrupt controller ID \cpu_id to \stats.
+int irq_get_stats(uint32_t cpu_id, irq_vector_t vector, struct irq_vector_stats *stats);
+
 void handle_interrupt(irq_vector_t vector);
 void end_of_interrupt(void);
 
@@ -1,12 +1,20 @@
 #ifndef KERNEL_KMEM_H
 #define KERNEL_KMEM_H
 
+#include <kernel/magazine.h>
+#include <kernel/types.h>
+
 #include <stddef.h>
 #include <stdint.h>
 
+struct kmem_cache_stats;
+
 /// Default object alignment.
 #define KMEM_DEFAULT_ALIGN sizeof(void *)
 
+/// Cache line size, for caches of objects that must not share cache lines.
+#define KMEM_CACHE_LINE_SIZE 64
+
 /// A buffer metadata block.
 struct kmem_bufctl {
 	struct kmem_bufctl	*next;
@@ -17,13 +25,39 @@ struct kmem_bufctl {
 /// An object cache slab.
 struct kmem_slab {
 	struct kmem_cache	*cache;
-	struct kmem_bufctl	*head;
-	void			*base;
+	struct kmem_bufctl	*head;		// Free buffers
+	void			*base;		// Memory of the slab
+	struct kmem_slab	*prev;		// Link in a slab list of the cache
 	struct kmem_slab	*next;
+	struct kmem_slab	*hash_next;	// Link in the off-slab hash table
 	uint32_t		nr_free;
 	uint32_t		capacity;
 };
 
+/// A list of slabs.
+struct kmem_slab_list {
+	struct kmem_slab	*head;
+	size_t			nr_slabs;
+};
+
+/// The cache has no magazine layer, so objects go directly to the slabs.
+#define KMEM_CACHE_NOMAGAZINE	(1U << 0)
+
+/// Objects are aligned to cache lines, so that no two objects share a cache
+/// line.
+#define KMEM_CACHE_HWALIGN	(1U << 1)
+
+/// Slabs are backed by large pages, which cover many objects with a single
+/// TLB entry. For hot caches of small objects.
+#define KMEM_CACHE_LARGESLAB	(1U << 2)
+
+/// The slab metadata is stored outside of the slab memory. Set by the
+/// allocator for caches of large objects.
+#define KMEM_CACHE_OFFSLAB	(1U << 16)
+
+/// Maximum number of empty slabs that a cache keeps for future allocations.
+#define KMEM_CACHE_MAX_EMPTY	2
+
 /// Maximum cache name length.
 #define KMEM_NAME_MAX_LEN	32
 
@@ -32,12 +66,24 @@ struct kmem_cache {
 	size_t			bufctl;		// Bufctl offset
 	size_t			size;		// Object size
 	size_t			align;		// Object alignment
-	struct kmem_slab	*slab;		// Slab
+	size_t			slab_size;	// Slab size and alignment
+	size_t			color_align;	// Slab color granularity
+	size_t			color_max;	// Largest slab color
+	size_t			color_next;	// Color of the next slab
+	unsigned int		flags;		// Cache flags
+	struct kmem_slab_list	partial;	// Slabs with both free and allocated objects
+	struct kmem_slab_list	full;		// Slabs with no free objects
+	struct kmem_slab_list	empty;		// Slabs with no allocated objects
+	struct kmem_cache	*next;		// Link in the list of all caches
+	uint64_t		nr_allocs;	// Objects allocated
+	uint64_t		nr_frees;	// Objects freed
+	uint64_t		nr_failures;	// Allocations that failed
+	struct kmem_magazine_layer magazines;	// Magazine layer
 	char			name[KMEM_NAME_MAX_LEN]; // Cache name
 };
 
-/// Create an object cache.
-struct kmem_cache *kmem_cache_create(const char *name, size_t obj_size, size_t align);
+/// Create an object cache with KMEM_CACHE_* flags \flags.
+struct kmem_cache *kmem_cache_create(const char *name, size_t obj_size, size_t align, unsigned int flags);
 
 /// Destroy an object cache.
 void kmem_cache_destroy(struct kmem_cache *cache);
@@ -48,9 +94,34 @@ void *kmem_cache_alloc(struct kmem_cache *cache);
 /// Free an object to \cache object cache.
 void kmem_cache_free(struct kmem_cache *cache, void *obj);
 
+/// Copy the statistics of \cache to \stats.
+void kmem_cache_get_stats(struct kmem_cache *cache, struct kmem_cache_stats *stats);
+
+/// Copy allocator statistics of type \type (KMEM_STATS_*) to user space buffer
+/// \ubuf of \len bytes. Returns the number of entries that are available,
+/// which may be more than fit in the buffer.
+ssize_t kmem_get_stats(int type, void /* __user */ *ubuf, size_t len);
+
+/// Return the memory of cached objects and empty slabs of all caches to the
+/// page allocator.
+void kmem_reap(void);
+
 /// Allocate an object of size \size.
 void *kmem_alloc(size_t size);
 
+/// Allocate an object of size \size that is aligned to \align, which must be a
+/// power of two. Objects larger than a page are backed by the page allocator,
+/// and very large objects by vmalloc(), so they may not be physically
+/// contiguous.
+void *kmem_alloc_align(size_t size, size_t align);
+
+/// Free an object \ptr of size \size that was allocated with alignment \align.
+void kmem_free_align(void *ptr, size_t size, size_t align);
+
+/// Resize an object \ptr of size \old_size to \new_size, preserving its
+/// contents. Returns NULL and leaves the object intact if out of memory.
+void *kmem_realloc_align(void *ptr, size_t old_size, size_t new_size, size_t align);
+
 /// Allocate an object of size \size and fill the memory with zeros.
 void *kmem_zalloc(size_t size);
 
@@ -0,0 +1,6 @@
+#ifndef KERNEL_LOOPBACK_H
+#define KERNEL_LOOPBACK_H
+
+void loopback_init(void);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef KERNEL_MAGAZINE_H
+#define KERNEL_MAGAZINE_H
+
+#include <kernel/cpu.h>
+
+#include <stdint.h>
+
+/// Number of rounds (objects) in a magazine.
+#define KMEM_MAGAZINE_SIZE 30
+
+/// Maximum number of full magazines in a depot.
+#define KMEM_DEPOT_MAX_FULL 8
+
+/// A magazine, which is a stack of cached objects.
+struct kmem_magazine {
+	struct kmem_magazine	*next;
+	uint32_t		nr_rounds;
+	void			*rounds[KMEM_MAGAZINE_SIZE];
+};
+
+/// The per-CPU part of a magazine layer.
+struct kmem_cpu_cache {
+	struct kmem_magazine	*loaded;	// Magazine that objects are taken from and returned to
+	struct kmem_magazine	*previous;	// Either full or empty
+};
+
+/// The depot of a magazine layer, which holds the magazines that are not
+/// loaded on any CPU.
+struct kmem_depot {
+	struct kmem_magazine	*full;
+	struct kmem_magazine	*empty;
+	uint32_t		nr_full;
+};
+
+typedef void *(*kmem_backend_alloc_t)(void *arg);
+typedef void (*kmem_backend_free_t)(void *arg, void *obj);
+
+/// A magazine layer, which caches objects of a backend allocator.
+struct kmem_magazine_layer {
+	struct kmem_cpu_cache	cpu[MAX_CPUS];
+	struct kmem_depot	depot;
+	kmem_backend_alloc_t	alloc;
+	kmem_backend_free_t	free;
+	void			*arg;
+};
+
+/// Initialize magazine layer \layer in front of a backend allocator.
+void kmem_magazine_layer_init(struct kmem_magazine_layer *layer, kmem_backend_alloc_t alloc, kmem_backend_free_t free,
+			      void *arg);
+
+/// Allocate an object from magazine layer \layer.
+void *kmem_magazine_alloc(struct kmem_magazine_layer *layer);
+
+/// Free object \obj to magazine layer \layer.
+void kmem_magazine_free(struct kmem_magazine_layer *layer, void *obj);
+
+/// Return the objects that are cached in magazine layer \layer to the backend allocator.
+void kmem_magazine_layer_drain(struct kmem_magazine_layer *layer);
+
+/// Initialize the magazine cache. Magazine layers cache no objects before this.
+int kmem_magazine_init(void);
+
+#endif
@@ -19,4 +19,6 @@ extern virt_t kernel_vm_end;
 
 void memory_add_span(uint64_t addr, uint64_t size);
 
+void *ioremap(phys_t io_mem_start, size_t io_mem_size);
+
 #endif
@@ -4,6 +4,7 @@
 #include <arch/mmu.h>
 #include <arch/vmem.h>
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -16,6 +17,9 @@ typedef enum {
 typedef enum {
 	MMU_USER_PAGE = 1UL << 0,
 	MMU_NOCACHE = 1UL << 1,
+	/* Write-combining memory type, which is uncached but lets the CPU merge
+	   and buffer writes. Falls back to MMU_NOCACHE without PAT support.  */
+	MMU_WRITE_COMBINE = 1UL << 2,
 } mmu_flags_t;
 
 void mmu_invalidate_tlb(void);
@@ -24,6 +28,20 @@ void mmu_load_map(mmu_map_t map);
 int mmu_map_range(mmu_map_t map, virt_t vaddr, phys_t paddr, size_t size, mmu_prot_t prot, mmu_flags_t flags);
 int mmu_map_small_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags);
 int mmu_map_large_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags);
+/// Map a 1 GiB huge page, which fails unless mmu_has_huge_pages().
+int mmu_map_huge_page(mmu_map_t map, virt_t vaddr, phys_t paddr, mmu_prot_t prot, mmu_flags_t flags);
+/// Unmap the small page at \vaddr and store its physical address to \paddr.
+int mmu_unmap_small_page(mmu_map_t map, virt_t vaddr, phys_t *paddr);
+/// Unmap the large page at \vaddr and store its physical address to \paddr.
+int mmu_unmap_large_page(mmu_map_t map, virt_t vaddr, phys_t *paddr);
+/// Unmap the huge page at \vaddr and store its physical address to \paddr.
+int mmu_unmap_huge_page(mmu_map_t map, virt_t vaddr, phys_t *paddr);
+/// Returns the size of the aligned block around \vaddr that has no page table, which makes every page in it unmapped, or
+/// zero if \vaddr has a page table or is mapped.
+size_t mmu_unmapped_size(mmu_map_t map, virt_t vaddr);
+/// Returns true if the MMU supports 1 GiB huge pages.
+bool mmu_has_huge_pages(void);
+int mmu_unmap_range(mmu_map_t map, virt_t vaddr, size_t size);
 void mmu_map_dump(mmu_map_t map);
 
 #endif
@@ -0,0 +1,51 @@
+#ifndef KERNEL_NUMA_H
+#define KERNEL_NUMA_H
+
+#include <arch/vmem.h>
+
+#include <stdint.h>
+
+/// Maximum number of NUMA nodes.
+#define MAX_NUMA_NODES 8
+
+/// Maximum number of physical memory ranges with a NUMA node affinity.
+#define MAX_NUMA_MEMORY_RANGES 32
+
+/// The distance of a NUMA node to itself.
+#define NUMA_LOCAL_DISTANCE 10
+
+/// The distance between two NUMA nodes when the platform does not report it.
+#define NUMA_REMOTE_DISTANCE 20
+
+/// Return the NUMA node of proximity domain \domain, allocating a node for it if it has none.
+int numa_domain_to_node(uint32_t domain);
+
+/// Register physical memory range [\base, \base + \len) to belong to NUMA node \node.
+void numa_add_memory(int node, phys_t base, uint64_t len);
+
+/// Register the CPU with interrupt controller ID \cpu_id to belong to NUMA node \node.
+void numa_add_cpu(int node, uint32_t cpu_id);
+
+/// Set the relative distance from NUMA node \from to NUMA node \to.
+void numa_set_distance(int from, int to, uint8_t distance);
+
+/// Finish NUMA topology setup after the platform configuration and the interrupt controller are initialized.
+void numa_init(void);
+
+/// Return the number of NUMA nodes.
+int numa_nr_nodes(void);
+
+/// Return the relative distance from NUMA node \from to NUMA node \to.
+int numa_distance(int from, int to);
+
+/// Return the NUMA node of the CPU with interrupt controller ID \cpu_id.
+int numa_cpu_node(uint32_t cpu_id);
+
+/// Return the NUMA node of the current CPU.
+int numa_current_node(void);
+
+/// Return the NUMA node of physical address \addr and store the end of the memory range of that node that
+/// contains \addr to \end.
+int numa_memory_node(phys_t addr, phys_t *end);
+
+#endif
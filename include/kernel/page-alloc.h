@@ -1,15 +1,63 @@
 #ifndef KERNEL_PAGE_ALLOC_H
 #define KERNEL_PAGE_ALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define PAGE_SIZE_SMALL (1ULL << 12)
 #define PAGE_SIZE_LARGE (1ULL << 21)
+#define PAGE_SIZE_HUGE (1ULL << 30)
 
 void page_alloc_init(void);
 void *page_alloc_small(void);
+void *page_alloc_small_node(int node);
 void page_free_small(void *page);
+void *page_alloc_order(unsigned int order);
+void page_free_order(void *page, unsigned int order);
 void *page_alloc_large(void);
+void *page_alloc_large_node(int node);
 void page_free_large(void *page);
 
+/// Counters of the memory that the small and large page arenas exchange.
+struct page_arena_stats {
+	uint64_t	small_free;		// Free bytes in the small page arena
+	uint64_t	large_free;		// Free bytes in the large page arena
+	uint64_t	large_pages_split;	// Large pages split into the small page arena
+	uint64_t	large_pages_reclaimed;	// Free large pages reclaimed from the small page arena
+};
+
+void page_arena_get_stats(struct page_arena_stats *stats);
+
+struct kmem_arena_stats;
+
+/* Statistics of the page arena of type \type (KMEM_ARENA_*) of NUMA node \node.  */
+int page_arena_get_node_stats(int node, unsigned int type, struct kmem_arena_stats *stats);
+
+/// Counters of the pre-zeroed page pool.
+struct page_zero_stats {
+	uint64_t	nr_small;	// Zeroed small pages in the pool
+	uint64_t	nr_large;	// Zeroed large pages in the pool
+	uint64_t	small_hits;	// Small page allocations served from the pool
+	uint64_t	small_misses;	// Small page allocations zeroed on the allocation path
+	uint64_t	large_hits;	// Large page allocations served from the pool
+	uint64_t	large_misses;	// Large page allocations zeroed on the allocation path
+};
+
+/* Pages that are zeroed ahead of time by the idle loop.  */
+void *page_alloc_small_zeroed(void);
+void *page_alloc_large_zeroed(void);
+bool page_zero_refill(void);
+/* Return the pages of the pool to the allocator. Returns true if a page was freed.  */
+bool page_zero_drain(void);
+void page_zero_get_stats(struct page_zero_stats *stats);
+
+/* The small page arena without the page cache in front of it.  */
+void *page_arena_alloc_small(void);
+void page_arena_free_small(void *page);
+
+/* The magazine layer in front of the small page arena.  */
+void *page_cache_alloc_small(void);
+void page_cache_free_small(void *page);
+void page_cache_drain(void);
+
 #endif
@@ -1,7 +1,22 @@
 #ifndef KERNEL_PAGE_FAULT_H
 #define KERNEL_PAGE_FAULTH
 
+#include <stdint.h>
+
+/* Page fault flags, which describe the faulting access:  */
+enum {
+	/* The access was a write.  */
+	PAGE_FAULT_WRITE = 1U << 0,
+	/* The access was an instruction fetch.  */
+	PAGE_FAULT_EXEC = 1U << 1,
+	/* The page is present, but the access violates its protection.  */
+	PAGE_FAULT_PROT = 1U << 2,
+};
+
 void page_fault_set_fixup(void *);
 void *page_fault_get_fixup(void);
+/* Populates the page of the current process address space that contains
+   \addr. Returns 0 if the faulting access can be restarted.  */
+int page_fault_handle(uint64_t addr, uint32_t flags);
 
 #endif
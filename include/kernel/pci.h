@@ -1,6 +1,15 @@
 #ifndef KERNEL_PCI_H
 #define KERNEL_PCI_H
 
+#include <stdint.h>
+
+/// Register the ECAM region of PCI segment group \segment for buses \start_bus to \end_bus, which starts at
+/// physical address \base for bus 0.
+void pci_ecam_register(uint64_t base, uint16_t segment, uint8_t start_bus, uint8_t end_bus);
+
+/// Map the registered ECAM region. Configuration space is accessed through I/O ports until this is called.
+void pci_ecam_init(void);
+
 void pci_probe(void);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef KERNEL_SOFTIRQ_H
+#define KERNEL_SOFTIRQ_H
+
+#include <stdbool.h>
+
+/// A tasklet function, which returns `true` if it has more work to do.
+typedef bool (*tasklet_func_t)(void *arg);
+
+/// Deferred interrupt work.
+///
+/// An interrupt handler acknowledges the interrupt and schedules a tasklet,
+/// which does the batch work after the handler returns. A tasklet runs with
+/// local interrupts disabled and is never run concurrently with itself.
+struct tasklet {
+	struct tasklet	*next;
+	tasklet_func_t	func;
+	void		*arg;
+	bool		scheduled;
+};
+
+/// Initialize tasklet \t to run \func with argument \arg.
+void tasklet_init(struct tasklet *t, tasklet_func_t func, void *arg);
+
+/// Schedule tasklet \t on the current CPU, unless it is already scheduled.
+void tasklet_schedule(struct tasklet *t);
+
+/// Return `true` if tasklets are scheduled on the current CPU.
+bool softirq_pending(void);
+
+/// Run the tasklets that are scheduled on the current CPU.
+void softirq_run(void);
+
+#endif
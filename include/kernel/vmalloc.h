@@ -0,0 +1,14 @@
+#ifndef KERNEL_VMALLOC_H
+#define KERNEL_VMALLOC_H
+
+#include <stddef.h>
+
+/// Allocate \size bytes of virtually contiguous kernel memory, which is backed
+/// by small pages that need not be physically contiguous. The memory must not
+/// be used for DMA. Must not be called from interrupt context.
+void *vmalloc(size_t size);
+
+/// Free memory that was allocated with vmalloc().
+void vfree(void *addr);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __MANTICORE_UAPI_ACQUIRE_ABI_H
+#define __MANTICORE_UAPI_ACQUIRE_ABI_H
+
+/*
+ * Flags of the acquire system call:
+ */
+enum {
+	/* Map the device queues to the process, which drives the device itself
+	   without the kernel in the I/O path (kernel-bypass mode).  */
+	ACQUIRE_BYPASS = 1 << 0,
+};
+
+#endif
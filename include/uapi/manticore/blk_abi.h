@@ -0,0 +1,57 @@
+#ifndef __MANTICORE_UAPI_BLK_ABI_H
+#define __MANTICORE_UAPI_BLK_ABI_H
+
+#include <stdint.h>
+
+// Size of a block device sector in bytes.
+#define BLK_SECTOR_SIZE 512
+
+// Block I/O request, which is submitted to the I/O queue of a block device
+// with IO_OPCODE_SUBMIT, where the I/O command `addr` is the address of the
+// request and `len` is the size of the request. The kernel reads the request
+// when it is submitted and delivers an EVENT_BLOCK_IO event with the same
+// address when the request completes. Requests can complete out of order.
+struct blk_request {
+	// Request type (BLK_REQ_*).
+	uint32_t	type;
+	uint32_t	reserved;
+	// First sector of the request.
+	uint64_t	sector;
+	// Data buffer, which must be in the data area of the block device
+	// (CONFIG_BLOCK_DATA_AREA). The device transfers data directly from or
+	// to the buffer.
+	void		*buf;
+	// Length of the data buffer in bytes, a multiple of BLK_SECTOR_SIZE.
+	uint64_t	len;
+};
+
+enum blk_request_type {
+	// Read data from the device to the buffer.
+	BLK_REQ_READ = 0,
+	// Write data from the buffer to the device.
+	BLK_REQ_WRITE = 1,
+	// Flush the device write cache. The request has no buffer.
+	BLK_REQ_FLUSH = 4,
+};
+
+enum blk_status {
+	// The request completed successfully.
+	BLK_STATUS_OK = 0,
+	// The device failed to perform the request.
+	BLK_STATUS_IOERR = 1,
+	// The request is not supported or is not valid.
+	BLK_STATUS_UNSUPP = 2,
+};
+
+// Statistics of a block device, which is mapped read-only to a process that
+// acquires the device. The address of the mapping is the CONFIG_STATS option.
+// The counters are updated by the kernel and are never reset.
+struct blk_device_stats {
+	// Number of requests that the device completed.
+	uint64_t	completions;
+	// Number of times a completion event did not fit in the event queue of
+	// the process. The completion is delivered again when the queue has room.
+	uint64_t	event_overflows;
+};
+
+#endif
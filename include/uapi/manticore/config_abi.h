@@ -9,6 +9,49 @@ enum {
 	CONFIG_ETHERNET_MAC_ADDRESS = 0,
 	/* The I/O queue of the ethernet interface.  */
 	CONFIG_IO_QUEUE = 1,
+	/* The address of the struct net_device_stats statistics of the ethernet interface.  */
+	CONFIG_STATS = 2,
+};
+
+/*
+ * Loopback ethernet device configuration options:
+ */
+enum {
+	/* The delay of a frame from transmit to receive in CPU cycles (uint64_t).  */
+	CONFIG_LOOPBACK_LATENCY = 3,
+	/* The fraction of frames that are dropped in parts per million (uint32_t).  */
+	CONFIG_LOOPBACK_DROP_RATE = 4,
+};
+
+/*
+ * Block device configuration options (the I/O queue is CONFIG_IO_QUEUE and the
+ * address of the struct blk_device_stats statistics is CONFIG_STATS):
+ */
+enum {
+	/* The capacity of the block device in 512-byte sectors (uint64_t).  */
+	CONFIG_BLOCK_CAPACITY = 5,
+	/* The address of the data area, which holds the buffers of block I/O requests.  */
+	CONFIG_BLOCK_DATA_AREA = 6,
+	/* The size of the data area in bytes (uint64_t).  */
+	CONFIG_BLOCK_DATA_AREA_SIZE = 7,
+};
+
+/*
+ * Virtio device configuration options in kernel-bypass mode:
+ */
+enum {
+	/* The struct virtio_bypass_info state of the device.  */
+	CONFIG_VIRTIO_BYPASS_INFO = 8,
+};
+
+/*
+ * Device interrupt configuration options:
+ */
+enum {
+	/* The struct irq_affinity interrupt affinity of a device queue (write-only).  */
+	CONFIG_IRQ_AFFINITY = 9,
+	/* The struct irq_queue_stats interrupt statistics of the device queues (read-only).  */
+	CONFIG_IRQ_STATS = 10,
 };
 
 #endif
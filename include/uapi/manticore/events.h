@@ -5,6 +5,15 @@
 
 enum {
 	EVENT_PACKET_RX = 0x01,
+	// A received packet that is prefixed with a `struct net_offload_hdr`.
+	EVENT_PACKET_RX_OFFLOAD = 0x02,
+	// A completed block I/O request. The `addr` field is the address of the
+	// submitted `struct blk_request` and the `len` field is the status
+	// (BLK_STATUS_*) of the request.
+	EVENT_BLOCK_IO = 0x03,
+	// A device interrupt of a device in kernel-bypass mode. The `len` field
+	// is the index of the queue that raised the interrupt.
+	EVENT_INTERRUPT = 0x04,
 };
 
 struct event {
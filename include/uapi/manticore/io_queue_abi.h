@@ -9,6 +9,8 @@ typedef void *io_queue_t;
 enum io_opcode {
 	IO_OPCODE_SUBMIT = 0x1,
 	IO_OPCODE_COMPLETE = 0x2,
+	// Submit a frame that is prefixed with a `struct net_offload_hdr`.
+	IO_OPCODE_SUBMIT_OFFLOAD = 0x3,
 };
 
 struct io_cmd {
@@ -0,0 +1,41 @@
+#ifndef __MANTICORE_UAPI_IRQ_ABI_H
+#define __MANTICORE_UAPI_IRQ_ABI_H
+
+#include <stdint.h>
+
+// Interrupt affinity of a device queue, which is set with the
+// CONFIG_IRQ_AFFINITY option.
+struct irq_affinity {
+	// Index of the device queue.
+	uint32_t	queue;
+	// Interrupt controller ID of the CPU that the interrupt is delivered to.
+	uint32_t	cpu_id;
+};
+
+// Number of buckets in the cycle histogram of an interrupt vector.
+#define IRQ_HIST_BUCKETS 32
+
+// Statistics of an interrupt vector.
+struct irq_vector_stats {
+	// Number of interrupts that were delivered to the vector.
+	uint64_t	count;
+	// Histogram of the interrupt handler run time. Bucket i counts the
+	// interrupts that were handled in [2^i, 2^(i+1)) CPU cycles.
+	uint64_t	cycles_hist[IRQ_HIST_BUCKETS];
+};
+
+// Interrupt statistics of a device queue, which are returned by the
+// CONFIG_IRQ_STATS option as an array with an element for every queue
+// that has an interrupt.
+struct irq_queue_stats {
+	// Index of the device queue.
+	uint32_t		queue;
+	// Interrupt controller ID of the CPU that the interrupt is delivered to.
+	uint32_t		cpu_id;
+	// Interrupt vector on that CPU.
+	uint32_t		vector;
+	uint32_t		reserved;
+	struct irq_vector_stats	stats;
+};
+
+#endif
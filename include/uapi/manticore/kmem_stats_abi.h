@@ -0,0 +1,95 @@
+#ifndef __MANTICORE_UAPI_KMEM_STATS_ABI_H
+#define __MANTICORE_UAPI_KMEM_STATS_ABI_H
+
+#include <stdint.h>
+
+// Kernel memory allocator statistics, which are returned by the kmem_stats
+// system call:
+enum {
+	// An array of struct kmem_cache_stats, one for every object cache and
+	// for the page and vmalloc backends of large kernel allocations.
+	KMEM_STATS_CACHES = 0,
+	// An array of struct kmem_arena_stats, one for every page arena of
+	// every NUMA node.
+	KMEM_STATS_ARENAS = 1,
+	// An array of struct kmem_site_stats, one for every allocation call
+	// site. Only available in kernels built with KMEM_PROFILE=1.
+	KMEM_STATS_SITES = 2,
+};
+
+// Maximum object cache name length.
+#define KMEM_STATS_NAME_LEN 32
+
+// Statistics of a kernel object cache.
+struct kmem_cache_stats {
+	// Name of the cache.
+	char		name[KMEM_STATS_NAME_LEN];
+	// Size of an object in bytes, or zero if the objects have variable size.
+	uint64_t	obj_size;
+	// Size of a slab in bytes, or zero if the cache has no slabs.
+	uint64_t	slab_size;
+	// Number of objects in a slab.
+	uint64_t	objs_per_slab;
+	// Number of objects that were allocated.
+	uint64_t	allocs;
+	// Number of objects that were freed.
+	uint64_t	frees;
+	// Number of allocations that failed for lack of memory.
+	uint64_t	failures;
+	// Number of objects that are allocated now (allocs - frees).
+	uint64_t	live;
+	// Number of slabs with both free and allocated objects.
+	uint64_t	nr_partial;
+	// Number of slabs with no free objects.
+	uint64_t	nr_full;
+	// Number of slabs with no allocated objects.
+	uint64_t	nr_empty;
+	// Number of free objects in the slabs. Objects that are cached in the
+	// magazine layer count as allocated.
+	uint64_t	free_objs;
+	// Number of bytes of memory that the cache holds, which is the slab
+	// memory, or the memory of live objects for variable-size objects.
+	uint64_t	bytes;
+};
+
+// Page arena types.
+enum {
+	KMEM_ARENA_SMALL = 0,
+	KMEM_ARENA_LARGE = 1,
+	KMEM_ARENA_DMA = 2,
+};
+
+// Statistics of a page arena of a NUMA node.
+struct kmem_arena_stats {
+	// NUMA node of the arena.
+	uint32_t	node;
+	// Type of the arena (KMEM_ARENA_*).
+	uint32_t	type;
+	// Number of free bytes in the arena.
+	uint64_t	free_bytes;
+	// Number of allocations from the arena.
+	uint64_t	allocs;
+	// Number of frees to the arena.
+	uint64_t	frees;
+	// Number of allocations that failed because the arena had no range
+	// that fits. Most of them are satisfied by growing the arena or by
+	// another node.
+	uint64_t	failures;
+};
+
+// Statistics of an allocation call site.
+struct kmem_site_stats {
+	// Return address of the allocation call.
+	uint64_t	site;
+	// Number of allocations.
+	uint64_t	allocs;
+	// Number of allocations that failed.
+	uint64_t	failures;
+	// Number of bytes that were allocated.
+	uint64_t	bytes;
+	// Total and maximum allocation latency in CPU cycles.
+	uint64_t	cycles;
+	uint64_t	cycles_max;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __MANTICORE_UAPI_NET_OFFLOAD_ABI_H
+#define __MANTICORE_UAPI_NET_OFFLOAD_ABI_H
+
+#include <stdint.h>
+
+// Checksum and segmentation offload request for a frame that is submitted with
+// IO_OPCODE_SUBMIT_OFFLOAD. The layout is identical to the virtio-net header.
+struct net_offload_hdr {
+	// Offload flags (NET_OFFLOAD_F_*).
+	uint8_t		flags;
+	// Segmentation offload type (NET_GSO_*).
+	uint8_t		gso_type;
+	// Length of the Ethernet, IP, and transport headers in bytes.
+	uint16_t	hdr_len;
+	// Maximum payload size of a segment in bytes.
+	uint16_t	gso_size;
+	// Offset from the start of the frame where checksumming starts.
+	uint16_t	csum_start;
+	// Offset from `csum_start` where the checksum is stored.
+	uint16_t	csum_offset;
+};
+
+enum net_offload_flags {
+	// The checksum field contains the pseudo-header checksum and must be completed.
+	NET_OFFLOAD_F_NEEDS_CSUM = 0x1,
+};
+
+enum net_gso_type {
+	// No segmentation.
+	NET_GSO_NONE = 0x0,
+	// Segment a TCP/IPv4 segment into MSS-sized segments.
+	NET_GSO_TCPV4 = 0x1,
+	// Fragment a UDP/IPv4 datagram into IP fragments.
+	NET_GSO_UDP = 0x3,
+	// Split a UDP/IPv4 payload into separate datagrams.
+	NET_GSO_UDP_L4 = 0x5,
+};
+
+#endif
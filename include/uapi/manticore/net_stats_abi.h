@@ -0,0 +1,33 @@
+#ifndef __MANTICORE_UAPI_NET_STATS_ABI_H
+#define __MANTICORE_UAPI_NET_STATS_ABI_H
+
+#include <stdint.h>
+
+// Statistics of a network device queue. The counters are updated by the kernel
+// and are never reset.
+struct net_queue_stats {
+	// Number of packets received or transmitted.
+	uint64_t	packets;
+	// Number of bytes received or transmitted, excluding device headers.
+	uint64_t	bytes;
+	// Number of packets dropped by the driver, including event queue overflows.
+	uint64_t	drops;
+	// Number of times the device ran out of receive buffers or the driver ran
+	// out of transmit descriptors.
+	uint64_t	ring_full;
+	// Number of events dropped because a process event queue was full.
+	uint64_t	event_overflows;
+	// Number of interrupts.
+	uint64_t	interrupts;
+	// Number of device notifications.
+	uint64_t	doorbells;
+};
+
+// Statistics of a network device, which is mapped read-only to a process that
+// acquires the device. The address of the mapping is the CONFIG_STATS option.
+struct net_device_stats {
+	struct net_queue_stats	rx;
+	struct net_queue_stats	tx;
+};
+
+#endif
@@ -10,6 +10,9 @@ enum {
 	SYS_get_config		= 7,
 	SYS_acquire		= 8,
 	SYS_vmspace_alloc	= 9,
+	SYS_set_config		= 10,
+	SYS_kmem_stats		= 11,
+	SYS_vmspace_free	= 12,
 };
 
 #endif
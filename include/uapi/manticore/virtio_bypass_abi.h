@@ -0,0 +1,72 @@
+#ifndef __MANTICORE_UAPI_VIRTIO_BYPASS_ABI_H
+#define __MANTICORE_UAPI_VIRTIO_BYPASS_ABI_H
+
+#include <stdint.h>
+
+// Maximum number of virtqueues in struct virtio_bypass_info.
+#define VIRTIO_BYPASS_MAX_QUEUES 2
+
+// A virtqueue that is mapped to a process in kernel-bypass mode. The
+// descriptor table and the rings have the layout of the VirtIO 1.0 split
+// virtqueue and the process owns all of their entries.
+struct virtio_bypass_queue {
+	// Address of the descriptor table.
+	uint64_t	desc;
+	// Address of the available ring.
+	uint64_t	avail;
+	// Address of the used ring.
+	uint64_t	used;
+	// Address of the 16-bit notification register of the queue, where the
+	// queue index is written to notify the device of new available buffers.
+	uint64_t	notify;
+	// Number of entries in the queue.
+	uint16_t	size;
+	// Index of the queue.
+	uint16_t	queue_idx;
+	// Index in the used ring up to which the kernel has consumed entries.
+	uint16_t	last_used_idx;
+	uint16_t	reserved;
+};
+
+// A memory area of a device in kernel-bypass mode.
+struct virtio_bypass_area {
+	// Address of the area in the process.
+	uint64_t	addr;
+	// Address of the area as seen by the device, which is what descriptors
+	// refer to.
+	uint64_t	dma_addr;
+	// Size of the area in bytes.
+	uint64_t	size;
+};
+
+// Virtio network device state that is mapped to a process that acquires the
+// device with ACQUIRE_BYPASS. The structure is the CONFIG_VIRTIO_BYPASS_INFO
+// option.
+//
+// The RX queue is queue 0 and the TX queue is queue 1. When the device is
+// acquired, RX descriptor i refers to the RX buffer at offset i * rx_buf_size
+// of the RX area and all RX descriptors are available to the device. The TX
+// queue is empty. Every buffer is prefixed with a virtio_net_hdr of
+// vhdr_size bytes.
+//
+// The kernel no longer touches the queues and forwards RX queue interrupts as
+// EVENT_INTERRUPT events. There is no IOMMU: the device accesses any memory
+// that a descriptor refers to, so the process must only use the RX and TX
+// areas for buffers.
+struct virtio_bypass_info {
+	// Negotiated feature bits.
+	uint64_t			features;
+	// Size of the virtio_net_hdr that prefixes every buffer.
+	uint64_t			vhdr_size;
+	// Size of an RX buffer.
+	uint64_t			rx_buf_size;
+	// Number of RX buffers that are initially available to the device.
+	uint64_t			nr_rx_bufs;
+	struct virtio_bypass_area	rx_area;
+	struct virtio_bypass_area	tx_area;
+	// Number of queues.
+	uint64_t			nr_queues;
+	struct virtio_bypass_queue	queues[VIRTIO_BYPASS_MAX_QUEUES];
+};
+
+#endif
@@ -3,6 +3,16 @@
 
 #include <stdint.h>
 
+// Virtual memory space region flags:
+enum {
+	// Populate the region up front with the largest pages that fit it,
+	// including 1 GiB pages where the CPU supports them. The memory stays
+	// pinned until the region is freed.
+	VMSPACE_HUGE_PAGES = 1 << 0,
+	// Populate the region with 4 KiB pages only.
+	VMSPACE_NO_HUGE_PAGES = 1 << 1,
+};
+
 // Virtual memory space region.
 struct vmspace_region {
 	// Size of the virtual memory space region in bytes (input).
@@ -11,6 +21,8 @@ struct vmspace_region {
 	uint64_t	align;
 	// Start address of the virtual memory space region (output).
 	uint64_t	start;
+	// Flags of the virtual memory space region (VMSPACE_*) (input).
+	uint64_t	flags;
 };
 
 #endif
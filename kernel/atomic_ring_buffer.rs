@@ -15,8 +15,9 @@ impl AtomicRingBuffer {
         }
     }
 
-    /// Inserts an element `elem` to this ring buffer.
-    pub fn emplace<T>(&self, elem: &T) -> usize {
+    /// Inserts an element `elem` to this ring buffer. Returns `false` if the
+    /// ring buffer is full.
+    pub fn emplace<T>(&self, elem: &T) -> bool {
         unsafe {
             atomic_ring_buffer_emplace(self.raw_ptr, mem::transmute(elem))
         }
@@ -47,7 +48,7 @@ impl AtomicRingBuffer {
 
 extern "C" {
     pub fn atomic_ring_buffer_new(buf: usize, buf_size: usize, element_size: usize) -> usize;
-    pub fn atomic_ring_buffer_emplace(ring_buffer: usize, event: usize) -> usize;
+    pub fn atomic_ring_buffer_emplace(ring_buffer: usize, event: usize) -> bool;
     pub fn atomic_ring_buffer_front(queue: usize) -> usize;
     pub fn atomic_ring_buffer_pop(queue: usize);
 }
@@ -1,7 +1,7 @@
 use alloc::rc::Rc;
 use alloc::vec::Vec;
 use core::cell::RefCell;
-use errno::Result;
+use errno::{Error, Result, EINVAL};
 use event::EventListener;
 use intrusive_collections::{KeyAdapter, RBTree, RBTreeLink};
 use vm::VMAddressSpace;
@@ -9,6 +9,18 @@ use vm::VMAddressSpace;
 // Keep this up-to-date with include/uapi/manticore/config_abi.h.
 pub const CONFIG_ETHERNET_MAC_ADDRESS: i32 = 0;
 pub const CONFIG_IO_QUEUE: i32 = 1;
+pub const CONFIG_STATS: i32 = 2;
+pub const CONFIG_LOOPBACK_LATENCY: i32 = 3;
+pub const CONFIG_LOOPBACK_DROP_RATE: i32 = 4;
+pub const CONFIG_BLOCK_CAPACITY: i32 = 5;
+pub const CONFIG_BLOCK_DATA_AREA: i32 = 6;
+pub const CONFIG_BLOCK_DATA_AREA_SIZE: i32 = 7;
+pub const CONFIG_VIRTIO_BYPASS_INFO: i32 = 8;
+pub const CONFIG_IRQ_AFFINITY: i32 = 9;
+pub const CONFIG_IRQ_STATS: i32 = 10;
+
+// Keep this up-to-date with include/uapi/manticore/acquire_abi.h.
+pub const ACQUIRE_BYPASS: i32 = 1 << 0;
 
 /// A device descriptor.
 pub struct DeviceDesc(i32);
@@ -36,9 +48,23 @@ impl DeviceDesc {
 
 pub trait DeviceOps {
     fn acquire(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>) -> Result<()>;
+    /// Acquires the device in kernel-bypass mode, where the device queues are
+    /// mapped to the process and the kernel only forwards interrupts.
+    fn acquire_bypass(&self, _vmspace: &mut VMAddressSpace, _listener: Rc<dyn EventListener>) -> Result<()> {
+        Err(Error::new(EINVAL))
+    }
     fn subscribe(&self, events: &'static str);
     fn get_config(&self, option: ConfigOption) -> Option<Vec<u8>>;
+    /// Sets configuration option `option` to `value`.
+    fn set_config(&self, _option: ConfigOption, _value: &[u8]) -> Result<()> {
+        Err(Error::new(EINVAL))
+    }
     fn process_io(&self);
+    /// Returns `true` if the device has I/O that needs to be processed without
+    /// waiting for an interrupt, such as I/O commands submitted by a process.
+    fn io_pending(&self) -> bool {
+        false
+    }
 }
 
 pub struct Device {
@@ -54,8 +80,12 @@ impl Device {
         Device { name, ops, link: RBTreeLink::new(), }
     }
 
-    pub fn acquire(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>) -> Result<()> {
-        self.ops.borrow().acquire(vmspace, listener)
+    pub fn acquire(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>, flags: i32) -> Result<()> {
+        match flags {
+            0 => self.ops.borrow().acquire(vmspace, listener),
+            ACQUIRE_BYPASS => self.ops.borrow().acquire_bypass(vmspace, listener),
+            _ => Err(Error::new(EINVAL)),
+        }
     }
 
     pub fn subscribe(&self, events: &'static str) {
@@ -66,9 +96,17 @@ impl Device {
         self.ops.borrow().get_config(option)
     }
 
+    pub fn set_config(&self, option: ConfigOption, value: &[u8]) -> Result<()> {
+        self.ops.borrow().set_config(option, value)
+    }
+
     pub fn process_io(&self) {
         self.ops.borrow().process_io()
     }
+
+    pub fn io_pending(&self) -> bool {
+        self.ops.borrow().io_pending()
+    }
 }
 
 impl<'a> KeyAdapter<'a> for DeviceAdapter {
@@ -142,3 +180,9 @@ pub fn process_io() {
         }
     }
 }
+
+/// Returns `true` if any device has I/O that needs to be processed without
+/// waiting for an interrupt.
+pub fn io_pending() -> bool {
+    unsafe { NAMESPACE.devices.iter().any(|dev| dev.io_pending()) }
+}
@@ -1,6 +1,8 @@
 use core::result;
 
 pub const ENOMEM: i32 = 12;
+pub const EFAULT: i32 = 14;
+pub const EBUSY: i32 = 16;
 pub const EINVAL: i32 = 22;
 pub const ENOSYS: i32 = 38;
 
@@ -19,6 +19,12 @@ use atomic_ring_buffer::AtomicRingBuffer;
 #[derive(Clone, Debug)]
 pub enum Event {
     PacketIO { addr: usize, len: usize },
+    /// A received packet that is prefixed with a network offload header.
+    PacketIOOffload { addr: usize, len: usize },
+    /// A completed block I/O request.
+    BlockIO { req: usize, status: usize },
+    /// An interrupt of a device in kernel-bypass mode.
+    Interrupt { queue: usize },
 }
 
 /// A raw kernel event (needs to match definition in include/uapi/manticore/events.h).
@@ -30,6 +36,9 @@ struct RawEvent {
 }
 
 const EVENT_PACKET_RX: usize = 0x01;
+const EVENT_PACKET_RX_OFFLOAD: usize = 0x02;
+const EVENT_BLOCK_IO: usize = 0x03;
+const EVENT_INTERRUPT: usize = 0x04;
 
 /// An event queue between kernel and user space.
 #[derive(Debug)]
@@ -44,19 +53,31 @@ impl EventQueue {
         }
     }
 
-    pub fn emplace(&mut self, event: Event) {
+    /// Inserts `event` to this event queue. Returns `false` if the queue is
+    /// full and the event was dropped.
+    pub fn emplace(&mut self, event: Event) -> bool {
         let raw_event = match event {
             Event::PacketIO { addr, len } => {
                 RawEvent { type_: EVENT_PACKET_RX, addr, len }
             }
+            Event::PacketIOOffload { addr, len } => {
+                RawEvent { type_: EVENT_PACKET_RX_OFFLOAD, addr, len }
+            }
+            Event::BlockIO { req, status } => {
+                RawEvent { type_: EVENT_BLOCK_IO, addr: req, len: status }
+            }
+            Event::Interrupt { queue } => {
+                RawEvent { type_: EVENT_INTERRUPT, addr: 0, len: queue }
+            }
         };
-        self.ring_buffer.emplace(&raw_event);
+        self.ring_buffer.emplace(&raw_event)
     }
 }
 
 /// An event listener.
 pub trait EventListener {
-    fn on_event(&self, ev: Event);
+    /// Delivers event `ev` to the listener. Returns `false` if the event was dropped.
+    fn on_event(&self, ev: Event) -> bool;
 }
 
 /// An event notifier.
@@ -88,9 +109,13 @@ impl EventNotifier {
         self.listeners.borrow_mut().push(listener);
     }
 
-    pub fn on_event(&self, ev: Event) {
+    /// Delivers event `ev` to all listeners. Returns `false` if any listener
+    /// dropped the event.
+    pub fn on_event(&self, ev: Event) -> bool {
+        let mut delivered = true;
         for ref mut listener in self.listeners.borrow().iter() {
-            listener.on_event(ev.clone());
+            delivered &= listener.on_event(ev.clone());
         }
+        delivered
     }
 }
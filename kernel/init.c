@@ -6,7 +6,9 @@
 #include <kernel/panic.h>
 #include <kernel/sched.h>
 #include <kernel/kmem.h>
+#include <kernel/loopback.h>
 #include <kernel/cpu.h>
+#include <kernel/softirq.h>
 
 #include <arch/interrupts.h>
 #include <arch/thread.h>
@@ -22,7 +24,14 @@ struct task_state *idle_task;
 static void idle(void)
 {
 	for (;;) {
-		arch_halt_cpu();
+		/* Tasklets that still have work after the interrupt that
+		   scheduled them are run here instead of waiting for the next
+		   interrupt. Otherwise, the CPU zeroes pages ahead of time
+		   and halts only when the zeroed page pool is full.  */
+		if (!softirq_pending() && !page_zero_refill()) {
+			arch_halt_cpu();
+		}
+		softirq_run();
 		wake_up_processes();
 		schedule();
 	}
@@ -41,10 +50,13 @@ void start_kernel(void)
 		panic("kmem_init failed");
 	}
 	arch_late_setup();
+	loopback_init();
 	arch_local_interrupt_enable();
 	initrd_load();
 #ifdef HAVE_TEST
 	test_kmem();
+	test_dma();
+	test_mmu();
 	test_page_alloc();
 	test_printf();
 #endif
@@ -9,6 +9,7 @@ use atomic_ring_buffer::AtomicRingBuffer;
 #[derive(Clone, Debug)]
 pub enum Opcode {
     Submit,
+    SubmitOffload,
     Complete,
 }
 
@@ -32,6 +33,7 @@ struct RawIOCmd {
 
 const RAW_IO_OPCODE_SUBMIT: u32 = 0x01;
 const RAW_IO_OPCODE_COMPLETE: u32 = 0x02;
+const RAW_IO_OPCODE_SUBMIT_OFFLOAD: u32 = 0x03;
 
 #[derive(Debug)]
 /// An I/O command submission queue.
@@ -49,6 +51,11 @@ impl IOQueue {
         }
     }
 
+    /// Returns `true` if the I/O queue has no I/O commands.
+    pub fn is_empty(&self) -> bool {
+        self.ring_buffer.front::<RawIOCmd>().is_none()
+    }
+
     /// Removes the first I/O command from the I/O queue.
     pub fn pop(&mut self) -> Option<IOCmd> {
         if let Some(raw_io_cmd) = self.ring_buffer.front::<RawIOCmd>() {
@@ -56,6 +63,7 @@ impl IOQueue {
                 match (*raw_io_cmd).opcode {
                     RAW_IO_OPCODE_SUBMIT => Some(Opcode::Submit),
                     RAW_IO_OPCODE_COMPLETE => Some(Opcode::Complete),
+                    RAW_IO_OPCODE_SUBMIT_OFFLOAD => Some(Opcode::SubmitOffload),
                     _ => None,
                 }
             };
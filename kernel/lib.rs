@@ -26,16 +26,31 @@ pub mod mmu;
 pub mod vm;
 pub mod process;
 pub mod sched;
+pub mod softirq;
 pub mod device;
 pub mod ioport;
 pub mod ioqueue;
+pub mod loopback;
+pub mod net;
 pub mod user_access;
 
+pub use memory::dma_alloc;
+pub use memory::dma_alloc_node;
+pub use memory::dma_free;
+pub use loopback::loopback_init;
 pub use memory::memory_add_span;
 pub use memory::page_alloc_init;
 pub use memory::page_alloc_small;
+pub use memory::page_alloc_small_node;
 pub use memory::page_free_small;
+pub use memory::page_alloc_order;
+pub use memory::page_free_order;
+pub use memory::page_arena_alloc_small;
+pub use memory::page_arena_free_small;
+pub use memory::page_arena_get_stats;
+pub use memory::page_arena_get_node_stats;
 pub use memory::page_alloc_large;
+pub use memory::page_alloc_large_node;
 pub use memory::page_free_large;
 pub use process::process_spawn;
 
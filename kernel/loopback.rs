@@ -0,0 +1,368 @@
+//! Loopback network device.
+//!
+//! The loopback device is an Ethernet device without hardware: frames that a
+//! process transmits through the I/O queue are delivered back to it as
+//! received frames through the event queue. The device makes it possible to
+//! benchmark the network data path without a network interface card or a peer
+//! on the host. Link latency and frame loss are emulated with the
+//! `CONFIG_LOOPBACK_LATENCY` and `CONFIG_LOOPBACK_DROP_RATE` options.
+
+use alloc::collections::VecDeque;
+use alloc::rc::Rc;
+use alloc::vec::Vec;
+use core::cell::{Cell, RefCell};
+use core::mem;
+use core::ptr;
+use core::slice;
+use device::{register_device, ConfigOption, Device, DeviceOps};
+use device::{CONFIG_ETHERNET_MAC_ADDRESS, CONFIG_IO_QUEUE, CONFIG_LOOPBACK_DROP_RATE, CONFIG_LOOPBACK_LATENCY, CONFIG_STATS};
+use errno::{Error, Result, EINVAL};
+use event::{Event, EventListener, EventNotifier};
+use ioqueue::{IOCmd, IOQueue, Opcode};
+use memory;
+use net::{self, NetDeviceStats, NetOffloadHdr, NET_GSO_NONE, NET_OFFLOAD_F_DATA_VALID, NET_OFFLOAD_F_NEEDS_CSUM};
+use print;
+use vm::{VMAddressSpace, VMProt};
+
+/// The name of the loopback device that is exported to user space.
+const LOOPBACK_DEV_NAME: &str = "/dev/loop-eth";
+
+/// The MAC address of the loopback device, which is locally administered.
+const LOOPBACK_MAC_ADDR: [u8; 6] = [0x02, 0x00, 0x00, 0x00, 0x00, 0x01];
+
+/// Size of a receive buffer for a frame up to the Ethernet MTU.
+const RX_BUF_SIZE_SMALL: usize = 2048;
+
+/// Size of a receive buffer for the largest frame that segmentation offload
+/// produces (64 KiB IP datagram).
+const RX_BUF_SIZE_LARGE: usize = 68 * 1024;
+
+/// Number of large receive buffers, which are at the start of the receive area.
+const NR_RX_BUFS_LARGE: usize = 8;
+
+/// Offset of the frame in a receive buffer. An offload header is placed
+/// immediately before the frame.
+const RX_FRAME_OFF: usize = mem::size_of::<NetOffloadHdr>();
+
+/// Maximum drop rate in parts per million.
+const DROP_RATE_MAX: u32 = 1_000_000;
+
+extern "C" {
+    fn arch_cycle_counter() -> u64;
+}
+
+/// A frame that is in transit from transmit to receive.
+struct Inflight {
+    /// Receive buffer that holds the frame.
+    buf: usize,
+    /// Length of the frame.
+    len: usize,
+    /// The frame is prefixed with an offload header.
+    offload: bool,
+    /// Cycle counter value after which the frame is received.
+    deadline: u64,
+}
+
+struct LoopbackDevice {
+    notifier: Rc<EventNotifier>,
+    rx_area: usize,
+    rx_free_small: RefCell<Vec<usize>>,
+    rx_free_large: RefCell<Vec<usize>>,
+    /// Receive buffers that are delivered to user space and not completed
+    /// yet, indexed by `rx_buf_index`.
+    rx_outstanding: RefCell<Vec<bool>>,
+    inflight: RefCell<VecDeque<Inflight>>,
+    latency: Cell<u64>,
+    drop_rate: Cell<u32>,
+    rng_state: Cell<u64>,
+    stats_page: usize,
+    stats_addr: RefCell<Option<usize>>,
+    rx_buffer_addr: RefCell<Option<usize>>,
+    io_queue: RefCell<Option<IOQueue>>,
+}
+
+impl LoopbackDevice {
+    fn new() -> Option<Self> {
+        let rx_area = unsafe { memory::page_alloc_large() } as usize;
+        if rx_area == 0 {
+            return None;
+        }
+        let stats_page = unsafe { memory::page_alloc_small_zeroed() } as usize;
+        if stats_page == 0 {
+            unsafe { memory::page_free_large(rx_area as *mut u8) };
+            return None;
+        }
+        let large_area_size = NR_RX_BUFS_LARGE * RX_BUF_SIZE_LARGE;
+        let nr_bufs_small = (memory::PAGE_SIZE_LARGE as usize - large_area_size) / RX_BUF_SIZE_SMALL;
+        let rx_free_large = (0..NR_RX_BUFS_LARGE).map(|i| rx_area + i * RX_BUF_SIZE_LARGE).collect();
+        let rx_free_small = (0..nr_bufs_small).map(|i| rx_area + large_area_size + i * RX_BUF_SIZE_SMALL).collect();
+        Some(LoopbackDevice {
+            notifier: Rc::new(EventNotifier::new(LOOPBACK_DEV_NAME)),
+            rx_area,
+            rx_free_small: RefCell::new(rx_free_small),
+            rx_free_large: RefCell::new(rx_free_large),
+            rx_outstanding: RefCell::new(vec![false; NR_RX_BUFS_LARGE + nr_bufs_small]),
+            inflight: RefCell::new(VecDeque::new()),
+            latency: Cell::new(0),
+            drop_rate: Cell::new(0),
+            rng_state: Cell::new(0x853c_49e6_748f_ea9b),
+            stats_page,
+            stats_addr: RefCell::new(None),
+            rx_buffer_addr: RefCell::new(None),
+            io_queue: RefCell::new(None),
+        })
+    }
+
+    fn stats(&self) -> &NetDeviceStats {
+        unsafe { &*(self.stats_page as *const NetDeviceStats) }
+    }
+
+    fn process_io_one(&self, cmd: IOCmd) {
+        match cmd.opcode {
+            Opcode::Submit => {
+                let frame = unsafe { slice::from_raw_parts(cmd.addr, cmd.len) };
+                self.xmit(&NetOffloadHdr::default(), frame);
+            }
+            Opcode::SubmitOffload => {
+                let hdr_size = mem::size_of::<NetOffloadHdr>();
+                if cmd.len < hdr_size {
+                    return;
+                }
+                let hdr = unsafe { ptr::read_unaligned(cmd.addr as *const NetOffloadHdr) };
+                let frame = unsafe { slice::from_raw_parts(cmd.addr.add(hdr_size), cmd.len - hdr_size) };
+                self.xmit(&hdr, frame);
+            }
+            Opcode::Complete => {
+                if let Some(rx_buffer_addr) = *self.rx_buffer_addr.borrow() {
+                    let off = (cmd.addr as usize).wrapping_sub(rx_buffer_addr);
+                    let large_area_size = NR_RX_BUFS_LARGE * RX_BUF_SIZE_LARGE;
+                    let (buf, size) = if off < large_area_size {
+                        (self.rx_area + off / RX_BUF_SIZE_LARGE * RX_BUF_SIZE_LARGE, RX_BUF_SIZE_LARGE)
+                    } else if off < memory::PAGE_SIZE_LARGE as usize {
+                        (self.rx_area + off / RX_BUF_SIZE_SMALL * RX_BUF_SIZE_SMALL, RX_BUF_SIZE_SMALL)
+                    } else {
+                        return;
+                    };
+                    // A buffer that is completed twice, or that was never
+                    // delivered, would be handed out twice.
+                    let outstanding = mem::replace(&mut self.rx_outstanding.borrow_mut()[self.rx_buf_index(buf)], false);
+                    if outstanding {
+                        self.rx_buf_free(buf, size);
+                    }
+                }
+            }
+        }
+    }
+
+    /// Transmits `frame` with the offloads requested in `hdr` by copying it to
+    /// a receive buffer. Segmentation offload frames are received as they are,
+    /// like a device that supports receive offload would.
+    fn xmit(&self, hdr: &NetOffloadHdr, frame: &[u8]) {
+        let stats = self.stats();
+        if self.should_drop() {
+            stats.tx.drops.inc();
+            return;
+        }
+        let size = RX_FRAME_OFF + frame.len();
+        let buf = if size <= RX_BUF_SIZE_SMALL {
+            self.rx_free_small.borrow_mut().pop()
+        } else if size <= RX_BUF_SIZE_LARGE {
+            self.rx_free_large.borrow_mut().pop()
+        } else {
+            stats.tx.drops.inc();
+            return;
+        };
+        let buf = match buf {
+            Some(buf) => buf,
+            None => {
+                stats.rx.ring_full.inc();
+                stats.rx.drops.inc();
+                return;
+            }
+        };
+        let rx_frame = unsafe { slice::from_raw_parts_mut((buf + RX_FRAME_OFF) as *mut u8, frame.len()) };
+        rx_frame.copy_from_slice(frame);
+        let offload = hdr.gso_type != NET_GSO_NONE;
+        if offload {
+            let rx_hdr = NetOffloadHdr {
+                flags: NET_OFFLOAD_F_DATA_VALID,
+                gso_type: hdr.gso_type,
+                hdr_len: hdr.hdr_len,
+                gso_size: hdr.gso_size,
+                csum_start: 0,
+                csum_offset: 0,
+            };
+            unsafe { ptr::write_unaligned(buf as *mut NetOffloadHdr, rx_hdr) };
+        } else if hdr.flags & NET_OFFLOAD_F_NEEDS_CSUM != 0 {
+            if net::checksum_complete(rx_frame, hdr.csum_start as usize, hdr.csum_offset as usize).is_err() {
+                self.rx_buf_free(buf, size);
+                stats.tx.drops.inc();
+                return;
+            }
+        }
+        stats.tx.packets.inc();
+        stats.tx.bytes.add(frame.len() as u64);
+        let latency = self.latency.get();
+        let deadline = if latency != 0 { unsafe { arch_cycle_counter() + latency } } else { 0 };
+        self.inflight.borrow_mut().push_back(Inflight { buf, len: frame.len(), offload, deadline });
+    }
+
+    /// Delivers the frames whose latency has elapsed to user space.
+    fn recv(&self) {
+        let stats = self.stats();
+        let rx_buffer_addr = match *self.rx_buffer_addr.borrow() {
+            Some(addr) => addr,
+            None => return,
+        };
+        let now = if self.latency.get() != 0 { unsafe { arch_cycle_counter() } } else { 0 };
+        loop {
+            let pkt = match self.inflight.borrow_mut().pop_front() {
+                Some(pkt) => pkt,
+                None => break,
+            };
+            if pkt.deadline > now {
+                self.inflight.borrow_mut().push_front(pkt);
+                break;
+            }
+            let user_buf = rx_buffer_addr + (pkt.buf - self.rx_area);
+            let delivered = if pkt.offload {
+                self.notifier.on_event(Event::PacketIOOffload { addr: user_buf, len: RX_FRAME_OFF + pkt.len })
+            } else {
+                self.notifier.on_event(Event::PacketIO { addr: user_buf + RX_FRAME_OFF, len: pkt.len })
+            };
+            if !delivered {
+                stats.rx.event_overflows.inc();
+                stats.rx.drops.inc();
+                self.rx_buf_free(pkt.buf, RX_FRAME_OFF + pkt.len);
+                continue;
+            }
+            self.rx_outstanding.borrow_mut()[self.rx_buf_index(pkt.buf)] = true;
+            stats.rx.packets.inc();
+            stats.rx.bytes.add(pkt.len as u64);
+        }
+    }
+
+    /// Returns the index of receive buffer `buf`. The large buffers come
+    /// first, followed by the small buffers.
+    fn rx_buf_index(&self, buf: usize) -> usize {
+        let off = buf - self.rx_area;
+        let large_area_size = NR_RX_BUFS_LARGE * RX_BUF_SIZE_LARGE;
+        if off < large_area_size {
+            off / RX_BUF_SIZE_LARGE
+        } else {
+            NR_RX_BUFS_LARGE + (off - large_area_size) / RX_BUF_SIZE_SMALL
+        }
+    }
+
+    /// Returns receive buffer `buf`, which holds `size` bytes, to its free list.
+    fn rx_buf_free(&self, buf: usize, size: usize) {
+        if size <= RX_BUF_SIZE_SMALL {
+            self.rx_free_small.borrow_mut().push(buf);
+        } else {
+            self.rx_free_large.borrow_mut().push(buf);
+        }
+    }
+
+    /// Returns `true` if a frame should be dropped to emulate frame loss.
+    fn should_drop(&self) -> bool {
+        let drop_rate = self.drop_rate.get();
+        if drop_rate == 0 {
+            return false;
+        }
+        // xorshift64* pseudo-random number generator.
+        let mut x = self.rng_state.get();
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        self.rng_state.set(x);
+        (x.wrapping_mul(0x2545_f491_4f6c_dd1d) >> 32) % (DROP_RATE_MAX as u64) < (drop_rate as u64)
+    }
+}
+
+impl DeviceOps for LoopbackDevice {
+    fn acquire(&self, vmspace: &mut VMAddressSpace, listener: Rc<dyn EventListener>) -> Result<()> {
+        self.notifier.add_listener(listener);
+
+        let rx_area_size = memory::PAGE_SIZE_LARGE as usize;
+        let (rx_buf_start, rx_buf_end) = vmspace.allocate(rx_area_size, rx_area_size, VMProt::VM_PROT_READ)?;
+        vmspace.map(rx_buf_start, rx_buf_end, self.rx_area)?;
+        self.rx_buffer_addr.replace(Some(rx_buf_start));
+
+        let stats_size = memory::PAGE_SIZE_SMALL as usize;
+        let (stats_start, stats_end) = vmspace.allocate(stats_size, stats_size, VMProt::VM_PROT_READ)?;
+        vmspace.map(stats_start, stats_end, self.stats_page)?;
+        self.stats_addr.replace(Some(stats_start));
+
+        let io_buf_size = 4096;
+        let (io_buf_start, io_buf_end) = vmspace.allocate(io_buf_size, memory::PAGE_SIZE_SMALL as usize, VMProt::VM_PROT_RW)?;
+        vmspace.populate(io_buf_start, io_buf_end)?;
+        let io_queue = IOQueue::new(io_buf_start, io_buf_size);
+        self.io_queue.replace(Some(io_queue));
+
+        Ok(())
+    }
+
+    fn subscribe(&self, _events: &'static str) {}
+
+    fn get_config(&self, opt: ConfigOption) -> Option<Vec<u8>> {
+        match opt {
+            CONFIG_ETHERNET_MAC_ADDRESS => Some(LOOPBACK_MAC_ADDR.to_vec()),
+            CONFIG_IO_QUEUE => {
+                self.io_queue.borrow().as_ref().map(|io_queue| io_queue.ring_buffer.raw_ptr().to_ne_bytes().to_vec())
+            }
+            CONFIG_STATS => self.stats_addr.borrow().map(|addr| addr.to_ne_bytes().to_vec()),
+            CONFIG_LOOPBACK_LATENCY => Some(self.latency.get().to_ne_bytes().to_vec()),
+            CONFIG_LOOPBACK_DROP_RATE => Some(self.drop_rate.get().to_ne_bytes().to_vec()),
+            _ => None,
+        }
+    }
+
+    fn set_config(&self, opt: ConfigOption, value: &[u8]) -> Result<()> {
+        match opt {
+            CONFIG_LOOPBACK_LATENCY if value.len() == mem::size_of::<u64>() => {
+                let mut raw = [0u8; 8];
+                raw.copy_from_slice(value);
+                self.latency.set(u64::from_ne_bytes(raw));
+                Ok(())
+            }
+            CONFIG_LOOPBACK_DROP_RATE if value.len() == mem::size_of::<u32>() => {
+                let mut raw = [0u8; 4];
+                raw.copy_from_slice(value);
+                let drop_rate = u32::from_ne_bytes(raw);
+                if drop_rate > DROP_RATE_MAX {
+                    return Err(Error::new(EINVAL));
+                }
+                self.drop_rate.set(drop_rate);
+                Ok(())
+            }
+            _ => Err(Error::new(EINVAL)),
+        }
+    }
+
+    fn process_io(&self) {
+        if let Some(io_queue) = self.io_queue.borrow_mut().as_mut() {
+            while let Some(cmd) = io_queue.pop() {
+                self.process_io_one(cmd);
+            }
+        }
+        self.recv();
+    }
+
+    fn io_pending(&self) -> bool {
+        let io_submitted = self.io_queue.borrow().as_ref().map_or(false, |io_queue| !io_queue.is_empty());
+        io_submitted || !self.inflight.borrow().is_empty()
+    }
+}
+
+/// Registers the loopback device.
+#[no_mangle]
+pub extern "C" fn loopback_init() {
+    match LoopbackDevice::new() {
+        Some(dev) => {
+            register_device(Rc::new(Device::new(LOOPBACK_DEV_NAME, RefCell::new(Rc::new(dev)))));
+        }
+        None => {
+            println!("loopback: unable to allocate memory");
+        }
+    }
+}
@@ -9,20 +9,30 @@
 //! the Slab Allocator to Many CPUs and Arbitrary Resources." USENIX
 //! Annual Technical Conference, General Track. 2001.
 
-use intrusive_collections::{Bound, UnsafeRef, RBTree, RBTreeLink, KeyAdapter};
+use intrusive_collections::{Bound, UnsafeRef, LinkedList, LinkedListLink, RBTree, RBTreeLink, KeyAdapter};
 use alloc::alloc::{GlobalAlloc, Layout};
+use core::cmp;
 use core::intrinsics::transmute;
+use core::ptr;
+use errno::{Error, Result, EINVAL, ENOMEM};
+use mmu;
 use print;
 
 const KIB: u64 = 1 << 10;
 const MIB: u64 = 1 << 20;
+const GIB: u64 = 1 << 30;
 
 pub const PAGE_SIZE_SMALL: u64 = 4 * KIB;
 pub const PAGE_SIZE_LARGE: u64 = 2 * MIB;
+pub const PAGE_SIZE_HUGE: u64 = 1 * GIB;
+
+/// Order of a huge page for `page_alloc_order`.
+pub const PAGE_ORDER_HUGE: u32 = 18;
 
 /// Memory segment.
 ///
-/// A memory segment is a contiguous span of memory.
+/// A memory segment is a contiguous span of free memory. The segment header is
+/// stored at the beginning of the span itself.
 #[derive(Debug)]
 struct MemorySegment {
     /// Base address of the memory segment.
@@ -31,10 +41,14 @@ struct MemorySegment {
     pub size: u64,
     /// Link in segments red-black tree.
     pub segments_link: RBTreeLink,
+    /// Link in the free list of the segment size.
+    pub freelist_link: LinkedListLink,
 }
 
 intrusive_adapter!(SegmentsAdaptor = UnsafeRef<MemorySegment>: MemorySegment { segments_link: RBTreeLink });
 
+intrusive_adapter!(FreelistAdaptor = UnsafeRef<MemorySegment>: MemorySegment { freelist_link: LinkedListLink });
+
 impl<'a> KeyAdapter<'a> for SegmentsAdaptor {
     type Key = u64;
     fn get_key(&self, x: &'a MemorySegment) -> u64 {
@@ -49,96 +63,166 @@ impl MemorySegment {
             base,
             size,
             segments_link: RBTreeLink::new(),
+            freelist_link: LinkedListLink::new(),
         }
     }
+}
 
-    /// Splits `size` bytes from the beginning of this memory segment.
-    ///
-    /// Note! The `self` memory segment is invalid after a call to the `split` function.
-    fn split(&self, size: u64) -> &MemorySegment {
-        unsafe {
-            let seg : &mut MemorySegment = transmute(self.base + size);
-            *seg = MemorySegment::new(self.base + size, self.size - size);
-            seg
-        }
-    }
+/// Number of segment free lists. Free list `n` holds the free segments whose
+/// size is in the range [2^n, 2^(n+1)).
+const NR_FREELISTS: usize = 64;
+
+const EMPTY_FREELIST: LinkedList<FreelistAdaptor> = LinkedList::new(FreelistAdaptor::NEW);
+
+/// Returns the index of the free list of segments of `size` bytes.
+fn freelist_index(size: u64) -> usize {
+    63 - size.leading_zeros() as usize
 }
 
 /// Memory arena.
 ///
-/// A memory arena is a collection of memory segments.
+/// A memory arena is a collection of memory segments. Free segments are kept
+/// both in a red-black tree ordered by base address, which finds the
+/// neighbours of a freed span for coalescing, and in power-of-two free lists,
+/// which find a segment of any size in constant time ("instant fit" in Vmem).
 struct MemoryArena {
     /// Memory segments, ordered by base address.
     segments: RBTree<SegmentsAdaptor>,
+    /// Memory segments, segregated by size.
+    freelists: [LinkedList<FreelistAdaptor>; NR_FREELISTS],
+    /// Bit `n` is set if free list `n` is not empty.
+    freelist_map: u64,
+    /// Allocation granularity, which segment bases and sizes are multiples of.
+    quantum: u64,
+    /// Number of free bytes in the arena.
+    free_size: u64,
+    /// Number of allocations from the arena.
+    nr_allocs: u64,
+    /// Number of frees to the arena.
+    nr_frees: u64,
+    /// Number of allocations that found no fitting segment.
+    nr_failures: u64,
 }
 
 impl MemoryArena {
-    const fn new() -> Self {
-        MemoryArena { segments: RBTree::new(SegmentsAdaptor::NEW) }
+    const fn new(quantum: u64) -> Self {
+        MemoryArena {
+            segments: RBTree::new(SegmentsAdaptor::NEW),
+            freelists: [EMPTY_FREELIST; NR_FREELISTS],
+            freelist_map: 0,
+            quantum,
+            free_size: 0,
+            nr_allocs: 0,
+            nr_frees: 0,
+            nr_failures: 0,
+        }
     }
 
+    /// Allocates `size` bytes, which must be a multiple of the arena quantum.
     unsafe fn alloc(&mut self, size: u64) -> *mut u8 {
-        let mut cur = self.segments.front_mut();
-        match cur.get() {
-            Some(seg) => {
-                if seg.size < size {
-                    return transmute(0u64);
-                }
-                let ret = seg.base;
-                if seg.size > size {
-                    let new_seg = seg.split(size);
-                    let reference = UnsafeRef::from_raw(new_seg);
-                    cur.replace_with(reference).expect("memory segment replacement failed");
-                } else {
-                    cur.remove();
-                }
-                transmute(ret)
-            }
-            None => transmute(0u64)
+        self.xalloc(size, self.quantum)
+    }
+
+    /// Allocates `size` bytes aligned to `align`. The unused head and tail of
+    /// the segment are returned to the arena, so `size` and `align` must be
+    /// multiples of the arena quantum.
+    unsafe fn xalloc(&mut self, size: u64, align: u64) -> *mut u8 {
+        let align = cmp::max(align, self.quantum);
+        if size == 0 {
+            return ptr::null_mut();
+        }
+        let seg = self.find_segment(size, align);
+        if seg.is_null() {
+            self.nr_failures += 1;
+            return ptr::null_mut();
         }
+        self.nr_allocs += 1;
+        let (base, end) = ((*seg).base, (*seg).base + (*seg).size);
+        self.remove_segment(seg);
+        let start = align_up(base, align);
+        if base != start {
+            self.insert_segment(base, start - base);
+        }
+        if start + size != end {
+            self.insert_segment(start + size, end - (start + size));
+        }
+        transmute(start)
     }
 
-    unsafe fn free(&mut self, raw_addr: *mut u8, mut size: u64) {
-        let mut addr : u64 = transmute(raw_addr);
-        {
-            // Attempt to coalesce with next segment:
-            let mut cursor = self.segments.find_mut(&(addr + size));
-            let coalesced = cursor.get().map_or(false, |next| {
-                if addr + size == next.base {
-                    size += next.size;
-                    true
-                } else {
-                    false
-                }
-            });
-            if coalesced {
-                cursor.remove();
+    /// Returns a free segment that fits `size` bytes aligned to `align`, or
+    /// null if there is none.
+    unsafe fn find_segment(&self, size: u64, align: u64) -> *const MemorySegment {
+        // Segment bases are multiples of the quantum, so every segment of at
+        // least `need` bytes fits. Such segments are in the free lists from
+        // `fit_idx` up, and the first non-empty one is found from the bitmap.
+        let need = size + (align - self.quantum);
+        let fit_idx = if need.is_power_of_two() { freelist_index(need) } else { freelist_index(need) + 1 };
+        if fit_idx < NR_FREELISTS {
+            let map = self.freelist_map & !((1u64 << fit_idx) - 1);
+            if map != 0 {
+                let idx = map.trailing_zeros() as usize;
+                return self.freelists[idx].front().get().map_or(ptr::null(), |seg| seg as *const MemorySegment);
             }
         }
-        {
-            // Attempt to coalesce with previous segment:
-            let mut cursor = self.segments.upper_bound_mut(Bound::Excluded(&addr));
-            let coalesced = cursor.get().map_or(false, |prev| {
-                if prev.base + prev.size == addr {
-                    addr = prev.base;
-                    size += prev.size;
-                    true
-                } else {
-                    false
+        // The smaller segments only fit depending on their size and alignment,
+        // so they are searched one by one.
+        for idx in freelist_index(size)..cmp::min(fit_idx, NR_FREELISTS) {
+            for seg in self.freelists[idx].iter() {
+                if align_up(seg.base, align) + size <= seg.base + seg.size {
+                    return seg;
                 }
-            });
-            if coalesced {
-                cursor.remove();
             }
         }
-        let seg : &mut MemorySegment = transmute(addr);
-        *seg = MemorySegment::new(addr, size);
-        self.add_to_freelist(seg);
+        ptr::null()
+    }
+
+    unsafe fn free(&mut self, raw_addr: *mut u8, size: u64) {
+        self.nr_frees += 1;
+        self.add_span(raw_addr, size);
+    }
+
+    /// Adds the free span of `size` bytes at `raw_addr` to the arena, and
+    /// coalesces it with its neighbours. Unlike `free`, the span is not
+    /// accounted as a free, because it was not allocated from the arena.
+    unsafe fn add_span(&mut self, raw_addr: *mut u8, mut size: u64) {
+        let mut addr : u64 = transmute(raw_addr);
+        // Attempt to coalesce with next segment:
+        let next = self.segments.find(&(addr + size)).get().map_or(ptr::null(), |next| next as *const MemorySegment);
+        if !next.is_null() {
+            size += (*next).size;
+            self.remove_segment(next);
+        }
+        // Attempt to coalesce with previous segment:
+        let prev = self.segments.upper_bound(Bound::Excluded(&addr)).get().map_or(ptr::null(), |prev| prev as *const MemorySegment);
+        if !prev.is_null() && (*prev).base + (*prev).size == addr {
+            addr = (*prev).base;
+            size += (*prev).size;
+            self.remove_segment(prev);
+        }
+        self.insert_segment(addr, size);
     }
 
-    unsafe fn add_to_freelist(&mut self, seg: &MemorySegment) {
-        let reference = UnsafeRef::from_raw(seg);
-        self.segments.insert(reference);
+    /// Adds the free span of `size` bytes at `base` to the arena without
+    /// coalescing it with its neighbours.
+    unsafe fn insert_segment(&mut self, base: u64, size: u64) {
+        let seg: *mut MemorySegment = transmute(base);
+        ptr::write(seg, MemorySegment::new(base, size));
+        let idx = freelist_index(size);
+        self.segments.insert(UnsafeRef::from_raw(seg));
+        // Recently freed memory is reused first, while it is still cached.
+        self.freelists[idx].push_front(UnsafeRef::from_raw(seg));
+        self.freelist_map |= 1u64 << idx;
+        self.free_size += size;
+    }
+
+    unsafe fn remove_segment(&mut self, seg: *const MemorySegment) {
+        let idx = freelist_index((*seg).size);
+        self.free_size -= (*seg).size;
+        self.segments.cursor_mut_from_ptr(seg).remove();
+        self.freelists[idx].cursor_mut_from_ptr(seg).remove();
+        if self.freelists[idx].is_empty() {
+            self.freelist_map &= !(1u64 << idx);
+        }
     }
 
     #[allow(dead_code)]
@@ -150,25 +234,238 @@ impl MemoryArena {
     }
 }
 
-/// The kernel small page arena.
-static mut KERNEL_SMALL_PAGE_ARENA: MemoryArena = MemoryArena::new();
+/// Maximum number of NUMA nodes.
+pub const MAX_NUMA_NODES: usize = 8;
+
+extern "C" {
+    fn numa_nr_nodes() -> i32;
+    fn numa_distance(from: i32, to: i32) -> i32;
+    fn numa_current_node() -> i32;
+    fn numa_memory_node(addr: u64, end: *mut u64) -> i32;
+}
+
+/// The page arenas of a NUMA node.
+struct NodeArenas {
+    /// The small page arena.
+    small: MemoryArena,
+    /// The large page arena.
+    large: MemoryArena,
+    /// The DMA memory arena. The arena is refilled with large pages when it
+    /// runs out of memory, and never returns memory to the large page arena.
+    dma: MemoryArena,
+}
+
+impl NodeArenas {
+    const fn new() -> Self {
+        NodeArenas {
+            small: MemoryArena::new(PAGE_SIZE_SMALL),
+            large: MemoryArena::new(PAGE_SIZE_LARGE),
+            dma: MemoryArena::new(DMA_ALIGN_MIN as u64),
+        }
+    }
+}
+
+const EMPTY_NODE_ARENAS: NodeArenas = NodeArenas::new();
 
-static mut KERNEL_LARGE_PAGE_ARENA: MemoryArena = MemoryArena::new();
+/// The kernel page arenas, one set per NUMA node. Memory is always freed to
+/// the arenas of the node it belongs to.
+static mut NODE_ARENAS: [NodeArenas; MAX_NUMA_NODES] = [EMPTY_NODE_ARENAS; MAX_NUMA_NODES];
 
-/// Register a memory span to the kernel arena.
+/// Returns the NUMA node of kernel virtual address `addr`.
+fn node_of(addr: u64) -> usize {
+    unsafe {
+        if numa_nr_nodes() == 1 {
+            return 0;
+        }
+        let mut end = 0;
+        numa_memory_node(mmu::virt_to_phys(addr as usize) as u64, &mut end) as usize
+    }
+}
+
+/// Returns the NUMA node of the calling CPU.
+pub fn current_node() -> usize {
+    unsafe { numa_current_node() as usize }
+}
+
+/// Calls `f` for NUMA node `node` and then for the other nodes from the
+/// nearest to the farthest, until it returns a non-null address. If all nodes
+/// fail, the pre-zeroed page pool is drained and the nodes are tried again.
+fn alloc_nearest<F: FnMut(usize) -> *mut u8>(node: usize, mut f: F) -> *mut u8 {
+    let addr = alloc_nearest_once(node, &mut f);
+    if !addr.is_null() || !unsafe { page_zero_drain() } {
+        return addr;
+    }
+    alloc_nearest_once(node, &mut f)
+}
+
+fn alloc_nearest_once<F: FnMut(usize) -> *mut u8>(node: usize, f: &mut F) -> *mut u8 {
+    let addr = f(node);
+    let nr_nodes = unsafe { numa_nr_nodes() as usize };
+    if !addr.is_null() || nr_nodes == 1 {
+        return addr;
+    }
+    let mut tried = 1u64 << node;
+    for _ in 1..nr_nodes {
+        let mut nearest = None;
+        for other in 0..nr_nodes {
+            if tried & (1u64 << other) != 0 {
+                continue;
+            }
+            let distance = unsafe { numa_distance(node as i32, other as i32) };
+            if nearest.map_or(true, |(_, d)| distance < d) {
+                nearest = Some((other, distance));
+            }
+        }
+        let other = match nearest {
+            Some((other, _)) => other,
+            None => break,
+        };
+        tried |= 1u64 << other;
+        let addr = f(other);
+        if !addr.is_null() {
+            return addr;
+        }
+    }
+    ptr::null_mut()
+}
+
+/// Counters of the memory that the small and large page arenas exchange.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct PageArenaStats {
+    /// Number of free bytes in the small page arena.
+    pub small_free: u64,
+    /// Number of free bytes in the large page arena.
+    pub large_free: u64,
+    /// Number of large pages that were split into the small page arena.
+    pub large_pages_split: u64,
+    /// Number of free large pages that were reclaimed from the small page arena.
+    pub large_pages_reclaimed: u64,
+}
+
+static mut PAGE_ARENA_STATS: PageArenaStats = PageArenaStats {
+    small_free: 0,
+    large_free: 0,
+    large_pages_split: 0,
+    large_pages_reclaimed: 0,
+};
+
+/// Moves a large page to the small page arena of `node`. Returns `false` if
+/// the large page arena of the node is empty.
+unsafe fn small_arena_grow(node: usize) -> bool {
+    let arenas = &mut NODE_ARENAS[node];
+    let page = arenas.large.alloc(PAGE_SIZE_LARGE);
+    if page.is_null() {
+        return false;
+    }
+    arenas.small.add_span(page, PAGE_SIZE_LARGE);
+    PAGE_ARENA_STATS.large_pages_split += 1;
+    true
+}
+
+/// Allocates `size` bytes aligned to `align` from the large page arena of
+/// `node`. If the large page arena has no such range, fully free
+/// large-page-aligned ranges of the small page arena, which were split from
+/// large pages earlier, are allocated instead.
+unsafe fn large_arena_xalloc(node: usize, size: u64, align: u64) -> *mut u8 {
+    let arenas = &mut NODE_ARENAS[node];
+    let addr = arenas.large.xalloc(size, align);
+    if !addr.is_null() {
+        return addr;
+    }
+    // Small pages that are cached in the magazine layer keep ranges of the
+    // small page arena from coalescing.
+    page_cache_drain();
+    let addr = arenas.small.xalloc(size, align);
+    if !addr.is_null() {
+        PAGE_ARENA_STATS.large_pages_reclaimed += size / PAGE_SIZE_LARGE;
+    }
+    addr
+}
+
+/// Returns the page arena counters, summed over all NUMA nodes.
+#[no_mangle]
+pub unsafe extern "C" fn page_arena_get_stats(stats: *mut PageArenaStats) {
+    let mut ret = PAGE_ARENA_STATS;
+    for arenas in NODE_ARENAS.iter() {
+        ret.small_free += arenas.small.free_size;
+        ret.large_free += arenas.large.free_size;
+    }
+    *stats = ret;
+}
+
+/// Statistics of a page arena of a NUMA node, which mirror `struct
+/// kmem_arena_stats` of the kmem_stats system call.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct KmemArenaStats {
+    pub node: u32,
+    pub arena_type: u32,
+    pub free_bytes: u64,
+    pub allocs: u64,
+    pub frees: u64,
+    pub failures: u64,
+}
+
+pub const KMEM_ARENA_SMALL: u32 = 0;
+pub const KMEM_ARENA_LARGE: u32 = 1;
+pub const KMEM_ARENA_DMA: u32 = 2;
+
+/// Returns the statistics of the page arena of type `arena_type` of NUMA
+/// node `node`.
+#[no_mangle]
+pub unsafe extern "C" fn page_arena_get_node_stats(node: i32, arena_type: u32, stats: *mut KmemArenaStats) -> i32 {
+    if node < 0 || node as usize >= MAX_NUMA_NODES {
+        return Error::new(EINVAL).errno();
+    }
+    let arenas = &NODE_ARENAS[node as usize];
+    let arena = match arena_type {
+        KMEM_ARENA_SMALL => &arenas.small,
+        KMEM_ARENA_LARGE => &arenas.large,
+        KMEM_ARENA_DMA => &arenas.dma,
+        _ => return Error::new(EINVAL).errno(),
+    };
+    *stats = KmemArenaStats {
+        node: node as u32,
+        arena_type,
+        free_bytes: arena.free_size,
+        allocs: arena.nr_allocs,
+        frees: arena.nr_frees,
+        failures: arena.nr_failures,
+    };
+    0
+}
+
+/// Register a memory span to the kernel arena. The span is split at NUMA node
+/// boundaries, and every part is registered to the arenas of its node.
 #[no_mangle]
 pub extern "C" fn memory_add_span(start: u64, size: u64) {
     let end = start + size;
+    let mut start = start;
+    while start < end {
+        let phys = unsafe { mmu::virt_to_phys(start as usize) as u64 };
+        let mut node_end = 0;
+        let node = unsafe { numa_memory_node(phys, &mut node_end) as usize };
+        let len = cmp::min(end - start, node_end.saturating_sub(phys));
+        let len = if len == 0 { end - start } else { len };
+        memory_add_node_span(node, start, start + len);
+        start += len;
+    }
+}
+
+fn memory_add_node_span(node: usize, start: u64, end: u64) {
     let large_start = align_up(start, PAGE_SIZE_LARGE);
     let large_end = align_down(end, PAGE_SIZE_LARGE);
-    if start != large_start {
-        memory_add_span_small(start, large_start);
+    if large_start >= large_end {
+        memory_add_span_small(node, start, end);
+        return;
     }
-    if large_start != large_end {
-        memory_add_span_large(large_start, large_end);
+    if start != large_start {
+        memory_add_span_small(node, start, large_start);
     }
+    memory_add_span_large(node, large_start, large_end);
     if end != large_end {
-        memory_add_span_small(large_end, end);
+        memory_add_span_small(node, large_end, end);
     }
 }
 
@@ -184,19 +481,15 @@ pub fn align_up(value: u64, align: u64) -> u64 {
     align_down(value + align - 1, align)
 }
 
-fn memory_add_span_small(start: u64, end: u64) {
+fn memory_add_span_small(node: usize, start: u64, end: u64) {
     unsafe {
-        let seg : &mut MemorySegment = transmute(start);
-        *seg = MemorySegment::new(start, end-start);
-        KERNEL_SMALL_PAGE_ARENA.add_to_freelist(seg);
+        NODE_ARENAS[node].small.add_span(transmute(start), end - start);
     }
 }
 
-fn memory_add_span_large(start: u64, end: u64) {
+fn memory_add_span_large(node: usize, start: u64, end: u64) {
     unsafe {
-        let seg : &mut MemorySegment = transmute(start);
-        *seg = MemorySegment::new(start, end-start);
-        KERNEL_LARGE_PAGE_ARENA.add_to_freelist(seg);
+        NODE_ARENAS[node].large.add_span(transmute(start), end - start);
     }
 }
 
@@ -204,30 +497,274 @@ fn memory_add_span_large(start: u64, end: u64) {
 #[no_mangle]
 pub extern "C" fn page_alloc_init() {}
 
+extern "C" {
+    fn page_cache_alloc_small() -> *mut u8;
+    fn page_cache_free_small(addr: *mut u8);
+    fn page_cache_drain();
+    fn page_zero_drain() -> bool;
+}
+
+extern "C" {
+    /// Allocate a zeroed small page, preferably from the pool of pages that
+    /// the idle loop zeroes ahead of time.
+    pub fn page_alloc_small_zeroed() -> *mut u8;
+    /// Allocate a zeroed large page, preferably from the pool of pages that
+    /// the idle loop zeroes ahead of time.
+    pub fn page_alloc_large_zeroed() -> *mut u8;
+}
+
 /// Allocate a small page.
+///
+/// Small pages are cached in a magazine layer in front of the small page
+/// arena, so most allocations do not touch the arena.
 #[no_mangle]
 pub extern "C" fn page_alloc_small() -> *mut u8 {
     unsafe {
-        KERNEL_SMALL_PAGE_ARENA.alloc(PAGE_SIZE_SMALL)
+        page_cache_alloc_small()
     }
 }
 
 /// Free a small page.
 #[no_mangle]
 pub unsafe extern "C" fn page_free_small(addr: *mut u8) {
-    KERNEL_SMALL_PAGE_ARENA.free(addr, PAGE_SIZE_SMALL);
+    // Pages of remote nodes bypass the magazine layer, which would otherwise
+    // hand them out to local allocations.
+    if numa_nr_nodes() > 1 && node_of(addr as u64) != current_node() {
+        page_arena_free_small(addr);
+        return;
+    }
+    page_cache_free_small(addr);
+}
+
+/// Allocate a small page from the small page arena of NUMA node `node`,
+/// falling back to the nearest other node. The small page arena of a node is
+/// grown with a large page of the node when it runs out of memory.
+#[no_mangle]
+pub extern "C" fn page_alloc_small_node(node: i32) -> *mut u8 {
+    if node < 0 || node as usize >= MAX_NUMA_NODES {
+        return ptr::null_mut();
+    }
+    alloc_nearest(node as usize, |node| unsafe {
+        let arena = &mut NODE_ARENAS[node].small;
+        let addr = arena.alloc(PAGE_SIZE_SMALL);
+        if !addr.is_null() || !small_arena_grow(node) {
+            return addr;
+        }
+        arena.alloc(PAGE_SIZE_SMALL)
+    })
+}
+
+/// Allocate a small page from the small page arena of the calling CPU's node.
+#[no_mangle]
+pub extern "C" fn page_arena_alloc_small() -> *mut u8 {
+    page_alloc_small_node(current_node() as i32)
+}
+
+/// Free a small page to the small page arena.
+#[no_mangle]
+pub unsafe extern "C" fn page_arena_free_small(addr: *mut u8) {
+    NODE_ARENAS[node_of(addr as u64)].small.free(addr, PAGE_SIZE_SMALL);
+}
+
+/// Allocate 2^`order` physically contiguous small pages that are aligned to
+/// their total size.
+#[no_mangle]
+pub extern "C" fn page_alloc_order(order: u32) -> *mut u8 {
+    if order >= 32 {
+        return ptr::null_mut();
+    }
+    let size = PAGE_SIZE_SMALL << order;
+    alloc_nearest(current_node(), |node| unsafe {
+        let arenas = &mut NODE_ARENAS[node];
+        let mut addr = arenas.small.xalloc(size, size);
+        // Pages that are cached in the magazine layer fragment the arena, so
+        // return them to the arena before growing it.
+        if addr.is_null() && order > 0 {
+            page_cache_drain();
+            addr = arenas.small.xalloc(size, size);
+        }
+        if addr.is_null() {
+            if size < PAGE_SIZE_LARGE {
+                if small_arena_grow(node) {
+                    addr = arenas.small.xalloc(size, size);
+                }
+            } else {
+                // The pages are freed to the small page arena, from where
+                // they are reclaimed as large pages again.
+                addr = arenas.large.xalloc(size, size);
+                if !addr.is_null() {
+                    PAGE_ARENA_STATS.large_pages_split += size / PAGE_SIZE_LARGE;
+                }
+            }
+        }
+        addr
+    })
+}
+
+/// Free 2^`order` small pages that were allocated with `page_alloc_order`.
+#[no_mangle]
+pub unsafe extern "C" fn page_free_order(addr: *mut u8, order: u32) {
+    NODE_ARENAS[node_of(addr as u64)].small.free(addr, PAGE_SIZE_SMALL << order);
+}
+
+/// Allocate a large page from NUMA node `node`, falling back to the nearest
+/// other node.
+#[no_mangle]
+pub extern "C" fn page_alloc_large_node(node: i32) -> *mut u8 {
+    if node < 0 || node as usize >= MAX_NUMA_NODES {
+        return ptr::null_mut();
+    }
+    alloc_nearest(node as usize, |node| unsafe { large_arena_xalloc(node, PAGE_SIZE_LARGE, PAGE_SIZE_LARGE) })
 }
 
 /// Allocate a large page.
 #[no_mangle]
 pub unsafe extern "C" fn page_alloc_large() -> *mut u8 {
-    KERNEL_LARGE_PAGE_ARENA.alloc(PAGE_SIZE_LARGE)
+    page_alloc_large_node(current_node() as i32)
 }
 
 /// Free a large page.
 #[no_mangle]
 pub unsafe extern "C" fn page_free_large(addr: *mut u8) {
-    KERNEL_LARGE_PAGE_ARENA.free(addr, PAGE_SIZE_LARGE)
+    NODE_ARENAS[node_of(addr as u64)].large.free(addr, PAGE_SIZE_LARGE)
+}
+
+/// Minimum alignment and size granularity of DMA memory.
+pub const DMA_ALIGN_MIN: usize = 64;
+
+/// Back the DMA memory region with dedicated large pages.
+pub const DMA_ALLOC_LARGE_PAGE: u32 = 1 << 0;
+
+/// DMA memory region.
+///
+/// A DMA memory region is physically contiguous memory that is shared with
+/// devices. The kernel virtual address and the physical address of the region
+/// are returned together, so drivers do not have to translate addresses.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct DmaRegion {
+    /// Kernel virtual address of the region.
+    pub virt: usize,
+    /// Physical address of the region.
+    pub phys: usize,
+    /// Size of the region.
+    pub size: usize,
+    /// Allocation flags.
+    pub flags: u32,
+    /// NUMA node of the region.
+    pub node: u32,
+}
+
+impl DmaRegion {
+    /// Allocates a zeroed DMA memory region of `size` bytes that is aligned to
+    /// `align` bytes, which must be a power of two, from the NUMA node of the
+    /// calling CPU.
+    pub fn alloc(size: usize, align: usize, flags: u32) -> Result<DmaRegion> {
+        DmaRegion::alloc_node(size, align, flags, current_node())
+    }
+
+    /// Allocates a zeroed DMA memory region like `alloc`, but from NUMA node
+    /// `node`, which should be the node that the device is attached to. If
+    /// the node is out of memory, the nearest other node is used instead.
+    pub fn alloc_node(size: usize, align: usize, flags: u32, node: usize) -> Result<DmaRegion> {
+        if size == 0 || !align.is_power_of_two() || node >= MAX_NUMA_NODES {
+            return Err(Error::new(EINVAL));
+        }
+        let (size, align) = if flags & DMA_ALLOC_LARGE_PAGE != 0 {
+            (align_up(size as u64, PAGE_SIZE_LARGE), cmp::max(align as u64, PAGE_SIZE_LARGE))
+        } else {
+            (align_up(size as u64, DMA_ALIGN_MIN as u64), cmp::max(align as u64, DMA_ALIGN_MIN as u64))
+        };
+        let addr = alloc_nearest(node, |node| unsafe {
+            if flags & DMA_ALLOC_LARGE_PAGE != 0 {
+                return large_arena_xalloc(node, size, align);
+            }
+            let arena = &mut NODE_ARENAS[node].dma;
+            let addr = arena.xalloc(size, align);
+            if !addr.is_null() || !dma_arena_refill(node, size, align) {
+                return addr;
+            }
+            arena.xalloc(size, align)
+        });
+        if addr.is_null() {
+            return Err(Error::new(ENOMEM));
+        }
+        let (virt, size) = (addr as usize, size as usize);
+        unsafe { ptr::write_bytes(virt as *mut u8, 0, size) };
+        Ok(DmaRegion {
+            virt,
+            phys: unsafe { mmu::virt_to_phys(virt) },
+            size,
+            flags,
+            node: node_of(virt as u64) as u32,
+        })
+    }
+
+    /// Frees the DMA memory region. The region must not be accessed by the
+    /// kernel or devices afterwards.
+    pub unsafe fn free(&self) {
+        if self.virt == 0 {
+            return;
+        }
+        let arenas = &mut NODE_ARENAS[self.node as usize];
+        if self.flags & DMA_ALLOC_LARGE_PAGE != 0 {
+            arenas.large.free(self.virt as *mut u8, self.size as u64);
+        } else {
+            arenas.dma.free(self.virt as *mut u8, self.size as u64);
+        }
+    }
+
+    /// Returns the physical address of kernel virtual address `addr`, which
+    /// must be within the region.
+    pub fn phys_addr(&self, addr: usize) -> usize {
+        self.phys + (addr - self.virt)
+    }
+}
+
+/// Refills the DMA arena of `node` with large pages of the node so that an
+/// allocation of `size` bytes aligned to `align` bytes succeeds.
+unsafe fn dma_arena_refill(node: usize, size: u64, align: u64) -> bool {
+    let refill_size = align_up(size, PAGE_SIZE_LARGE);
+    let refill_align = cmp::max(align, PAGE_SIZE_LARGE);
+    let addr = large_arena_xalloc(node, refill_size, refill_align);
+    if addr.is_null() {
+        return false;
+    }
+    NODE_ARENAS[node].dma.add_span(addr, refill_size);
+    true
+}
+
+/// Allocate a DMA memory region.
+#[no_mangle]
+pub unsafe extern "C" fn dma_alloc(region: *mut DmaRegion, size: usize, align: usize, flags: u32) -> i32 {
+    match DmaRegion::alloc(size, align, flags) {
+        Ok(r) => {
+            *region = r;
+            0
+        }
+        Err(err) => err.errno(),
+    }
+}
+
+/// Allocate a DMA memory region from NUMA node `node`.
+#[no_mangle]
+pub unsafe extern "C" fn dma_alloc_node(region: *mut DmaRegion, size: usize, align: usize, flags: u32, node: i32) -> i32 {
+    if node < 0 {
+        return Error::new(EINVAL).errno();
+    }
+    match DmaRegion::alloc_node(size, align, flags, node as usize) {
+        Ok(r) => {
+            *region = r;
+            0
+        }
+        Err(err) => err.errno(),
+    }
+}
+
+/// Free a DMA memory region.
+#[no_mangle]
+pub unsafe extern "C" fn dma_free(region: *const DmaRegion) {
+    (*region).free();
 }
 
 pub struct KAllocator;
@@ -242,14 +779,21 @@ extern "C" {
     pub fn kmem_alloc(size: usize) -> usize;
     pub fn kmem_zalloc(size: usize) -> usize;
     pub fn kmem_free(ptr: usize, size: usize);
+    pub fn kmem_alloc_align(size: usize, align: usize) -> *mut u8;
+    pub fn kmem_free_align(ptr: *mut u8, size: usize, align: usize);
+    pub fn kmem_realloc_align(ptr: *mut u8, old_size: usize, new_size: usize, align: usize) -> *mut u8;
 }
 
 unsafe impl GlobalAlloc for KAllocator {
     unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
-        transmute(kmem_alloc(layout.size()))
+        kmem_alloc_align(layout.size(), layout.align())
     }
 
     unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
-        kmem_free(ptr as usize, layout.size());
+        kmem_free_align(ptr, layout.size(), layout.align());
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        kmem_realloc_align(ptr, layout.size(), new_size, layout.align())
     }
 }
@@ -0,0 +1,482 @@
+//! Network packet helpers for network device drivers.
+//!
+//! This module provides Internet checksum calculation, a software
+//! implementation of generic segmentation offload (GSO), which drivers fall
+//! back to when the device cannot segment large packets itself, and generic
+//! receive offload (GRO), which merges received packets of the same flow.
+//! It also defines the device statistics that drivers export to user space.
+
+use core::cell::Cell;
+use core::cmp;
+use errno::{Error, Result, EINVAL};
+
+/// A network offload header that describes checksum and segmentation offload
+/// requests for a frame. The layout is identical to the virtio-net header.
+///
+/// NOTE! When modifying this data structure, please make sure it matches the C
+/// definition in `include/uapi/manticore/net_offload_abi.h`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct NetOffloadHdr {
+    pub flags: u8,
+    pub gso_type: u8,
+    pub hdr_len: u16,
+    pub gso_size: u16,
+    pub csum_start: u16,
+    pub csum_offset: u16,
+}
+
+/// The checksum at `csum_start + csum_offset` needs to be completed.
+pub const NET_OFFLOAD_F_NEEDS_CSUM: u8 = 1;
+/// The packet checksum has been validated.
+pub const NET_OFFLOAD_F_DATA_VALID: u8 = 2;
+
+/// Segmentation offload types.
+pub const NET_GSO_NONE: u8 = 0;
+pub const NET_GSO_TCPV4: u8 = 1;
+pub const NET_GSO_UDP: u8 = 3;
+pub const NET_GSO_UDP_L4: u8 = 5;
+
+/// A statistics counter.
+#[repr(transparent)]
+#[derive(Debug, Default)]
+pub struct Counter(Cell<u64>);
+
+impl Counter {
+    /// Adds `n` to the counter.
+    pub fn add(&self, n: u64) {
+        self.0.set(self.0.get().wrapping_add(n));
+    }
+
+    /// Increments the counter by one.
+    pub fn inc(&self) {
+        self.add(1);
+    }
+
+    pub fn get(&self) -> u64 {
+        self.0.get()
+    }
+}
+
+/// Network device queue statistics.
+///
+/// NOTE! When modifying this data structure, please make sure it matches the C
+/// definition in `include/uapi/manticore/net_stats_abi.h`.
+#[repr(C)]
+#[derive(Debug, Default)]
+pub struct NetQueueStats {
+    pub packets: Counter,
+    pub bytes: Counter,
+    pub drops: Counter,
+    pub ring_full: Counter,
+    pub event_overflows: Counter,
+    pub interrupts: Counter,
+    pub doorbells: Counter,
+}
+
+/// Network device statistics.
+#[repr(C)]
+#[derive(Debug, Default)]
+pub struct NetDeviceStats {
+    pub rx: NetQueueStats,
+    pub tx: NetQueueStats,
+}
+
+const ETH_HLEN: usize = 14;
+const ETH_P_IP: u16 = 0x0800;
+const IP_HLEN_MIN: usize = 20;
+const IP_MF: u16 = 0x2000;
+const IP_OFFMASK: u16 = 0x1fff;
+const IPPROTO_TCP: u8 = 6;
+const IPPROTO_UDP: u8 = 17;
+const TCP_HLEN_MIN: usize = 20;
+const TCP_FLAG_FIN: u8 = 0x01;
+const TCP_FLAG_SYN: u8 = 0x02;
+const TCP_FLAG_RST: u8 = 0x04;
+const TCP_FLAG_PSH: u8 = 0x08;
+const TCP_FLAG_URG: u8 = 0x20;
+const UDP_HLEN: usize = 8;
+
+fn read_be16(buf: &[u8], off: usize) -> u16 {
+    ((buf[off] as u16) << 8) | buf[off + 1] as u16
+}
+
+fn write_be16(buf: &mut [u8], off: usize, val: u16) {
+    buf[off] = (val >> 8) as u8;
+    buf[off + 1] = val as u8;
+}
+
+fn read_be32(buf: &[u8], off: usize) -> u32 {
+    ((read_be16(buf, off) as u32) << 16) | read_be16(buf, off + 2) as u32
+}
+
+fn write_be32(buf: &mut [u8], off: usize, val: u32) {
+    write_be16(buf, off, (val >> 16) as u16);
+    write_be16(buf, off + 2, val as u16);
+}
+
+/// Adds the 16-bit words of `buf` to the one's complement sum `sum`.
+pub fn checksum_add(mut sum: u64, buf: &[u8]) -> u64 {
+    let mut words = buf.chunks_exact(2);
+    for word in &mut words {
+        sum += ((word[0] as u64) << 8) | word[1] as u64;
+    }
+    let rem = words.remainder();
+    if rem.len() == 1 {
+        sum += (rem[0] as u64) << 8;
+    }
+    sum
+}
+
+/// Folds the one's complement sum `sum` into a 16-bit Internet checksum.
+pub fn checksum_finalize(mut sum: u64) -> u16 {
+    while sum >> 16 != 0 {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    !(sum as u16)
+}
+
+/// Returns the sum of the IPv4 pseudo-header for the IP header `iph`.
+fn pseudo_header_sum(iph: &[u8], proto: u8, len: usize) -> u64 {
+    checksum_add(0, &iph[12..20]) + proto as u64 + len as u64
+}
+
+/// Completes a partial checksum in `frame`.
+///
+/// The checksum is calculated from `csum_start` to the end of the frame and
+/// stored at `csum_start + csum_offset`, which is expected to hold the
+/// pseudo-header checksum.
+pub fn checksum_complete(frame: &mut [u8], csum_start: usize, csum_offset: usize) -> Result<()> {
+    if csum_start + csum_offset + 2 > frame.len() {
+        return Err(Error::new(EINVAL));
+    }
+    let csum = checksum_finalize(checksum_add(0, &frame[csum_start..]));
+    write_be16(frame, csum_start + csum_offset, if csum == 0 { 0xffff } else { csum });
+    Ok(())
+}
+
+/// Software GSO segmenter.
+///
+/// Splits an Ethernet frame that carries a large IPv4 TCP segment or UDP
+/// datagram into segments of at most `gso_size` bytes of payload each. The
+/// headers of the original frame are replicated for every segment, with
+/// lengths, sequence numbers, and checksums fixed up per segment. The payload
+/// of a segment is not copied, but referred to by its offset in the frame, so
+/// that drivers can transmit segments as scatter-gather lists.
+pub struct GsoSegmenter<'a> {
+    frame: &'a [u8],
+    gso_type: u8,
+    l4_off: usize,
+    hdr_len: usize,
+    seg_size: usize,
+    offset: usize,
+    seg_idx: u16,
+    done: bool,
+}
+
+impl<'a> GsoSegmenter<'a> {
+    /// Constructs a segmenter for `frame` as described by offload header `hdr`.
+    pub fn new(hdr: &NetOffloadHdr, frame: &'a mut [u8]) -> Result<Self> {
+        if frame.len() < ETH_HLEN + IP_HLEN_MIN || read_be16(frame, 12) != ETH_P_IP {
+            return Err(Error::new(EINVAL));
+        }
+        let ihl = ((frame[ETH_HLEN] & 0x0f) as usize) * 4;
+        if frame[ETH_HLEN] >> 4 != 4 || ihl < IP_HLEN_MIN || ETH_HLEN + ihl > frame.len() {
+            return Err(Error::new(EINVAL));
+        }
+        let l4_off = ETH_HLEN + ihl;
+        let proto = frame[ETH_HLEN + 9];
+        let gso_size = hdr.gso_size as usize;
+        let (hdr_len, seg_size) = match (hdr.gso_type, proto) {
+            (NET_GSO_TCPV4, IPPROTO_TCP) => {
+                if l4_off + TCP_HLEN_MIN > frame.len() {
+                    return Err(Error::new(EINVAL));
+                }
+                let doff = ((frame[l4_off + 12] >> 4) as usize) * 4;
+                (l4_off + doff, gso_size)
+            }
+            (NET_GSO_UDP_L4, IPPROTO_UDP) => (l4_off + UDP_HLEN, gso_size),
+            // IP fragments carry the UDP header as payload and their payload
+            // length must be a multiple of eight bytes.
+            (NET_GSO_UDP, IPPROTO_UDP) => (l4_off, gso_size & !7),
+            _ => return Err(Error::new(EINVAL)),
+        };
+        if hdr_len > frame.len() || l4_off + UDP_HLEN > frame.len() || seg_size < UDP_HLEN {
+            return Err(Error::new(EINVAL));
+        }
+        if hdr.gso_type == NET_GSO_UDP {
+            // Fragments cannot be checksummed individually, so complete the
+            // checksum of the whole datagram up front.
+            let len = frame.len() - l4_off;
+            write_be16(frame, l4_off + 6, 0);
+            let sum = pseudo_header_sum(&frame[ETH_HLEN..], IPPROTO_UDP, len);
+            let csum = checksum_finalize(checksum_add(sum, &frame[l4_off..]));
+            write_be16(frame, l4_off + 6, if csum == 0 { 0xffff } else { csum });
+        }
+        Ok(GsoSegmenter {
+            frame,
+            gso_type: hdr.gso_type,
+            l4_off,
+            hdr_len,
+            seg_size,
+            offset: 0,
+            seg_idx: 0,
+            done: false,
+        })
+    }
+
+    /// Returns the length of the headers of a segment.
+    pub fn hdr_len(&self) -> usize {
+        self.hdr_len
+    }
+
+    /// Writes the headers of the next segment to `hdr`, which must be at
+    /// least `hdr_len()` bytes long. Returns the offset and length of the
+    /// segment payload in the frame, or `None` if all segments have been
+    /// produced.
+    pub fn next_segment(&mut self, hdr: &mut [u8]) -> Option<(usize, usize)> {
+        if self.done {
+            return None;
+        }
+        let payload_off = self.hdr_len + self.offset;
+        let n = cmp::min(self.frame.len() - payload_off, self.seg_size);
+        let last = payload_off + n == self.frame.len();
+        let len = self.hdr_len + n;
+        let l3_off = ETH_HLEN;
+        let l4_off = self.l4_off;
+        let payload = &self.frame[payload_off..payload_off + n];
+
+        let hdr = &mut hdr[..self.hdr_len];
+        hdr.copy_from_slice(&self.frame[..self.hdr_len]);
+
+        write_be16(hdr, l3_off + 2, (len - l3_off) as u16);
+        if self.gso_type == NET_GSO_UDP {
+            let mut frag_off = (self.offset / 8) as u16;
+            if !last {
+                frag_off |= IP_MF;
+            }
+            write_be16(hdr, l3_off + 6, frag_off);
+        } else {
+            let id = read_be16(self.frame, l3_off + 4).wrapping_add(self.seg_idx);
+            write_be16(hdr, l3_off + 4, id);
+        }
+        write_be16(hdr, l3_off + 10, 0);
+        let ip_csum = checksum_finalize(checksum_add(0, &hdr[l3_off..l4_off]));
+        write_be16(hdr, l3_off + 10, ip_csum);
+
+        match self.gso_type {
+            NET_GSO_TCPV4 => {
+                let seq = read_be32(self.frame, l4_off + 4).wrapping_add(self.offset as u32);
+                write_be32(hdr, l4_off + 4, seq);
+                if !last {
+                    hdr[l4_off + 13] &= !(TCP_FLAG_FIN | TCP_FLAG_PSH);
+                }
+                write_be16(hdr, l4_off + 16, 0);
+                let sum = pseudo_header_sum(&hdr[l3_off..], IPPROTO_TCP, len - l4_off);
+                let sum = checksum_add(checksum_add(sum, &hdr[l4_off..]), payload);
+                write_be16(hdr, l4_off + 16, checksum_finalize(sum));
+            }
+            NET_GSO_UDP_L4 => {
+                write_be16(hdr, l4_off + 4, (len - l4_off) as u16);
+                write_be16(hdr, l4_off + 6, 0);
+                let sum = pseudo_header_sum(&hdr[l3_off..], IPPROTO_UDP, len - l4_off);
+                let csum = checksum_finalize(checksum_add(checksum_add(sum, &hdr[l4_off..]), payload));
+                write_be16(hdr, l4_off + 6, if csum == 0 { 0xffff } else { csum });
+            }
+            _ => {}
+        }
+
+        self.offset += n;
+        self.seg_idx = self.seg_idx.wrapping_add(1);
+        self.done = last;
+        Some((payload_off, n))
+    }
+}
+
+/// Returns true if the transport checksum of the IPv4 packet `iph` is valid.
+fn l4_checksum_valid(iph: &[u8], l4_off: usize, proto: u8) -> bool {
+    let seg = &iph[l4_off..];
+    if proto == IPPROTO_UDP && read_be16(seg, 6) == 0 {
+        return true;
+    }
+    let sum = pseudo_header_sum(iph, proto, seg.len());
+    checksum_finalize(checksum_add(sum, seg)) == 0
+}
+
+/// Software GRO (generic receive offload) context.
+///
+/// A GRO context holds the headers of a packet that starts a merged packet.
+/// Consecutive in-order TCP segments or equally sized UDP datagrams of the
+/// same flow are merged into it by appending their payload, so that the
+/// network stack processes them as one packet.
+pub struct GroContext {
+    proto: u8,
+    l4_off: usize,
+    hdr_len: usize,
+    gso_size: usize,
+    len: usize,
+    segs: usize,
+    tcp_flags: u8,
+    flush: bool,
+}
+
+impl GroContext {
+    /// Maximum length of a merged frame.
+    const MAX_LEN: usize = ETH_HLEN + 65535;
+
+    /// Starts a merged packet with the frame `frame`. Returns `None` if the
+    /// frame is not a GRO candidate. If `csum_valid` is false, the transport
+    /// checksum is verified in software.
+    pub fn new(frame: &[u8], csum_valid: bool) -> Option<Self> {
+        let (l4_off, hdr_len, len) = Self::parse(frame)?;
+        let iph = &frame[ETH_HLEN..len];
+        let proto = iph[9];
+        if !csum_valid && !l4_checksum_valid(iph, l4_off - ETH_HLEN, proto) {
+            return None;
+        }
+        let mut tcp_flags = 0;
+        if proto == IPPROTO_TCP {
+            tcp_flags = frame[l4_off + 13];
+            if tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_RST | TCP_FLAG_URG | TCP_FLAG_FIN) != 0 {
+                return None;
+            }
+        }
+        Some(GroContext {
+            proto,
+            l4_off,
+            hdr_len,
+            gso_size: len - hdr_len,
+            len,
+            segs: 1,
+            tcp_flags,
+            flush: tcp_flags & TCP_FLAG_PSH != 0,
+        })
+    }
+
+    /// Parses the headers of `frame`. Returns the offset of the transport
+    /// header, the total length of headers, and the length of the frame
+    /// without link-layer padding.
+    fn parse(frame: &[u8]) -> Option<(usize, usize, usize)> {
+        if frame.len() < ETH_HLEN + IP_HLEN_MIN || read_be16(frame, 12) != ETH_P_IP {
+            return None;
+        }
+        let iph = &frame[ETH_HLEN..];
+        let ihl = ((iph[0] & 0x0f) as usize) * 4;
+        let tot_len = read_be16(iph, 2) as usize;
+        if iph[0] >> 4 != 4 || ihl < IP_HLEN_MIN || tot_len < ihl || ETH_HLEN + tot_len > frame.len() {
+            return None;
+        }
+        if read_be16(iph, 6) & (IP_MF | IP_OFFMASK) != 0 {
+            return None;
+        }
+        let l4_off = ETH_HLEN + ihl;
+        let len = ETH_HLEN + tot_len;
+        let l4_hlen = match iph[9] {
+            IPPROTO_TCP if l4_off + TCP_HLEN_MIN <= len => {
+                let doff = ((frame[l4_off + 12] >> 4) as usize) * 4;
+                if doff < TCP_HLEN_MIN {
+                    return None;
+                }
+                doff
+            }
+            IPPROTO_UDP if l4_off + UDP_HLEN <= len => UDP_HLEN,
+            _ => return None,
+        };
+        if l4_off + l4_hlen >= len {
+            return None;
+        }
+        Some((l4_off, l4_off + l4_hlen, len))
+    }
+
+    /// Returns the length of the merged frame.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Returns the number of segments in the merged packet.
+    pub fn segs(&self) -> usize {
+        self.segs
+    }
+
+    /// Tries to merge `frame` into the merged packet whose frame starts with
+    /// `head`. On success, returns the offset and length of the payload in
+    /// `frame` that the caller must append to the merged frame.
+    pub fn merge(&mut self, head: &[u8], frame: &[u8], csum_valid: bool) -> Option<(usize, usize)> {
+        if self.flush {
+            return None;
+        }
+        let (l4_off, hdr_len, len) = Self::parse(frame)?;
+        if l4_off != self.l4_off || hdr_len != self.hdr_len {
+            return None;
+        }
+        let payload_len = len - hdr_len;
+        if payload_len > self.gso_size || self.len + payload_len > Self::MAX_LEN {
+            return None;
+        }
+        // The IP headers must be identical except for length, ID, and checksum.
+        let (a, b) = (&head[ETH_HLEN..l4_off], &frame[ETH_HLEN..l4_off]);
+        if a[0..2] != b[0..2] || a[6..10] != b[6..10] || a[12..] != b[12..] || head[..ETH_HLEN] != frame[..ETH_HLEN] {
+            return None;
+        }
+        match self.proto {
+            IPPROTO_TCP => {
+                let (a, b) = (&head[l4_off..hdr_len], &frame[l4_off..hdr_len]);
+                let seq = read_be32(a, 4).wrapping_add((self.len - self.hdr_len) as u32);
+                let flags = b[13];
+                let ignored = TCP_FLAG_PSH | TCP_FLAG_FIN;
+                // Ports, acknowledgement number, flags, and options must match.
+                if a[0..4] != b[0..4] || read_be32(b, 4) != seq || a[8..12] != b[8..12] || a[12] != b[12]
+                    || a[13] & !ignored != flags & !ignored || a[20..] != b[20..]
+                {
+                    return None;
+                }
+                if !csum_valid && !l4_checksum_valid(&frame[ETH_HLEN..len], l4_off - ETH_HLEN, IPPROTO_TCP) {
+                    return None;
+                }
+                self.tcp_flags |= flags & ignored;
+            }
+            _ => {
+                if head[l4_off..l4_off + 4] != frame[l4_off..l4_off + 4] {
+                    return None;
+                }
+                if !csum_valid && !l4_checksum_valid(&frame[ETH_HLEN..len], l4_off - ETH_HLEN, IPPROTO_UDP) {
+                    return None;
+                }
+            }
+        }
+        self.len += payload_len;
+        self.segs += 1;
+        if payload_len < self.gso_size || self.tcp_flags & (TCP_FLAG_PSH | TCP_FLAG_FIN) != 0 {
+            self.flush = true;
+        }
+        Some((hdr_len, payload_len))
+    }
+
+    /// Fixes up the headers of the merged frame `frame` and returns the
+    /// offload header that describes it.
+    pub fn finish(&self, frame: &mut [u8]) -> NetOffloadHdr {
+        let l3_off = ETH_HLEN;
+        write_be16(frame, l3_off + 2, (self.len - l3_off) as u16);
+        write_be16(frame, l3_off + 10, 0);
+        let ip_csum = checksum_finalize(checksum_add(0, &frame[l3_off..self.l4_off]));
+        write_be16(frame, l3_off + 10, ip_csum);
+        let gso_type = match self.proto {
+            IPPROTO_TCP => {
+                frame[self.l4_off + 13] |= self.tcp_flags;
+                NET_GSO_TCPV4
+            }
+            _ => {
+                write_be16(frame, self.l4_off + 4, (self.len - self.l4_off) as u16);
+                NET_GSO_UDP_L4
+            }
+        };
+        NetOffloadHdr {
+            flags: NET_OFFLOAD_F_DATA_VALID,
+            gso_type,
+            hdr_len: self.hdr_len as u16,
+            gso_size: self.gso_size as u16,
+            csum_start: 0,
+            csum_offset: 0,
+        }
+    }
+}
@@ -72,8 +72,8 @@ impl Drop for Process {
 }
 
 impl EventListener for Process {
-    fn on_event(&self, ev: Event) {
-        self.event_queue.borrow_mut().emplace(ev);
+    fn on_event(&self, ev: Event) -> bool {
+        self.event_queue.borrow_mut().emplace(ev)
     }
 }
 
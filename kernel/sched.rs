@@ -4,14 +4,17 @@
 
 use alloc::rc::Rc;
 use core::cmp;
+use core::slice;
 use device::DeviceDesc;
-use errno::EINVAL;
+use errno::{EFAULT, EINVAL};
 use intrusive_collections::LinkedList;
+use memory;
 use null_terminated::NulStr;
 use process::{Process, ProcessAdapter, ProcessState, TaskState};
-use vm::VMProt;
+use vm::{VMSPACE_HUGE_PAGES, VMSPACE_NO_HUGE_PAGES};
 use user_access;
 use device;
+use softirq;
 
 /// Current running process.
 static mut CURRENT: Option<Rc<Process>> = None;
@@ -98,11 +101,11 @@ extern "C" {
 }
 
 #[no_mangle]
-pub extern "C" fn process_acquire(name: &'static NulStr) -> i32 {
+pub extern "C" fn process_acquire(name: &'static NulStr, flags: i32) -> i32 {
     let current = get_current();
     match current.acquire(&name[..]) {
         Ok((device, desc)) => {
-            if let Err(e) = device.acquire(&mut current.vmspace.borrow_mut(), current.clone()) {
+            if let Err(e) = device.acquire(&mut current.vmspace.borrow_mut(), current.clone(), flags) {
                 return e.errno();
             }
             desc.to_user()
@@ -135,12 +138,38 @@ pub unsafe extern "C" fn process_get_config(raw_desc: i32, opt: i32, buf: *mut u
     -EINVAL
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn process_set_config(raw_desc: i32, opt: i32, buf: *const u8, len: usize) -> i32 {
+    let current = get_current();
+    let desc = DeviceDesc::from_user(raw_desc);
+    if let Some(device) = current.device_space.borrow().lookup(desc) {
+        let value = slice::from_raw_parts(buf, len);
+        return match device.set_config(opt, value) {
+            Ok(()) => 0,
+            Err(e) => e.errno(),
+        };
+    }
+    -EINVAL
+}
+
 /// Make the current process wait for an event.
 #[no_mangle]
 pub extern "C" fn process_wait() {
     let current = get_current();
     current.state.replace(ProcessState::WAITING);
+    // If the process submitted I/O commands, return after processing them so
+    // that a process which only transmits does not wait for an interrupt.
+    let io_submitted = device::io_pending();
     device::process_io();
+    // Run the deferred interrupt work that is left over from the interrupts,
+    // which may deliver events to the process.
+    softirq::run();
+    // Devices without interrupts, such as the loopback device, deliver events
+    // while processing I/O, so do not wait for an interrupt that never comes.
+    if io_submitted || current.event_queue.borrow().ring_buffer.front::<u8>().is_some() || device::io_pending() {
+        current.state.replace(ProcessState::RUNNING);
+        return;
+    }
     schedule();
 }
 
@@ -151,22 +180,69 @@ pub extern "C" fn process_getevents() -> usize {
 }
 
 #[no_mangle]
-pub extern "C" fn process_vmspace_alloc(size: u64, align: u64, vmr_start: *mut u64) -> i32 {
+pub extern "C" fn process_vmspace_alloc(size: u64, align: u64, flags: u64, vmr_start: *mut u64) -> i32 {
+    let page_size = match flags {
+        0 => memory::PAGE_SIZE_LARGE,
+        VMSPACE_HUGE_PAGES => memory::PAGE_SIZE_HUGE,
+        VMSPACE_NO_HUGE_PAGES => memory::PAGE_SIZE_SMALL,
+        _ => return -EINVAL,
+    };
     let current = get_current();
     let mut vmspace = current.vmspace.borrow_mut();
-    let (start, end) = match vmspace.allocate(size as usize, align as usize, VMProt::VM_PROT_RW) {
+    let (start, end) = match vmspace.allocate_user(size as usize, align as usize, page_size as usize) {
         Ok(area) => {
             area
         },
         Err(e) => { return e.errno() }
     };
-    if let Err(e) = vmspace.populate(start, end) {
-        return e.errno();
+    // Huge page regions are populated up front, which pins their memory.
+    // Other regions are populated on demand by page faults.
+    if flags & VMSPACE_HUGE_PAGES != 0 {
+        if let Err(e) = vmspace.populate(start, end) {
+            let _ = vmspace.deallocate(start, end);
+            return e.errno();
+        }
     }
     unsafe { *vmr_start = start as u64 };
     0
 }
 
+#[no_mangle]
+pub extern "C" fn process_vmspace_free(start: u64, size: u64) -> i32 {
+    let current = get_current();
+    let mut vmspace = current.vmspace.borrow_mut();
+    let end = match start.checked_add(size) {
+        Some(end) => end,
+        None => return -EINVAL,
+    };
+    if let Err(e) = vmspace.deallocate_user(start as usize, end as usize) {
+        return e.errno();
+    }
+    0
+}
+
+/// Handles a page fault at `addr` in the address space of the current
+/// process. Returns 0 if the faulting access can be restarted.
+#[no_mangle]
+pub extern "C" fn page_fault_handle(addr: u64, flags: u32) -> i32 {
+    let current = unsafe {
+        match CURRENT {
+            Some(ref current) => current.clone(),
+            None => return -EFAULT,
+        }
+    };
+    // The fault is not handled if the kernel faulted while it was changing
+    // the address space.
+    let mut vmspace = match current.vmspace.try_borrow_mut() {
+        Ok(vmspace) => vmspace,
+        Err(_) => return -EFAULT,
+    };
+    if let Err(e) = vmspace.handle_fault(addr as usize, flags) {
+        return e.errno();
+    }
+    0
+}
+
 #[no_mangle]
 pub extern fn page_fault_set_fixup(fixup: u64)
 {
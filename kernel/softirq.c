@@ -0,0 +1,84 @@
+#include <kernel/softirq.h>
+
+#include <kernel/cpu.h>
+
+#include <arch/interrupts.h>
+
+#include <stddef.h>
+
+/* Maximum number of times the scheduled tasklets are run in one
+   softirq_run() call. A tasklet that still has work after that is left
+   scheduled and run again from the idle loop or when a process waits, so
+   that an interrupt storm cannot keep the CPU in interrupt context.  */
+#define SOFTIRQ_MAX_ROUNDS 4
+
+struct softirq_queue {
+	struct tasklet	*head;
+	struct tasklet	*tail;
+};
+
+/* Tasklets that are scheduled on a CPU, in the order they were scheduled.  */
+static struct softirq_queue softirq_queues[MAX_CPUS];
+
+static struct softirq_queue *softirq_queue_current(void)
+{
+	int cpu = arch_cpu_index(arch_cpu_id());
+	if (cpu < 0) {
+		return NULL;
+	}
+	return &softirq_queues[cpu];
+}
+
+void tasklet_init(struct tasklet *t, tasklet_func_t func, void *arg)
+{
+	t->next = NULL;
+	t->func = func;
+	t->arg = arg;
+	t->scheduled = false;
+}
+
+void tasklet_schedule(struct tasklet *t)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	struct softirq_queue *queue = softirq_queue_current();
+	if (queue && !t->scheduled) {
+		t->scheduled = true;
+		t->next = NULL;
+		if (queue->tail) {
+			queue->tail->next = t;
+		} else {
+			queue->head = t;
+		}
+		queue->tail = t;
+	}
+	arch_local_interrupt_restore(flags);
+}
+
+bool softirq_pending(void)
+{
+	struct softirq_queue *queue = softirq_queue_current();
+	return queue && queue->head;
+}
+
+void softirq_run(void)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	struct softirq_queue *queue = softirq_queue_current();
+	for (int round = 0; queue && queue->head && round < SOFTIRQ_MAX_ROUNDS; round++) {
+		/* Tasklets that are scheduled while this round runs, including
+		   the ones that have more work, run in the next round.  */
+		struct tasklet *t = queue->head;
+		queue->head = NULL;
+		queue->tail = NULL;
+		while (t) {
+			struct tasklet *next = t->next;
+			t->next = NULL;
+			t->scheduled = false;
+			if (t->func(t->arg)) {
+				tasklet_schedule(t);
+			}
+			t = next;
+		}
+	}
+	arch_local_interrupt_restore(flags);
+}
@@ -0,0 +1,53 @@
+//! Deferred interrupt work.
+//!
+//! The `softirq` module contains bindings to the tasklets of the C kernel. An
+//! interrupt handler schedules a tasklet, which does the batch work after the
+//! handler returns, with local interrupts disabled.
+
+use core::cell::Cell;
+use core::ptr;
+
+/// A tasklet function, which returns `true` if it has more work to do.
+pub type TaskletFunc = extern "C" fn(arg: usize) -> bool;
+
+/// A tasklet, which has the layout of `struct tasklet`.
+#[repr(C)]
+pub struct Tasklet {
+    next: Cell<*mut Tasklet>,
+    func: Cell<Option<TaskletFunc>>,
+    arg: Cell<usize>,
+    scheduled: Cell<bool>,
+}
+
+impl Tasklet {
+    pub const fn new() -> Self {
+        Tasklet {
+            next: Cell::new(ptr::null_mut()),
+            func: Cell::new(None),
+            arg: Cell::new(0),
+            scheduled: Cell::new(false),
+        }
+    }
+
+    /// Sets the function and argument of the tasklet. The tasklet must not
+    /// move after it is initialized.
+    pub fn init(&self, func: TaskletFunc, arg: usize) {
+        unsafe { tasklet_init(self, func, arg) };
+    }
+
+    /// Schedules the tasklet on the current CPU.
+    pub fn schedule(&self) {
+        unsafe { tasklet_schedule(self) };
+    }
+}
+
+/// Runs the tasklets that are scheduled on the current CPU.
+pub fn run() {
+    unsafe { softirq_run() };
+}
+
+extern "C" {
+    fn tasklet_init(t: *const Tasklet, func: TaskletFunc, arg: usize);
+    fn tasklet_schedule(t: *const Tasklet);
+    fn softirq_run();
+}
@@ -3,6 +3,7 @@
 #include <kernel/types.h>
 #include <kernel/console.h>
 #include <kernel/errno.h>
+#include <kernel/kmem.h>
 #include <kernel/page-alloc.h>
 #include <kernel/panic.h>
 #include <kernel/sched.h>
@@ -52,6 +53,22 @@ static int sys_get_config(int desc, int opt, void *buf, size_t len)
 	return process_get_config(desc, opt, buf, len);
 }
 
+static int sys_set_config(int desc, int opt, const void /* __user */ *ubuf, size_t len)
+{
+#define CONFIG_VALUE_MAX 64
+	char buf[CONFIG_VALUE_MAX];
+	int err;
+
+	if (len > CONFIG_VALUE_MAX) {
+		return -EINVAL;
+	}
+	err = memcpy_from_user(buf, ubuf, len);
+	if (err) {
+		return err;
+	}
+	return process_set_config(desc, opt, buf, len);
+}
+
 static int sys_acquire(const char /* __user */ *uname, int flags)
 {
 #define MAX_NAME_LEN 32
@@ -106,7 +123,7 @@ static int sys_vmspace_alloc(struct vmspace_region /* __user */ *uvmr, size_t si
 		vmr.align = PAGE_SIZE_SMALL;
 	}
 	uint64_t start = 0;
-	err = process_vmspace_alloc(vmr.size, vmr.align, &start);
+	err = process_vmspace_alloc(vmr.size, vmr.align, vmr.flags, &start);
 	if (err) {
 		return err;
 	}
@@ -114,6 +131,26 @@ static int sys_vmspace_alloc(struct vmspace_region /* __user */ *uvmr, size_t si
 	return memcpy_to_user(uvmr, &vmr, sizeof(vmr));
 }
 
+static int sys_vmspace_free(const struct vmspace_region /* __user */ *uvmr, size_t size)
+{
+	struct vmspace_region vmr;
+	int err;
+
+	if (size != sizeof(vmr)) {
+		return -EINVAL;
+	}
+	err = memcpy_from_user(&vmr, uvmr, sizeof(vmr));
+	if (err) {
+		return err;
+	}
+	return process_vmspace_free(vmr.start, vmr.size);
+}
+
+static ssize_t sys_kmem_stats(int type, void /* __user */ *ubuf, size_t len)
+{
+	return kmem_get_stats(type, ubuf, len);
+}
+
 #define SYSCALL0(fn)                                                                                                   \
 	case (SYS_##fn):                                                                                               \
 		do {                                                                                                   \
@@ -144,6 +181,21 @@ static int sys_vmspace_alloc(struct vmspace_region /* __user */ *uvmr, size_t si
 			return sys_##fn(arg0, arg1);                                                                   \
 		} while (0)
 
+#define SYSCALL3(fn, arg0_type, arg1_type, arg2_type)                                                                  \
+	case (SYS_##fn):                                                                                               \
+		do {                                                                                                   \
+			va_list args;                                                                                  \
+			arg0_type arg0;                                                                                \
+			arg1_type arg1;                                                                                \
+			arg2_type arg2;                                                                                \
+			va_start(args, nr);                                                                            \
+			arg0 = va_arg(args, arg0_type);                                                                \
+			arg1 = va_arg(args, arg1_type);                                                                \
+			arg2 = va_arg(args, arg2_type);                                                                \
+			va_end(args);                                                                                  \
+			return sys_##fn(arg0, arg1, arg2);                                                             \
+		} while (0)
+
 #define SYSCALL4(fn, arg0_type, arg1_type, arg2_type, arg3_type)                                                       \
 	case (SYS_##fn):                                                                                               \
 		do {                                                                                                   \
@@ -172,6 +224,9 @@ long syscall(int nr, ...)
 	SYSCALL4(get_config, int, int, void *, size_t);
 	SYSCALL2(acquire, const char *, int);
 	SYSCALL2(vmspace_alloc, struct vmspace_region *, size_t);
+	SYSCALL4(set_config, int, int, const void *, size_t);
+	SYSCALL3(kmem_stats, int, void *, size_t);
+	SYSCALL2(vmspace_free, const struct vmspace_region *, size_t);
 	}
 	return -ENOSYS;
 }
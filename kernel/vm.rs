@@ -1,10 +1,14 @@
 //! Virtual memory manager.
 
 use alloc::boxed::Box;
-use core::cell::Cell;
+use alloc::collections::BTreeMap;
+use core::cell::{Cell, RefCell};
+use core::cmp;
+use core::fmt;
 use core::mem;
-use errno::{Error, Result, EINVAL, ENOMEM};
-use intrusive_collections::{Bound, RBTree, RBTreeLink, KeyAdapter};
+use core::ptr;
+use errno::{Error, Result, EFAULT, EINVAL, ENOMEM};
+use intrusive_collections::{Bound, KeyAdapter, LinkedList, LinkedListLink, RBTree, RBTreeLink, UnsafeRef};
 use memory;
 use mmu;
 use rlibc::memcpy;
@@ -20,6 +24,62 @@ bitflags! {
     }
 }
 
+/// Page fault was caused by a write access.
+pub const PAGE_FAULT_WRITE: u32 = 1 << 0;
+/// Page fault was caused by an instruction fetch.
+pub const PAGE_FAULT_EXEC: u32 = 1 << 1;
+/// Page fault was caused by a protection violation on a present page.
+pub const PAGE_FAULT_PROT: u32 = 1 << 2;
+
+/// Region is populated up front with the largest pages that fit it.
+pub const VMSPACE_HUGE_PAGES: u64 = 1 << 0;
+/// Region is populated with small pages only.
+pub const VMSPACE_NO_HUGE_PAGES: u64 = 1 << 1;
+
+/// Size of the window of small pages that is populated around a faulting
+/// page.
+const FAULT_AROUND_SIZE: usize = 64 * 1024;
+
+/// Page of memory that populates a part of a VM region.
+#[derive(Debug)]
+pub struct VMPage {
+    /// Kernel address of the page.
+    pub page: usize,
+    /// Size of the page in bytes.
+    pub size: usize,
+}
+
+impl VMPage {
+    /// Allocates a zeroed page of `size` bytes.
+    fn alloc(size: usize) -> Option<VMPage> {
+        let page = unsafe {
+            match size as u64 {
+                memory::PAGE_SIZE_HUGE => {
+                    let page = memory::page_alloc_order(memory::PAGE_ORDER_HUGE);
+                    if !page.is_null() {
+                        ptr::write_bytes(page, 0, size);
+                    }
+                    page
+                }
+                memory::PAGE_SIZE_LARGE => memory::page_alloc_large_zeroed(),
+                _ => memory::page_alloc_small_zeroed(),
+            }
+        };
+        if page.is_null() {
+            return None;
+        }
+        Some(VMPage { page: page as usize, size })
+    }
+
+    unsafe fn free(&self) {
+        match self.size as u64 {
+            memory::PAGE_SIZE_HUGE => memory::page_free_order(self.page as *mut u8, memory::PAGE_ORDER_HUGE),
+            memory::PAGE_SIZE_LARGE => memory::page_free_large(self.page as *mut u8),
+            _ => memory::page_free_small(self.page as *mut u8),
+        }
+    }
+}
+
 /// VM region
 ///
 /// This type represents a contiguous memory region in a virtual address
@@ -29,7 +89,17 @@ pub struct VMRegion {
     pub start: usize,
     pub end: usize,
     pub prot: VMProt,
-    pub page: Cell<Option<usize>>,
+    /// Largest page size that the region is populated with.
+    pub page_size: usize,
+    /// Pages that populate the region, indexed by the virtual address they
+    /// are mapped at.
+    pub pages: RefCell<BTreeMap<usize, VMPage>>,
+    /// `true` if the region maps memory that the caller owns, which is not
+    /// populated on demand.
+    pub mapped: Cell<bool>,
+    /// `true` if the process allocated the region with vmspace_alloc, which
+    /// lets it free the region with vmspace_free.
+    pub user_owned: Cell<bool>,
     pub link: RBTreeLink,
 }
 
@@ -54,16 +124,95 @@ impl VMRegion {
             start,
             end,
             prot,
-            page: Cell::new(None),
+            page_size: memory::PAGE_SIZE_LARGE as usize,
+            pages: RefCell::new(BTreeMap::new()),
+            mapped: Cell::new(false),
+            user_owned: Cell::new(false),
             link: RBTreeLink::new(),
         }
     }
 
     pub fn delete(&self) {
-        if let Some(page) = self.page.get() {
-            unsafe { memory::page_free_small(page as *mut u8); }
-            self.page.set(None);
+        let pages = mem::replace(&mut *self.pages.borrow_mut(), BTreeMap::new());
+        for page in pages.values() {
+            unsafe { page.free() };
+        }
+    }
+
+    /// Returns the range of the populated page that contains `addr`.
+    fn page_at(&self, addr: usize) -> Option<(usize, usize)> {
+        let pages = self.pages.borrow();
+        match pages.range(..=addr).next_back() {
+            Some((&start, page)) if addr < start + page.size => Some((start, start + page.size)),
+            _ => None,
+        }
+    }
+
+    /// Populates the page of the region that contains `addr` with zeroed
+    /// memory, unless it is populated already, and returns the range of the
+    /// page. The largest page of at most `max_size` bytes is used that is
+    /// within the region and has no populated parts.
+    fn populate_page(&self, mmu_map: mmu::MMUMap, addr: usize, max_size: usize) -> Result<(usize, usize)> {
+        if let Some(range) = self.page_at(addr) {
+            return Ok(range);
+        }
+        for &size in &[memory::PAGE_SIZE_HUGE as usize, memory::PAGE_SIZE_LARGE as usize] {
+            if size > max_size || (size as u64 == memory::PAGE_SIZE_HUGE && !unsafe { mmu::mmu_has_huge_pages() }) {
+                continue;
+            }
+            let start = memory::align_down(addr as u64, size as u64) as usize;
+            if start < self.start || start + size > self.end {
+                continue;
+            }
+            if self.pages.borrow().range(start..start + size).next().is_some() {
+                continue;
+            }
+            // Fall back to a smaller page if no page of this size is
+            // available or the page table cannot map one.
+            if let Some(page) = VMPage::alloc(size) {
+                match self.map_page(mmu_map, start, page) {
+                    Err(e) if e == Error::new(EINVAL) => {}
+                    result => return result,
+                }
+            }
+        }
+        let size = memory::PAGE_SIZE_SMALL as usize;
+        let start = memory::align_down(addr as u64, size as u64) as usize;
+        match VMPage::alloc(size) {
+            Some(page) => self.map_page(mmu_map, start, page),
+            None => Err(Error::new(ENOMEM)),
+        }
+    }
+
+    /// Maps `page` at `start` and records it in the page index. The page is
+    /// freed if it cannot be mapped.
+    fn map_page(&self, mmu_map: mmu::MMUMap, start: usize, page: VMPage) -> Result<(usize, usize)> {
+        let end = start + page.size;
+        let err = unsafe {
+            mmu::mmu_map_range(
+                mmu_map,
+                start,
+                mmu::virt_to_phys(page.page),
+                page.size,
+                self.mmu_prot(),
+                mmu::MMU_USER_PAGE,
+            )
+        };
+        if err != 0 {
+            unsafe { page.free() };
+            return Err(Error::new(-err));
+        }
+        self.pages.borrow_mut().insert(start, page);
+        Ok((start, end))
+    }
+
+    /// Unmaps the part of the region from `start` to `end`.
+    fn unmap(&self, mmu_map: mmu::MMUMap, start: usize, end: usize) -> Result<()> {
+        let err = unsafe { mmu::mmu_unmap_range(mmu_map, start, end - start) };
+        if err != 0 {
+            return Err(Error::new(-err));
         }
+        Ok(())
     }
 
     pub fn mmu_prot(&self) -> usize {
@@ -81,6 +230,239 @@ impl VMRegion {
     }
 }
 
+/// Free extent of a virtual address space.
+#[derive(Debug)]
+struct VMFreeExtent {
+    start: usize,
+    end: usize,
+    /// Link in the extents red-black tree.
+    addr_link: RBTreeLink,
+    /// Link in the free list of the extent size.
+    size_link: LinkedListLink,
+}
+
+intrusive_adapter!(VMFreeExtentAddrAdapter = UnsafeRef<VMFreeExtent>: VMFreeExtent { addr_link: RBTreeLink });
+
+intrusive_adapter!(VMFreeExtentSizeAdapter = UnsafeRef<VMFreeExtent>: VMFreeExtent { size_link: LinkedListLink });
+
+impl<'a> KeyAdapter<'a> for VMFreeExtentAddrAdapter {
+    type Key = usize;
+    fn get_key(&self, x: &'a VMFreeExtent) -> usize {
+        x.start
+    }
+}
+
+/// Number of extent free lists. Free list `n` holds the free extents whose
+/// size is in the range [2^n, 2^(n+1)).
+const NR_FREELISTS: usize = 64;
+
+const EMPTY_FREELIST: LinkedList<VMFreeExtentSizeAdapter> = LinkedList::new(VMFreeExtentSizeAdapter::NEW);
+
+/// Returns the index of the free list of extents of `size` bytes.
+fn freelist_index(size: usize) -> usize {
+    63 - size.leading_zeros() as usize
+}
+
+/// Free virtual address space
+///
+/// This type keeps track of the unallocated parts of a range of a virtual
+/// address space. Like the kernel memory arenas, free extents are kept both in
+/// a red-black tree ordered by start address, which finds the neighbours of a
+/// freed range for coalescing, and in power-of-two free lists, which find an
+/// extent that fits an allocation without walking the address space.
+pub struct VMFreeSpace {
+    /// Free extents, ordered by start address.
+    extents: RBTree<VMFreeExtentAddrAdapter>,
+    /// Free extents, segregated by size.
+    freelists: [LinkedList<VMFreeExtentSizeAdapter>; NR_FREELISTS],
+    /// Bit `n` is set if free list `n` is not empty.
+    freelist_map: u64,
+    /// Start of the managed range.
+    start: usize,
+    /// Exclusive end of the managed range.
+    end: usize,
+}
+
+impl VMFreeSpace {
+    /// Constructs a `VMFreeSpace` where the range from `start` to `end` is
+    /// free.
+    pub fn new(start: usize, end: usize) -> Self {
+        let mut space = VMFreeSpace {
+            extents: RBTree::new(VMFreeExtentAddrAdapter::NEW),
+            freelists: [EMPTY_FREELIST; NR_FREELISTS],
+            freelist_map: 0,
+            start,
+            end,
+        };
+        space.insert_extent(start, end);
+        space
+    }
+
+    /// Allocates `size` bytes aligned to `align`, which must be a power of
+    /// two, and returns the start address of the allocated range.
+    pub fn alloc(&mut self, size: usize, align: usize) -> Option<usize> {
+        let align = cmp::max(align, memory::PAGE_SIZE_SMALL as usize);
+        // Sizes and alignments beyond the managed range never fit, and
+        // rejecting them keeps the address arithmetic below from overflowing.
+        let range = self.end - self.start;
+        if size == 0 || size > range || align > range {
+            return None;
+        }
+        let ext = self.find_extent(size, align);
+        if ext.is_null() {
+            return None;
+        }
+        let start = unsafe { memory::align_up((*ext).start as u64, align as u64) as usize };
+        self.reserve_extent(ext, start, start + size);
+        Some(start)
+    }
+
+    /// Marks the part of the range from `start` to `end` that is within the
+    /// managed range as allocated. Returns `false` if it is not free.
+    pub fn reserve(&mut self, start: usize, end: usize) -> bool {
+        let (start, end) = (cmp::max(start, self.start), cmp::min(end, self.end));
+        if start >= end {
+            return true;
+        }
+        let ext = self
+            .extents
+            .upper_bound(Bound::Included(&start))
+            .get()
+            .map_or(ptr::null(), |ext| ext as *const VMFreeExtent);
+        if ext.is_null() || unsafe { (*ext).end } < end {
+            return false;
+        }
+        self.reserve_extent(ext, start, end);
+        true
+    }
+
+    /// Marks the part of the range from `start` to `end` that is within the
+    /// managed range as free again.
+    pub fn free(&mut self, start: usize, end: usize) {
+        let (mut start, mut end) = (cmp::max(start, self.start), cmp::min(end, self.end));
+        if start >= end {
+            return;
+        }
+        // Attempt to coalesce with next extent:
+        let next = self.extents.find(&end).get().map_or(ptr::null(), |next| next as *const VMFreeExtent);
+        if !next.is_null() {
+            end = unsafe { (*next).end };
+            self.remove_extent(next);
+        }
+        // Attempt to coalesce with previous extent:
+        let prev = self
+            .extents
+            .upper_bound(Bound::Excluded(&start))
+            .get()
+            .map_or(ptr::null(), |prev| prev as *const VMFreeExtent);
+        if !prev.is_null() && unsafe { (*prev).end } == start {
+            start = unsafe { (*prev).start };
+            self.remove_extent(prev);
+        }
+        self.insert_extent(start, end);
+    }
+
+    /// Returns a free extent that fits `size` bytes aligned to `align`, or
+    /// null if there is none.
+    fn find_extent(&self, size: usize, align: usize) -> *const VMFreeExtent {
+        // Extent starts are page aligned, so every extent of at least `need`
+        // bytes fits. Such extents are in the free lists from `fit_idx` up,
+        // and the first non-empty one is found from the bitmap.
+        let need = match size.checked_add(align - memory::PAGE_SIZE_SMALL as usize) {
+            Some(need) => need,
+            None => return ptr::null(),
+        };
+        let fit_idx = if need.is_power_of_two() { freelist_index(need) } else { freelist_index(need) + 1 };
+        if fit_idx < NR_FREELISTS {
+            let map = self.freelist_map & !((1u64 << fit_idx) - 1);
+            if map != 0 {
+                let idx = map.trailing_zeros() as usize;
+                return self.freelists[idx].front().get().map_or(ptr::null(), |ext| ext as *const VMFreeExtent);
+            }
+        }
+        // The smaller extents only fit depending on their size and alignment,
+        // so they are searched one by one.
+        for idx in freelist_index(size)..cmp::min(fit_idx, NR_FREELISTS) {
+            for ext in self.freelists[idx].iter() {
+                if memory::align_up(ext.start as u64, align as u64) as usize + size <= ext.end {
+                    return ext;
+                }
+            }
+        }
+        ptr::null()
+    }
+
+    /// Removes the range from `start` to `end` from free extent `ext`, which
+    /// contains the range.
+    fn reserve_extent(&mut self, ext: *const VMFreeExtent, start: usize, end: usize) {
+        let (ext_start, ext_end) = unsafe { ((*ext).start, (*ext).end) };
+        self.remove_extent(ext);
+        if ext_start != start {
+            self.insert_extent(ext_start, start);
+        }
+        if end != ext_end {
+            self.insert_extent(end, ext_end);
+        }
+    }
+
+    fn insert_extent(&mut self, start: usize, end: usize) {
+        let ext = Box::new(VMFreeExtent {
+            start,
+            end,
+            addr_link: RBTreeLink::new(),
+            size_link: LinkedListLink::new(),
+        });
+        let ext = unsafe { UnsafeRef::from_box(ext) };
+        let idx = freelist_index(end - start);
+        self.extents.insert(ext.clone());
+        // Recently freed ranges are reused first, while their page tables
+        // are still cached.
+        self.freelists[idx].push_front(ext);
+        self.freelist_map |= 1u64 << idx;
+    }
+
+    fn remove_extent(&mut self, ext: *const VMFreeExtent) {
+        let idx = unsafe { freelist_index((*ext).end - (*ext).start) };
+        unsafe {
+            self.extents.cursor_mut_from_ptr(ext).remove();
+            if let Some(ext) = self.freelists[idx].cursor_mut_from_ptr(ext).remove() {
+                drop(UnsafeRef::into_box(ext));
+            }
+        }
+        if self.freelists[idx].is_empty() {
+            self.freelist_map &= !(1u64 << idx);
+        }
+    }
+}
+
+impl Drop for VMFreeSpace {
+    fn drop(&mut self) {
+        loop {
+            let ext = match self.extents.front().get() {
+                Some(ext) => ext as *const VMFreeExtent,
+                None => break,
+            };
+            self.remove_extent(ext);
+        }
+    }
+}
+
+impl fmt::Debug for VMFreeSpace {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_list().entries(self.extents.iter().map(|ext| (ext.start, ext.end))).finish()
+    }
+}
+
+/// Start of the part of a virtual address space that `VMAddressSpace::allocate`
+/// places regions in. The fixed regions of a process image, its stack and its
+/// event buffer are below it.
+pub const VM_ALLOC_START: usize = 1 << 32;
+
+/// Exclusive end of the part of a virtual address space that
+/// `VMAddressSpace::allocate` places regions in, which is the end of the lower
+/// half of the canonical address space.
+pub const VM_ALLOC_END: usize = 1 << 47;
+
 /// VM address space
 ///
 /// This type provides mapping for a virtual address space. It keeps
@@ -91,6 +473,7 @@ impl VMRegion {
 #[derive(Debug)]
 pub struct VMAddressSpace {
     pub vm_regions: RBTree<VMRegionAdapter>,
+    pub free_space: VMFreeSpace,
     pub mmu_map: mmu::MMUMap,
 }
 
@@ -104,6 +487,7 @@ impl VMAddressSpace {
     pub fn new(mmu_map: usize) -> Self {
         VMAddressSpace {
             vm_regions: RBTree::new(VMRegionAdapter::new()),
+            free_space: VMFreeSpace::new(VM_ALLOC_START, VM_ALLOC_END),
             mmu_map,
         }
     }
@@ -116,35 +500,55 @@ impl VMAddressSpace {
         unsafe { mmu::mmu_load_map(self.mmu_map) };
     }
 
+    /// Returns `true` if the range from `start` to `end` overlaps with a region.
+    fn overlaps(&self, start: usize, end: usize) -> bool {
+        // Regions do not overlap each other, so only the last region that
+        // starts before `end` can reach into the range.
+        self.vm_regions.upper_bound(Bound::Excluded(&end)).get().map_or(false, |region| region.end > start)
+    }
+
     /// Allocates virtual memory
     ///
+    /// The region is placed in the free part of the address space that fits
+    /// it, so the address space of deallocated regions is reused.
+    ///
     /// # Arguments
     ///
     /// * `size` - The size of the allocated region
+    /// * `align` - The alignment of the region start address, which is
+    ///   rounded up to a power of two
     /// * `prot` - The protection of the allocated region
     pub fn allocate(&mut self, size: usize, align: usize, prot: VMProt) -> Result<(usize, usize)> {
-        if !memory::is_aligned(size as u64, memory::PAGE_SIZE_SMALL) {
+        self.allocate_with_page_size(size, align, prot, memory::PAGE_SIZE_LARGE as usize)
+    }
+
+    /// Allocates virtual memory that is populated with pages of at most
+    /// `page_size` bytes.
+    ///
+    /// The region is aligned to the largest page size that it can hold, so
+    /// that only its head and tail need smaller pages.
+    pub fn allocate_with_page_size(&mut self, size: usize, align: usize, prot: VMProt, page_size: usize) -> Result<(usize, usize)> {
+        if size == 0 || !memory::is_aligned(size as u64, memory::PAGE_SIZE_SMALL) {
             return Err(Error::new(EINVAL));
         }
-        /* FIXME: We allocate immediately after the region that holds the highest address. Although
-           this approach is simple, it leaves holes in the address space if regions are
-           deallocated.  */
-        let upper_bound = self.vm_regions.upper_bound(Bound::Unbounded);
-        let upper_end = upper_bound.get().map_or(0, |region| region.end);
-        let start = memory::align_up(upper_end as u64, align as u64) as usize;
-        let end = start + size;
-        {
-            let iter = self.vm_regions.range(
-                Bound::Included(&start),
-                Bound::Excluded(&end),
-            );
-            if iter.count() > 0 {
-                return Err(Error::new(EINVAL));
+        let mut align = match cmp::max(align, 1).checked_next_power_of_two() {
+            Some(align) => align,
+            None => return Err(Error::new(EINVAL)),
+        };
+        for &size_align in &[memory::PAGE_SIZE_HUGE as usize, memory::PAGE_SIZE_LARGE as usize] {
+            if size_align <= page_size && size_align <= size {
+                align = cmp::max(align, size_align);
+                break;
             }
         }
-        self.vm_regions.insert(
-            Box::new(VMRegion::new(start, end, prot)),
-        );
+        let start = match self.free_space.alloc(size, align) {
+            Some(start) => start,
+            None => return Err(Error::new(ENOMEM)),
+        };
+        let end = start + size;
+        let mut region = VMRegion::new(start, end, prot);
+        region.page_size = page_size;
+        self.vm_regions.insert(Box::new(region));
         Ok((start, end))
     }
 
@@ -156,18 +560,15 @@ impl VMAddressSpace {
     /// * `end` - The exclusive end address of the allocated region
     /// * `prot` - The protection of the allocated region
     pub fn allocate_fixed(&mut self, start: usize, end: usize, prot: VMProt) -> Result<()> {
+        if start >= end {
+            return Err(Error::new(EINVAL));
+        }
         let size = end - start;
         if !memory::is_aligned(size as u64, memory::PAGE_SIZE_SMALL) {
             return Err(Error::new(EINVAL));
         }
-        {
-            let iter = self.vm_regions.range(
-                Bound::Included(&start),
-                Bound::Excluded(&end),
-            );
-            if iter.count() > 0 {
-                return Err(Error::new(EINVAL));
-            }
+        if self.overlaps(start, end) || !self.free_space.reserve(start, end) {
+            return Err(Error::new(EINVAL));
         }
         self.vm_regions.insert(
             Box::new(VMRegion::new(start, end, prot)),
@@ -175,28 +576,68 @@ impl VMAddressSpace {
         Ok(())
     }
 
+    /// Allocates a read-write region on behalf of the process, which can
+    /// deallocate it with `deallocate_user`.
+    pub fn allocate_user(&mut self, size: usize, align: usize, page_size: usize) -> Result<(usize, usize)> {
+        let (start, end) = self.allocate_with_page_size(size, align, VMProt::VM_PROT_RW, page_size)?;
+        if let Some(region) = self.vm_regions.find(&start).get() {
+            region.user_owned.set(true);
+        }
+        Ok((start, end))
+    }
+
+    /// Deallocates the region that starts at `start` and ends at `end` on
+    /// behalf of the process. Only regions that were allocated with
+    /// `allocate_user` can be deallocated, because the kernel keeps using
+    /// the others.
+    pub fn deallocate_user(&mut self, start: usize, end: usize) -> Result<()> {
+        match self.vm_regions.find(&start).get() {
+            Some(region) if region.user_owned.get() => {}
+            _ => return Err(Error::new(EINVAL)),
+        }
+        self.deallocate(start, end)
+    }
+
+    /// Deallocates the region that starts at `start` and ends at `end`.
+    ///
+    /// The region is unmapped, which invalidates the TLB entries of its pages,
+    /// the memory that populated it is freed, and its part of the address
+    /// space can be allocated again.
     pub fn deallocate(&mut self, start: usize, end: usize) -> Result<()> {
-        let mut cur = self.vm_regions.find_mut(&start);
-        if let Some(region) = cur.get() {
-            if region.end != end {
-                return Err(Error::new(EINVAL));
+        {
+            let cur = self.vm_regions.find(&start);
+            let region = match cur.get() {
+                Some(region) if region.end == end => region,
+                _ => return Err(Error::new(EINVAL)),
+            };
+            // Only the populated pages of a region are mapped, so a sparse
+            // region is unmapped without walking its unpopulated parts.
+            if region.mapped.get() {
+                region.unmap(self.mmu_map, start, end)?;
+            } else {
+                for (&page_start, page) in region.pages.borrow().iter() {
+                    region.unmap(self.mmu_map, page_start, page_start + page.size)?;
+                }
             }
-            cur.remove();
-            Ok(())
-        } else {
-            Err(Error::new(EINVAL))
         }
+        // Dropping the region frees its memory.
+        self.vm_regions.find_mut(&start).remove();
+        self.free_space.free(start, end);
+        Ok(())
     }
 
+    /// Maps the memory at kernel address `page` to the region that starts at
+    /// `start` and ends at `end`. The caller retains ownership of the memory,
+    /// which is not freed when the region is deleted.
     pub fn map(&mut self, start: usize, end: usize, page: usize) -> Result<()> {
         let cur = self.vm_regions.find(&start);
         if let Some(region) = cur.get() {
             if region.end != end {
                 return Err(Error::new(EINVAL));
             }
+            region.mapped.set(true);
             let err = unsafe {
                 let size = (end - start) as usize;
-                region.page.set(Some(page as usize));
                 mmu::mmu_map_range(
                     self.mmu_map,
                     start,
@@ -215,30 +656,23 @@ impl VMAddressSpace {
         }
     }
 
-    pub fn populate(&mut self, start: usize, end: usize) -> Result<()> {
+    /// Maps the device memory at physical address `phys` to the region that
+    /// starts at `start` and ends at `end` with caching disabled.
+    pub fn map_io(&mut self, start: usize, end: usize, phys: usize) -> Result<()> {
         let cur = self.vm_regions.find(&start);
         if let Some(region) = cur.get() {
             if region.end != end {
                 return Err(Error::new(EINVAL));
             }
+            region.mapped.set(true);
             let err = unsafe {
-                let size = (end - start) as u64;
-                let page = match size {
-                    memory::PAGE_SIZE_LARGE => memory::page_alloc_large(),
-                    memory::PAGE_SIZE_SMALL => memory::page_alloc_small(),
-                    _ => return Err(Error::new(EINVAL)),
-                };
-                if page as usize == 0 {
-                    return Err(Error::new(ENOMEM));
-                }
-                region.page.set(Some(page as usize));
                 mmu::mmu_map_range(
                     self.mmu_map,
                     start,
-                    mmu::virt_to_phys(mem::transmute(page)),
+                    phys,
                     end - start,
                     region.mmu_prot(),
-                    mmu::MMU_USER_PAGE,
+                    mmu::MMU_USER_PAGE | mmu::MMU_NOCACHE,
                 )
             };
             if err != 0 {
@@ -250,6 +684,77 @@ impl VMAddressSpace {
         }
     }
 
+    /// Populates the region that starts at `start` and ends at `end` with
+    /// zeroed memory up front instead of on demand. Large pages are used
+    /// where the region covers them.
+    pub fn populate(&mut self, start: usize, end: usize) -> Result<()> {
+        let mmu_map = self.mmu_map;
+        let cur = self.vm_regions.find(&start);
+        if let Some(region) = cur.get() {
+            if region.end != end {
+                return Err(Error::new(EINVAL));
+            }
+            let mut addr = start;
+            while addr < end {
+                let (_, page_end) = region.populate_page(mmu_map, addr, region.page_size)?;
+                addr = page_end;
+            }
+            Ok(())
+        } else {
+            Err(Error::new(EINVAL))
+        }
+    }
+
+    /// Handles a page fault at `addr`, where `flags` is a combination of the
+    /// `PAGE_FAULT_*` flags.
+    ///
+    /// Regions that are not populated up front are populated on demand: the
+    /// first access to a page faults and populates it with zeroed memory. A
+    /// large page is used where the region covers it. Otherwise, the small
+    /// pages in the window around the faulting page are populated too, which
+    /// saves the faults of the neighbouring accesses that usually follow.
+    pub fn handle_fault(&mut self, addr: usize, flags: u32) -> Result<()> {
+        let mmu_map = self.mmu_map;
+        let region = match self.find_region(addr) {
+            Some(region) => region,
+            None => return Err(Error::new(EFAULT)),
+        };
+        if region.mapped.get() || flags & PAGE_FAULT_PROT != 0 {
+            return Err(Error::new(EFAULT));
+        }
+        if flags & PAGE_FAULT_WRITE != 0 && !region.prot.contains(VMProt::VM_PROT_WRITE) {
+            return Err(Error::new(EFAULT));
+        }
+        if flags & PAGE_FAULT_EXEC != 0 && !region.prot.contains(VMProt::VM_PROT_EXEC) {
+            return Err(Error::new(EFAULT));
+        }
+        // A huge page is never populated on demand, because zeroing it would
+        // stall the faulting access for too long.
+        let max_size = cmp::min(region.page_size, memory::PAGE_SIZE_LARGE as usize);
+        let (start, end) = region.populate_page(mmu_map, addr, max_size)?;
+        if (end - start) as u64 == memory::PAGE_SIZE_SMALL {
+            let around_start = memory::align_down(addr as u64, FAULT_AROUND_SIZE as u64) as usize;
+            let around_end = cmp::min(around_start + FAULT_AROUND_SIZE, region.end);
+            let around_start = cmp::max(around_start, region.start);
+            for page_addr in (around_start..around_end).step_by(memory::PAGE_SIZE_SMALL as usize) {
+                // Fault-around is an optimization, so it stops quietly when
+                // memory runs out.
+                if region.populate_page(mmu_map, page_addr, memory::PAGE_SIZE_SMALL as usize).is_err() {
+                    break;
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// Returns the region that contains `addr`.
+    fn find_region(&self, addr: usize) -> Option<&VMRegion> {
+        match self.vm_regions.upper_bound(Bound::Included(&addr)).get() {
+            Some(region) if addr < region.end => Some(region),
+            _ => None,
+        }
+    }
+
     pub fn populate_from(
         &mut self,
         vm_start: usize,
@@ -269,22 +774,7 @@ impl VMAddressSpace {
                 return Err(Error::new(EINVAL));
             }
             for offset in (0..vm_size).step_by(memory::PAGE_SIZE_SMALL as usize) {
-                let page = memory::page_alloc_small();
-                if page as usize == 0 {
-                    return Err(Error::new(ENOMEM));
-                }
-                region.page.set(Some(page as usize));
-                let err = unsafe { mmu::mmu_map_range(
-                    self.mmu_map,
-                    vm_start + offset,
-                    mmu::virt_to_phys(mem::transmute(page)),
-                    memory::PAGE_SIZE_SMALL as usize,
-                    region.mmu_prot(),
-                    mmu::MMU_USER_PAGE,
-                )};
-                if err != 0 {
-                    return Err(Error::new(err));
-                }
+                region.populate_page(self.mmu_map, vm_start + offset, memory::PAGE_SIZE_SMALL as usize)?;
             }
             unsafe { memcpy(mem::transmute(dst_start), mem::transmute(src_start), (src_end - src_start) as usize) };
             Ok(())
@@ -11,9 +11,18 @@
 #include <kernel/kmem.h>
 
 #include <kernel/align.h>
+#include <kernel/cpu.h>
 #include <kernel/errno.h>
+#include <kernel/numa.h>
 #include <kernel/page-alloc.h>
 #include <kernel/printf.h>
+#include <kernel/panic.h>
+#include <kernel/user-access.h>
+#include <kernel/vmalloc.h>
+
+#include <uapi/manticore/kmem_stats_abi.h>
+
+#include <arch/interrupts.h>
 
 #include <stdbool.h>
 #include <string.h>
@@ -21,21 +30,197 @@
 static struct kmem_cache kmem_cache_cache;
 static struct kmem_cache kmem_slab_cache;
 
+/* All object caches, for reaping.  */
+static struct kmem_cache *kmem_caches;
+
+/* Number of buckets in the hash table of off-slab slabs.  */
+#define KMEM_SLAB_HASH_SIZE 256
+
+/* The slabs of off-slab caches, keyed by slab memory address. Objects of
+   on-slab caches find their slab at the end of the slab memory instead.  */
+static struct kmem_slab *kmem_slab_hash[KMEM_SLAB_HASH_SIZE];
+
+/* Increments allocator statistics counter \counter, which is also updated
+   from interrupt handlers.  */
+static inline void kmem_count(uint64_t *counter)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	(*counter)++;
+	arch_local_interrupt_restore(flags);
+}
+
+#ifdef HAVE_KMEM_PROFILE
+
+/* Maximum number of allocation call sites that are profiled.  */
+#define KMEM_PROFILE_MAX_SITES 512
+
+/* Allocation call sites, in an open addressing hash table keyed by the
+   return address of the allocation call.  */
+static struct kmem_site_stats kmem_sites[KMEM_PROFILE_MAX_SITES];
+
+static void kmem_profile_record(void *site, size_t size, void *obj, uint64_t cycles)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	size_t idx = ((uintptr_t) site >> 2) % KMEM_PROFILE_MAX_SITES;
+	for (size_t i = 0; i < KMEM_PROFILE_MAX_SITES; i++) {
+		struct kmem_site_stats *s = &kmem_sites[(idx + i) % KMEM_PROFILE_MAX_SITES];
+		if (s->site && s->site != (uintptr_t) site) {
+			continue;
+		}
+		s->site = (uintptr_t) site;
+		if (obj) {
+			s->allocs++;
+			s->bytes += size;
+		} else {
+			s->failures++;
+		}
+		s->cycles += cycles;
+		if (cycles > s->cycles_max) {
+			s->cycles_max = cycles;
+		}
+		break;
+	}
+	arch_local_interrupt_restore(flags);
+}
+
+/* Evaluates allocation \alloc of \size bytes and records it to the call
+   site of the enclosing function.  */
+#define KMEM_PROFILE(alloc, size)                                                                                      \
+	({                                                                                                             \
+		uint64_t __start = arch_cycle_counter();                                                               \
+		void *__obj = (alloc);                                                                                 \
+		kmem_profile_record(__builtin_return_address(0), (size), __obj, arch_cycle_counter() - __start);       \
+		__obj;                                                                                                 \
+	})
+
+#else
+
+#define KMEM_PROFILE(alloc, size) (alloc)
+
+#endif
+
 static struct kmem_bufctl *kmem_object_to_bufctl(struct kmem_cache *cache, void *obj)
 {
 	return obj + cache->bufctl;
 }
 
+static inline struct kmem_slab **kmem_slab_hash_bucket(void *base)
+{
+	return &kmem_slab_hash[((uintptr_t) base / PAGE_SIZE_SMALL) % KMEM_SLAB_HASH_SIZE];
+}
+
+static void kmem_slab_hash_insert(struct kmem_slab *slab)
+{
+	struct kmem_slab **bucket = kmem_slab_hash_bucket(slab->base);
+	slab->hash_next = *bucket;
+	*bucket = slab;
+}
+
+static void kmem_slab_hash_remove(struct kmem_slab *slab)
+{
+	struct kmem_slab **p = kmem_slab_hash_bucket(slab->base);
+	while (*p != slab) {
+		p = &(*p)->hash_next;
+	}
+	*p = slab->hash_next;
+}
+
+/* Returns the slab that object \obj of \cache was allocated from.  */
+static struct kmem_slab *kmem_object_to_slab(struct kmem_cache *cache, void *obj)
+{
+	void *base = (void *) align_down((uintptr_t) obj, cache->slab_size);
+	if (!(cache->flags & KMEM_CACHE_OFFSLAB)) {
+		return base + cache->slab_size - sizeof(struct kmem_slab);
+	}
+	struct kmem_slab *slab = *kmem_slab_hash_bucket(base);
+	while (slab && slab->base != base) {
+		slab = slab->hash_next;
+	}
+	return slab;
+}
+
+static void kmem_slab_list_add(struct kmem_slab_list *list, struct kmem_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = list->head;
+	if (list->head) {
+		list->head->prev = slab;
+	}
+	list->head = slab;
+	list->nr_slabs++;
+}
+
+static void kmem_slab_list_remove(struct kmem_slab_list *list, struct kmem_slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		list->head = slab->next;
+	}
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+	slab->prev = NULL;
+	slab->next = NULL;
+	list->nr_slabs--;
+}
+
+static void kmem_slab_list_move(struct kmem_slab_list *from, struct kmem_slab_list *to, struct kmem_slab *slab)
+{
+	kmem_slab_list_remove(from, slab);
+	kmem_slab_list_add(to, slab);
+}
+
+static void *kmem_slab_page_alloc(struct kmem_cache *cache)
+{
+	if (cache->slab_size == PAGE_SIZE_LARGE) {
+		return page_alloc_large();
+	}
+	return page_alloc_small();
+}
+
+static void kmem_slab_page_free(struct kmem_cache *cache, void *base)
+{
+	if (cache->slab_size == PAGE_SIZE_LARGE) {
+		page_free_large(base);
+	} else {
+		page_free_small(base);
+	}
+}
+
+/* Returns the offset of the first object of a new slab. Successive slabs
+   start their objects at different cache line offsets, using the space
+   that is left over at the end of the slab, so that objects at the same
+   index of different slabs do not map to the same cache sets.  */
+static size_t kmem_slab_next_color(struct kmem_cache *cache)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	size_t color = cache->color_next;
+	cache->color_next += cache->color_align;
+	if (cache->color_next > cache->color_max) {
+		cache->color_next = 0;
+	}
+	arch_local_interrupt_restore(flags);
+	return color;
+}
+
 static struct kmem_slab *kmem_slab_create(struct kmem_cache *cache)
 {
-	void *base = page_alloc_small();
+	void *base = kmem_slab_page_alloc(cache);
 	if (!base) {
-		return NULL;
+		/* Cached objects and empty slabs of other caches may free
+		   enough memory.  */
+		kmem_reap();
+		base = kmem_slab_page_alloc(cache);
+		if (!base) {
+			return NULL;
+		}
 	}
-	size_t slab_size = PAGE_SIZE_SMALL;
+	size_t slab_size = cache->slab_size;
+	size_t color = kmem_slab_next_color(cache);
 	struct kmem_slab *slab;
-	if (cache->size < PAGE_SIZE_SMALL / 8) {
-		slab = base + PAGE_SIZE_SMALL - sizeof(*slab);
+	if (!(cache->flags & KMEM_CACHE_OFFSLAB)) {
+		slab = base + slab_size - sizeof(*slab);
 		slab_size -= sizeof(*slab);
 	} else {
 		slab = kmem_cache_alloc(&kmem_slab_cache);
@@ -45,12 +230,14 @@ static struct kmem_slab *kmem_slab_create(struct kmem_cache *cache)
 	}
 	slab->cache = cache;
 	slab->base = base;
-	slab->head = kmem_object_to_bufctl(cache, base);
+	slab->head = kmem_object_to_bufctl(cache, base + color);
+	slab->prev = NULL;
 	slab->next = NULL;
+	slab->hash_next = NULL;
 	slab->nr_free = 0;
 	slab->capacity = 0;
 	size_t buffer_size = align_up(cache->size, cache->align);
-	for (size_t offset = 0; offset + buffer_size <= slab_size; offset += buffer_size) {
+	for (size_t offset = color; offset + buffer_size <= slab_size; offset += buffer_size) {
 		void *addr = base + offset;
 		struct kmem_bufctl *bufctl = kmem_object_to_bufctl(cache, addr);
 		size_t next_offset = offset + buffer_size;
@@ -66,31 +253,28 @@ static struct kmem_slab *kmem_slab_create(struct kmem_cache *cache)
 	}
 	return slab;
 error_free_page:
-	page_free_small(base);
+	kmem_slab_page_free(cache, base);
 	return NULL;
 }
 
 static void kmem_slab_destroy(struct kmem_slab *slab)
 {
-	page_free_small(slab->base);
+	struct kmem_cache *cache = slab->cache;
+	void *base = slab->base;
+	if (cache->flags & KMEM_CACHE_OFFSLAB) {
+		kmem_cache_free(&kmem_slab_cache, slab);
+	}
+	kmem_slab_page_free(cache, base);
 }
 
 static void *kmem_slab_alloc_object(struct kmem_slab *slab)
 {
 	struct kmem_bufctl *bufctl = slab->head;
-	if (!bufctl) {
-		return NULL;
-	}
 	slab->head = bufctl->next;
 	slab->nr_free--;
 	return bufctl->addr;
 }
 
-static bool kmem_slab_is_full(struct kmem_slab *slab)
-{
-	return slab->nr_free == slab->capacity;
-}
-
 static void kmem_slab_free_object(struct kmem_slab *slab, void *obj)
 {
 	struct kmem_bufctl *bufctl = kmem_object_to_bufctl(slab->cache, obj);
@@ -101,24 +285,68 @@ static void kmem_slab_free_object(struct kmem_slab *slab, void *obj)
 	slab->nr_free++;
 }
 
-static int kmem_cache_init(struct kmem_cache *cache, const char *name, size_t size, size_t align)
+static void *kmem_cache_slab_alloc(struct kmem_cache *cache);
+static void kmem_cache_slab_free(struct kmem_cache *cache, void *obj);
+
+static void *kmem_cache_backend_alloc(void *arg)
+{
+	return kmem_cache_slab_alloc(arg);
+}
+
+static void kmem_cache_backend_free(void *arg, void *obj)
+{
+	kmem_cache_slab_free(arg, obj);
+}
+
+static int kmem_cache_init(struct kmem_cache *cache, const char *name, size_t size, size_t align, unsigned int flags)
 {
 	if (align_up(size, align) < sizeof(struct kmem_bufctl)) {
 		return -EINVAL;
 	}
+	if (flags & KMEM_CACHE_HWALIGN && align < KMEM_CACHE_LINE_SIZE) {
+		align = KMEM_CACHE_LINE_SIZE;
+	}
 	strlcpy(cache->name, name, KMEM_NAME_MAX_LEN);
 	cache->size = size;
 	cache->align = align;
-	cache->bufctl = align_up(size, align) - sizeof(struct kmem_bufctl);
-	cache->slab = kmem_slab_create(cache);
+	cache->slab_size = flags & KMEM_CACHE_LARGESLAB ? PAGE_SIZE_LARGE : PAGE_SIZE_SMALL;
+	cache->flags = flags;
+	/* Small objects keep the slab metadata at the end of the slab, which
+	   finds the slab of an object from the object address alone.  */
+	if (size >= cache->slab_size / 8) {
+		cache->flags |= KMEM_CACHE_OFFSLAB;
+	}
+	size_t buffer_size = align_up(size, align);
+	if (buffer_size > cache->slab_size) {
+		return -EINVAL;
+	}
+	cache->bufctl = buffer_size - sizeof(struct kmem_bufctl);
+	size_t usable = cache->slab_size;
+	if (!(cache->flags & KMEM_CACHE_OFFSLAB)) {
+		usable -= sizeof(struct kmem_slab);
+	}
+	cache->color_align = align > KMEM_CACHE_LINE_SIZE ? align : KMEM_CACHE_LINE_SIZE;
+	cache->color_max = align_down(usable % buffer_size, cache->color_align);
+	cache->color_next = 0;
+	cache->partial = (struct kmem_slab_list){ 0 };
+	cache->full = (struct kmem_slab_list){ 0 };
+	cache->empty = (struct kmem_slab_list){ 0 };
+	cache->nr_allocs = 0;
+	cache->nr_frees = 0;
+	cache->nr_failures = 0;
+	kmem_magazine_layer_init(&cache->magazines, kmem_cache_backend_alloc, kmem_cache_backend_free, cache);
+	unsigned long irq_flags = arch_local_interrupt_save();
+	cache->next = kmem_caches;
+	kmem_caches = cache;
+	arch_local_interrupt_restore(irq_flags);
 	return 0;
 }
 
-struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align)
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, unsigned int flags)
 {
 	struct kmem_cache *cache = kmem_cache_alloc(&kmem_cache_cache);
 	if (cache) {
-		if (kmem_cache_init(cache, name, size, align) < 0) {
+		if (kmem_cache_init(cache, name, size, align, flags) < 0) {
 			kmem_cache_free(&kmem_cache_cache, cache);
 			return NULL;
 		}
@@ -126,50 +354,200 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align
 	return cache;
 }
 
-void kmem_cache_destroy(struct kmem_cache *cache)
+static void kmem_slab_list_destroy(struct kmem_slab_list *list)
 {
-	struct kmem_slab *slab = cache->slab;
-	for (;;) {
-		struct kmem_slab *next = slab->next;
-		kmem_slab_destroy(slab);
-		if (!next) {
-			break;
+	struct kmem_slab *slab;
+	while ((slab = list->head)) {
+		kmem_slab_list_remove(list, slab);
+		if (slab->cache->flags & KMEM_CACHE_OFFSLAB) {
+			kmem_slab_hash_remove(slab);
 		}
-		slab = next;
+		kmem_slab_destroy(slab);
+	}
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+	kmem_magazine_layer_drain(&cache->magazines);
+	unsigned long flags = arch_local_interrupt_save();
+	struct kmem_cache **p = &kmem_caches;
+	while (*p != cache) {
+		p = &(*p)->next;
 	}
+	*p = cache->next;
+	arch_local_interrupt_restore(flags);
+	if (cache->partial.nr_slabs || cache->full.nr_slabs) {
+		printf("warning: destroying cache '%s' with allocated objects\n", cache->name);
+	}
+	kmem_slab_list_destroy(&cache->partial);
+	kmem_slab_list_destroy(&cache->full);
+	kmem_slab_list_destroy(&cache->empty);
 	kmem_cache_free(&kmem_cache_cache, cache);
 }
 
-void *kmem_cache_alloc(struct kmem_cache *cache)
+static void *kmem_cache_slab_alloc(struct kmem_cache *cache)
 {
 	for (;;) {
-		void *obj = kmem_slab_alloc_object(cache->slab);
-		if (obj) {
+		unsigned long flags = arch_local_interrupt_save();
+		/* Partial slabs are used before empty ones, so that empty slabs
+		   can be reclaimed.  */
+		struct kmem_slab *slab = cache->partial.head;
+		if (!slab && cache->empty.head) {
+			slab = cache->empty.head;
+			kmem_slab_list_move(&cache->empty, &cache->partial, slab);
+		}
+		if (slab) {
+			void *obj = kmem_slab_alloc_object(slab);
+			if (!slab->nr_free) {
+				kmem_slab_list_move(&cache->partial, &cache->full, slab);
+			}
+			arch_local_interrupt_restore(flags);
 			return obj;
 		}
-		struct kmem_slab *slab = kmem_slab_create(cache);
+		arch_local_interrupt_restore(flags);
+		/* The slab is created with interrupts enabled, because creating
+		   it may reap this cache.  */
+		slab = kmem_slab_create(cache);
 		if (!slab) {
 			return NULL;
 		}
-		slab->next = cache->slab;
-		cache->slab = slab;
+		flags = arch_local_interrupt_save();
+		if (cache->flags & KMEM_CACHE_OFFSLAB) {
+			kmem_slab_hash_insert(slab);
+		}
+		kmem_slab_list_add(&cache->empty, slab);
+		arch_local_interrupt_restore(flags);
 	}
 }
 
-void kmem_cache_free(struct kmem_cache *cache, void *obj)
+static void kmem_cache_slab_free(struct kmem_cache *cache, void *obj)
 {
-	kmem_slab_free_object(cache->slab, obj);
-
-	if (!kmem_slab_is_full(cache->slab)) {
+	unsigned long flags = arch_local_interrupt_save();
+	struct kmem_slab *slab = kmem_object_to_slab(cache, obj);
+	if (!slab || slab->cache != cache) {
+		panic("kmem: object %p freed to cache '%s' that it does not belong to", obj, cache->name);
+	}
+	kmem_slab_free_object(slab, obj);
+	if (slab->nr_free == 1) {
+		kmem_slab_list_move(&cache->full, &cache->partial, slab);
+	}
+	if (slab->nr_free < slab->capacity) {
+		arch_local_interrupt_restore(flags);
 		return;
 	}
-	struct kmem_slab *slab = cache->slab;
-	if (slab->next) {
-		cache->slab = slab->next;
+	kmem_slab_list_move(&cache->partial, &cache->empty, slab);
+	/* Empty slabs are reclaimed lazily, so that a cache that allocates and
+	   frees objects around a slab boundary does not create and destroy
+	   slabs all the time.  */
+	struct kmem_slab *victim = NULL;
+	if (cache->empty.nr_slabs > KMEM_CACHE_MAX_EMPTY) {
+		victim = slab;
+		kmem_slab_list_remove(&cache->empty, victim);
+		if (cache->flags & KMEM_CACHE_OFFSLAB) {
+			kmem_slab_hash_remove(victim);
+		}
+	}
+	arch_local_interrupt_restore(flags);
+	if (victim) {
+		kmem_slab_destroy(victim);
+	}
+}
+
+/* Destroys the empty slabs of \cache.  */
+static void kmem_cache_reap(struct kmem_cache *cache)
+{
+	for (;;) {
+		unsigned long flags = arch_local_interrupt_save();
+		struct kmem_slab *slab = cache->empty.head;
+		if (slab) {
+			kmem_slab_list_remove(&cache->empty, slab);
+			if (cache->flags & KMEM_CACHE_OFFSLAB) {
+				kmem_slab_hash_remove(slab);
+			}
+		}
+		arch_local_interrupt_restore(flags);
+		if (!slab) {
+			break;
+		}
 		kmem_slab_destroy(slab);
 	}
 }
 
+void kmem_reap(void)
+{
+	/* Caches are never destroyed while they are reaped, so the list is
+	   walked with interrupts enabled.  */
+	for (struct kmem_cache *cache = kmem_caches; cache; cache = cache->next) {
+		if (!(cache->flags & KMEM_CACHE_NOMAGAZINE)) {
+			kmem_magazine_layer_drain(&cache->magazines);
+		}
+	}
+	for (struct kmem_cache *cache = kmem_caches; cache; cache = cache->next) {
+		kmem_cache_reap(cache);
+	}
+}
+
+static void *__kmem_cache_alloc(struct kmem_cache *cache)
+{
+	void *obj;
+	if (cache->flags & KMEM_CACHE_NOMAGAZINE) {
+		obj = kmem_cache_slab_alloc(cache);
+	} else {
+		obj = kmem_magazine_alloc(&cache->magazines);
+	}
+	kmem_count(obj ? &cache->nr_allocs : &cache->nr_failures);
+	return obj;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	return KMEM_PROFILE(__kmem_cache_alloc(cache), cache->size);
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	kmem_count(&cache->nr_frees);
+	if (cache->flags & KMEM_CACHE_NOMAGAZINE) {
+		kmem_cache_slab_free(cache, obj);
+		return;
+	}
+	kmem_magazine_free(&cache->magazines, obj);
+}
+
+static size_t kmem_slab_list_free_objs(struct kmem_slab_list *list)
+{
+	size_t nr = 0;
+	for (struct kmem_slab *slab = list->head; slab; slab = slab->next) {
+		nr += slab->nr_free;
+	}
+	return nr;
+}
+
+void kmem_cache_get_stats(struct kmem_cache *cache, struct kmem_cache_stats *stats)
+{
+	size_t buffer_size = align_up(cache->size, cache->align);
+	size_t usable = cache->slab_size;
+	if (!(cache->flags & KMEM_CACHE_OFFSLAB)) {
+		usable -= sizeof(struct kmem_slab);
+	}
+	memset(stats, 0, sizeof(*stats));
+	strlcpy(stats->name, cache->name, KMEM_STATS_NAME_LEN);
+	stats->obj_size = cache->size;
+	stats->slab_size = cache->slab_size;
+	stats->objs_per_slab = usable / buffer_size;
+	unsigned long flags = arch_local_interrupt_save();
+	stats->allocs = cache->nr_allocs;
+	stats->frees = cache->nr_frees;
+	stats->failures = cache->nr_failures;
+	stats->nr_partial = cache->partial.nr_slabs;
+	stats->nr_full = cache->full.nr_slabs;
+	stats->nr_empty = cache->empty.nr_slabs;
+	stats->free_objs = kmem_slab_list_free_objs(&cache->partial) + kmem_slab_list_free_objs(&cache->empty);
+	arch_local_interrupt_restore(flags);
+	stats->live = stats->allocs - stats->frees;
+	stats->bytes = (stats->nr_partial + stats->nr_full + stats->nr_empty) * cache->slab_size;
+}
+
 static size_t kmem_alloc_sizes[] = {
     32, 64, 128, 256, 512, 1024, 2048, 4096,
 };
@@ -206,18 +584,157 @@ static inline struct kmem_cache *kmem_size_to_cache(size_t size)
 	return &kmalloc_caches[idx];
 }
 
-void *kmem_alloc(size_t size)
+/* Allocations above this size that do not fit the kmalloc caches are
+   virtually contiguous, and the smaller ones physically contiguous pages.  */
+#define KMEM_LARGE_MAX (128 * 1024)
+
+enum kmem_backend {
+	KMEM_BACKEND_CACHE,
+	KMEM_BACKEND_PAGES,
+	KMEM_BACKEND_VMALLOC,
+};
+
+/* Counters of the backends of large allocations, which have no cache.  */
+struct kmem_backend_stats {
+	const char	*name;
+	uint64_t	nr_allocs;
+	uint64_t	nr_frees;
+	uint64_t	nr_failures;
+	uint64_t	bytes;		// Memory of live objects
+};
+
+static struct kmem_backend_stats kmem_backend_stats[] = {
+	[KMEM_BACKEND_PAGES] = { .name = "kmem-pages" },
+	[KMEM_BACKEND_VMALLOC] = { .name = "kmem-vmalloc" },
+};
+
+static void *kmem_backend_count_alloc(enum kmem_backend backend, void *obj, size_t capacity)
+{
+	struct kmem_backend_stats *stats = &kmem_backend_stats[backend];
+	unsigned long flags = arch_local_interrupt_save();
+	if (obj) {
+		stats->nr_allocs++;
+		stats->bytes += capacity;
+	} else {
+		stats->nr_failures++;
+	}
+	arch_local_interrupt_restore(flags);
+	return obj;
+}
+
+static void kmem_backend_count_free(enum kmem_backend backend, size_t capacity)
+{
+	struct kmem_backend_stats *stats = &kmem_backend_stats[backend];
+	unsigned long flags = arch_local_interrupt_save();
+	stats->nr_frees++;
+	stats->bytes -= capacity;
+	arch_local_interrupt_restore(flags);
+}
+
+static unsigned int kmem_large_order(size_t size)
+{
+	unsigned int order = 0;
+	while ((PAGE_SIZE_SMALL << order) < size) {
+		order++;
+	}
+	return order;
+}
+
+/* Returns the backend of an allocation of \size bytes aligned to \align
+   bytes, and stores the number of bytes that the backend actually reserves
+   to \capacity. Objects of the kmalloc caches are aligned to the cache
+   object size, so an alignment is honored by allocating at least as many
+   bytes.  */
+static enum kmem_backend kmem_size_to_backend(size_t size, size_t align, size_t *capacity)
+{
+	size_t class = size < align ? align : size;
+	struct kmem_cache *cache = kmem_size_to_cache(class);
+	if (cache) {
+		*capacity = cache->size;
+		return KMEM_BACKEND_CACHE;
+	}
+	if (class <= KMEM_LARGE_MAX || align > PAGE_SIZE_SMALL) {
+		*capacity = PAGE_SIZE_SMALL << kmem_large_order(class);
+		return KMEM_BACKEND_PAGES;
+	}
+	*capacity = align_up(size, PAGE_SIZE_SMALL);
+	return KMEM_BACKEND_VMALLOC;
+}
+
+static void *__kmem_alloc_align(size_t size, size_t align)
+{
+	size_t capacity;
+
+	if (align & (align - 1)) {
+		return NULL;
+	}
+	switch (kmem_size_to_backend(size, align, &capacity)) {
+	case KMEM_BACKEND_CACHE:
+		return __kmem_cache_alloc(kmem_size_to_cache(capacity));
+	case KMEM_BACKEND_PAGES:
+		return kmem_backend_count_alloc(KMEM_BACKEND_PAGES, page_alloc_order(kmem_large_order(capacity)),
+						capacity);
+	case KMEM_BACKEND_VMALLOC:
+		return kmem_backend_count_alloc(KMEM_BACKEND_VMALLOC, vmalloc(size), capacity);
+	}
+	return NULL;
+}
+
+void *kmem_alloc_align(size_t size, size_t align)
+{
+	return KMEM_PROFILE(__kmem_alloc_align(size, align), size);
+}
+
+void kmem_free_align(void *ptr, size_t size, size_t align)
+{
+	size_t capacity;
+
+	if (!ptr) {
+		return;
+	}
+	switch (kmem_size_to_backend(size, align, &capacity)) {
+	case KMEM_BACKEND_CACHE:
+		kmem_cache_free(kmem_size_to_cache(capacity), ptr);
+		break;
+	case KMEM_BACKEND_PAGES:
+		kmem_backend_count_free(KMEM_BACKEND_PAGES, capacity);
+		page_free_order(ptr, kmem_large_order(capacity));
+		break;
+	case KMEM_BACKEND_VMALLOC:
+		kmem_backend_count_free(KMEM_BACKEND_VMALLOC, capacity);
+		vfree(ptr);
+		break;
+	}
+}
+
+void *kmem_realloc_align(void *ptr, size_t old_size, size_t new_size, size_t align)
 {
-	struct kmem_cache *cache = kmem_size_to_cache(size);
-	if (!cache) {
+	size_t old_capacity, new_capacity;
+
+	/* Growing within the memory that the backend reserved for the object
+	   anyway, as a Vec does one element at a time, is free.  */
+	enum kmem_backend old_backend = kmem_size_to_backend(old_size, align, &old_capacity);
+	enum kmem_backend new_backend = kmem_size_to_backend(new_size, align, &new_capacity);
+	if (old_backend == new_backend && old_capacity == new_capacity) {
+		return ptr;
+	}
+	void *new_ptr = KMEM_PROFILE(__kmem_alloc_align(new_size, align), new_size);
+	if (!new_ptr) {
 		return NULL;
 	}
-	return kmem_cache_alloc(cache);
+	memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+	kmem_free_align(ptr, old_size, align);
+	return new_ptr;
+}
+
+void *kmem_alloc(size_t size)
+{
+	return KMEM_PROFILE(__kmem_alloc_align(size, KMEM_DEFAULT_ALIGN), size);
 }
 
 void *kmem_zalloc(size_t size)
 {
-	void *p = kmem_alloc(size);
+	void *p = KMEM_PROFILE(__kmem_alloc_align(size, KMEM_DEFAULT_ALIGN), size);
 	if (!p) {
 		return NULL;
 	}
@@ -227,21 +744,121 @@ void *kmem_zalloc(size_t size)
 
 void kmem_free(void *ptr, size_t size)
 {
-	struct kmem_cache *cache = kmem_size_to_cache(size);
-	if (!cache) {
-		return;
+	kmem_free_align(ptr, size, KMEM_DEFAULT_ALIGN);
+}
+
+static void kmem_backend_get_stats(struct kmem_backend_stats *backend, struct kmem_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	strlcpy(stats->name, backend->name, KMEM_STATS_NAME_LEN);
+	unsigned long flags = arch_local_interrupt_save();
+	stats->allocs = backend->nr_allocs;
+	stats->frees = backend->nr_frees;
+	stats->failures = backend->nr_failures;
+	stats->bytes = backend->bytes;
+	arch_local_interrupt_restore(flags);
+	stats->live = stats->allocs - stats->frees;
+}
+
+/* Copies entry \idx of \size bytes to user space buffer \ubuf of \len
+   bytes, if it fits.  */
+static int kmem_stats_copy(void /* __user */ *ubuf, size_t len, size_t idx, const void *entry, size_t size)
+{
+	if ((idx + 1) * size > len) {
+		return 0;
 	}
-	kmem_cache_free(cache, ptr);
+	return memcpy_to_user(ubuf + idx * size, entry, size);
+}
+
+static ssize_t kmem_get_cache_stats(void /* __user */ *ubuf, size_t len)
+{
+	struct kmem_cache_stats stats;
+	size_t nr = 0;
+	int err;
+
+	/* Caches are created and destroyed only from process context, so the
+	   list does not change under the walk.  */
+	for (struct kmem_cache *cache = kmem_caches; cache; cache = cache->next) {
+		kmem_cache_get_stats(cache, &stats);
+		err = kmem_stats_copy(ubuf, len, nr++, &stats, sizeof(stats));
+		if (err) {
+			return err;
+		}
+	}
+	for (size_t i = KMEM_BACKEND_PAGES; i < ARRAY_SIZE(kmem_backend_stats); i++) {
+		kmem_backend_get_stats(&kmem_backend_stats[i], &stats);
+		err = kmem_stats_copy(ubuf, len, nr++, &stats, sizeof(stats));
+		if (err) {
+			return err;
+		}
+	}
+	return nr;
+}
+
+static ssize_t kmem_get_arena_stats(void /* __user */ *ubuf, size_t len)
+{
+	struct kmem_arena_stats stats;
+	size_t nr = 0;
+	int err;
+
+	for (int node = 0; node < numa_nr_nodes(); node++) {
+		for (unsigned int type = KMEM_ARENA_SMALL; type <= KMEM_ARENA_DMA; type++) {
+			page_arena_get_node_stats(node, type, &stats);
+			err = kmem_stats_copy(ubuf, len, nr++, &stats, sizeof(stats));
+			if (err) {
+				return err;
+			}
+		}
+	}
+	return nr;
+}
+
+#ifdef HAVE_KMEM_PROFILE
+static ssize_t kmem_get_site_stats(void /* __user */ *ubuf, size_t len)
+{
+	struct kmem_site_stats stats;
+	size_t nr = 0;
+	int err;
+
+	for (size_t i = 0; i < KMEM_PROFILE_MAX_SITES; i++) {
+		unsigned long flags = arch_local_interrupt_save();
+		stats = kmem_sites[i];
+		arch_local_interrupt_restore(flags);
+		if (!stats.site) {
+			continue;
+		}
+		err = kmem_stats_copy(ubuf, len, nr++, &stats, sizeof(stats));
+		if (err) {
+			return err;
+		}
+	}
+	return nr;
+}
+#endif
+
+ssize_t kmem_get_stats(int type, void /* __user */ *ubuf, size_t len)
+{
+	switch (type) {
+	case KMEM_STATS_CACHES:
+		return kmem_get_cache_stats(ubuf, len);
+	case KMEM_STATS_ARENAS:
+		return kmem_get_arena_stats(ubuf, len);
+#ifdef HAVE_KMEM_PROFILE
+	case KMEM_STATS_SITES:
+		return kmem_get_site_stats(ubuf, len);
+#endif
+	}
+	return -EINVAL;
 }
 
 int kmem_init(void)
 {
 	int err;
-	err = kmem_cache_init(&kmem_cache_cache, "kmem_cache_cache", sizeof(struct kmem_cache), KMEM_DEFAULT_ALIGN);
+	err = kmem_cache_init(&kmem_cache_cache, "kmem_cache_cache", sizeof(struct kmem_cache), KMEM_DEFAULT_ALIGN, 0);
 	if (err) {
 		return err;
 	}
-	err = kmem_cache_init(&kmem_slab_cache, "kmem_slab_cache", sizeof(struct kmem_slab), KMEM_DEFAULT_ALIGN);
+	err = kmem_cache_init(&kmem_slab_cache, "kmem_slab_cache", sizeof(struct kmem_slab), KMEM_DEFAULT_ALIGN, 0);
 	if (err) {
 		return err;
 	}
@@ -249,10 +866,12 @@ int kmem_init(void)
 		char cache_name[KMEM_NAME_MAX_LEN];
 		size_t size = kmem_alloc_sizes[i];
 		snprintf(cache_name, KMEM_NAME_MAX_LEN, "kmalloc-%lu", size);
-		err = kmem_cache_init(&kmalloc_caches[i], cache_name, size, KMEM_DEFAULT_ALIGN);
+		/* The caches are aligned to the object size, which
+		   kmem_alloc_align() relies on.  */
+		err = kmem_cache_init(&kmalloc_caches[i], cache_name, size, size, 0);
 		if (err) {
 			return err;
 		}
 	}
-	return 0;
+	return kmem_magazine_init();
 }
@@ -0,0 +1,200 @@
+//
+// Magazine layer
+//
+// A magazine layer caches objects of a backend allocator, such as a slab
+// cache or a page arena, in per-CPU magazines. The common alloc/free pairs
+// only push and pop a per-CPU stack. The design follows Bonwick's paper on
+// magazines:
+//
+// Bonwick, Jeff, and Jonathan Adams. "Magazines and Vmem: Extending the
+// Slab Allocator to Many CPUs and Arbitrary Resources." USENIX Annual
+// Technical Conference, General Track. 2001.
+//
+
+#include <kernel/magazine.h>
+
+#include <kernel/errno.h>
+#include <kernel/kmem.h>
+
+#include <arch/interrupts.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+static struct kmem_cache *kmem_magazine_cache;
+
+/* Index of the current CPU in the per-CPU caches. The kernel runs only on
+   the boot CPU until application processors are brought up.  */
+static inline struct kmem_cpu_cache *kmem_cpu_cache(struct kmem_magazine_layer *layer)
+{
+	return &layer->cpu[0];
+}
+
+static inline bool kmem_magazine_is_empty(struct kmem_magazine *mag)
+{
+	return !mag || mag->nr_rounds == 0;
+}
+
+static inline bool kmem_magazine_is_full(struct kmem_magazine *mag)
+{
+	return !mag || mag->nr_rounds == KMEM_MAGAZINE_SIZE;
+}
+
+static void kmem_magazine_swap(struct kmem_cpu_cache *cc)
+{
+	struct kmem_magazine *mag = cc->loaded;
+	cc->loaded = cc->previous;
+	cc->previous = mag;
+}
+
+static struct kmem_magazine *kmem_depot_pop(struct kmem_magazine **list)
+{
+	struct kmem_magazine *mag = *list;
+	if (mag) {
+		*list = mag->next;
+		mag->next = NULL;
+	}
+	return mag;
+}
+
+static void kmem_depot_push(struct kmem_magazine **list, struct kmem_magazine *mag)
+{
+	mag->next = *list;
+	*list = mag;
+}
+
+/* Returns the rounds of magazine \mag to the backend allocator.  */
+static void kmem_magazine_flush(struct kmem_magazine_layer *layer, struct kmem_magazine *mag)
+{
+	while (mag->nr_rounds) {
+		layer->free(layer->arg, mag->rounds[--mag->nr_rounds]);
+	}
+}
+
+void kmem_magazine_layer_init(struct kmem_magazine_layer *layer, kmem_backend_alloc_t alloc, kmem_backend_free_t free,
+			      void *arg)
+{
+	for (unsigned int i = 0; i < MAX_CPUS; i++) {
+		layer->cpu[i].loaded = NULL;
+		layer->cpu[i].previous = NULL;
+	}
+	layer->depot.full = NULL;
+	layer->depot.empty = NULL;
+	layer->depot.nr_full = 0;
+	layer->alloc = alloc;
+	layer->free = free;
+	layer->arg = arg;
+}
+
+void *kmem_magazine_alloc(struct kmem_magazine_layer *layer)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	struct kmem_cpu_cache *cc = kmem_cpu_cache(layer);
+	if (kmem_magazine_is_empty(cc->loaded)) {
+		if (!kmem_magazine_is_empty(cc->previous)) {
+			kmem_magazine_swap(cc);
+		} else if (layer->depot.full) {
+			if (cc->previous) {
+				kmem_depot_push(&layer->depot.empty, cc->previous);
+			}
+			cc->previous = cc->loaded;
+			cc->loaded = kmem_depot_pop(&layer->depot.full);
+			layer->depot.nr_full--;
+		} else {
+			arch_local_interrupt_restore(flags);
+			return layer->alloc(layer->arg);
+		}
+	}
+	void *obj = cc->loaded->rounds[--cc->loaded->nr_rounds];
+	arch_local_interrupt_restore(flags);
+	return obj;
+}
+
+void kmem_magazine_free(struct kmem_magazine_layer *layer, void *obj)
+{
+	for (;;) {
+		unsigned long flags = arch_local_interrupt_save();
+		struct kmem_cpu_cache *cc = kmem_cpu_cache(layer);
+		if (kmem_magazine_is_full(cc->loaded) && cc->previous && cc->previous->nr_rounds == 0) {
+			kmem_magazine_swap(cc);
+		}
+		if (!kmem_magazine_is_full(cc->loaded)) {
+			cc->loaded->rounds[cc->loaded->nr_rounds++] = obj;
+			arch_local_interrupt_restore(flags);
+			return;
+		}
+		if (layer->depot.empty) {
+			if (cc->previous) {
+				if (layer->depot.nr_full < KMEM_DEPOT_MAX_FULL) {
+					kmem_depot_push(&layer->depot.full, cc->previous);
+					layer->depot.nr_full++;
+				} else {
+					/* The depot holds enough objects already, so
+					   the surplus goes back to the backend.  */
+					kmem_magazine_flush(layer, cc->previous);
+					kmem_depot_push(&layer->depot.empty, cc->previous);
+				}
+			}
+			cc->previous = cc->loaded;
+			cc->loaded = kmem_depot_pop(&layer->depot.empty);
+			cc->loaded->rounds[cc->loaded->nr_rounds++] = obj;
+			arch_local_interrupt_restore(flags);
+			return;
+		}
+		arch_local_interrupt_restore(flags);
+		/* The magazine is allocated with interrupts enabled and the layer
+		   in a consistent state, because the allocation may recurse into
+		   this layer, for example when the magazine cache needs a page.  */
+		struct kmem_magazine *mag = kmem_magazine_cache ? kmem_cache_alloc(kmem_magazine_cache) : NULL;
+		if (!mag) {
+			layer->free(layer->arg, obj);
+			return;
+		}
+		mag->next = NULL;
+		mag->nr_rounds = 0;
+		flags = arch_local_interrupt_save();
+		kmem_depot_push(&layer->depot.empty, mag);
+		arch_local_interrupt_restore(flags);
+	}
+}
+
+void kmem_magazine_layer_drain(struct kmem_magazine_layer *layer)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	struct kmem_magazine *mags = NULL;
+	for (unsigned int i = 0; i < MAX_CPUS; i++) {
+		struct kmem_cpu_cache *cc = &layer->cpu[i];
+		if (cc->loaded) {
+			kmem_depot_push(&mags, cc->loaded);
+		}
+		if (cc->previous) {
+			kmem_depot_push(&mags, cc->previous);
+		}
+		cc->loaded = NULL;
+		cc->previous = NULL;
+	}
+	struct kmem_magazine *mag;
+	while ((mag = kmem_depot_pop(&layer->depot.full))) {
+		kmem_depot_push(&mags, mag);
+	}
+	while ((mag = kmem_depot_pop(&layer->depot.empty))) {
+		kmem_depot_push(&mags, mag);
+	}
+	layer->depot.nr_full = 0;
+	arch_local_interrupt_restore(flags);
+
+	while ((mag = kmem_depot_pop(&mags))) {
+		kmem_magazine_flush(layer, mag);
+		kmem_cache_free(kmem_magazine_cache, mag);
+	}
+}
+
+int kmem_magazine_init(void)
+{
+	kmem_magazine_cache = kmem_cache_create("kmem_magazine", sizeof(struct kmem_magazine), KMEM_DEFAULT_ALIGN,
+						 KMEM_CACHE_NOMAGAZINE);
+	if (!kmem_magazine_cache) {
+		return -ENOMEM;
+	}
+	return 0;
+}
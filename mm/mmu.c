@@ -24,50 +24,79 @@ int mmu_map_range(mmu_map_t map, virt_t vaddr, phys_t paddr, size_t size, mmu_pr
 	if (!is_aligned(vaddr, PAGE_SIZE_SMALL)) {
 		return -EINVAL;
 	}
-	virt_t start = vaddr;
+	/* Map every part of the range with the largest page that fits it. The
+	   virtual and the physical address must both be aligned to the page.  */
+	bool huge = mmu_has_huge_pages();
 	virt_t end = vaddr + size;
-	virt_t large_start = align_up(vaddr, PAGE_SIZE_LARGE);
-	virt_t large_end = align_down(vaddr + size, PAGE_SIZE_LARGE);
-	if (large_end < large_start) {
-		/* No large pages: */
-		for (virt_t offset = start; offset < end; offset += PAGE_SIZE_SMALL) {
-			int err = mmu_map_small_page(map, offset, paddr, prot, flags);
-			if (err) {
-				return err;
-			}
-			paddr += PAGE_SIZE_SMALL;
+	virt_t offset = vaddr;
+	while (offset < end) {
+		size_t page_size;
+		int err;
+		if (huge && is_aligned(offset, PAGE_SIZE_HUGE) && is_aligned(paddr, PAGE_SIZE_HUGE) &&
+		    end - offset >= PAGE_SIZE_HUGE) {
+			page_size = PAGE_SIZE_HUGE;
+			err = mmu_map_huge_page(map, offset, paddr, prot, flags);
+		} else if (is_aligned(offset, PAGE_SIZE_LARGE) && is_aligned(paddr, PAGE_SIZE_LARGE) &&
+			   end - offset >= PAGE_SIZE_LARGE) {
+			page_size = PAGE_SIZE_LARGE;
+			err = mmu_map_large_page(map, offset, paddr, prot, flags);
+		} else {
+			page_size = PAGE_SIZE_SMALL;
+			err = mmu_map_small_page(map, offset, paddr, prot, flags);
 		}
-	} else {
-		/* First map any small pages before the large pages: */
-		if (start != large_start) {
-			for (virt_t offset = start; offset < large_start; offset += PAGE_SIZE_SMALL) {
-				int err = mmu_map_small_page(map, offset, paddr, prot, flags);
-				if (err) {
-					return err;
-				}
-				paddr += PAGE_SIZE_SMALL;
-			}
+		if (err) {
+			return err;
 		}
-		/* Then map the large pages: */
-		if (large_start != large_end) {
-			for (virt_t offset = large_start; offset < large_end; offset += PAGE_SIZE_LARGE) {
-				int err = mmu_map_large_page(map, offset, paddr, prot, flags);
-				if (err) {
-					return err;
-				}
-				paddr += PAGE_SIZE_LARGE;
+		offset += page_size;
+		paddr += page_size;
+	}
+	return 0;
+}
+
+/// Unmaps virtual address range.
+///
+/// The TLB entries of the unmapped pages are invalidated one by one, which
+/// keeps the TLB entries of the rest of the address space. Pages in the range
+/// that are not mapped are skipped, a whole page table at a time where the
+/// page table is missing. The physical memory that was mapped to the range is
+/// not freed.
+///
+/// \param map MMU translation map.
+/// \param vaddr Start of virtual address range to unmap.
+/// \param size Size of the address range to unmap.
+///
+/// \return 0 if successful
+///         -EINVAL if passed parameters are invalid
+int mmu_unmap_range(mmu_map_t map, virt_t vaddr, size_t size)
+{
+	if (!is_aligned(vaddr, PAGE_SIZE_SMALL) || !is_aligned(size, PAGE_SIZE_SMALL)) {
+		return -EINVAL;
+	}
+	virt_t end = vaddr + size;
+	virt_t offset = vaddr;
+	while (offset < end) {
+		phys_t paddr;
+		size_t hole = mmu_unmapped_size(map, offset);
+		if (hole) {
+			virt_t next = align_down(offset, hole) + hole;
+			if (next <= offset) {
+				break;
 			}
+			offset = next;
+			continue;
 		}
-		/* Finally, map left-over small pages: */
-		if (large_end != end) {
-			for (virt_t offset = large_end; offset < end; offset += PAGE_SIZE_SMALL) {
-				int err = mmu_map_small_page(map, offset, paddr, prot, flags);
-				if (err) {
-					return err;
-				}
-				paddr += PAGE_SIZE_SMALL;
-			}
+		if (is_aligned(offset, PAGE_SIZE_HUGE) && end - offset >= PAGE_SIZE_HUGE &&
+		    !mmu_unmap_huge_page(map, offset, &paddr)) {
+			offset += PAGE_SIZE_HUGE;
+			continue;
+		}
+		if (is_aligned(offset, PAGE_SIZE_LARGE) && end - offset >= PAGE_SIZE_LARGE &&
+		    !mmu_unmap_large_page(map, offset, &paddr)) {
+			offset += PAGE_SIZE_LARGE;
+			continue;
 		}
+		mmu_unmap_small_page(map, offset, &paddr);
+		offset += PAGE_SIZE_SMALL;
 	}
 	return 0;
 }
@@ -0,0 +1,154 @@
+//
+// NUMA topology
+//
+// The platform configuration, such as the ACPI SRAT and SLIT tables,
+// registers the memory ranges and CPUs of each NUMA node and the distances
+// between the nodes. The page allocator uses the topology to allocate memory
+// from the node of the calling CPU.
+//
+
+#include <kernel/numa.h>
+
+#include <kernel/cpu.h>
+#include <kernel/printf.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct numa_memory_range {
+	phys_t	base;
+	phys_t	end;
+	int	node;
+};
+
+struct numa_cpu {
+	uint32_t	cpu_id;
+	int		node;
+};
+
+static uint32_t numa_domains[MAX_NUMA_NODES];
+static int nr_numa_nodes;
+
+static struct numa_memory_range numa_memory_ranges[MAX_NUMA_MEMORY_RANGES];
+static size_t nr_numa_memory_ranges;
+
+static struct numa_cpu numa_cpus[MAX_CPUS];
+static size_t nr_numa_cpus;
+
+static uint8_t numa_distances[MAX_NUMA_NODES][MAX_NUMA_NODES];
+
+/* The node of the boot CPU. Application processors are not brought up yet,
+   so the kernel only runs on the boot CPU.  */
+static int numa_boot_node;
+
+static bool numa_is_valid_node(int node)
+{
+	return node >= 0 && node < nr_numa_nodes;
+}
+
+int numa_domain_to_node(uint32_t domain)
+{
+	for (int node = 0; node < nr_numa_nodes; node++) {
+		if (numa_domains[node] == domain) {
+			return node;
+		}
+	}
+	if (nr_numa_nodes == MAX_NUMA_NODES) {
+		printf("warning: ignoring NUMA proximity domain %u, increase MAX_NUMA_NODES\n", domain);
+		return 0;
+	}
+	numa_domains[nr_numa_nodes] = domain;
+	return nr_numa_nodes++;
+}
+
+void numa_add_memory(int node, phys_t base, uint64_t len)
+{
+	if (nr_numa_memory_ranges == MAX_NUMA_MEMORY_RANGES) {
+		printf("warning: ignoring NUMA memory range, increase MAX_NUMA_MEMORY_RANGES\n");
+		return;
+	}
+	struct numa_memory_range *range = &numa_memory_ranges[nr_numa_memory_ranges++];
+	range->base = base;
+	range->end = base + len;
+	range->node = node;
+}
+
+void numa_add_cpu(int node, uint32_t cpu_id)
+{
+	if (nr_numa_cpus == MAX_CPUS) {
+		return;
+	}
+	numa_cpus[nr_numa_cpus].cpu_id = cpu_id;
+	numa_cpus[nr_numa_cpus].node = node;
+	nr_numa_cpus++;
+}
+
+void numa_set_distance(int from, int to, uint8_t distance)
+{
+	if (from < 0 || from >= MAX_NUMA_NODES || to < 0 || to >= MAX_NUMA_NODES) {
+		return;
+	}
+	numa_distances[from][to] = distance;
+}
+
+void numa_init(void)
+{
+	if (nr_numa_nodes == 0) {
+		return;
+	}
+	numa_boot_node = numa_cpu_node(arch_cpu_id());
+	printf("NUMA: %d nodes, boot CPU on node %d\n", nr_numa_nodes, numa_boot_node);
+	for (size_t i = 0; i < nr_numa_memory_ranges; i++) {
+		struct numa_memory_range *range = &numa_memory_ranges[i];
+		printf("  node %d: %016lx-%016lx\n", range->node, range->base, range->end);
+	}
+}
+
+int numa_nr_nodes(void)
+{
+	return nr_numa_nodes ? nr_numa_nodes : 1;
+}
+
+int numa_distance(int from, int to)
+{
+	if (!numa_is_valid_node(from) || !numa_is_valid_node(to)) {
+		return from == to ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+	}
+	if (numa_distances[from][to]) {
+		return numa_distances[from][to];
+	}
+	return from == to ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+}
+
+int numa_cpu_node(uint32_t cpu_id)
+{
+	for (size_t i = 0; i < nr_numa_cpus; i++) {
+		if (numa_cpus[i].cpu_id == cpu_id) {
+			return numa_cpus[i].node;
+		}
+	}
+	return 0;
+}
+
+int numa_current_node(void)
+{
+	return numa_boot_node;
+}
+
+int numa_memory_node(phys_t addr, phys_t *end)
+{
+	/* Memory outside of the ranges belongs to node 0 up to the next range.  */
+	phys_t next = ~0ULL;
+	for (size_t i = 0; i < nr_numa_memory_ranges; i++) {
+		struct numa_memory_range *range = &numa_memory_ranges[i];
+		if (addr >= range->base && addr < range->end) {
+			*end = range->end;
+			return range->node;
+		}
+		if (range->base > addr && range->base < next) {
+			next = range->base;
+		}
+	}
+	*end = next;
+	return 0;
+}
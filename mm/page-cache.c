@@ -0,0 +1,43 @@
+//
+// Small page cache
+//
+// A magazine layer in front of the small page arena, so that the page
+// allocations of page tables, slabs and process memory do not search and
+// update the arena for every page.
+//
+
+#include <kernel/page-alloc.h>
+
+#include <kernel/magazine.h>
+
+static void *page_cache_backend_alloc(void *arg)
+{
+	return page_arena_alloc_small();
+}
+
+static void page_cache_backend_free(void *arg, void *page)
+{
+	page_arena_free_small(page);
+}
+
+/* The layer is initialized statically, because pages are allocated before the
+   kernel memory allocator is.  */
+static struct kmem_magazine_layer page_small_layer = {
+	.alloc = page_cache_backend_alloc,
+	.free = page_cache_backend_free,
+};
+
+void *page_cache_alloc_small(void)
+{
+	return kmem_magazine_alloc(&page_small_layer);
+}
+
+void page_cache_free_small(void *page)
+{
+	kmem_magazine_free(&page_small_layer, page);
+}
+
+void page_cache_drain(void)
+{
+	kmem_magazine_layer_drain(&page_small_layer);
+}
@@ -0,0 +1,208 @@
+//
+// Pre-zeroed page pool
+//
+// Pages that are mapped to user space or used as page tables must be zeroed
+// before use. The pool keeps pages that the idle loop has zeroed ahead of
+// time, so that the allocation paths take a zeroed page in constant time
+// instead of clearing it, which for a large page takes tens of microseconds.
+//
+// The idle loop zeroes pages with non-temporal stores, which do not evict
+// the working set from the cache, and clears large pages in chunks so that
+// it can return to the scheduler quickly when a process wakes up.
+//
+
+#include <kernel/page-alloc.h>
+
+#include <arch/interrupts.h>
+#include <arch/page.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Number of zeroed pages that the pool holds.  */
+#define PAGE_ZERO_POOL_SMALL 64
+#define PAGE_ZERO_POOL_LARGE 2
+
+/* Number of bytes of a large page that the idle loop zeroes at a time.  */
+#define PAGE_ZERO_CHUNK_SIZE (64 * 1024)
+
+struct page_zero_pool {
+	void		**pages;
+	unsigned int	nr_pages;
+	unsigned int	max_pages;
+};
+
+static void *zero_small_pages[PAGE_ZERO_POOL_SMALL];
+static void *zero_large_pages[PAGE_ZERO_POOL_LARGE];
+
+static struct page_zero_pool zero_small_pool = {
+	.pages = zero_small_pages,
+	.max_pages = PAGE_ZERO_POOL_SMALL,
+};
+
+static struct page_zero_pool zero_large_pool = {
+	.pages = zero_large_pages,
+	.max_pages = PAGE_ZERO_POOL_LARGE,
+};
+
+/* The large page that the idle loop is zeroing and the number of bytes of it
+   that are zeroed.  */
+static void *zero_large_page;
+static size_t zero_large_offset;
+
+static struct page_zero_stats zero_stats;
+
+static void *page_zero_pool_pop(struct page_zero_pool *pool, uint64_t *hits, uint64_t *misses)
+{
+	void *page = NULL;
+
+	unsigned long flags = arch_local_interrupt_save();
+	if (pool->nr_pages) {
+		page = pool->pages[--pool->nr_pages];
+		(*hits)++;
+	} else {
+		(*misses)++;
+	}
+	arch_local_interrupt_restore(flags);
+	return page;
+}
+
+static void *page_zero_pool_take(struct page_zero_pool *pool)
+{
+	void *page = NULL;
+
+	unsigned long flags = arch_local_interrupt_save();
+	if (pool->nr_pages) {
+		page = pool->pages[--pool->nr_pages];
+	}
+	arch_local_interrupt_restore(flags);
+	return page;
+}
+
+static bool page_zero_pool_push(struct page_zero_pool *pool, void *page)
+{
+	bool ret = false;
+
+	unsigned long flags = arch_local_interrupt_save();
+	if (pool->nr_pages < pool->max_pages) {
+		pool->pages[pool->nr_pages++] = page;
+		ret = true;
+	}
+	arch_local_interrupt_restore(flags);
+	return ret;
+}
+
+void *page_alloc_small_zeroed(void)
+{
+	void *page = page_zero_pool_pop(&zero_small_pool, &zero_stats.small_hits, &zero_stats.small_misses);
+	if (page) {
+		return page;
+	}
+	page = page_alloc_small();
+	if (page) {
+		memset(page, 0, PAGE_SIZE_SMALL);
+	}
+	return page;
+}
+
+void *page_alloc_large_zeroed(void)
+{
+	void *page = page_zero_pool_pop(&zero_large_pool, &zero_stats.large_hits, &zero_stats.large_misses);
+	if (page) {
+		return page;
+	}
+	page = page_alloc_large();
+	if (page) {
+		memset(page, 0, PAGE_SIZE_LARGE);
+	}
+	return page;
+}
+
+static bool page_zero_refill_small(void)
+{
+	void *page = page_alloc_small();
+	if (!page) {
+		return false;
+	}
+	arch_clear_page_nocache(page, PAGE_SIZE_SMALL);
+	if (!page_zero_pool_push(&zero_small_pool, page)) {
+		page_free_small(page);
+	}
+	return true;
+}
+
+static bool page_zero_refill_large(void)
+{
+	/* The page is taken out of zero_large_page while a chunk of it is
+	   zeroed, so that page_zero_drain() cannot free it under us.  */
+	unsigned long flags = arch_local_interrupt_save();
+	void *page = zero_large_page;
+	size_t offset = zero_large_offset;
+	zero_large_page = NULL;
+	arch_local_interrupt_restore(flags);
+	if (!page) {
+		page = page_alloc_large();
+		if (!page) {
+			return false;
+		}
+		offset = 0;
+	}
+	arch_clear_page_nocache(page + offset, PAGE_ZERO_CHUNK_SIZE);
+	offset += PAGE_ZERO_CHUNK_SIZE;
+	if (offset == PAGE_SIZE_LARGE) {
+		if (!page_zero_pool_push(&zero_large_pool, page)) {
+			page_free_large(page);
+		}
+		return true;
+	}
+	flags = arch_local_interrupt_save();
+	zero_large_page = page;
+	zero_large_offset = offset;
+	arch_local_interrupt_restore(flags);
+	return true;
+}
+
+bool page_zero_refill(void)
+{
+	if (zero_small_pool.nr_pages < zero_small_pool.max_pages && page_zero_refill_small()) {
+		return true;
+	}
+	if (zero_large_pool.nr_pages < zero_large_pool.max_pages && page_zero_refill_large()) {
+		return true;
+	}
+	return false;
+}
+
+bool page_zero_drain(void)
+{
+	bool ret = false;
+	void *page;
+
+	while ((page = page_zero_pool_take(&zero_small_pool))) {
+		page_arena_free_small(page);
+		ret = true;
+	}
+	while ((page = page_zero_pool_take(&zero_large_pool))) {
+		page_free_large(page);
+		ret = true;
+	}
+	unsigned long flags = arch_local_interrupt_save();
+	page = zero_large_page;
+	zero_large_page = NULL;
+	arch_local_interrupt_restore(flags);
+	if (page) {
+		page_free_large(page);
+		ret = true;
+	}
+	return ret;
+}
+
+void page_zero_get_stats(struct page_zero_stats *stats)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	*stats = zero_stats;
+	stats->nr_small = zero_small_pool.nr_pages;
+	stats->nr_large = zero_large_pool.nr_pages;
+	arch_local_interrupt_restore(flags);
+}
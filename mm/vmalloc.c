@@ -0,0 +1,161 @@
+//
+// Virtually contiguous kernel memory
+//
+// vmalloc() maps individual small pages to a contiguous range of a dedicated
+// kernel virtual memory area, so that large buffers do not need physically
+// contiguous memory. The area is managed with a bitmap of pages. Every
+// allocation is followed by an unmapped guard page, which turns overruns
+// into page faults.
+//
+
+#include <kernel/vmalloc.h>
+
+#include <kernel/align.h>
+#include <kernel/mmu.h>
+#include <kernel/page-alloc.h>
+
+#include <arch/interrupts.h>
+#include <arch/vmem-defs.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VMALLOC_NR_PAGES (KERNEL_VMALLOC_SIZE / PAGE_SIZE_SMALL)
+
+#define VMALLOC_BITS_PER_WORD 64
+
+/* Pages of the area that are reserved, including guard pages.  */
+static uint64_t vmalloc_used[VMALLOC_NR_PAGES / VMALLOC_BITS_PER_WORD];
+
+/* The last page of every allocation, which finds the size of an allocation
+   in vfree().  */
+static uint64_t vmalloc_last[VMALLOC_NR_PAGES / VMALLOC_BITS_PER_WORD];
+
+/* Page index where the search for free pages starts.  */
+static size_t vmalloc_hint;
+
+static inline bool vmalloc_test(uint64_t *bitmap, size_t idx)
+{
+	return bitmap[idx / VMALLOC_BITS_PER_WORD] & (1ULL << (idx % VMALLOC_BITS_PER_WORD));
+}
+
+static inline void vmalloc_set(uint64_t *bitmap, size_t idx, bool value)
+{
+	uint64_t mask = 1ULL << (idx % VMALLOC_BITS_PER_WORD);
+	if (value) {
+		bitmap[idx / VMALLOC_BITS_PER_WORD] |= mask;
+	} else {
+		bitmap[idx / VMALLOC_BITS_PER_WORD] &= ~mask;
+	}
+}
+
+/* Finds \nr_pages free pages starting at or after \start, or returns
+   VMALLOC_NR_PAGES if there are none.  */
+static size_t vmalloc_find(size_t start, size_t end, size_t nr_pages)
+{
+	size_t run = 0;
+	for (size_t idx = start; idx < end; idx++) {
+		if (vmalloc_test(vmalloc_used, idx)) {
+			run = 0;
+			continue;
+		}
+		if (++run == nr_pages) {
+			return idx + 1 - nr_pages;
+		}
+	}
+	return VMALLOC_NR_PAGES;
+}
+
+/* Reserves \nr_pages pages of the area and returns the index of the first
+   one, or VMALLOC_NR_PAGES if the area is full.  */
+static size_t vmalloc_reserve(size_t nr_pages)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	size_t idx = vmalloc_find(vmalloc_hint, VMALLOC_NR_PAGES, nr_pages);
+	if (idx == VMALLOC_NR_PAGES) {
+		idx = vmalloc_find(0, VMALLOC_NR_PAGES, nr_pages);
+	}
+	if (idx != VMALLOC_NR_PAGES) {
+		for (size_t i = idx; i < idx + nr_pages; i++) {
+			vmalloc_set(vmalloc_used, i, true);
+		}
+		vmalloc_set(vmalloc_last, idx + nr_pages - 1, true);
+		vmalloc_hint = idx + nr_pages;
+	}
+	arch_local_interrupt_restore(flags);
+	return idx;
+}
+
+static void vmalloc_release(size_t idx, size_t nr_pages)
+{
+	unsigned long flags = arch_local_interrupt_save();
+	for (size_t i = idx; i < idx + nr_pages; i++) {
+		vmalloc_set(vmalloc_used, i, false);
+	}
+	vmalloc_set(vmalloc_last, idx + nr_pages - 1, false);
+	arch_local_interrupt_restore(flags);
+}
+
+static inline virt_t vmalloc_page_addr(size_t idx)
+{
+	return KERNEL_VMALLOC_START + idx * PAGE_SIZE_SMALL;
+}
+
+/* Unmaps and frees the first \nr_mapped pages of the allocation at page
+   \idx.  */
+static void vmalloc_unmap(size_t idx, size_t nr_mapped)
+{
+	mmu_map_t map = mmu_current_map();
+	for (size_t i = idx; i < idx + nr_mapped; i++) {
+		phys_t paddr;
+		if (!mmu_unmap_small_page(map, vmalloc_page_addr(i), &paddr)) {
+			page_free_small(paddr_to_ptr(paddr));
+		}
+	}
+}
+
+void *vmalloc(size_t size)
+{
+	if (!size) {
+		return NULL;
+	}
+	size_t nr_pages = align_up(size, PAGE_SIZE_SMALL) / PAGE_SIZE_SMALL;
+	/* The guard page is reserved but never mapped.  */
+	size_t idx = vmalloc_reserve(nr_pages + 1);
+	if (idx == VMALLOC_NR_PAGES) {
+		return NULL;
+	}
+	mmu_map_t map = mmu_current_map();
+	for (size_t i = 0; i < nr_pages; i++) {
+		void *page = page_alloc_small();
+		if (!page) {
+			vmalloc_unmap(idx, i);
+			vmalloc_release(idx, nr_pages + 1);
+			return NULL;
+		}
+		int err = mmu_map_small_page(map, vmalloc_page_addr(idx + i), ptr_to_paddr(page),
+					     MMU_PROT_READ | MMU_PROT_WRITE, 0);
+		if (err) {
+			page_free_small(page);
+			vmalloc_unmap(idx, i);
+			vmalloc_release(idx, nr_pages + 1);
+			return NULL;
+		}
+	}
+	return (void *) vmalloc_page_addr(idx);
+}
+
+void vfree(void *addr)
+{
+	if (!addr) {
+		return;
+	}
+	size_t idx = ((virt_t) addr - KERNEL_VMALLOC_START) / PAGE_SIZE_SMALL;
+	size_t nr_pages = 1;
+	while (!vmalloc_test(vmalloc_last, idx + nr_pages - 1)) {
+		nr_pages++;
+	}
+	/* The last page of the allocation is the guard page.  */
+	vmalloc_unmap(idx, nr_pages - 1);
+	vmalloc_release(idx, nr_pages);
+}
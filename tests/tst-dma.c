@@ -0,0 +1,71 @@
+#include <kernel/dma.h>
+#include <kernel/page-alloc.h>
+#include <kernel/panic.h>
+#include <kernel/printf.h>
+
+#include <string.h>
+
+static void check_region(struct dma_region *region, size_t size, size_t align)
+{
+	if (region->size < size) {
+		panic("DMA region is too small");
+	}
+	if (region->phys % align || region->virt % align) {
+		panic("DMA region is misaligned");
+	}
+	for (size_t offset = 0; offset < region->size; offset += PAGE_SIZE_SMALL) {
+		if (virt_to_phys(region->virt + offset) != region->phys + offset) {
+			panic("DMA region is not physically contiguous");
+		}
+	}
+	const uint8_t *p = (const uint8_t *) region->virt;
+	for (size_t i = 0; i < region->size; i++) {
+		if (p[i]) {
+			panic("DMA region is not zeroed");
+		}
+	}
+}
+
+static void test_dma_alloc_small(void)
+{
+	printf("%s\n", __func__);
+	struct dma_region regions[16];
+	for (unsigned int i = 0; i < 16; i++) {
+		size_t size = 100 + i * 1000;
+		size_t align = 16 << (i % 8);
+		if (dma_alloc(&regions[i], size, align, 0)) {
+			panic("dma_alloc failed");
+		}
+		check_region(&regions[i], size, align);
+		memset((void *) regions[i].virt, 0xfe, regions[i].size);
+	}
+	for (unsigned int i = 0; i < 16; i += 2) {
+		dma_free(&regions[i]);
+	}
+	for (unsigned int i = 1; i < 16; i += 2) {
+		dma_free(&regions[i]);
+	}
+}
+
+static void test_dma_alloc_large(void)
+{
+	printf("%s\n", __func__);
+	struct dma_region region;
+	size_t size = PAGE_SIZE_LARGE + PAGE_SIZE_SMALL;
+	if (dma_alloc(&region, size, PAGE_SIZE_SMALL, DMA_ALLOC_LARGE_PAGE)) {
+		panic("dma_alloc failed");
+	}
+	check_region(&region, size, PAGE_SIZE_LARGE);
+	dma_free(&region);
+	if (dma_alloc(&region, size, PAGE_SIZE_SMALL, 0)) {
+		panic("dma_alloc failed");
+	}
+	check_region(&region, size, PAGE_SIZE_SMALL);
+	dma_free(&region);
+}
+
+void test_dma(void)
+{
+	test_dma_alloc_small();
+	test_dma_alloc_large();
+}
@@ -1,10 +1,252 @@
 #include <kernel/kmem.h>
 
+#include <kernel/align.h>
+#include <kernel/cpu.h>
+#include <kernel/page-alloc.h>
+#include <kernel/printf.h>
+#include <kernel/vmalloc.h>
+
+#include <uapi/manticore/kmem_stats_abi.h>
+
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
+/* Number of objects that the stress test holds at once.  */
+#define STRESS_NR_OBJECTS 2048
+
+/* Number of allocations that a benchmark times.  */
+#define BENCH_ITERATIONS 10000
+
+/* Number of objects that are held at once in the batch benchmark.  */
+#define BENCH_BATCH_SIZE 256
+
+static void *objects[STRESS_NR_OBJECTS];
+
+static uint64_t stress_seed = 1;
+
+static uint64_t stress_random(void)
+{
+	stress_seed = stress_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return stress_seed >> 33;
+}
+
+static void stress_fill(void *obj, size_t size, uint64_t tag)
+{
+	uint64_t *p = obj;
+	for (size_t i = 0; i < size / sizeof(*p); i++) {
+		p[i] = tag;
+	}
+}
+
+static bool stress_check(void *obj, size_t size, uint64_t tag)
+{
+	uint64_t *p = obj;
+	for (size_t i = 0; i < size / sizeof(*p); i++) {
+		if (p[i] != tag) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Allocates and frees objects in random order and checks that no two live
+   objects overlap and that all slabs are empty once every object is freed.  */
+static void test_kmem_stress(size_t size, unsigned int flags)
+{
+	struct kmem_cache *cache = kmem_cache_create("stress", size, KMEM_DEFAULT_ALIGN, flags);
+	int nr_errors = 0;
+
+	printf("%s: size %lu%s\n", __func__, (uint64_t) size, flags & KMEM_CACHE_NOMAGAZINE ? " no magazine" : "");
+	for (int round = 0; round < 8; round++) {
+		for (int i = 0; i < STRESS_NR_OBJECTS; i++) {
+			if (objects[i] && stress_random() % 2) {
+				if (!stress_check(objects[i], size, (uint64_t) i)) {
+					nr_errors++;
+				}
+				kmem_cache_free(cache, objects[i]);
+				objects[i] = NULL;
+			}
+			if (!objects[i]) {
+				objects[i] = kmem_cache_alloc(cache);
+				if (!objects[i]) {
+					printf("FAIL: out of memory\n");
+					return;
+				}
+				stress_fill(objects[i], size, (uint64_t) i);
+			}
+		}
+	}
+	for (int i = 0; i < STRESS_NR_OBJECTS; i++) {
+		if (!stress_check(objects[i], size, (uint64_t) i)) {
+			nr_errors++;
+		}
+		kmem_cache_free(cache, objects[i]);
+		objects[i] = NULL;
+	}
+	kmem_reap();
+	if (cache->partial.nr_slabs || cache->full.nr_slabs || cache->empty.nr_slabs) {
+		printf("FAIL: %lu partial, %lu full, %lu empty slabs left\n", (uint64_t) cache->partial.nr_slabs,
+		       (uint64_t) cache->full.nr_slabs, (uint64_t) cache->empty.nr_slabs);
+	}
+	if (nr_errors) {
+		printf("FAIL: %d corrupted objects\n", nr_errors);
+	}
+	kmem_cache_destroy(cache);
+}
+
+/* Allocations of every backend honor the requested alignment and keep their
+   contents across reallocation.  */
+static void test_kmem_large(void)
+{
+	static const size_t sizes[] = { 24, 3000, 8192, 100000, 300000, 1 << 20 };
+	static const size_t aligns[] = { 8, 64, 4096, 16384 };
+
+	printf("%s\n", __func__);
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (unsigned int j = 0; j < sizeof(aligns) / sizeof(aligns[0]); j++) {
+			size_t size = sizes[i], align = aligns[j];
+			void *p = kmem_alloc_align(size, align);
+			if (!p) {
+				printf("FAIL: size %lu align %lu: out of memory\n", (uint64_t) size, (uint64_t) align);
+				continue;
+			}
+			if ((uintptr_t) p % align) {
+				printf("FAIL: size %lu align %lu: misaligned %p\n", (uint64_t) size, (uint64_t) align, p);
+			}
+			stress_fill(p, size, size);
+			void *q = kmem_realloc_align(p, size, size * 2, align);
+			if (!q) {
+				printf("FAIL: size %lu align %lu: realloc failed\n", (uint64_t) size, (uint64_t) align);
+				kmem_free_align(p, size, align);
+				continue;
+			}
+			if ((uintptr_t) q % align || !stress_check(q, size, size)) {
+				printf("FAIL: size %lu align %lu: realloc lost contents\n", (uint64_t) size, (uint64_t) align);
+			}
+			kmem_free_align(q, size * 2, align);
+		}
+	}
+	void *p = vmalloc(4 << 20);
+	if (!p) {
+		printf("FAIL: vmalloc out of memory\n");
+		return;
+	}
+	stress_fill(p, 4 << 20, 0x5a);
+	if (!stress_check(p, 4 << 20, 0x5a)) {
+		printf("FAIL: vmalloc memory corrupted\n");
+	}
+	vfree(p);
+}
+
+/* Objects of a KMEM_CACHE_HWALIGN cache are aligned to cache lines, and the
+   slabs of the cache start their objects at different colors.  */
+static void test_kmem_color(void)
+{
+	struct kmem_cache *cache = kmem_cache_create("color", 200, KMEM_DEFAULT_ALIGN,
+						     KMEM_CACHE_HWALIGN | KMEM_CACHE_NOMAGAZINE);
+	uint64_t colors = 0;
+
+	printf("%s\n", __func__);
+	for (int i = 0; i < 64; i++) {
+		objects[i] = kmem_cache_alloc(cache);
+		if ((uintptr_t) objects[i] % KMEM_CACHE_LINE_SIZE) {
+			printf("FAIL: object %p is not cache line aligned\n", objects[i]);
+		}
+		/* Buffers are 256 bytes, so the offset within a buffer is the
+		   color of the slab.  */
+		colors |= 1ULL << (((uintptr_t) objects[i] % 256) / KMEM_CACHE_LINE_SIZE);
+	}
+	if (__builtin_popcountll(colors) < 2) {
+		printf("FAIL: slabs are not colored\n");
+	}
+	for (int i = 0; i < 64; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+	kmem_cache_destroy(cache);
+
+	cache = kmem_cache_create("largeslab", 64, KMEM_DEFAULT_ALIGN, KMEM_CACHE_LARGESLAB);
+	int nr_large_pages = 0;
+	for (int i = 0; i < STRESS_NR_OBJECTS; i++) {
+		objects[i] = kmem_cache_alloc(cache);
+		if (!i || align_down((uintptr_t) objects[i], PAGE_SIZE_LARGE) !=
+			      align_down((uintptr_t) objects[i - 1], PAGE_SIZE_LARGE)) {
+			nr_large_pages++;
+		}
+	}
+	/* All objects fit in the slab of a single large page.  */
+	if (nr_large_pages != 1) {
+		printf("FAIL: %d objects span %d large pages\n", STRESS_NR_OBJECTS, nr_large_pages);
+	}
+	for (int i = 0; i < STRESS_NR_OBJECTS; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+	kmem_cache_destroy(cache);
+}
+
+/* The cache statistics count live objects and slabs.  */
+static void test_kmem_stats(void)
+{
+	struct kmem_cache *cache = kmem_cache_create("stats", 128, KMEM_DEFAULT_ALIGN, KMEM_CACHE_NOMAGAZINE);
+	struct kmem_cache_stats stats;
+
+	printf("%s\n", __func__);
+	for (int i = 0; i < 100; i++) {
+		objects[i] = kmem_cache_alloc(cache);
+	}
+	kmem_cache_get_stats(cache, &stats);
+	size_t nr_slabs = stats.nr_partial + stats.nr_full + stats.nr_empty;
+	if (stats.allocs != 100 || stats.live != 100) {
+		printf("FAIL: %lu allocs and %lu live objects, expected 100\n", stats.allocs, stats.live);
+	}
+	if (nr_slabs * stats.objs_per_slab - stats.free_objs != 100) {
+		printf("FAIL: slabs hold %lu objects, expected 100\n", nr_slabs * stats.objs_per_slab - stats.free_objs);
+	}
+	for (int i = 0; i < 100; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+	kmem_cache_get_stats(cache, &stats);
+	if (stats.frees != 100 || stats.live != 0) {
+		printf("FAIL: %lu frees and %lu live objects, expected 100 and 0\n", stats.frees, stats.live);
+	}
+	if (stats.nr_partial || stats.nr_full || stats.nr_empty > KMEM_CACHE_MAX_EMPTY) {
+		printf("FAIL: slabs are not released\n");
+	}
+	kmem_cache_destroy(cache);
+}
+
+static void bench_kmem_cache(size_t size, unsigned int flags)
+{
+	struct kmem_cache *cache = kmem_cache_create("bench", size, KMEM_DEFAULT_ALIGN, flags);
+	const char *variant = flags & KMEM_CACHE_NOMAGAZINE ? "slab" : "magazine";
+
+	uint64_t start = arch_cycle_counter();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		void *obj = kmem_cache_alloc(cache);
+		kmem_cache_free(cache, obj);
+	}
+	uint64_t cycles = arch_cycle_counter() - start;
+	printf("%s: size %lu %s: %lu cycles per alloc/free\n", __func__, (uint64_t) size, variant,
+	       cycles / BENCH_ITERATIONS);
+
+	start = arch_cycle_counter();
+	for (int i = 0; i < BENCH_ITERATIONS / BENCH_BATCH_SIZE; i++) {
+		for (int j = 0; j < BENCH_BATCH_SIZE; j++) {
+			objects[j] = kmem_cache_alloc(cache);
+		}
+		for (int j = 0; j < BENCH_BATCH_SIZE; j++) {
+			kmem_cache_free(cache, objects[j]);
+		}
+	}
+	cycles = arch_cycle_counter() - start;
+	printf("%s: size %lu %s batch: %lu cycles per alloc/free\n", __func__, (uint64_t) size, variant,
+	       cycles / (BENCH_ITERATIONS / BENCH_BATCH_SIZE * BENCH_BATCH_SIZE));
+	kmem_cache_destroy(cache);
+}
+
 void test_kmem(void)
 {
-	struct kmem_cache *cache = kmem_cache_create("cache", 64, KMEM_DEFAULT_ALIGN);
+	struct kmem_cache *cache = kmem_cache_create("cache", 64, KMEM_DEFAULT_ALIGN, 0);
 	for (int i = 0; i < 10000; i++) {
 		void *p = kmem_cache_alloc(cache);
 		if (!p) {
@@ -19,4 +261,15 @@ void test_kmem(void)
 		memset(p, 0xfe, 64);
 	}
 	kmem_cache_destroy(cache);
+
+	test_kmem_stress(64, 0);
+	test_kmem_stress(64, KMEM_CACHE_NOMAGAZINE);
+	test_kmem_stress(1024, 0);
+	test_kmem_stress(1024, KMEM_CACHE_NOMAGAZINE);
+	test_kmem_large();
+	test_kmem_color();
+	test_kmem_stats();
+	bench_kmem_cache(64, 0);
+	bench_kmem_cache(64, KMEM_CACHE_NOMAGAZINE);
+	bench_kmem_cache(1024, KMEM_CACHE_NOMAGAZINE);
 }
@@ -0,0 +1,46 @@
+#include <kernel/align.h>
+#include <kernel/memory.h>
+#include <kernel/mmu.h>
+#include <kernel/page-alloc.h>
+#include <kernel/panic.h>
+#include <kernel/printf.h>
+
+/* Order of a block of small pages that holds a large page at an offset that is not aligned to a large page.  */
+#define UNALIGNED_BLOCK_ORDER 10
+
+/* A range whose virtual address is aligned to a large page but whose physical address is not is mapped with small
+   pages, which map every byte to the right frame.  */
+static void test_mmu_map_unaligned_phys(void)
+{
+	printf("%s\n", __func__);
+	void *block = page_alloc_order(UNALIGNED_BLOCK_ORDER);
+	if (!block) {
+		panic("page_alloc_order failed");
+	}
+	phys_t paddr = ptr_to_paddr(block) + PAGE_SIZE_SMALL;
+	virt_t vaddr = align_up(kernel_vm_end, PAGE_SIZE_LARGE);
+	kernel_vm_end = vaddr + PAGE_SIZE_LARGE;
+	uint64_t *src = paddr_to_ptr(paddr);
+	for (size_t offset = 0; offset < PAGE_SIZE_LARGE; offset += PAGE_SIZE_SMALL) {
+		src[offset / sizeof(uint64_t)] = paddr + offset;
+	}
+	mmu_map_t map = mmu_current_map();
+	if (mmu_map_range(map, vaddr, paddr, PAGE_SIZE_LARGE, MMU_PROT_READ | MMU_PROT_WRITE, 0)) {
+		panic("mmu_map_range failed");
+	}
+	const uint64_t *dst = (const uint64_t *) vaddr;
+	for (size_t offset = 0; offset < PAGE_SIZE_LARGE; offset += PAGE_SIZE_SMALL) {
+		if (dst[offset / sizeof(uint64_t)] != paddr + offset) {
+			panic("mmu_map_range mapped the wrong frame");
+		}
+	}
+	if (mmu_unmap_range(map, vaddr, PAGE_SIZE_LARGE)) {
+		panic("mmu_unmap_range failed");
+	}
+	page_free_order(block, UNALIGNED_BLOCK_ORDER);
+}
+
+void test_mmu(void)
+{
+	test_mmu_map_unaligned_phys();
+}
@@ -1,7 +1,234 @@
 #include <kernel/page-alloc.h>
 #include <kernel/printf.h>
+#include <kernel/cpu.h>
+#include <stdbool.h>
 #include <string.h>
 
+/* Number of allocations that a benchmark times.  */
+#define BENCH_ITERATIONS 10000
+
+/* Number of pages that are held at once in the batch benchmark and the
+   fragmentation test.  */
+#define BATCH_SIZE 256
+
+static void *pages[BATCH_SIZE];
+
+static void bench_page_alloc_small(void)
+{
+	uint64_t start = arch_cycle_counter();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		void *page = page_alloc_small();
+		page_free_small(page);
+	}
+	uint64_t cycles = arch_cycle_counter() - start;
+	printf("%s: %lu cycles per alloc/free\n", __func__, cycles / BENCH_ITERATIONS);
+}
+
+static void bench_page_alloc_small_batch(void)
+{
+	uint64_t start = arch_cycle_counter();
+	for (int i = 0; i < BENCH_ITERATIONS / BATCH_SIZE; i++) {
+		for (int j = 0; j < BATCH_SIZE; j++) {
+			pages[j] = page_alloc_small();
+		}
+		for (int j = 0; j < BATCH_SIZE; j++) {
+			page_free_small(pages[j]);
+		}
+	}
+	uint64_t cycles = arch_cycle_counter() - start;
+	printf("%s: %lu cycles per alloc/free\n", __func__, cycles / (BENCH_ITERATIONS / BATCH_SIZE * BATCH_SIZE));
+}
+
+static void bench_page_alloc_order(void)
+{
+	for (unsigned int order = 0; order <= 8; order += 4) {
+		uint64_t start = arch_cycle_counter();
+		for (int i = 0; i < BENCH_ITERATIONS; i++) {
+			void *page = page_alloc_order(order);
+			page_free_order(page, order);
+		}
+		uint64_t cycles = arch_cycle_counter() - start;
+		printf("%s: order %u: %lu cycles per alloc/free\n", __func__, order, cycles / BENCH_ITERATIONS);
+	}
+}
+
+static void test_page_alloc_order(void)
+{
+	printf("%s\n", __func__);
+	for (unsigned int order = 0; order <= 8; order++) {
+		void *page = page_alloc_order(order);
+		size_t size = PAGE_SIZE_SMALL << order;
+		if (!page || (uintptr_t) page % size) {
+			printf("order %u: bad page %p\n", order, page);
+			continue;
+		}
+		memset(page, 0xfe, size);
+		page_free_order(page, order);
+	}
+}
+
+/* Multi-page allocations must succeed when the free memory at the lowest
+   addresses is fragmented.  */
+static void test_page_alloc_fragmented(void)
+{
+	printf("%s\n", __func__);
+	for (int i = 0; i < BATCH_SIZE; i++) {
+		pages[i] = page_alloc_small();
+	}
+	for (int i = 0; i < BATCH_SIZE; i += 2) {
+		page_free_small(pages[i]);
+	}
+	void *block = page_alloc_order(4);
+	printf("order 4 block: %p\n", block);
+	if (!block) {
+		printf("out of memory\n");
+	} else {
+		page_free_order(block, 4);
+	}
+	for (int i = 1; i < BATCH_SIZE; i += 2) {
+		page_free_small(pages[i]);
+	}
+	/* The freed pages coalesce, so the range is contiguous again.  */
+	block = page_alloc_order(8);
+	printf("order 8 block: %p\n", block);
+	if (block) {
+		page_free_order(block, 8);
+	}
+}
+
+/* Allocates all memory as small pages and then as large pages. Memory moves
+   between the small and large page arenas, so both runs get the memory that
+   the other run freed.  */
+static void test_page_alloc_exchange(void)
+{
+	struct page_arena_stats stats;
+	void *head = NULL;
+	uint64_t nr_small = 0;
+	uint64_t nr_large = 0;
+
+	printf("%s\n", __func__);
+	for (;;) {
+		void **page = page_alloc_small();
+		if (!page) {
+			break;
+		}
+		*page = head;
+		head = page;
+		nr_small++;
+	}
+	while (head) {
+		void *next = *(void **) head;
+		page_free_small(head);
+		head = next;
+	}
+	for (;;) {
+		void **page = page_alloc_large();
+		if (!page) {
+			break;
+		}
+		*page = head;
+		head = page;
+		nr_large++;
+	}
+	while (head) {
+		void *next = *(void **) head;
+		page_free_large(head);
+		head = next;
+	}
+	page_arena_get_stats(&stats);
+	printf("small pages: %lu (%lu MiB), large pages: %lu (%lu MiB)\n", nr_small,
+	       (uint64_t) (nr_small * PAGE_SIZE_SMALL >> 20), nr_large, (uint64_t) (nr_large * PAGE_SIZE_LARGE >> 20));
+	printf("large pages split: %lu, reclaimed: %lu\n", stats.large_pages_split, stats.large_pages_reclaimed);
+}
+
+static bool page_is_zero(const uint64_t *page, size_t size)
+{
+	for (size_t i = 0; i < size / sizeof(*page); i++) {
+		if (page[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Dirty pages are freed and the pool is refilled as the idle loop would,
+   after which the pool hands out zeroed pages.  */
+static void test_page_alloc_zeroed(void)
+{
+	struct page_zero_stats stats;
+
+	printf("%s\n", __func__);
+	for (int i = 0; i < BATCH_SIZE; i++) {
+		pages[i] = page_alloc_small();
+		memset(pages[i], 0xfe, PAGE_SIZE_SMALL);
+	}
+	for (int i = 0; i < BATCH_SIZE; i++) {
+		page_free_small(pages[i]);
+	}
+	void *large = page_alloc_large();
+	memset(large, 0xfe, PAGE_SIZE_LARGE);
+	page_free_large(large);
+
+	uint64_t start = arch_cycle_counter();
+	int nr_refills = 0;
+	while (page_zero_refill()) {
+		nr_refills++;
+	}
+	uint64_t cycles = arch_cycle_counter() - start;
+	page_zero_get_stats(&stats);
+	printf("pool: %lu small, %lu large pages zeroed in %d refills, %lu cycles\n", stats.nr_small, stats.nr_large,
+	       nr_refills, cycles);
+
+	start = arch_cycle_counter();
+	for (uint64_t i = 0; i < stats.nr_small; i++) {
+		pages[i] = page_alloc_small_zeroed();
+	}
+	cycles = arch_cycle_counter() - start;
+	printf("%lu cycles per pooled small page\n", stats.nr_small ? cycles / stats.nr_small : 0);
+	for (uint64_t i = 0; i < stats.nr_small; i++) {
+		if (!page_is_zero(pages[i], PAGE_SIZE_SMALL)) {
+			printf("FAIL: small page %p is not zeroed\n", pages[i]);
+		}
+		page_free_small(pages[i]);
+	}
+	for (uint64_t i = 0; i < stats.nr_large; i++) {
+		void *page = page_alloc_large_zeroed();
+		if (!page_is_zero(page, PAGE_SIZE_LARGE)) {
+			printf("FAIL: large page %p is not zeroed\n", page);
+		}
+		page_free_large(page);
+	}
+	/* The pool is empty, so the pages are zeroed on the allocation path.  */
+	void *page = page_alloc_small_zeroed();
+	if (!page_is_zero(page, PAGE_SIZE_SMALL)) {
+		printf("FAIL: small page %p is not zeroed\n", page);
+	}
+	page_free_small(page);
+	page_zero_get_stats(&stats);
+	printf("small hits: %lu misses: %lu, large hits: %lu misses: %lu\n", stats.small_hits, stats.small_misses,
+	       stats.large_hits, stats.large_misses);
+}
+
+/* Draining the pool returns its pages to the allocator.  */
+static void test_page_zero_drain(void)
+{
+	struct page_zero_stats stats;
+
+	printf("%s\n", __func__);
+	while (page_zero_refill()) {
+	}
+	if (!page_zero_drain()) {
+		printf("FAIL: no pages drained\n");
+	}
+	page_zero_get_stats(&stats);
+	if (stats.nr_small || stats.nr_large) {
+		printf("FAIL: %lu small, %lu large pages left in the pool\n", stats.nr_small, stats.nr_large);
+	}
+	if (page_zero_drain()) {
+		printf("FAIL: empty pool drained\n");
+	}
+}
+
 static void test_page_alloc_small(void)
 {
 	printf("%s\n", __func__);
@@ -44,6 +271,14 @@ static void test_page_alloc_large(void)
 
 void test_page_alloc(void)
 {
+	bench_page_alloc_small();
+	bench_page_alloc_small_batch();
+	bench_page_alloc_order();
+	test_page_alloc_order();
+	test_page_alloc_fragmented();
+	test_page_alloc_exchange();
+	test_page_alloc_zeroed();
+	test_page_zero_drain();
 	test_page_alloc_small();
 	test_page_alloc_large();
 }
@@ -27,12 +27,20 @@ static void echo(int sockfd)
 	char buf[maxbuf];
 	struct sockaddr_storage addr = {};
 	socklen_t addrlen = sizeof(addr);
-	ssize_t nr = recvfrom(sockfd, buf, maxbuf, MSG_DONTWAIT, (struct sockaddr*) &addr, &addrlen);
-	if (nr < 0) {
-		die("recv");
-	}
-	if (sendto(sockfd, buf, nr, MSG_DONTWAIT, (struct sockaddr*) &addr, addrlen) != (ssize_t) nr) {
-		die("send");
+	/* A single readiness event can cover several datagrams, so receive
+	   until the socket is drained.  */
+	for (;;) {
+		addrlen = sizeof(addr);
+		ssize_t nr = recvfrom(sockfd, buf, maxbuf, MSG_DONTWAIT, (struct sockaddr*) &addr, &addrlen);
+		if (nr < 0) {
+			if (errno == EAGAIN) {
+				break;
+			}
+			die("recv");
+		}
+		if (sendto(sockfd, buf, nr, MSG_DONTWAIT, (struct sockaddr*) &addr, addrlen) != (ssize_t) nr) {
+			die("send");
+		}
 	}
 }
 
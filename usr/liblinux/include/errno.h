@@ -2,10 +2,13 @@
 #define _ERRNO_H
 
 #define EBADF 9
+#define EAGAIN 11
+#define ENOMEM 12
 #define EFAULT 14
 #define EINVAL 22
 #define EMFILE 24
 #define ENOSYS 38
+#define EMSGSIZE 90
 #define ENOPROTOOPT 92
 #define EOPNOTSUPP 95
 
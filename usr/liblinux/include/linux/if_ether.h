@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #define ETH_ALEN 6
+#define ETH_HLEN 14
 
 #define ETH_P_IP 0x0800
 #define ETH_P_ARP 0x0806
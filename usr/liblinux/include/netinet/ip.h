@@ -8,6 +8,8 @@
 #define IP_MF 0x2000U	   /* More Fragments (MF) */
 #define IP_OFFMASK 0x1fffU /* Fragment offset mask */
 
+#define IP_MAXPACKET 65535 /* Maximum packet size */
+
 struct iphdr {
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 	unsigned ihl : 4;
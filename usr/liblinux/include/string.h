@@ -5,6 +5,7 @@
 
 void *memset(void *s, int c, size_t len);
 void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
 char *strerror(int errnum);
 size_t strlen(const char *s);
 
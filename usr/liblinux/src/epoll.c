@@ -4,6 +4,7 @@
 
 #include <manticore/atomic-ring-buffer.h>
 #include <manticore/events.h>
+#include <manticore/net_offload_abi.h>
 #include <manticore/syscalls.h>
 
 #include "internal/net.h"
@@ -95,6 +96,20 @@ int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
 			}
 			break;
 		}
+		case EVENT_PACKET_RX_OFFLOAD: {
+			const struct net_offload_hdr *offh = kern_event->addr;
+			struct packet_view pk = {
+				.start = kern_event->addr + sizeof(*offh),
+				.end = kern_event->addr + kern_event->len,
+				.gso_size = offh->gso_type == NET_GSO_UDP_L4 ? offh->gso_size : 0,
+			};
+			if (net_input(&pk)) {
+				struct epoll_event *ep_event = &events[nr_events++];
+				*ep_event = interest_set[0]; // FIXME
+				ep_event->events = EPOLLIN;
+			}
+			break;
+		}
 		default:
 			break;
 		}
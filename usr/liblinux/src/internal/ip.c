@@ -7,12 +7,20 @@
 #include <arpa/inet.h>
 #include <assert.h> // FIXME
 #include <errno.h>
+#include <linux/if_ether.h>
+#include <manticore/net_offload_abi.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Maximum UDP payload in an IPv4 datagram.  */
+#define UDP_MAX_PAYLOAD (IP_MAXPACKET - sizeof(struct iphdr) - sizeof(struct udphdr))
+
+/* Size of the transmit buffer: an offload header and a maximum-sized frame.  */
+#define NET_TX_BUF_SIZE (sizeof(struct net_offload_hdr) + ETH_HLEN + IP_MAXPACKET)
+
 #define WARN(str) fprintf(stderr, "warning: %s\n", str)
 
 struct ip_statistics {
@@ -26,18 +34,28 @@ ssize_t udp_recvfrom(struct socket *sk, void *restrict buf, size_t len, int flag
 {
 	LIBLINUX_TRACE(udp_recvfrom);
 
-	struct iphdr *iph = (void *) sk->rx_buffer;
-
-	// FIXME: check pbuf length
+	size_t dgram_len;
+	const char *dgram = socket_rx_front(sk, &dgram_len);
+	if (!dgram) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (dgram_len < sizeof(struct iphdr) + sizeof(struct udphdr)) {
+		socket_rx_pop(sk);
+		errno = EAGAIN;
+		return -1;
+	}
+	const struct iphdr *iph = (const void *) dgram;
 
-	struct udphdr *udph = (void *) sk->rx_buffer + sizeof(struct iphdr);
+	const struct udphdr *udph = (const void *) dgram + sizeof(struct iphdr);
 
 	uint16_t udp_len = ntohs(udph->len);
 
 	size_t data_off = sizeof(struct iphdr) + sizeof(struct udphdr);
 	size_t data_len = udp_len - sizeof(struct udphdr);
-
-	// FIXME: check pbuf length
+	if (data_len > dgram_len - data_off) {
+		data_len = dgram_len - data_off;
+	}
 
 	if (*addrlen < sizeof(struct sockaddr_in)) {
 		errno = EINVAL;
@@ -48,12 +66,14 @@ ssize_t udp_recvfrom(struct socket *sk, void *restrict buf, size_t len, int flag
 	saddr_in->sin_port = udph->source;
 	*addrlen = sizeof(struct sockaddr_in);
 
-	// FIXME: How can we retrieve rest of the data?
+	/* Like on Linux, the part of the datagram that does not fit the buffer
+	   is discarded.  */
 	size_t nr = data_len;
 	if (nr > len) {
 		nr = len;
 	}
-	memcpy(buf, sk->rx_buffer + data_off, nr);
+	memcpy(buf, dgram + data_off, nr);
+	socket_rx_pop(sk);
 
 	return nr;
 }
@@ -110,6 +130,23 @@ uint16_t udp_checksum(const void *buf, size_t len, in_addr_t dest_ip, in_addr_t
 	return checksum_finalize(sum);
 }
 
+/* Returns the IPv4 pseudo-header checksum that is stored in the UDP header for checksum offload.  */
+static uint16_t udp_pseudo_checksum(size_t len, in_addr_t dest_ip, in_addr_t src_ip)
+{
+	uint64_t sum = 0;
+
+	sum += src_ip & 0xffffU;
+	sum += src_ip >> 16;
+
+	sum += dest_ip & 0xffffU;
+	sum += dest_ip >> 16;
+
+	sum += htons(IPPROTO_UDP);
+	sum += htons(len);
+
+	return ~checksum_finalize(sum);
+}
+
 struct packet_buf {
 	void *buf;
 	size_t len;
@@ -135,17 +172,21 @@ size_t packet_buf_len(struct packet_buf *pk)
 
 void *packet_buf_reserve(struct packet_buf *pk, size_t size)
 {
-	assert(pk->len + size < pk->capacity);
+	if (pk->capacity - pk->len < size) {
+		return NULL;
+	}
 	size_t off = pk->len;
 	pk->len += size;
 	return pk->buf + off;
 }
 
-void packet_buf_append(struct packet_buf *pk, const void *buf, size_t len)
+void *packet_buf_append(struct packet_buf *pk, const void *buf, size_t len)
 {
 	void *dst = packet_buf_reserve(pk, len);
-
-	memcpy(dst, buf, len);
+	if (dst) {
+		memcpy(dst, buf, len);
+	}
+	return dst;
 }
 
 struct ethhdr *ethhdr_append(struct packet_buf *pk, const char *dest, const char *source, uint16_t proto)
@@ -200,6 +241,11 @@ ssize_t udp_sendto(struct socket *sk, const void *buf, size_t len, int flags, co
 		return -1;
 	}
 
+	if (len > UDP_MAX_PAYLOAD) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
 	struct sockaddr_in *saddr_in = (void *)dest_addr;
 
 	in_addr_t src_ip = __liblinux_host_ip;
@@ -212,10 +258,18 @@ ssize_t udp_sendto(struct socket *sk, const void *buf, size_t len, int flags, co
 	uint16_t udp_len = sizeof(struct udphdr) + len;
 	uint16_t ip_len = sizeof(struct iphdr) + udp_len;
 
-	static char _tx_buf[4096]; /* FIXME */
+	static char _tx_buf[NET_TX_BUF_SIZE];
 
 	struct packet_buf pk;
-	packet_buf_init(&pk, _tx_buf, 4096);
+	packet_buf_init(&pk, _tx_buf, sizeof(_tx_buf));
+
+	/* Let the kernel or the device split the payload into multiple datagrams.  */
+	bool gso = sk->gso_size && len > sk->gso_size;
+
+	struct net_offload_hdr *offh = NULL;
+	if (gso) {
+		offh = packet_buf_reserve(&pk, sizeof(*offh));
+	}
 
 	ethhdr_append(&pk, dest_arp, src_arp, ETH_P_IP);
 
@@ -227,9 +281,22 @@ ssize_t udp_sendto(struct socket *sk, const void *buf, size_t len, int flags, co
 
 	iph->check = ipv4_checksum(iph, sizeof(*iph));
 
-	udph->check = udp_checksum(udph, udp_len, dest_ip, src_ip);
+	if (gso) {
+		offh->flags = NET_OFFLOAD_F_NEEDS_CSUM;
+		offh->gso_type = NET_GSO_UDP_L4;
+		offh->hdr_len = ETH_HLEN + sizeof(*iph) + sizeof(*udph);
+		offh->gso_size = sk->gso_size;
+		offh->csum_start = ETH_HLEN + sizeof(*iph);
+		offh->csum_offset = offsetof(struct udphdr, check);
 
-	io_submit(__liblinux_eth_ioqueue, packet_buf_start(&pk), packet_buf_len(&pk)); /* FIXME: error handling */
+		udph->check = udp_pseudo_checksum(udp_len, dest_ip, src_ip);
+
+		io_submit_offload(__liblinux_eth_ioqueue, packet_buf_start(&pk), packet_buf_len(&pk)); /* FIXME: error handling */
+	} else {
+		udph->check = udp_checksum(udph, udp_len, dest_ip, src_ip);
+
+		io_submit(__liblinux_eth_ioqueue, packet_buf_start(&pk), packet_buf_len(&pk)); /* FIXME: error handling */
+	}
 
 	return len;
 }
@@ -246,7 +313,28 @@ static void udp_input(struct packet_view *pk)
 
 	assert(sk != NULL);
 
-	socket_input(sk, pk);
+	if (pk->gso_size) {
+		/* Split a merged packet back into datagrams.  */
+		struct {
+			struct iphdr iph;
+			struct udphdr udph;
+		} hdr;
+		memcpy(&hdr, pk->start, sizeof(hdr));
+
+		const char *data = pk->start + sizeof(hdr);
+		size_t data_len = udp_len - sizeof(struct udphdr);
+
+		for (size_t off = 0; off < data_len; off += pk->gso_size) {
+			size_t seg_len = data_len - off;
+			if (seg_len > pk->gso_size) {
+				seg_len = pk->gso_size;
+			}
+			hdr.udph.len = htons(sizeof(struct udphdr) + seg_len);
+			socket_input_segment(sk, &hdr, sizeof(hdr), data + off, seg_len);
+		}
+	} else {
+		socket_input(sk, pk);
+	}
 
 	packet_view_trim(pk, sizeof(struct iphdr) + udp_len);
 }
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/socket.h>
 
 struct socket;
@@ -11,10 +12,13 @@ struct socket;
 /// A packet descriptor.
 ///
 /// A packet descriptor specifies an (start, end) tuple that points to a
-/// contiguous memory area that contains one packet.
+/// contiguous memory area that contains one packet. If \gso_size is non-zero,
+/// the packet is a merged packet whose payload consists of multiple datagrams
+/// of \gso_size bytes each (the last one can be shorter).
 struct packet_view {
 	void *start;
 	void *end;
+	uint16_t gso_size;
 };
 
 /// Returns the length of the packet pointed to by \pk
@@ -8,6 +8,7 @@
 
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <string.h>
 
 static const struct socket_operations udp_socket_ops = {
@@ -48,6 +49,9 @@ int socket_alloc(int domain, int type, int protocol)
 	struct socket *sk = &sockets[sockidx];
 	sk->ops = ops;
 	sk->local_port = 0;
+	sk->gso_size = 0;
+	sk->rx_head = 0;
+	sk->rx_tail = 0;
 
 	return sockfd;
 }
@@ -78,8 +82,63 @@ struct socket *socket_lookup_by_flow(uint16_t local_port, uint16_t foreign_port)
 
 void socket_input(struct socket *sk, struct packet_view *pk)
 {
-	// FIXME: This overwrites existing data.
-	memcpy(sk->rx_buffer, pk->start, packet_view_len(pk));
+	socket_input_segment(sk, pk->start, packet_view_len(pk), NULL, 0);
+}
+
+/* Returns the size of the queue entry of a datagram of \len bytes.  */
+static size_t socket_rx_entry_size(size_t len)
+{
+	return (sizeof(uint32_t) + len + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+/* Queues a datagram that consists of headers \hdr and data \data to the receive queue of socket \sk. The datagram is
+   dropped if the queue is full.  */
+void socket_input_segment(struct socket *sk, const void *hdr, size_t hdr_len, const void *data, size_t data_len)
+{
+	uint32_t len = hdr_len + data_len;
+	size_t entry_size = socket_rx_entry_size(len);
+	if (sk->rx_tail + entry_size > sizeof(sk->rx_queue)) {
+		/* Move the queued datagrams to the start of the queue to make room
+		   at the end.  */
+		memmove(sk->rx_queue, sk->rx_queue + sk->rx_head, sk->rx_tail - sk->rx_head);
+		sk->rx_tail -= sk->rx_head;
+		sk->rx_head = 0;
+		if (sk->rx_tail + entry_size > sizeof(sk->rx_queue)) {
+			return;
+		}
+	}
+	char *entry = sk->rx_queue + sk->rx_tail;
+	memcpy(entry, &len, sizeof(len));
+	memcpy(entry + sizeof(len), hdr, hdr_len);
+	memcpy(entry + sizeof(len) + hdr_len, data, data_len);
+	sk->rx_tail += entry_size;
+}
+
+/* Returns the oldest datagram in the receive queue of socket \sk and stores its length to \len, or returns NULL if
+   the queue is empty.  */
+const void *socket_rx_front(struct socket *sk, size_t *len)
+{
+	if (sk->rx_head == sk->rx_tail) {
+		return NULL;
+	}
+	uint32_t entry_len;
+	memcpy(&entry_len, sk->rx_queue + sk->rx_head, sizeof(entry_len));
+	*len = entry_len;
+	return sk->rx_queue + sk->rx_head + sizeof(entry_len);
+}
+
+/* Removes the oldest datagram from the receive queue of socket \sk.  */
+void socket_rx_pop(struct socket *sk)
+{
+	size_t len;
+	if (!socket_rx_front(sk, &len)) {
+		return;
+	}
+	sk->rx_head += socket_rx_entry_size(len);
+	if (sk->rx_head == sk->rx_tail) {
+		sk->rx_head = 0;
+		sk->rx_tail = 0;
+	}
 }
 
 int socket_accept(struct socket *sk, struct sockaddr *restrict addr, socklen_t *restrict addrlen)
@@ -105,6 +164,15 @@ int socket_bind(struct socket *sk, const struct sockaddr *addr, socklen_t addrle
 
 int socket_getsockopt(struct socket *sk, int level, int optname, void *restrict optval, socklen_t *restrict optlen)
 {
+	if (level == SOL_UDP && optname == UDP_SEGMENT) {
+		if (*optlen < sizeof(int)) {
+			errno = EINVAL;
+			return -1;
+		}
+		*(int *)optval = sk->gso_size;
+		*optlen = sizeof(int);
+		return 0;
+	}
 	errno = ENOPROTOOPT;
 	return -1;
 }
@@ -129,6 +197,19 @@ ssize_t socket_sendto(struct socket *sk, const void *buf, size_t len, int flags,
 
 int socket_setsockopt(struct socket *sk, int level, int optname, const void *optval, socklen_t optlen)
 {
+	if (level == SOL_UDP && optname == UDP_SEGMENT) {
+		if (optlen != sizeof(int)) {
+			errno = EINVAL;
+			return -1;
+		}
+		int gso_size = *(const int *)optval;
+		if (gso_size < 0 || gso_size > UINT16_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+		sk->gso_size = gso_size;
+		return 0;
+	}
 	errno = ENOPROTOOPT;
 	return -1;
 }
@@ -16,10 +16,20 @@ struct socket_operations {
 			  socklen_t addrlen);
 };
 
+/* Size of the receive queue of a socket, which holds at least two
+   maximum-sized datagrams.  */
+#define SOCKET_RX_QUEUE_SIZE (256 * 1024)
+
 struct socket {
 	const struct socket_operations *ops;
 	uint16_t local_port;
-	char rx_buffer[1500]; /* FIXME make bigger */
+	uint16_t gso_size;
+	/* Receive queue of datagrams. Every datagram is stored as its length,
+	   followed by its IP and UDP headers and payload. Queued datagrams are
+	   between rx_head and rx_tail.  */
+	char rx_queue[SOCKET_RX_QUEUE_SIZE];
+	size_t rx_head;
+	size_t rx_tail;
 };
 
 int socket_alloc(int domain, int type, int protocol);
@@ -28,6 +38,9 @@ struct socket *socket_lookup_by_fd(int sockfd);
 struct socket *socket_lookup_by_flow(uint16_t local_port, uint16_t foreign_port);
 
 void socket_input(struct socket *sk, struct packet_view *pk);
+void socket_input_segment(struct socket *sk, const void *hdr, size_t hdr_len, const void *data, size_t data_len);
+const void *socket_rx_front(struct socket *sk, size_t *len);
+void socket_rx_pop(struct socket *sk);
 
 int socket_accept(struct socket *sk, struct sockaddr *restrict addr, socklen_t *restrict addrlen);
 int socket_bind(struct socket *sk, const struct sockaddr *addr, socklen_t addrlen);
@@ -0,0 +1,11 @@
+#include <string.h>
+
+void *memset(void *s, int c, size_t n)
+{
+	char *d = s;
+
+	for (size_t i = 0; i < n; i++) {
+		d[i] = c;
+	}
+	return s;
+}
@@ -7,6 +7,8 @@ char *strerror(int errnum)
 	switch (errnum) {
 	case EBADF:
 		return "Bad file descriptor";
+	case EAGAIN:
+		return "Resource temporarily unavailable";
 	case EINVAL:
 		return "Invalid argument";
 	case EMFILE:
@@ -15,11 +15,15 @@ int acquire(const char *name, int flags);
 int subscribe(const char *event);
 int getevents(void **events);
 int get_config(int desc, int opt, void *buf, size_t len);
+int set_config(int desc, int opt, const void *buf, size_t len);
 int vmspace_alloc(struct vmspace_region *, size_t size);
+int vmspace_free(const struct vmspace_region *, size_t size);
+ssize_t kmem_stats(int type, void *buf, size_t len);
 
 long syscall0(long number);
 long syscall1(long number, long arg0);
 long syscall2(long number, long arg0, long arg1);
+long syscall3(long number, long arg0, long arg1, long arg2);
 long syscall4(long number, long arg0, long arg1, long arg2, long arg3);
 
 #endif
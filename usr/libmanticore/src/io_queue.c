@@ -22,6 +22,11 @@ int io_submit(io_queue_t queue, void *addr, size_t len)
 	return __io_queue_append(queue, IO_OPCODE_SUBMIT, addr, len);
 }
 
+int io_submit_offload(io_queue_t queue, void *addr, size_t len)
+{
+	return __io_queue_append(queue, IO_OPCODE_SUBMIT_OFFLOAD, addr, len);
+}
+
 int io_complete(io_queue_t queue, void *addr, size_t len)
 {
 	return __io_queue_append(queue, IO_OPCODE_COMPLETE, addr, len);
@@ -33,6 +33,17 @@ long syscall2(long number, long arg0, long arg1)
         return ret;
 }
 
+long syscall3(long number, long arg0, long arg1, long arg2)
+{
+        unsigned long ret;
+        asm volatile(
+		"syscall"
+		: "=a"(ret)
+		: "a"(number), "D"(arg0), "S"(arg1), "d"(arg2)
+		: "rcx", "r11", "memory");
+        return ret;
+}
+
 long syscall4(long number, long arg0, long arg1, long arg2, long arg3)
 {
         unsigned long ret;
@@ -0,0 +1,6 @@
+#include <manticore/syscalls.h>
+
+ssize_t kmem_stats(int type, void *buf, size_t len)
+{
+	return syscall3(SYS_kmem_stats, (long) type, (long) buf, (long) len);
+}
@@ -0,0 +1,6 @@
+#include <manticore/syscalls.h>
+
+int set_config(int desc, int opt, const void *buf, size_t len)
+{
+	return syscall4(SYS_set_config, (long) desc, (long) opt, (long) buf, (long) len);
+}
@@ -0,0 +1,6 @@
+#include <manticore/syscalls.h>
+
+int vmspace_free(const struct vmspace_region *vmr, size_t size)
+{
+	return syscall2(SYS_vmspace_free, (long) vmr, (long) size);
+}
@@ -0,0 +1,168 @@
+#include "pkt.h"
+
+#include <manticore/config_abi.h>
+#include <manticore/io_queue.h>
+#include <manticore/net_offload_abi.h>
+#include <manticore/syscalls.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Source and destination IPv4 addresses of generated datagrams.  */
+#define PKTGEN_SOURCE_IP "10.0.2.15"
+#define PKTGEN_DEST_IP "10.0.2.2"
+
+/* Size of the Ethernet, IP, and UDP headers of a generated frame.  */
+#define PKT_HDR_LEN (ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+void pkt_die(const char *msg)
+{
+	fprintf(stderr, "error: %s\n", msg);
+	exit(1);
+}
+
+int pkt_dev_open(struct pkt_dev *dev, const char *name)
+{
+	uint64_t stats_addr = 0;
+	uint64_t latency;
+
+	dev->desc = acquire(name, 0);
+	if (dev->desc < 0) {
+		return dev->desc;
+	}
+	get_config(dev->desc, CONFIG_IO_QUEUE, &dev->io_queue, sizeof(io_queue_t));
+	get_config(dev->desc, CONFIG_ETHERNET_MAC_ADDRESS, dev->mac_addr, ETH_ALEN);
+	get_config(dev->desc, CONFIG_STATS, &stats_addr, sizeof(stats_addr));
+	dev->stats = (const struct net_device_stats *) stats_addr;
+	/* Only the loopback device has the loopback configuration options.  */
+	dev->loopback = get_config(dev->desc, CONFIG_LOOPBACK_LATENCY, &latency, sizeof(latency)) == 0;
+	return 0;
+}
+
+static uint16_t pkt_ipv4_checksum(const void *buf, size_t len)
+{
+	const uint16_t *p = buf;
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i < len / 2; i++) {
+		sum += p[i];
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return ~sum;
+}
+
+/* Builds a UDP frame of \frame_size bytes in \buf and returns its length. The
+   payload is stamped with pkt_payload before every transmission.  */
+size_t pkt_build(void *buf, size_t frame_size, const char *dest_mac, const char *source_mac)
+{
+	const size_t min_size = PKT_HDR_LEN + sizeof(struct pkt_payload);
+	if (frame_size < min_size) {
+		frame_size = min_size;
+	}
+	uint16_t udp_len = frame_size - ETH_HLEN - sizeof(struct iphdr);
+	uint16_t ip_len = frame_size - ETH_HLEN;
+
+	struct ethhdr *ethh = buf;
+	memcpy(ethh->h_dest, dest_mac, ETH_ALEN);
+	memcpy(ethh->h_source, source_mac, ETH_ALEN);
+	ethh->h_proto = htons(ETH_P_IP);
+
+	struct iphdr *iph = buf + ETH_HLEN;
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tos = 0;
+	iph->tot_len = htons(ip_len);
+	iph->id = 0;
+	iph->frag_off = htons(IP_DF);
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->check = 0;
+	iph->saddr = inet_addr(PKTGEN_SOURCE_IP);
+	iph->daddr = inet_addr(PKTGEN_DEST_IP);
+	iph->check = pkt_ipv4_checksum(iph, sizeof(*iph));
+
+	/* The UDP checksum is optional in IPv4. Leaving it out lets the payload
+	   be stamped without recomputing the checksum.  */
+	struct udphdr *udph = buf + ETH_HLEN + sizeof(*iph);
+	udph->source = htons(PKTGEN_UDP_PORT);
+	udph->dest = htons(PKTGEN_UDP_PORT);
+	udph->len = htons(udp_len);
+	udph->check = 0;
+
+	memset(buf + PKT_HDR_LEN, 0, frame_size - PKT_HDR_LEN);
+
+	return frame_size;
+}
+
+/* Stamps the frame in \buf with sequence number \seq and the current cycle
+   counter value.  */
+void pkt_stamp(void *buf, uint64_t seq)
+{
+	struct pkt_payload payload = {
+		.seq = seq,
+		.tsc = pkt_rdtsc(),
+	};
+	memcpy(buf + PKT_HDR_LEN, &payload, sizeof(payload));
+}
+
+/* Parses a received frame event. Returns true if the frame is a datagram of
+   the packet generator.  */
+bool pkt_parse(const struct event *event, struct pkt_rx *rx)
+{
+	const void *frame = event->addr;
+	size_t len = event->len;
+	uint16_t gso_size = 0;
+
+	switch (event->type) {
+	case EVENT_PACKET_RX:
+		break;
+	case EVENT_PACKET_RX_OFFLOAD: {
+		const struct net_offload_hdr *offh = event->addr;
+		if (len < sizeof(*offh)) {
+			return false;
+		}
+		if (offh->gso_type == NET_GSO_UDP_L4) {
+			gso_size = offh->gso_size;
+		}
+		frame += sizeof(*offh);
+		len -= sizeof(*offh);
+		break;
+	}
+	default:
+		return false;
+	}
+	if (len < PKT_HDR_LEN + sizeof(struct pkt_payload)) {
+		return false;
+	}
+	const struct ethhdr *ethh = frame;
+	if (ethh->h_proto != htons(ETH_P_IP)) {
+		return false;
+	}
+	const struct iphdr *iph = frame + ETH_HLEN;
+	if (iph->ihl != 5 || iph->protocol != IPPROTO_UDP) {
+		return false;
+	}
+	const struct udphdr *udph = frame + ETH_HLEN + sizeof(*iph);
+	if (udph->dest != htons(PKTGEN_UDP_PORT)) {
+		return false;
+	}
+	memcpy(&rx->payload, (const void *) udph + sizeof(*udph), sizeof(rx->payload));
+	rx->len = len;
+	rx->nr_datagrams = 1;
+	if (gso_size) {
+		size_t payload_len = len - PKT_HDR_LEN;
+		rx->nr_datagrams = (payload_len + gso_size - 1) / gso_size;
+	}
+	return true;
+}
+
+void pkt_complete(struct pkt_dev *dev, const struct event *event)
+{
+	io_complete(dev->io_queue, event->addr, event->len);
+}
@@ -0,0 +1,75 @@
+#ifndef PKTGEN_PKT_H
+#define PKTGEN_PKT_H
+
+#include <manticore/events.h>
+#include <manticore/io_queue_abi.h>
+#include <manticore/net_stats_abi.h>
+
+#include <linux/if_ether.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* UDP port that the packet generator sends to and the packet sink receives on.  */
+#define PKTGEN_UDP_PORT 9
+
+/* Payload of a generated UDP datagram.  */
+struct pkt_payload {
+	/* Sequence number of the datagram.  */
+	uint64_t	seq;
+	/* Cycle counter value when the datagram was submitted.  */
+	uint64_t	tsc;
+} __attribute__((packed));
+
+/* A network device acquired by the packet generator or the packet sink.  */
+struct pkt_dev {
+	int				desc;
+	io_queue_t			io_queue;
+	char				mac_addr[ETH_ALEN];
+	const struct net_device_stats	*stats;
+	/* The device is the loopback device.  */
+	bool				loopback;
+};
+
+/* A received datagram of the packet generator.  */
+struct pkt_rx {
+	/* Payload of the first datagram.  */
+	struct pkt_payload	payload;
+	/* Number of datagrams, which is more than one for a merged frame.  */
+	uint64_t		nr_datagrams;
+	/* Length of the frame in bytes.  */
+	size_t			len;
+};
+
+static inline uint64_t pkt_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((uint64_t) hi << 32) | lo;
+}
+
+static inline uint64_t pkt_cycles_to_usec(uint64_t cycles)
+{
+	return cycles / PKTGEN_CPU_MHZ;
+}
+
+static inline uint64_t pkt_cycles_to_nsec(uint64_t cycles)
+{
+	return cycles * 1000 / PKTGEN_CPU_MHZ;
+}
+
+void pkt_die(const char *msg) __attribute__((noreturn));
+
+int pkt_dev_open(struct pkt_dev *dev, const char *name);
+
+size_t pkt_build(void *buf, size_t frame_size, const char *dest_mac, const char *source_mac);
+
+void pkt_stamp(void *buf, uint64_t seq);
+
+bool pkt_parse(const struct event *event, struct pkt_rx *rx);
+
+void pkt_complete(struct pkt_dev *dev, const struct event *event);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Packet generator
+ *
+ * Transmits fixed-size UDP frames through the raw I/O queue of a network
+ * device as fast as possible and reports the transmit rate over the console.
+ * On the loopback device, the generator also receives its own frames and
+ * reports the receive rate and the latency from submission to delivery.
+ */
+
+#include "pkt.h"
+
+#include <manticore/atomic-ring-buffer.h>
+#include <manticore/config_abi.h>
+#include <manticore/io_queue.h>
+#include <manticore/syscalls.h>
+#include <manticore/vmspace_abi.h>
+
+#include <stdio.h>
+
+/* Number of frames that are submitted before the I/O queue is flushed.  */
+#define TX_BATCH 32
+
+/* Maximum number of received frames that are processed before the I/O queue
+   is flushed. This keeps transmit and completion commands within the I/O
+   queue capacity.  */
+#define RX_BATCH 32
+
+/* Size of a transmit buffer, which holds one frame.  */
+#define TX_BUF_SIZE 2048
+
+struct pktgen_stats {
+	uint64_t	tx_packets;
+	uint64_t	tx_bytes;
+	uint64_t	rx_packets;
+	uint64_t	rx_bytes;
+	uint64_t	latency_sum;
+	uint64_t	latency_min;
+	uint64_t	latency_max;
+};
+
+static struct pkt_dev dev;
+
+static struct pktgen_stats stats;
+
+static void pktgen_stats_reset(struct pktgen_stats *s)
+{
+	s->tx_packets = 0;
+	s->tx_bytes = 0;
+	s->rx_packets = 0;
+	s->rx_bytes = 0;
+	s->latency_sum = 0;
+	s->latency_min = UINT64_MAX;
+	s->latency_max = 0;
+}
+
+static void pktgen_report(const struct pktgen_stats *s, uint64_t cycles)
+{
+	uint64_t usec = pkt_cycles_to_usec(cycles);
+	if (!usec) {
+		usec = 1;
+	}
+	printf("tx: %lu pps %lu Mbps", s->tx_packets * 1000000 / usec, s->tx_bytes * 8 / usec);
+	if (s->rx_packets) {
+		printf(" rx: %lu pps %lu Mbps latency: min %lu avg %lu max %lu ns", s->rx_packets * 1000000 / usec,
+		       s->rx_bytes * 8 / usec, pkt_cycles_to_nsec(s->latency_min),
+		       pkt_cycles_to_nsec(s->latency_sum / s->rx_packets), pkt_cycles_to_nsec(s->latency_max));
+	}
+	if (dev.stats) {
+		printf(" drops: tx %lu rx %lu", dev.stats->tx.drops, dev.stats->rx.drops);
+	}
+	printf("\n");
+}
+
+/* Processes received frames and returns the number of datagrams of the
+   generator that were received.  */
+static uint64_t pktgen_poll(void)
+{
+	struct atomic_ring_buffer *queue;
+	uint64_t nr_datagrams = 0;
+	int nr_events = 0;
+
+	if (getevents((void **) &queue)) {
+		pkt_die("getevents");
+	}
+	uint64_t now = pkt_rdtsc();
+	while (!atomic_ring_buffer_is_empty(queue) && nr_events++ < RX_BATCH) {
+		struct event *event = atomic_ring_buffer_front(queue);
+		struct pkt_rx rx;
+		if (pkt_parse(event, &rx)) {
+			uint64_t latency = now - rx.payload.tsc;
+			stats.rx_packets += rx.nr_datagrams;
+			stats.rx_bytes += rx.len;
+			stats.latency_sum += latency * rx.nr_datagrams;
+			if (latency < stats.latency_min) {
+				stats.latency_min = latency;
+			}
+			if (latency > stats.latency_max) {
+				stats.latency_max = latency;
+			}
+			nr_datagrams += rx.nr_datagrams;
+		}
+		pkt_complete(&dev, event);
+		atomic_ring_buffer_pop(queue);
+	}
+	return nr_datagrams;
+}
+
+__attribute__((force_align_arg_pointer))
+int main(int argc, char *argv[])
+{
+	if (pkt_dev_open(&dev, PKTGEN_DEVICE) < 0) {
+		pkt_die("unable to acquire " PKTGEN_DEVICE);
+	}
+	if (dev.loopback) {
+		uint64_t latency = PKTGEN_LOOPBACK_LATENCY;
+		uint32_t drop_rate = PKTGEN_LOOPBACK_DROP_RATE;
+		set_config(dev.desc, CONFIG_LOOPBACK_LATENCY, &latency, sizeof(latency));
+		set_config(dev.desc, CONFIG_LOOPBACK_DROP_RATE, &drop_rate, sizeof(drop_rate));
+	}
+	struct vmspace_region vmr = {
+		.size = TX_BATCH * TX_BUF_SIZE,
+		.align = 4096,
+	};
+	if (vmspace_alloc(&vmr, sizeof(vmr)) < 0) {
+		pkt_die("vmspace_alloc");
+	}
+	/* Frames are sent to the broadcast address, except on the loopback
+	   device where they are sent to the device itself.  */
+	const char broadcast[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	const char *dest_mac = dev.loopback ? dev.mac_addr : broadcast;
+	void *tx_bufs[TX_BATCH];
+	size_t frame_size = 0;
+	for (int i = 0; i < TX_BATCH; i++) {
+		tx_bufs[i] = (void *) vmr.start + i * TX_BUF_SIZE;
+		frame_size = pkt_build(tx_bufs[i], PKTGEN_FRAME_SIZE, dest_mac, dev.mac_addr);
+	}
+	printf("pktgen: sending %lu %lu-byte frames to %s ...\n", (uint64_t) PKTGEN_COUNT, (uint64_t) frame_size,
+	       PKTGEN_DEVICE);
+
+	pktgen_stats_reset(&stats);
+	uint64_t seq = 0;
+	uint64_t received = 0;
+	uint64_t start = pkt_rdtsc();
+	while (seq < PKTGEN_COUNT) {
+		/* The kernel reads the frames when the I/O queue is flushed by
+		   wait(), so every batch reuses the same transmit buffers.  */
+		for (int i = 0; i < TX_BATCH && seq < PKTGEN_COUNT; i++) {
+			pkt_stamp(tx_bufs[i], seq++);
+			io_submit(dev.io_queue, tx_bufs[i], frame_size);
+			stats.tx_packets++;
+			stats.tx_bytes += frame_size;
+		}
+		wait();
+		received += pktgen_poll();
+		if (stats.tx_packets >= PKTGEN_REPORT_INTERVAL) {
+			uint64_t now = pkt_rdtsc();
+			pktgen_report(&stats, now - start);
+			pktgen_stats_reset(&stats);
+			start = now;
+		}
+	}
+	/* Wait for the frames that the loopback device has not delivered yet.  */
+	while (dev.loopback && received + dev.stats->rx.drops < dev.stats->tx.packets) {
+		wait();
+		received += pktgen_poll();
+	}
+	pktgen_report(&stats, pkt_rdtsc() - start);
+	printf("pktgen: sent %lu frames, received %lu frames\n", seq, received);
+	exit(0);
+}
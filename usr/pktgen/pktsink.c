@@ -0,0 +1,85 @@
+/*
+ * Packet sink
+ *
+ * Receives the UDP frames of the packet generator through the raw event queue
+ * of a network device and reports the receive rate and the number of frames
+ * that were lost, based on gaps in the sequence numbers, over the console.
+ */
+
+#include "pkt.h"
+
+#include <manticore/atomic-ring-buffer.h>
+#include <manticore/syscalls.h>
+
+#include <stdio.h>
+
+/* Maximum number of received frames that are processed before the I/O queue
+   is flushed, which keeps completion commands within the I/O queue capacity.  */
+#define RX_BATCH 64
+
+struct pktsink_stats {
+	uint64_t	rx_packets;
+	uint64_t	rx_bytes;
+	uint64_t	lost;
+};
+
+static struct pkt_dev dev;
+
+static struct pktsink_stats stats;
+
+static void pktsink_report(const struct pktsink_stats *s, uint64_t cycles)
+{
+	uint64_t usec = pkt_cycles_to_usec(cycles);
+	if (!usec) {
+		usec = 1;
+	}
+	printf("rx: %lu pps %lu Mbps lost: %lu", s->rx_packets * 1000000 / usec, s->rx_bytes * 8 / usec, s->lost);
+	if (dev.stats) {
+		printf(" drops: %lu ring full: %lu", dev.stats->rx.drops, dev.stats->rx.ring_full);
+	}
+	printf("\n");
+}
+
+__attribute__((force_align_arg_pointer))
+int main(int argc, char *argv[])
+{
+	if (pkt_dev_open(&dev, PKTGEN_DEVICE) < 0) {
+		pkt_die("unable to acquire " PKTGEN_DEVICE);
+	}
+	printf("pktsink: receiving on %s port %d ...\n", PKTGEN_DEVICE, PKTGEN_UDP_PORT);
+
+	struct atomic_ring_buffer *queue;
+	if (getevents((void **) &queue)) {
+		pkt_die("getevents");
+	}
+	uint64_t next_seq = 0;
+	uint64_t start = pkt_rdtsc();
+	for (;;) {
+		wait();
+		for (int i = 0; i < RX_BATCH && !atomic_ring_buffer_is_empty(queue); i++) {
+			struct event *event = atomic_ring_buffer_front(queue);
+			struct pkt_rx rx;
+			if (pkt_parse(event, &rx)) {
+				/* A sequence number below the expected one means that the
+				   generator was restarted.  */
+				if (rx.payload.seq > next_seq) {
+					stats.lost += rx.payload.seq - next_seq;
+				}
+				next_seq = rx.payload.seq + rx.nr_datagrams;
+				stats.rx_packets += rx.nr_datagrams;
+				stats.rx_bytes += rx.len;
+			}
+			pkt_complete(&dev, event);
+			atomic_ring_buffer_pop(queue);
+		}
+		if (stats.rx_packets >= PKTGEN_REPORT_INTERVAL) {
+			uint64_t now = pkt_rdtsc();
+			pktsink_report(&stats, now - start);
+			stats.rx_packets = 0;
+			stats.rx_bytes = 0;
+			stats.lost = 0;
+			start = now;
+		}
+	}
+	exit(0);
+}
@@ -0,0 +1,118 @@
+#include <assert.h>
+#include <stdint.h>
+
+#include <manticore/atomic-ring-buffer.h>
+#include <manticore/blk_abi.h>
+#include <manticore/config_abi.h>
+#include <manticore/events.h>
+#include <manticore/io_queue.h>
+#include <manticore/syscalls.h>
+
+/* Run with a scratch disk image, for example: scripts/run-test tst-blk --disk disk.img  */
+
+#define NR_REQS 8
+#define REQ_SIZE 4096
+
+/* More requests than there is room for completion events in the event queue.  */
+#define NR_OVERFLOW_REQS 512
+
+/* The requests that are collected with wait_for_completion().  */
+#define NR_ALL_REQS (NR_REQS + 1 + NR_OVERFLOW_REQS)
+
+static struct blk_request reqs[NR_ALL_REQS];
+
+static io_queue_t io_queue;
+
+/* Completion status of every request, or -1 if the request has not completed
+   yet. Requests can complete out of order, so every completion is recorded.  */
+static int64_t statuses[NR_ALL_REQS];
+
+static void submit(struct blk_request *req, uint32_t type, uint64_t sector, void *buf, uint64_t len)
+{
+	req->type = type;
+	req->sector = sector;
+	req->buf = buf;
+	req->len = len;
+	statuses[req - reqs] = -1;
+	assert(io_submit(io_queue, req, sizeof(*req)) == 0);
+}
+
+static void wait_for_completion(struct blk_request *req, uint64_t status)
+{
+	struct atomic_ring_buffer *queue;
+	assert(getevents((void **)&queue) == 0);
+	while (statuses[req - reqs] < 0) {
+		while (!atomic_ring_buffer_is_empty(queue)) {
+			struct event *ev = atomic_ring_buffer_front(queue);
+			if (ev->type == EVENT_BLOCK_IO) {
+				struct blk_request *done = ev->addr;
+				assert(done >= reqs && done < reqs + NR_ALL_REQS);
+				statuses[done - reqs] = ev->len;
+			}
+			atomic_ring_buffer_pop(queue);
+		}
+		if (statuses[req - reqs] < 0) {
+			wait();
+		}
+	}
+	assert((uint64_t) statuses[req - reqs] == status);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t capacity, data_area, data_area_size;
+
+	int desc = acquire("/dev/blk", 0);
+	assert(desc >= 0);
+	assert(get_config(desc, CONFIG_IO_QUEUE, &io_queue, sizeof(io_queue)) == 0);
+	assert(get_config(desc, CONFIG_BLOCK_CAPACITY, &capacity, sizeof(capacity)) == 0);
+	assert(get_config(desc, CONFIG_BLOCK_DATA_AREA, &data_area, sizeof(data_area)) == 0);
+	assert(get_config(desc, CONFIG_BLOCK_DATA_AREA_SIZE, &data_area_size, sizeof(data_area_size)) == 0);
+	assert(capacity * BLK_SECTOR_SIZE >= NR_REQS * REQ_SIZE);
+	assert(data_area_size >= NR_REQS * REQ_SIZE);
+
+	unsigned char *data = (void *) data_area;
+
+	/* Write with all requests in flight, then read back into a cleared data area:  */
+	for (int i = 0; i < NR_REQS * REQ_SIZE; i++) {
+		data[i] = i % 251;
+	}
+	for (int i = 0; i < NR_REQS; i++) {
+		submit(&reqs[i], BLK_REQ_WRITE, i * REQ_SIZE / BLK_SECTOR_SIZE, data + i * REQ_SIZE, REQ_SIZE);
+	}
+	for (int i = 0; i < NR_REQS; i++) {
+		wait_for_completion(&reqs[i], BLK_STATUS_OK);
+	}
+	for (int i = 0; i < NR_REQS * REQ_SIZE; i++) {
+		data[i] = 0;
+	}
+	for (int i = NR_REQS - 1; i >= 0; i--) {
+		submit(&reqs[i], BLK_REQ_READ, i * REQ_SIZE / BLK_SECTOR_SIZE, data + i * REQ_SIZE, REQ_SIZE);
+	}
+	for (int i = 0; i < NR_REQS; i++) {
+		wait_for_completion(&reqs[i], BLK_STATUS_OK);
+	}
+	for (int i = 0; i < NR_REQS * REQ_SIZE; i++) {
+		assert(data[i] == i % 251);
+	}
+
+	/* A buffer outside of the data area is rejected:  */
+	submit(&reqs[NR_REQS], BLK_REQ_READ, 0, reqs, BLK_SECTOR_SIZE);
+	wait_for_completion(&reqs[NR_REQS], BLK_STATUS_UNSUPP);
+
+	/* Completions that do not fit in a full event queue are delivered once the queue has room:  */
+	struct blk_device_stats *stats;
+	assert(get_config(desc, CONFIG_STATS, &stats, sizeof(stats)) == 0);
+	struct blk_request *overflow_reqs = &reqs[NR_REQS + 1];
+	for (int i = 0; i < NR_OVERFLOW_REQS; i++) {
+		submit(&overflow_reqs[i], BLK_REQ_READ, 0, data, BLK_SECTOR_SIZE);
+	}
+	while (stats->event_overflows == 0) {
+		wait();
+	}
+	for (int i = 0; i < NR_OVERFLOW_REQS; i++) {
+		wait_for_completion(&overflow_reqs[i], BLK_STATUS_OK);
+	}
+
+	exit(0);
+}
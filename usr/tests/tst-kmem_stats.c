@@ -0,0 +1,32 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <manticore/kmem_stats_abi.h>
+#include <manticore/syscalls.h>
+
+#define MAX_ENTRIES 64
+
+int main(int argc, char *argv[])
+{
+	static struct kmem_cache_stats caches[MAX_ENTRIES];
+	ssize_t nr = kmem_stats(KMEM_STATS_CACHES, caches, sizeof(caches));
+	assert(nr > 0);
+	assert(kmem_stats(KMEM_STATS_CACHES, NULL, 0) == nr);
+	for (ssize_t i = 0; i < nr && i < MAX_ENTRIES; i++) {
+		struct kmem_cache_stats *s = &caches[i];
+		assert(s->live == s->allocs - s->frees);
+		printf("%-20s %8lu live %8lu allocs %4lu failures %6lu slabs %10lu bytes\n", s->name, s->live,
+		       s->allocs, s->failures, s->nr_partial + s->nr_full + s->nr_empty, s->bytes);
+	}
+
+	static struct kmem_arena_stats arenas[MAX_ENTRIES];
+	nr = kmem_stats(KMEM_STATS_ARENAS, arenas, sizeof(arenas));
+	assert(nr >= 3);
+	assert(arenas[0].node == 0);
+	assert(arenas[0].type == KMEM_ARENA_SMALL);
+
+	assert(kmem_stats(-1, NULL, 0) == -EINVAL);
+	exit(0);
+}
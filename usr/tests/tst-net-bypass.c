@@ -0,0 +1,95 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <manticore/acquire_abi.h>
+#include <manticore/config_abi.h>
+#include <manticore/syscalls.h>
+#include <manticore/virtio_bypass_abi.h>
+
+/* Transmits a frame on the virtio network device in kernel-bypass mode by
+   driving the TX virtqueue directly. The test bypasses the liblinux start-up
+   code, which acquires the device for the I/O queue.  */
+
+#define VIRTQ_DESC_F_WRITE 2
+
+#define RX_QUEUE 0
+#define TX_QUEUE 1
+
+#define FRAME_SIZE 64
+
+struct virtq_desc {
+	uint64_t	addr;
+	uint32_t	len;
+	uint16_t	flags;
+	uint16_t	next;
+};
+
+struct virtq_avail {
+	uint16_t	flags;
+	uint16_t	idx;
+	uint16_t	ring[];
+};
+
+struct virtq_used_elem {
+	uint32_t	id;
+	uint32_t	len;
+};
+
+struct virtq_used {
+	uint16_t	flags;
+	uint16_t	idx;
+	struct virtq_used_elem	ring[];
+};
+
+__attribute__((force_align_arg_pointer))
+int main(int argc, char *argv[])
+{
+	struct virtio_bypass_info info;
+
+	int desc = acquire("/dev/eth", ACQUIRE_BYPASS);
+	assert(desc >= 0);
+	assert(acquire("/dev/eth", ACQUIRE_BYPASS) < 0);
+	assert(acquire("/dev/eth", 0) < 0);
+	assert(get_config(desc, CONFIG_VIRTIO_BYPASS_INFO, &info, sizeof(info)) == 0);
+	assert(info.nr_queues == 2);
+	assert(info.nr_rx_bufs > 0);
+	assert(info.nr_rx_bufs * info.rx_buf_size <= info.rx_area.size);
+
+	/* The RX descriptors refer to the RX buffers:  */
+	const struct virtio_bypass_queue *rxq = &info.queues[RX_QUEUE];
+	volatile struct virtq_desc *rx_descs = (void *) rxq->desc;
+	for (uint64_t i = 0; i < info.nr_rx_bufs; i++) {
+		assert(rx_descs[i].addr == info.rx_area.dma_addr + i * info.rx_buf_size);
+		assert(rx_descs[i].flags & VIRTQ_DESC_F_WRITE);
+	}
+
+	/* Transmit a broadcast frame from the start of the TX area:  */
+	const struct virtio_bypass_queue *txq = &info.queues[TX_QUEUE];
+	volatile struct virtq_desc *tx_descs = (void *) txq->desc;
+	volatile struct virtq_avail *tx_avail = (void *) txq->avail;
+	volatile struct virtq_used *tx_used = (void *) txq->used;
+	unsigned char *buf = (void *) info.tx_area.addr;
+	memset(buf, 0, info.vhdr_size + FRAME_SIZE);
+	memset(buf + info.vhdr_size, 0xff, 6);
+
+	uint16_t used_idx = tx_used->idx;
+	uint16_t avail_idx = tx_avail->idx;
+	tx_descs[0].addr = info.tx_area.dma_addr;
+	tx_descs[0].len = info.vhdr_size + FRAME_SIZE;
+	tx_descs[0].flags = 0;
+	tx_avail->ring[avail_idx % txq->size] = 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	tx_avail->idx = avail_idx + 1;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	*(volatile uint16_t *) txq->notify = txq->queue_idx;
+
+	/* The device returns the buffer without any help from the kernel:  */
+	while (tx_used->idx == used_idx) {
+		__builtin_ia32_pause();
+	}
+	assert(tx_used->ring[used_idx % txq->size].id == 0);
+
+	exit(0);
+}
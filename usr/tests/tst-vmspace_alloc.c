@@ -20,5 +20,71 @@ int main(int argc, char *argv[])
 	for (int i = 0; i < 4096; i++) {
 		assert(p[i] == (i % 0xff));
 	}
+
+	/* Regions are populated on demand, so a large sparse region only
+	   commits the memory of the pages that are touched.  */
+	struct vmspace_region sparse = {
+		.size = 1UL << 30,
+		.align = 4096,
+	};
+	assert(vmspace_alloc(&sparse, sizeof(sparse)) == 0);
+	unsigned char *q = (void *) sparse.start;
+	for (uint64_t off = 0; off < sparse.size; off += 64 * 1024 * 1024 + 4096) {
+		assert(q[off] == 0);
+		q[off] = 0xaa;
+		assert(q[off] == 0xaa);
+		assert(q[off + 1] == 0);
+	}
+	/* The last byte of a region is populated like the rest.  */
+	q[sparse.size - 1] = 0x55;
+	assert(q[sparse.size - 1] == 0x55);
+	assert(vmspace_free(&sparse, sizeof(sparse)) == 0);
+
+	/* Huge page regions mix page sizes: 2 MiB pages where the region covers
+	   them and 4 KiB pages for the tail.  */
+	struct vmspace_region huge = {
+		.size = 4 * 1024 * 1024 + 8192,
+		.flags = VMSPACE_HUGE_PAGES,
+	};
+	assert(vmspace_alloc(&huge, sizeof(huge)) == 0);
+	assert((huge.start % (2 * 1024 * 1024)) == 0);
+	unsigned char *h = (void *) huge.start;
+	for (uint64_t off = 0; off < huge.size; off += 4096) {
+		assert(h[off] == 0);
+		h[off] = off / 4096;
+	}
+	for (uint64_t off = 0; off < huge.size; off += 4096) {
+		assert(h[off] == (unsigned char) (off / 4096));
+	}
+	assert(vmspace_free(&huge, sizeof(huge)) == 0);
+
+	struct vmspace_region small = {
+		.size = 2 * 1024 * 1024,
+		.flags = VMSPACE_NO_HUGE_PAGES,
+	};
+	assert(vmspace_alloc(&small, sizeof(small)) == 0);
+	h = (void *) small.start;
+	h[small.size - 1] = 0xfe;
+	assert(h[small.size - 1] == 0xfe);
+	assert(vmspace_free(&small, sizeof(small)) == 0);
+
+	/* Huge pages cannot be both requested and forbidden.  */
+	struct vmspace_region invalid = {
+		.size = 4096,
+		.flags = VMSPACE_HUGE_PAGES | VMSPACE_NO_HUGE_PAGES,
+	};
+	assert(vmspace_alloc(&invalid, sizeof(invalid)) == -EINVAL);
+
+	/* Sizes and alignments that do not fit the address space fail.  */
+	struct vmspace_region too_large = {
+		.size = 0xfffffffffffff000UL,
+		.align = 4096,
+	};
+	assert(vmspace_alloc(&too_large, sizeof(too_large)) == -ENOMEM);
+	struct vmspace_region bad_align = {
+		.size = 4096,
+		.align = (1UL << 63) + 1,
+	};
+	assert(vmspace_alloc(&bad_align, sizeof(bad_align)) == -EINVAL);
 	exit(0);
 }
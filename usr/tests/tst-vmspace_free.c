@@ -0,0 +1,77 @@
+#include <assert.h>
+#include <errno.h>
+
+#include <manticore/syscalls.h>
+#include <manticore/vmspace_abi.h>
+
+int main(int argc, char *argv[])
+{
+	/* A range that held small pages can be populated with a large page
+	   after it is freed.  */
+	struct vmspace_region small = {
+		.size = 4096,
+		.align = 2 * 1024 * 1024,
+	};
+	assert(vmspace_alloc(&small, sizeof(small)) == 0);
+	unsigned char *s = (void *) small.start;
+	s[0] = 0xfe;
+	assert(vmspace_free(&small, sizeof(small)) == 0);
+	struct vmspace_region reused = {
+		.size = 2 * 1024 * 1024,
+		.align = 2 * 1024 * 1024,
+	};
+	assert(vmspace_alloc(&reused, sizeof(reused)) == 0);
+	assert(reused.start == small.start);
+	s = (void *) reused.start;
+	assert(s[0] == 0);
+	s[reused.size - 1] = 0xfe;
+	assert(s[reused.size - 1] == 0xfe);
+	assert(vmspace_free(&reused, sizeof(reused)) == 0);
+
+	struct vmspace_region vmr = {
+		.size = 4096,
+		.align = 4096,
+	};
+	assert(vmspace_alloc(&vmr, sizeof(vmr)) == 0);
+	assert(vmr.start != 0);
+	unsigned char *p = (void *) vmr.start;
+	p[0] = 0xfe;
+	assert(vmspace_free(&vmr, sizeof(vmr)) == 0);
+	/* The region is gone, so it cannot be freed twice.  */
+	assert(vmspace_free(&vmr, sizeof(vmr)) == -EINVAL);
+
+	/* The address space of the freed region is reused.  */
+	struct vmspace_region again = {
+		.size = 4096,
+		.align = 4096,
+	};
+	assert(vmspace_alloc(&again, sizeof(again)) == 0);
+	assert(again.start == vmr.start);
+	p = (void *) again.start;
+	assert(p[0] == 0);
+	assert(vmspace_free(&again, sizeof(again)) == 0);
+
+	/* A region must be freed as a whole.  */
+	struct vmspace_region large = {
+		.size = 2 * 1024 * 1024,
+		.align = 2 * 1024 * 1024,
+	};
+	assert(vmspace_alloc(&large, sizeof(large)) == 0);
+	struct vmspace_region part = {
+		.size = 4096,
+		.start = large.start,
+	};
+	assert(vmspace_free(&part, sizeof(part)) == -EINVAL);
+	assert(vmspace_free(&large, sizeof(large)) == 0);
+
+	/* Regions that the kernel set up, such as the event buffer, cannot be
+	   freed.  */
+	void *events;
+	assert(getevents(&events) == 0);
+	struct vmspace_region event_buf = {
+		.size = 4096,
+		.start = (uint64_t) events,
+	};
+	assert(vmspace_free(&event_buf, sizeof(event_buf)) == -EINVAL);
+	exit(0);
+}